@@ -0,0 +1,862 @@
+/*
+ *        Compiled data set.
+ *
+ * Copyright (c) 2007-2010, Naoaki Okazaki
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the names of the authors nor the names of its contributors
+ *       may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* $Id$ */
+
+#ifdef    HAVE_CONFIG_H
+#include <config.h>
+#endif/*HAVE_CONFIG_H*/
+
+#include <os.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+#define    USE_MMAP    1
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif/*HAVE_MMAP*/
+
+#include <crfsuite.h>
+#include "iwa.h"
+#include "readdata.h"
+
+/*
+    A compiled data set stores the sequences of a data in the native
+    memory layout so that it can be mapped into memory and used without
+    parsing. Attributes and labels are stored as IDs of the dictionaries
+    that follow the sequences. The layout is:
+
+    header
+    crf_content_t   contents[num_contents]
+    uint64_t        item_contents[num_items+1]      (first content of each item)
+    uint64_t        instance_items[num_instances+1] (first item of each instance)
+    int32_t         item_labels[num_items]          (-2 for __BOS_EOS__)
+    char            label strings (num_labels null-terminated strings)
+    char            attribute strings (num_attrs null-terminated strings)
+
+    The file is specific to the byte order and the size of crf_content_t
+    of the machine that wrote it; a reader rejects the file otherwise.
+ */
+
+#define    BINDATA_MAGIC        "CRFD"
+#define    BINDATA_VERSION      1
+#define    BINDATA_BYTEORDER    0x01020304
+
+typedef struct {
+    uint8_t     magic[4];           /* File magic. */
+    uint32_t    version;            /* Version number. */
+    uint32_t    byteorder;          /* BINDATA_BYTEORDER in the native byte order. */
+    uint32_t    size_content;       /* sizeof(crf_content_t). */
+    uint32_t    num_labels;         /* Number of labels. */
+    uint32_t    num_attrs;          /* Number of attributes. */
+    uint32_t    num_instances;      /* Number of instances. */
+    uint32_t    reserved;
+    uint64_t    num_items;          /* Number of items. */
+    uint64_t    num_contents;       /* Number of contents. */
+    uint64_t    off_contents;       /* Offset to contents. */
+    uint64_t    off_item_contents;  /* Offset to the content index of items. */
+    uint64_t    off_instance_items; /* Offset to the item index of instances. */
+    uint64_t    off_item_labels;    /* Offset to item labels. */
+    uint64_t    off_labels;         /* Offset to label strings. */
+    uint64_t    off_attrs;          /* Offset to attribute strings. */
+    uint64_t    size;               /* File size. */
+} bindata_header_t;
+
+/*
+    A compiled feature set stores the features of a feature file as the
+    IDs of the dictionaries built from the data sets read before it, so
+    that they can be given to a trainer without parsing or lookups. The
+    file is tied to the dictionaries by a checksum of their strings; the
+    attributes that appear only in the feature file follow the features.
+    The layout is:
+
+    header
+    int32_t         attrs[num_features]
+    int32_t         orders[num_features]
+    uint8_t         label_sequences[size_label_sequences] (concatenated)
+    char            new attribute strings (num_new_attrs null-terminated strings)
+ */
+
+#define    BINFEATURES_MAGIC    "CRFF"
+#define    BINFEATURES_VERSION  1
+
+typedef struct {
+    uint8_t     magic[4];           /* File magic. */
+    uint32_t    version;            /* Version number. */
+    uint32_t    byteorder;          /* BINDATA_BYTEORDER in the native byte order. */
+    uint32_t    size_int;           /* sizeof(int). */
+    uint32_t    num_labels;         /* Number of labels in the dictionary. */
+    uint32_t    num_attrs;          /* Number of attributes in the dictionary. */
+    uint32_t    num_new_attrs;      /* Number of attributes added by the features. */
+    uint32_t    num_features;       /* Number of features. */
+    uint64_t    checksum;           /* Checksum of the dictionaries. */
+    uint64_t    size_label_sequences;   /* Total length of label sequences. */
+    uint64_t    off_attrs;          /* Offset to the attributes of features. */
+    uint64_t    off_orders;         /* Offset to the orders of features. */
+    uint64_t    off_label_sequences;    /* Offset to the label sequences. */
+    uint64_t    off_new_attrs;      /* Offset to the new attribute strings. */
+    uint64_t    size;               /* File size. */
+} binfeatures_header_t;
+
+typedef struct {
+    void*   values;
+    size_t  size;       /* Size of an element. */
+    size_t  num;
+    size_t  max;
+} array_t;
+
+static void array_init(array_t* array, size_t size)
+{
+    memset(array, 0, sizeof(*array));
+    array->size = size;
+}
+
+static void array_finish(array_t* array)
+{
+    free(array->values);
+    array_init(array, array->size);
+}
+
+static int array_append_n(array_t* array, const void *values, size_t n)
+{
+    if (array->max < array->num + n) {
+        void *p = NULL;
+        size_t max = array->max;
+        while (max < array->num + n) {
+            max = (max + 1) * 2;
+        }
+        p = realloc(array->values, array->size * max);
+        if (p == NULL) {
+            return 1;
+        }
+        array->values = p;
+        array->max = max;
+    }
+    memcpy((char*)array->values + array->size * array->num, values, array->size * n);
+    array->num += n;
+    return 0;
+}
+
+static int array_append(array_t* array, const void *value)
+{
+    return array_append_n(array, value, 1);
+}
+
+static int progress(FILE *fpo, int prev, int current)
+{
+    while (prev < current) {
+        ++prev;
+        if (prev % 2 == 0) {
+            if (prev % 10 == 0) {
+                fprintf(fpo, "%d", prev / 10);
+                fflush(fpo);
+            } else {
+                fprintf(fpo, ".");
+                fflush(fpo);
+            }
+        }
+    }
+    return prev;
+}
+
+static int write_strings(FILE *fpb, crf_dictionary_t* dic, int begin, uint64_t* size)
+{
+    int i;
+    const int n = dic->num(dic);
+
+    for (i = begin;i < n;++i) {
+        size_t len;
+        const char *str = NULL;
+        dic->to_string(dic, i, &str);
+        len = strlen(str) + 1;
+        if (fwrite(str, 1, len, fpb) != len) {
+            dic->free_(dic, str);
+            return 1;
+        }
+        *size += len;
+        dic->free_(dic, str);
+    }
+    return 0;
+}
+
+int compile_data(FILE *fpi, FILE *fpo, FILE *fpb, crf_dictionary_t* attrs, crf_dictionary_t* labels)
+{
+    int ret = 0;
+    int32_t lid = -1;
+    uint64_t num_items = 0, num_contents = 0;
+    uint64_t offset = 0;
+    array_t item_contents, instance_items, item_labels;
+    bindata_header_t header;
+    crf_content_t cont;
+    iwa_t* iwa = NULL;
+    const iwa_token_t* token = NULL;
+    long filesize = 0, begin = 0, pos = 0;
+    int prev = 0, current = 0;
+
+    array_init(&item_contents, sizeof(uint64_t));
+    array_init(&instance_items, sizeof(uint64_t));
+    array_init(&item_labels, sizeof(int32_t));
+
+    /* Reserve the space for the header, which is written at the end. */
+    memset(&header, 0, sizeof(header));
+    if (fwrite(&header, sizeof(header), 1, fpb) != 1) {
+        ret = 1;
+        goto error_exit;
+    }
+    offset = sizeof(header);
+
+    /* Obtain the file size. */
+    begin = ftell(fpi);
+    fseek(fpi, 0, SEEK_END);
+    filesize = ftell(fpi) - begin;
+    fseek(fpi, begin, SEEK_SET);
+
+    fprintf(fpo, "0");
+    fflush(fpo);
+    prev = 0;
+
+    /*
+        Contents are written to the file as they are read; the indices of
+        items and instances are kept in memory until the end.
+     */
+    ret |= array_append(&item_contents, &num_contents);
+    ret |= array_append(&instance_items, &num_items);
+
+    iwa = iwa_reader(fpi);
+    while (token = iwa_read(iwa), token != NULL) {
+        /* Progress report. */
+        pos = iwa_offset(iwa);
+        current = (int)((pos - begin) * 100.0 / (double)filesize);
+        prev = progress(fpo, prev, current);
+
+        switch (token->type) {
+        case IWA_BOI:
+            lid = -1;
+            break;
+        case IWA_EOI:
+            /* Close the item. */
+            ++num_items;
+            ret |= array_append(&item_contents, &num_contents);
+            ret |= array_append(&item_labels, &lid);
+            break;
+        case IWA_ITEM:
+            if (lid == -1) {
+                if (!strcmp(token->attr, "__BOS_EOS__")) {
+                    lid = -2; /* EOS : to be overwritten by L */
+                } else {
+                    lid = labels->get(labels, token->attr);
+                }
+            } else {
+                crf_content_init(&cont);
+                cont.aid = attrs->get(attrs, token->attr);
+                if (token->value && *token->value) {
+                    cont.scale = atof(token->value);
+                } else {
+                    cont.scale = 1.0;
+                }
+                if (fwrite(&cont, sizeof(cont), 1, fpb) != 1) {
+                    ret = 1;
+                    goto error_exit;
+                }
+                ++num_contents;
+            }
+            break;
+        case IWA_NONE:
+        case IWA_EOF:
+            /* Close the instance unless it is empty. */
+            if (((uint64_t*)instance_items.values)[instance_items.num-1] < num_items) {
+                ret |= array_append(&instance_items, &num_items);
+            }
+            break;
+        case IWA_COMMENT:
+            break;
+        }
+
+        if (ret) {
+            goto error_exit;
+        }
+    }
+    progress(fpo, prev, 100);
+    fprintf(fpo, "\n");
+
+    /* Fill the header. */
+    memcpy(header.magic, BINDATA_MAGIC, 4);
+    header.version = BINDATA_VERSION;
+    header.byteorder = BINDATA_BYTEORDER;
+    header.size_content = sizeof(crf_content_t);
+    header.num_labels = labels->num(labels);
+    header.num_attrs = attrs->num(attrs);
+    header.num_instances = (uint32_t)(instance_items.num - 1);
+    header.num_items = num_items;
+    header.num_contents = num_contents;
+    header.off_contents = offset;
+    offset += sizeof(crf_content_t) * num_contents;
+
+    /* Write the indices and labels. */
+    header.off_item_contents = offset;
+    if (fwrite(item_contents.values, item_contents.size, item_contents.num, fpb) != item_contents.num) {
+        ret = 1;
+        goto error_exit;
+    }
+    offset += item_contents.size * item_contents.num;
+    header.off_instance_items = offset;
+    if (fwrite(instance_items.values, instance_items.size, instance_items.num, fpb) != instance_items.num) {
+        ret = 1;
+        goto error_exit;
+    }
+    offset += instance_items.size * instance_items.num;
+    header.off_item_labels = offset;
+    if (fwrite(item_labels.values, item_labels.size, item_labels.num, fpb) != item_labels.num) {
+        ret = 1;
+        goto error_exit;
+    }
+    offset += item_labels.size * item_labels.num;
+
+    /* Write the dictionaries. */
+    header.off_labels = offset;
+    if (ret = write_strings(fpb, labels, 0, &offset)) {
+        goto error_exit;
+    }
+    header.off_attrs = offset;
+    if (ret = write_strings(fpb, attrs, 0, &offset)) {
+        goto error_exit;
+    }
+    header.size = offset;
+
+    /* Write the header. */
+    if (fseek(fpb, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, fpb) != 1) {
+        ret = 1;
+        goto error_exit;
+    }
+
+error_exit:
+    iwa_delete(iwa);
+    array_finish(&item_labels);
+    array_finish(&instance_items);
+    array_finish(&item_contents);
+    return ret;
+}
+
+int is_binary_data(const char *filename)
+{
+    char magic[4];
+    FILE *fp = NULL;
+    int ret = 0;
+
+    /* A compiled data set cannot be read from STDIN. */
+    if (strcmp(filename, "-") == 0) {
+        return 0;
+    }
+
+    fp = fopen(filename, "rb");
+    if (fp != NULL) {
+        ret = (fread(magic, 1, 4, fp) == 4 && memcmp(magic, BINDATA_MAGIC, 4) == 0);
+        fclose(fp);
+    }
+    return ret;
+}
+
+static void binary_data_unmap(binary_data_t* bin)
+{
+    if (bin->block != NULL) {
+#ifdef  USE_MMAP
+        munmap(bin->block, bin->size);
+#else
+        free(bin->block);
+#endif/*USE_MMAP*/
+    }
+    bin->block = NULL;
+    bin->size = 0;
+}
+
+static int binary_data_map(binary_data_t* bin, const char *filename, size_t header_size)
+{
+#ifdef  USE_MMAP
+    struct stat st;
+    void *block = NULL;
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        return 1;
+    }
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)header_size) {
+        close(fd);
+        return 1;
+    }
+
+    /*
+        A private writable mapping lets a reader rewrite attribute IDs in
+        place; only the pages actually rewritten are copied.
+     */
+    block = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (block == MAP_FAILED) {
+        return 1;
+    }
+    bin->block = block;
+    bin->size = (size_t)st.st_size;
+    return 0;
+
+#else
+    long size = 0;
+    FILE *fp = fopen(filename, "rb");
+    if (fp == NULL) {
+        return 1;
+    }
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    if (size < (long)header_size) {
+        fclose(fp);
+        return 1;
+    }
+    bin->block = malloc((size_t)size);
+    if (bin->block == NULL) {
+        fclose(fp);
+        return 1;
+    }
+    bin->size = (size_t)size;
+    if (fread(bin->block, 1, bin->size, fp) != bin->size) {
+        fclose(fp);
+        binary_data_unmap(bin);
+        return 1;
+    }
+    fclose(fp);
+    return 0;
+
+#endif/*USE_MMAP*/
+}
+
+static int within(const binary_data_t* bin, uint64_t offset, uint64_t size)
+{
+    return (offset <= bin->size && size <= bin->size - offset);
+}
+
+static int read_strings(
+    const binary_data_t* bin,
+    uint64_t offset,
+    uint64_t end,
+    int n,
+    crf_dictionary_t* dic,
+    int intern,
+    int* map
+    )
+{
+    int i;
+    const char *p = (const char*)bin->block + offset;
+    const char *last = (const char*)bin->block + end;
+
+    for (i = 0;i < n;++i) {
+        const char *q = memchr(p, 0, last - p);
+        if (q == NULL) {
+            return 1;
+        }
+        map[i] = intern ? dic->get(dic, p) : dic->to_id(dic, p);
+        p = q + 1;
+    }
+    return 0;
+}
+
+void binary_data_init(binary_data_t* bin)
+{
+    memset(bin, 0, sizeof(*bin));
+}
+
+int read_binary_data(
+    binary_data_t* bin,
+    const char *filename,
+    crf_data_t* data,
+    crf_dictionary_t* attrs,
+    crf_dictionary_t* labels,
+    int intern
+    )
+{
+    int i, ret = 0, identity = 1;
+    int *amap = NULL, *lmap = NULL;
+    const int L = labels->num(labels);
+    const bindata_header_t* header = NULL;
+    crf_content_t* contents = NULL;
+    const uint64_t* item_contents = NULL;
+    const uint64_t* instance_items = NULL;
+    const int32_t* item_labels = NULL;
+    uint64_t n;
+
+    if (binary_data_map(bin, filename, sizeof(bindata_header_t)) != 0) {
+        return 1;
+    }
+
+    /* Check the header. */
+    header = (const bindata_header_t*)bin->block;
+    if (memcmp(header->magic, BINDATA_MAGIC, 4) != 0 ||
+        header->version != BINDATA_VERSION ||
+        header->byteorder != BINDATA_BYTEORDER ||
+        header->size_content != sizeof(crf_content_t) ||
+        header->size != bin->size ||
+        !within(bin, header->off_contents, header->num_contents * sizeof(crf_content_t)) ||
+        !within(bin, header->off_item_contents, (header->num_items + 1) * sizeof(uint64_t)) ||
+        !within(bin, header->off_instance_items, ((uint64_t)header->num_instances + 1) * sizeof(uint64_t)) ||
+        !within(bin, header->off_item_labels, header->num_items * sizeof(int32_t)) ||
+        header->off_attrs < header->off_labels || bin->size < header->off_attrs) {
+        ret = 1;
+        goto error_exit;
+    }
+    contents = (crf_content_t*)((char*)bin->block + header->off_contents);
+    item_contents = (const uint64_t*)((const char*)bin->block + header->off_item_contents);
+    instance_items = (const uint64_t*)((const char*)bin->block + header->off_instance_items);
+    item_labels = (const int32_t*)((const char*)bin->block + header->off_item_labels);
+    if (item_contents[header->num_items] != header->num_contents ||
+        instance_items[header->num_instances] != header->num_items) {
+        ret = 1;
+        goto error_exit;
+    }
+
+    /* Map the IDs in the file to the IDs in the dictionaries. */
+    amap = (int*)malloc(sizeof(int) * (header->num_attrs + 1));
+    lmap = (int*)malloc(sizeof(int) * (header->num_labels + 1));
+    if (amap == NULL || lmap == NULL) {
+        ret = 1;
+        goto error_exit;
+    }
+    if (read_strings(bin, header->off_labels, header->off_attrs, header->num_labels, labels, intern, lmap) ||
+        read_strings(bin, header->off_attrs, header->size, header->num_attrs, attrs, intern, amap)) {
+        ret = 1;
+        goto error_exit;
+    }
+    for (i = 0;i < (int)header->num_attrs;++i) {
+        if (amap[i] != i) {
+            identity = 0;
+            break;
+        }
+    }
+
+    /* Build the items, whose contents refer to the mapped file. */
+    bin->num_items = (size_t)header->num_items;
+    bin->items = (crf_item_t*)calloc((size_t)header->num_items, sizeof(crf_item_t));
+    data->instances = (crf_sequence_t*)calloc(header->num_instances, sizeof(crf_sequence_t));
+    if ((bin->items == NULL && 0 < header->num_items) ||
+        (data->instances == NULL && 0 < header->num_instances)) {
+        ret = 1;
+        goto error_exit;
+    }
+    for (n = 0;n < header->num_items;++n) {
+        crf_item_t* item = &bin->items[n];
+        int32_t label = item_labels[n];
+        uint64_t j = item_contents[n], k;
+
+        if (label < -2 || (int32_t)header->num_labels <= label ||
+            item_contents[n+1] < item_contents[n]) {
+            ret = 1;
+            goto error_exit;
+        }
+        if (label == -2) {
+            item->label = intern ? -2 : L;
+        } else {
+            item->label = (0 <= lmap[label]) ? lmap[label] : L;
+        }
+
+        /*
+            Rewrite the attribute IDs unless the dictionary assigned the
+            same IDs; contents of attributes unknown to the dictionary are
+            removed from the item.
+         */
+        if (!identity) {
+            for (k = item_contents[n];k < item_contents[n+1];++k) {
+                int aid = contents[k].aid;
+                if (aid < 0 || (int)header->num_attrs <= aid) {
+                    ret = 1;
+                    goto error_exit;
+                }
+                if (0 <= amap[aid]) {
+                    contents[j].aid = amap[aid];
+                    contents[j].scale = contents[k].scale;
+                    ++j;
+                }
+            }
+        } else {
+            j = item_contents[n+1];
+        }
+
+        item->contents = &contents[item_contents[n]];
+        item->num_contents = (int)(j - item_contents[n]);
+        item->max_contents = item->num_contents;
+    }
+
+    data->num_instances = (int)header->num_instances;
+    data->max_instances = data->num_instances;
+    for (i = 0;i < data->num_instances;++i) {
+        crf_sequence_t* seq = &data->instances[i];
+        if (instance_items[i+1] < instance_items[i]) {
+            ret = 1;
+            goto error_exit;
+        }
+        seq->items = &bin->items[instance_items[i]];
+        seq->num_items = (int)(instance_items[i+1] - instance_items[i]);
+        seq->max_items = 0;
+    }
+
+error_exit:
+    free(lmap);
+    free(amap);
+    if (ret) {
+        binary_data_finish(bin, data);
+    }
+    return ret;
+}
+
+void binary_data_finish(binary_data_t* bin, crf_data_t* data)
+{
+    size_t n;
+
+    /* Leave a data that was not read from a compiled data set. */
+    if (bin->block == NULL) {
+        return;
+    }
+
+    if (bin->items != NULL) {
+        for (n = 0;n < bin->num_items;++n) {
+            crf_item_t* item = &bin->items[n];
+            if (item->preprocessed_data_delete_func != NULL) {
+                item->preprocessed_data_delete_func(item->preprocessed_data);
+            } else {
+                free(item->preprocessed_data);
+            }
+        }
+        free(bin->items);
+    }
+    free(data->instances);
+    crf_data_init(data);
+    binary_data_unmap(bin);
+    binary_data_init(bin);
+}
+
+/* Checksum (64-bit FNV-1a) of the label and attribute strings in the dictionaries. */
+static uint64_t dictionary_checksum(crf_dictionary_t* labels, crf_dictionary_t* attrs)
+{
+    int i, k;
+    uint64_t h = 14695981039346656037ULL;
+    crf_dictionary_t* dics[2];
+
+    dics[0] = labels;
+    dics[1] = attrs;
+    for (k = 0;k < 2;++k) {
+        const int n = dics[k]->num(dics[k]);
+        for (i = 0;i < n;++i) {
+            const char *str = NULL;
+            const unsigned char *p = NULL;
+            dics[k]->to_string(dics[k], i, &str);
+            p = (const unsigned char*)str;
+            do {
+                h ^= *p;
+                h *= 1099511628211ULL;
+            } while (*p++);
+            dics[k]->free_(dics[k], str);
+        }
+    }
+    return h;
+}
+
+typedef struct {
+    array_t attrs;
+    array_t orders;
+    array_t label_sequences;
+} feature_arrays_t;
+
+static int feature_arrays_sink(void *instance, int n, const int *attrs, const int *orders, const unsigned char *label_sequences)
+{
+    int i, ret = 0;
+    size_t m = 0;
+    feature_arrays_t* arrays = (feature_arrays_t*)instance;
+
+    for (i = 0;i < n;++i) {
+        m += orders[i];
+    }
+    ret |= array_append_n(&arrays->attrs, attrs, n);
+    ret |= array_append_n(&arrays->orders, orders, n);
+    ret |= array_append_n(&arrays->label_sequences, label_sequences, m);
+    return ret ? CRFERR_OUTOFMEMORY : 0;
+}
+
+int compile_features(FILE *fpi, FILE *fpo, FILE *fpb, crf_dictionary_t* attrs, crf_dictionary_t* labels)
+{
+    int ret = 0;
+    uint64_t offset = 0;
+    binfeatures_header_t header;
+    feature_arrays_t arrays;
+
+    array_init(&arrays.attrs, sizeof(int));
+    array_init(&arrays.orders, sizeof(int));
+    array_init(&arrays.label_sequences, sizeof(unsigned char));
+
+    /* Take the snapshot of the dictionaries before reading the features. */
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BINFEATURES_MAGIC, 4);
+    header.version = BINFEATURES_VERSION;
+    header.byteorder = BINDATA_BYTEORDER;
+    header.size_int = sizeof(int);
+    header.num_labels = labels->num(labels);
+    header.num_attrs = attrs->num(attrs);
+    header.checksum = dictionary_checksum(labels, attrs);
+
+    if (parse_features(fpi, fpo, labels, attrs, feature_arrays_sink, &arrays) < 0) {
+        ret = 1;
+        goto error_exit;
+    }
+
+    /* Write the header and the arrays. */
+    header.num_new_attrs = attrs->num(attrs) - header.num_attrs;
+    header.num_features = (uint32_t)arrays.attrs.num;
+    header.size_label_sequences = arrays.label_sequences.num;
+    offset = sizeof(header);
+    header.off_attrs = offset;
+    offset += arrays.attrs.size * arrays.attrs.num;
+    header.off_orders = offset;
+    offset += arrays.orders.size * arrays.orders.num;
+    header.off_label_sequences = offset;
+    offset += arrays.label_sequences.num;
+    header.off_new_attrs = offset;
+    if (fwrite(&header, sizeof(header), 1, fpb) != 1 ||
+        fwrite(arrays.attrs.values, arrays.attrs.size, arrays.attrs.num, fpb) != arrays.attrs.num ||
+        fwrite(arrays.orders.values, arrays.orders.size, arrays.orders.num, fpb) != arrays.orders.num ||
+        fwrite(arrays.label_sequences.values, 1, arrays.label_sequences.num, fpb) != arrays.label_sequences.num) {
+        ret = 1;
+        goto error_exit;
+    }
+    if (ret = write_strings(fpb, attrs, (int)header.num_attrs, &offset)) {
+        goto error_exit;
+    }
+
+    /* Write the file size to the header. */
+    header.size = offset;
+    if (fseek(fpb, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, fpb) != 1) {
+        ret = 1;
+        goto error_exit;
+    }
+
+error_exit:
+    array_finish(&arrays.label_sequences);
+    array_finish(&arrays.orders);
+    array_finish(&arrays.attrs);
+    return ret;
+}
+
+int is_binary_features(const char *filename)
+{
+    char magic[4];
+    FILE *fp = NULL;
+    int ret = 0;
+
+    /* A compiled feature set cannot be read from STDIN. */
+    if (strcmp(filename, "-") == 0) {
+        return 0;
+    }
+
+    fp = fopen(filename, "rb");
+    if (fp != NULL) {
+        ret = (fread(magic, 1, 4, fp) == 4 && memcmp(magic, BINFEATURES_MAGIC, 4) == 0);
+        fclose(fp);
+    }
+    return ret;
+}
+
+int read_binary_features(const char *filename, crf_dictionary_t* labels, crf_dictionary_t* attrs, crf_trainer_t* trainer)
+{
+    int i, ret = 0;
+    uint64_t size = 0;
+    binary_data_t bin;
+    const binfeatures_header_t* header = NULL;
+    const int *orders = NULL;
+    const char *p = NULL, *last = NULL;
+
+    binary_data_init(&bin);
+    if (binary_data_map(&bin, filename, sizeof(binfeatures_header_t)) != 0) {
+        return -1;
+    }
+
+    /* Check the header and the snapshot of the dictionaries. */
+    header = (const binfeatures_header_t*)bin.block;
+    if (memcmp(header->magic, BINFEATURES_MAGIC, 4) != 0 ||
+        header->version != BINFEATURES_VERSION ||
+        header->byteorder != BINDATA_BYTEORDER ||
+        header->size_int != sizeof(int) ||
+        header->size != bin.size ||
+        !within(&bin, header->off_attrs, (uint64_t)header->num_features * sizeof(int)) ||
+        !within(&bin, header->off_orders, (uint64_t)header->num_features * sizeof(int)) ||
+        !within(&bin, header->off_label_sequences, header->size_label_sequences) ||
+        bin.size < header->off_new_attrs) {
+        ret = -1;
+        goto error_exit;
+    }
+    orders = (const int*)((const char*)bin.block + header->off_orders);
+    for (i = 0;i < (int)header->num_features;++i) {
+        size += (0 < orders[i]) ? orders[i] : 0;
+    }
+    if (size != header->size_label_sequences) {
+        ret = -1;
+        goto error_exit;
+    }
+    if (header->num_labels != (uint32_t)labels->num(labels) ||
+        header->num_attrs != (uint32_t)attrs->num(attrs) ||
+        header->checksum != dictionary_checksum(labels, attrs)) {
+        ret = -1;
+        goto error_exit;
+    }
+
+    /* Register the attributes that appear only in the features. */
+    p = (const char*)bin.block + header->off_new_attrs;
+    last = (const char*)bin.block + header->size;
+    for (i = 0;i < (int)header->num_new_attrs;++i) {
+        const char *q = memchr(p, 0, last - p);
+        if (q == NULL || attrs->get(attrs, p) != (int)header->num_attrs + i) {
+            ret = -1;
+            goto error_exit;
+        }
+        p = q + 1;
+    }
+
+    /* Give the features to the trainer straight from the file image. */
+    ret = trainer->add_features(
+        trainer,
+        (int)header->num_features,
+        (const int*)((const char*)bin.block + header->off_attrs),
+        orders,
+        (const unsigned char*)bin.block + header->off_label_sequences
+        );
+    ret = (ret == 0) ? (int)header->num_features : -1;
+
+error_exit:
+    binary_data_unmap(&bin);
+    return ret;
+}
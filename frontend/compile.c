@@ -0,0 +1,277 @@
+/*
+ *        Compile command for CRFsuite frontend.
+ *
+ * Copyright (c) 2007-2010, Naoaki Okazaki
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the names of the authors nor the names of its contributors
+ *       may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* $Id$ */
+
+#include <os.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <crfsuite.h>
+#include "option.h"
+#include "readdata.h"
+
+#define    SAFE_RELEASE(obj)    if ((obj) != NULL) { (obj)->release(obj); (obj) = NULL; }
+
+typedef struct {
+    char* input;
+    char* output;
+    char* features;
+
+    int help;
+} compile_option_t;
+
+static char* mystrdup(const char *src)
+{
+    char* dst = (char*)malloc(strlen(src)+1);
+    if (dst != NULL) {
+        strcpy(dst, src);
+    }
+    return dst;
+}
+
+static void compile_option_init(compile_option_t* opt)
+{
+    memset(opt, 0, sizeof(*opt));
+}
+
+static void compile_option_finish(compile_option_t* opt)
+{
+    free(opt->input);
+    free(opt->output);
+    free(opt->features);
+}
+
+BEGIN_OPTION_MAP(parse_compile_options, compile_option_t)
+
+    ON_OPTION_WITH_ARG(SHORTOPT('o') || LONGOPT("output"))
+        free(opt->output);
+        opt->output = mystrdup(arg);
+
+    ON_OPTION_WITH_ARG(SHORTOPT('f') || LONGOPT("features"))
+        free(opt->features);
+        opt->features = mystrdup(arg);
+
+    ON_OPTION(SHORTOPT('h') || LONGOPT("help"))
+        opt->help = 1;
+
+END_OPTION_MAP()
+
+static void show_usage(FILE *fp, const char *argv0, const char *command)
+{
+    fprintf(fp, "USAGE: %s %s [OPTIONS] [DATA ...]\n", argv0, command);
+    fprintf(fp, "Convert a data set given by a file (DATA) into the compiled format, which\n");
+    fprintf(fp, "the learn and tag commands read without parsing.\n");
+    fprintf(fp, "If argument DATA is omitted or '-', this utility reads a data from STDIN.\n");
+    fprintf(fp, "\n");
+    fprintf(fp, "With -f, convert a feature file (FEATURES) instead. The compiled features\n");
+    fprintf(fp, "refer to the dictionaries of the data sets (DATA ...) given in the order\n");
+    fprintf(fp, "the learn command reads them (training data, then evaluation data), and\n");
+    fprintf(fp, "can be used only for training with the same data sets.\n");
+    fprintf(fp, "\n");
+    fprintf(fp, "OPTIONS:\n");
+    fprintf(fp, "    -o, --output=OUTPUT Store the compiled data in a file (OUTPUT) [Required]\n");
+    fprintf(fp, "    -f, --features=FEATURES Compile the features in a file (FEATURES)\n");
+    fprintf(fp, "    -h, --help          Show the usage of this command and exit\n");
+}
+
+static int compile_feature_set(
+    compile_option_t* opt,
+    int num_data,
+    char * const *data_files,
+    crf_dictionary_t* attrs,
+    crf_dictionary_t* labels,
+    FILE *fpo,
+    FILE *fpe
+    )
+{
+    int i, ret = 0;
+    clock_t clk_begin, clk_current;
+    FILE *fp = NULL, *fpb = NULL;
+    crf_data_t data;
+    binary_data_t bin;
+
+    /* Build the dictionaries in the same way as the learn command. */
+    fprintf(fpo, "Reading the data\n");
+    for (i = 0;i < num_data;++i) {
+        crf_data_init(&data);
+        binary_data_init(&bin);
+        if (is_binary_data(data_files[i])) {
+            ret = read_binary_data(&bin, data_files[i], &data, attrs, labels, 1);
+        } else {
+            ret = read_data(&data_files[i], 1, 0, fpo, &data, attrs, labels);
+        }
+        binary_data_finish(&bin, &data);
+        crf_data_finish(&data);
+        if (ret) {
+            fprintf(fpe, "ERROR: Failed to read the data: %s\n", data_files[i]);
+            return 1;
+        }
+    }
+    fprintf(fpo, "\n");
+
+    /* Open the feature file and the output file. */
+    fp = fopen(opt->features, "r");
+    if (fp == NULL) {
+        fprintf(fpe, "ERROR: Failed to open the feature data.\n");
+        return 1;
+    }
+    fpb = fopen(opt->output, "wb");
+    if (fpb == NULL) {
+        fprintf(fpe, "ERROR: Failed to open the output file.\n");
+        fclose(fp);
+        return 1;
+    }
+
+    /* Compile the features. */
+    fprintf(fpo, "Compiling the features\n");
+    clk_begin = clock();
+    ret = compile_features(fp, fpo, fpb, attrs, labels);
+    clk_current = clock();
+    fclose(fp);
+    if (fclose(fpb) != 0 || ret) {
+        fprintf(fpe, "ERROR: Failed to write the compiled features.\n");
+        return 1;
+    }
+
+    /* Report the statistics of the dictionaries. */
+    fprintf(fpo, "Number of attributes: %d\n", attrs->num(attrs));
+    fprintf(fpo, "Number of labels: %d\n", labels->num(labels));
+    fprintf(fpo, "Seconds required: %.3f\n", (clk_current - clk_begin) / (double)CLOCKS_PER_SEC);
+    fprintf(fpo, "\n");
+    return 0;
+}
+
+int main_compile(int argc, char *argv[], const char *argv0)
+{
+    int ret = 0, arg_used = 0;
+    clock_t clk_begin, clk_current;
+    compile_option_t opt;
+    const char *command = argv[0];
+    FILE *fp = NULL, *fpb = NULL, *fpi = stdin, *fpo = stdout, *fpe = stderr;
+    crf_dictionary_t *attrs = NULL, *labels = NULL;
+
+    /* Parse the command-line option. */
+    compile_option_init(&opt);
+    arg_used = option_parse(++argv, --argc, parse_compile_options, &opt);
+    if (arg_used < 0) {
+        ret = 1;
+        goto force_exit;
+    }
+
+    /* Show the help message for this command if specified. */
+    if (opt.help) {
+        show_usage(fpo, argv0, command);
+        goto force_exit;
+    }
+
+    /* Make sure that -o or --output option is provided. */
+    if (opt.output == NULL) {
+        fprintf(fpe, "ERROR: You have to designate a file to store the compiled data.\n");
+        show_usage(fpo, argv0, command);
+        ret = 1;
+        goto force_exit;
+    }
+
+    /* Set an input file. */
+    if (arg_used < argc) {
+        opt.input = mystrdup(argv[arg_used]);
+    } else {
+        opt.input = mystrdup("-");    /* STDIN. */
+    }
+    if (opt.features != NULL && arg_used == argc) {
+        fprintf(fpe, "ERROR: You have to designate the data sets that the features refer to.\n");
+        ret = 1;
+        goto force_exit;
+    }
+
+    /* Create dictionaries for attributes and labels. */
+    ret = crf_create_instance("dictionary", (void**)&attrs);
+    if (!ret) {
+        fprintf(fpe, "ERROR: Failed to create a dictionary instance.\n");
+        ret = 1;
+        goto force_exit;
+    }
+    ret = crf_create_instance("dictionary", (void**)&labels);
+    if (!ret) {
+        fprintf(fpe, "ERROR: Failed to create a dictionary instance.\n");
+        ret = 1;
+        goto force_exit;
+    }
+    ret = 0;
+
+    if (opt.features != NULL) {
+        ret = compile_feature_set(&opt, argc - arg_used, argv + arg_used, attrs, labels, fpo, fpe);
+        goto force_exit;
+    }
+
+    /* Open the input and output files. */
+    fp = (strcmp(opt.input, "-") == 0) ? fpi : fopen(opt.input, "r");
+    if (fp == NULL) {
+        fprintf(fpe, "ERROR: Failed to open the data.\n");
+        ret = 1;
+        goto force_exit;
+    }
+    fpb = fopen(opt.output, "wb");
+    if (fpb == NULL) {
+        fprintf(fpe, "ERROR: Failed to open the output file.\n");
+        ret = 1;
+        goto force_exit;
+    }
+
+    /* Compile the data. */
+    fprintf(fpo, "Compiling the data\n");
+    clk_begin = clock();
+    if (ret = compile_data(fp, fpo, fpb, attrs, labels)) {
+        fprintf(fpe, "ERROR: Failed to write the compiled data.\n");
+        goto force_exit;
+    }
+    clk_current = clock();
+
+    /* Report the statistics of the data. */
+    fprintf(fpo, "Number of attributes: %d\n", attrs->num(attrs));
+    fprintf(fpo, "Number of labels: %d\n", labels->num(labels));
+    fprintf(fpo, "Seconds required: %.3f\n", (clk_current - clk_begin) / (double)CLOCKS_PER_SEC);
+    fprintf(fpo, "\n");
+
+force_exit:
+    if (fpb != NULL && fclose(fpb) != 0 && ret == 0) {
+        fprintf(fpe, "ERROR: Failed to write the compiled data.\n");
+        ret = 1;
+    }
+    if (fp != NULL && fp != fpi) fclose(fp);
+    SAFE_RELEASE(labels);
+    SAFE_RELEASE(attrs);
+    compile_option_finish(&opt);
+    return ret;
+}
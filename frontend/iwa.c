@@ -30,61 +30,231 @@
 
 /* $Id: iwa.c 168 2010-01-29 05:46:24Z naoaki $ */
 
+#ifdef    HAVE_CONFIG_H
+#include <config.h>
+#endif/*HAVE_CONFIG_H*/
+
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+#define    USE_MMAP    1
+#ifndef    _POSIX_C_SOURCE
+#define    _POSIX_C_SOURCE    200112L    /* fileno() */
+#endif/*_POSIX_C_SOURCE*/
+#endif/*HAVE_MMAP*/
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef    USE_MMAP
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif/*USE_MMAP*/
+
+#ifdef    __SSE2__
+#include <emmintrin.h>
+#endif/*__SSE2__*/
+
 #include "iwa.h"
 
-typedef struct {
-    size_t size;
-    size_t offset;
-    char *value;
-} iwa_string_t;
+/*
+    The reader keeps a whole line in the buffer before returning the tokens
+    of the line, so that the tokens can be returned as views into the buffer:
+    a field is unescaped in place and terminated by overwriting its delimiter
+    with a null character. The views are valid until the next call of
+    iwa_read().
+
+    A regular file is mapped into memory by windows of WINDOW_SIZE bytes (or
+    more for a longer line) with a private writable mapping; other streams
+    (e.g., pipes) are read into a buffer that grows for a long line.
+ */
 
 struct tag_iwa {
     FILE *fp;
 
     iwa_token_t token;
 
-    char *buffer;
-    char *offset;
-    char *end;
-
-    iwa_string_t attr;
-    iwa_string_t value;
+    char *buffer;       /* Read buffer or mapped window. */
+    char *offset;       /* Current position. */
+    char *eol;          /* End of the current line (newline or end). */
+    char *end;          /* End of the data in the buffer. */
+    size_t size;        /* Size of the buffer or window. */
+    long base;          /* Stream position of buffer[0]. */
+    int eof;            /* No data follows the buffer. */
+    int colon;          /* A colon followed the previous value field. */
+
+#ifdef    USE_MMAP
+    int mapped;         /* The buffer is a mapped window. */
+    int fd;
+    long filesize;
+    long pagesize;
+#endif/*USE_MMAP*/
 };
 
 #define    DEFAULT_SIZE    4096
 #define    BUFFER_SIZE        (DEFAULT_SIZE * 16)
+#define    WINDOW_SIZE        (1 << 26)
 
-static void string_init(iwa_string_t* str)
-{
-    str->value = (char*)calloc(DEFAULT_SIZE, sizeof(char));
-    str->size = DEFAULT_SIZE;
-    str->offset = 0;
-}
+static char empty[1] = {0};
 
-static void string_finish(iwa_string_t* str)
+/* Find the first colon, tab, or backslash in [p, last). */
+static char* find_delimiter(char *p, char *last)
 {
-    free(str->value);
-    memset(str, 0, sizeof(*str));
+#ifdef    __SSE2__
+    const __m128i colon = _mm_set1_epi8(':');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i backslash = _mm_set1_epi8('\\');
+
+    while (p + 16 <= last) {
+        __m128i x = _mm_loadu_si128((const __m128i*)p);
+        int mask = _mm_movemask_epi8(
+            _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(x, colon), _mm_cmpeq_epi8(x, tab)),
+                _mm_cmpeq_epi8(x, backslash)
+                ));
+        if (mask != 0) {
+#ifdef    __GNUC__
+            return p + __builtin_ctz(mask);
+#else
+            while (!(mask & 1)) {
+                mask >>= 1;
+                ++p;
+            }
+            return p;
+#endif/*__GNUC__*/
+        }
+        p += 16;
+    }
+#endif/*__SSE2__*/
+
+    while (p < last && *p != ':' && *p != '\t' && *p != '\\') {
+        ++p;
+    }
+    return p;
 }
 
-static void string_clear(iwa_string_t* str)
+#ifdef    USE_MMAP
+
+/* Map a window that starts with the stream position pos. */
+static int map_window(iwa_t* iwa, long pos, size_t size)
 {
-    memset(str->value, 0, str->size);
-    str->offset = 0;
+    long begin = pos - pos % iwa->pagesize;
+    size_t length = (size_t)(pos - begin) + size;
+    void *block = NULL;
+
+    if (iwa->filesize - begin < (long)length) {
+        length = (size_t)(iwa->filesize - begin);
+    }
+    if (iwa->buffer != NULL) {
+        munmap(iwa->buffer, iwa->size);
+        iwa->buffer = NULL;
+    }
+    block = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, iwa->fd, begin);
+    if (block == MAP_FAILED) {
+        return 1;
+    }
+#ifdef    POSIX_MADV_SEQUENTIAL
+    posix_madvise(block, length, POSIX_MADV_SEQUENTIAL);
+#endif/*POSIX_MADV_SEQUENTIAL*/
+
+    iwa->buffer = (char*)block;
+    iwa->size = length;
+    iwa->base = begin;
+    iwa->offset = iwa->buffer + (pos - begin);
+    iwa->end = iwa->buffer + length;
+    iwa->eof = (iwa->filesize <= begin + (long)length);
+    return 0;
 }
 
-static void string_append(iwa_string_t* str, int c)
+#endif/*USE_MMAP*/
+
+/*
+    Make the line starting at the current position available in the buffer,
+    and locate its end. Returns zero at the end of the stream.
+ */
+static int read_line(iwa_t* iwa)
 {
-    if (str->size <= str->offset) {
-        str->size *= 2;
-        str->value = (char*)realloc(str->value, str->size);
-        memset(&str->value[str->offset], 0, str->size - str->offset);
+    char *eol = NULL;
+
+    for (;;) {
+        eol = (char*)memchr(iwa->offset, '\n', iwa->end - iwa->offset);
+        if (eol != NULL) {
+            iwa->eol = eol;
+            return 1;
+        }
+        if (iwa->eof) {
+            break;
+        }
+
+#ifdef    USE_MMAP
+        if (iwa->mapped) {
+            /* Map a window that is large enough for the line. */
+            long pos = iwa->base + (long)(iwa->offset - iwa->buffer);
+            size_t size = (size_t)(iwa->end - iwa->offset) * 2;
+            if (size < WINDOW_SIZE) size = WINDOW_SIZE;
+            if (map_window(iwa, pos, size) != 0) {
+                iwa->offset = iwa->end = iwa->buffer = NULL;
+                iwa->size = 0;
+                iwa->eof = 1;
+                return 0;
+            }
+            continue;
+        }
+#endif/*USE_MMAP*/
+
+        {
+            /* Move the line to the front and fill the buffer. */
+            size_t count, rest = (size_t)(iwa->end - iwa->offset);
+            if (iwa->size <= rest) {
+                /* Keep one byte for the terminator of the last line. */
+                char *buffer = (char*)realloc(iwa->buffer, iwa->size * 2 + 1);
+                if (buffer == NULL) {
+                    iwa->eof = 1;
+                    break;
+                }
+                iwa->offset = buffer + (iwa->offset - iwa->buffer);
+                iwa->buffer = buffer;
+                iwa->size *= 2;
+            }
+            memmove(iwa->buffer, iwa->offset, rest);
+            iwa->base += (long)(iwa->offset - iwa->buffer);
+            iwa->offset = iwa->buffer;
+            count = fread(iwa->buffer + rest, sizeof(char), iwa->size - rest, iwa->fp);
+            iwa->end = iwa->buffer + rest + count;
+            if (count == 0) {
+                iwa->eof = 1;
+            }
+        }
     }
-    str->value[str->offset++] = c;
+
+    /* The last line without a newline character. */
+    if (iwa->offset == iwa->end) {
+        return 0;
+    }
+
+#ifdef    USE_MMAP
+    if (iwa->mapped) {
+        /* Copy the line so that it can be terminated. */
+        size_t rest = (size_t)(iwa->end - iwa->offset);
+        long pos = iwa->base + (long)(iwa->offset - iwa->buffer);
+        char *buffer = (char*)malloc(rest + 1);
+        if (buffer == NULL) {
+            return 0;
+        }
+        memcpy(buffer, iwa->offset, rest);
+        munmap(iwa->buffer, iwa->size);
+        iwa->mapped = 0;
+        iwa->buffer = buffer;
+        iwa->size = rest;
+        iwa->base = pos;
+        iwa->offset = buffer;
+        iwa->end = buffer + rest;
+    }
+#endif/*USE_MMAP*/
+
+    iwa->eol = iwa->end;
+    return 1;
 }
 
 iwa_t* iwa_reader(FILE *fp)
@@ -98,16 +268,35 @@ iwa_t* iwa_reader(FILE *fp)
     memset(iwa, 0, sizeof(iwa_t));
 
     iwa->fp = fp;
+    iwa->base = ftell(fp);
+    if (iwa->base < 0) {
+        iwa->base = 0;
+    }
 
-    iwa->buffer = (char*)malloc(sizeof(char) * BUFFER_SIZE);
-    iwa->offset = iwa->buffer + BUFFER_SIZE;
-    iwa->end = iwa->buffer + BUFFER_SIZE;
+#ifdef    USE_MMAP
+    {
+        /* Map a regular file into memory. */
+        struct stat st;
+        iwa->fd = fileno(fp);
+        iwa->pagesize = sysconf(_SC_PAGESIZE);
+        if (0 < iwa->pagesize && fstat(iwa->fd, &st) == 0 && S_ISREG(st.st_mode) &&
+            iwa->base < (long)st.st_size) {
+            iwa->filesize = (long)st.st_size;
+            if (map_window(iwa, iwa->base, WINDOW_SIZE) == 0) {
+                iwa->mapped = 1;
+                return iwa;
+            }
+        }
+    }
+#endif/*USE_MMAP*/
+
+    iwa->buffer = (char*)malloc(sizeof(char) * BUFFER_SIZE + 1);
     if (iwa->buffer == NULL) {
         goto error_exit;
     }
-
-    string_init(&iwa->attr);
-    string_init(&iwa->value);
+    iwa->size = BUFFER_SIZE;
+    iwa->offset = iwa->buffer;
+    iwa->end = iwa->buffer;
 
     return iwa;
 
@@ -119,106 +308,91 @@ error_exit:
 void iwa_delete(iwa_t* iwa)
 {
     if (iwa != NULL) {
-        string_finish(&iwa->value);
-        string_finish(&iwa->attr);
+#ifdef    USE_MMAP
+        if (iwa->mapped) {
+            if (iwa->buffer != NULL) {
+                munmap(iwa->buffer, iwa->size);
+            }
+        } else {
+            free(iwa->buffer);
+        }
+#else
         free(iwa->buffer);
+#endif/*USE_MMAP*/
     }
     free(iwa);
 }
 
-static int peek_char(iwa_t* iwa)
-{
-    /* Refill the buffer if necessary. */
-    if (iwa->end <= iwa->offset) {
-        size_t count = fread(iwa->buffer, sizeof(char), BUFFER_SIZE, iwa->fp);
-        iwa->offset = iwa->buffer;
-        iwa->end = iwa->buffer + count;
-        if (count == 0) {
-            return EOF;
-        }
-    }
-
-    /* Return the current character */
-    return *iwa->offset;
-}
-
-static int get_char(iwa_t* iwa)
+long iwa_offset(iwa_t* iwa)
 {
-    int c = peek_char(iwa);
-    if (c != EOF) {
-        ++iwa->offset;
+    if (iwa->buffer == NULL) {
+        return iwa->base;
     }
-    return c;
+    return iwa->base + (long)(iwa->offset - iwa->buffer);
 }
 
-static int read_comment(iwa_t* iwa, iwa_string_t* str)
+/*
+    Read a field until a colon, tab, or the end of the line, unescaping
+    '\:', '\\', and '\#' in place. Returns the delimiter, and leaves the
+    current position just after the delimiter.
+ */
+static int read_field(iwa_t* iwa, const char **field)
 {
     int c;
+    char *p = iwa->offset, *q = iwa->offset;
 
-    /* Read until an end-of-line. */
-    while (c = get_char(iwa), c != '\n' && c != EOF) {
-        string_append(str, c);
-    }
-
-    return c;
-}
-
-static void read_field_unquoted(iwa_t* iwa, iwa_string_t* str)
-{
-    int c;
-    /* Read until a colon, space, tab, or break-line character. */
-    while (c = peek_char(iwa), c != ':' && c != '\t' && c != '\n' && c != EOF) {
-        get_char(iwa);
-        string_append(str, c);
-    }
-    /* The input stream points to the character just after the field is terminated. */
-}
+    *field = iwa->offset;
+    for (;;) {
+        char *r = find_delimiter(p, iwa->eol);
+        if (q != p) {
+            memmove(q, p, r - p);
+        }
+        q += r - p;
+        p = r;
 
-static void read_field_unescaped(iwa_t* iwa, iwa_string_t* str)
-{
-    int c, d;
-    /* Read until a colon, space, tab, or break-line character. */
-    while (c = peek_char(iwa), c != ':' && c != '\t' && c != '\n' && c != EOF) {
-        get_char(iwa);
-        if (c == '\\') {
+        if (p == iwa->eol) {
+            c = '\n';
+            break;
+        } else if (*p == '\\') {
             /* Possibly a escape sequence. */
-            d = peek_char(iwa);
-            switch (d) {
-            case ':':
-            case '\\':
-            case '#':
-                c = d;
-                get_char(iwa);
-                break;
+            if (p + 1 < iwa->eol && (p[1] == ':' || p[1] == '\\' || p[1] == '#')) {
+                *q++ = p[1];
+                p += 2;
+            } else {
+                *q++ = *p++;
             }
+        } else {
+            c = *p++;
+            break;
         }
-
-        string_append(str, c);
     }
-    /* The input stream points to the character just after the field is terminated. */
+
+    /* Terminate the field. */
+    *q = 0;
+    iwa->offset = (c == '\n') ? iwa->eol : p;
+    return c;
 }
 
-static int read_item(iwa_t* iwa)
+static void read_item(iwa_t* iwa, iwa_token_t* token)
 {
     int c;
-    
-    read_field_unescaped(iwa, &iwa->attr);
-
-    /* Check the character just after the attribute field is terminated. */
-    c = peek_char(iwa);
-    if (c == ':') {
-        /* Discard the colon. */
-        get_char(iwa);
 
-        read_field_unescaped(iwa, &iwa->value);
+    if (iwa->colon) {
+        /* The previous value field was followed by a colon. */
+        iwa->colon = 0;
+        token->attr = empty;
+        c = ':';
+    } else {
+        c = read_field(iwa, &token->attr);
+    }
 
-        c = peek_char(iwa);
+    token->value = empty;
+    if (c == ':') {
+        c = read_field(iwa, &token->value);
         if (c == ':') {
-            return 1;
+            iwa->colon = 1;
         }
     }
-
-    return 0;
 }
 
 const iwa_token_t* iwa_read(iwa_t* iwa)
@@ -229,32 +403,20 @@ const iwa_token_t* iwa_read(iwa_t* iwa)
     token->attr = NULL;
     token->value = NULL;
     token->comment = NULL;
-    string_clear(&iwa->attr);
-    string_clear(&iwa->value);
-
-    /* Return NULL if the stream hits EOF. */
-    if (peek_char(iwa) == EOF) {
-        switch (token->type) {
-        case IWA_EOF:
-            return NULL;
-        case IWA_COMMENT:
-        case IWA_BOI:
-            token->type = IWA_EOI;
-            return token;
-        case IWA_NONE:
-        case IWA_EOI:
-            token->type = IWA_EOF;
-            return token;
-        }
-    }
 
     /* Conditions based on the previous state. */
     switch (token->type) {
+    case IWA_EOF:
+        return NULL;
     case IWA_NONE:
     case IWA_EOI:
-        if (peek_char(iwa) == '\n') {
+        if (!read_line(iwa)) {
+            token->type = IWA_EOF;
+        } else if (iwa->offset == iwa->eol) {
             /* A empty line. */
-            get_char(iwa);
+            if (iwa->eol < iwa->end) {
+                ++iwa->offset;
+            }
             token->type = IWA_NONE;
         } else {
             /* A non-empty line. */
@@ -267,29 +429,29 @@ const iwa_token_t* iwa_read(iwa_t* iwa)
         break;
     case IWA_BOI:
     case IWA_ITEM:
-        for (;;) {
-            int c = peek_char(iwa);
-
-            if (c == '\t') {
-                /* Skip white spaces. */
-                get_char(iwa);
-            } else if (c == '#') {
-                /* Read a comment. */
-                read_comment(iwa, &iwa->attr);
-                token->type = IWA_COMMENT;
-                token->comment = iwa->attr.value;
-                break;
-            } else if (c == '\n') {
-                get_char(iwa);
-                token->type = IWA_EOI;
-                break;
-            } else {
-                read_item(iwa);
-                token->type = IWA_ITEM;
-                token->attr = iwa->attr.value;
-                token->value = iwa->value.value;
-                break;
+        /* Skip white spaces. */
+        while (!iwa->colon && iwa->offset < iwa->eol && *iwa->offset == '\t') {
+            ++iwa->offset;
+        }
+
+        if (!iwa->colon && iwa->offset == iwa->eol) {
+            /* The end of the line. */
+            if (iwa->eol < iwa->end) {
+                ++iwa->offset;
             }
+            token->type = IWA_EOI;
+        } else if (!iwa->colon && *iwa->offset == '#') {
+            /* Read a comment until the end of the line. */
+            token->comment = iwa->offset;
+            *iwa->eol = 0;
+            iwa->offset = iwa->eol;
+            if (iwa->eol < iwa->end) {
+                ++iwa->offset;
+            }
+            token->type = IWA_COMMENT;
+        } else {
+            read_item(iwa, token);
+            token->type = IWA_ITEM;
         }
         break;
     }
@@ -58,6 +58,7 @@ typedef struct tag_iwa_token iwa_token_t;
 
 iwa_t* iwa_reader(FILE *fp);
 const iwa_token_t* iwa_read(iwa_t* iwa);
+long iwa_offset(iwa_t* iwa);
 void iwa_delete(iwa_t* iwa);
 
 #ifdef    __cplusplus
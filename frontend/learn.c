@@ -30,6 +30,10 @@
 
 /* $Id: learn.c 176 2010-07-14 09:31:04Z naoaki $ */
 
+#ifdef    HAVE_CONFIG_H
+#include <config.h>
+#endif/*HAVE_CONFIG_H*/
+
 #include <os.h>
 
 #include <stdio.h>
@@ -37,6 +41,10 @@
 #include <string.h>
 #include <time.h>
 
+#ifdef    HAVE_GLOB_H
+#include <glob.h>
+#endif/*HAVE_GLOB_H*/
+
 #include <crfsuite.h>
 #include "option.h"
 #include "readdata.h"
@@ -47,10 +55,13 @@
 
 typedef struct {
     char* model;
-    char* training;
     char* features;
     char* evaluation;
 
+    int num_trainings;
+    char** trainings;
+
+    int num_threads;
     int help;
 
     int num_params;
@@ -79,9 +90,13 @@ static void learn_option_finish(learn_option_t* opt)
 
     free(opt->model);
     free(opt->features);
-    free(opt->training);
     free(opt->evaluation);
 
+    for (i = 0;i < opt->num_trainings;++i) {
+        free(opt->trainings[i]);
+    }
+    free(opt->trainings);
+
     for (i = 0;i < opt->num_params;++i) {
         free(opt->params[i]);
     }
@@ -102,6 +117,9 @@ BEGIN_OPTION_MAP(parse_learn_options, learn_option_t)
         free(opt->features);
         opt->features = mystrdup(arg);
 
+    ON_OPTION_WITH_ARG(SHORTOPT('T') || LONGOPT("threads"))
+        opt->num_threads = atoi(arg);
+
     ON_OPTION(SHORTOPT('h') || LONGOPT("help"))
         opt->help = 1;
 
@@ -114,15 +132,19 @@ END_OPTION_MAP()
 
 static void show_usage(FILE *fp, const char *argv0, const char *command)
 {
-    fprintf(fp, "USAGE: %s %s [OPTIONS] [DATA]\n", argv0, command);
-    fprintf(fp, "Obtain a model from a training set of instances given by a file (DATA).\n");
+    fprintf(fp, "USAGE: %s %s [OPTIONS] [DATA ...]\n", argv0, command);
+    fprintf(fp, "Obtain a model from a training set of instances given by files (DATA).\n");
+    fprintf(fp, "Each DATA may be a wildcard pattern (e.g., 'train/*.txt').\n");
     fprintf(fp, "If argument DATA is omitted or '-', this utility reads a data from STDIN.\n");
+    fprintf(fp, "DATA and TEST may be data sets compiled by the compile command.\n");
     fprintf(fp, "\n");
     fprintf(fp, "OPTIONS:\n");
     fprintf(fp, "    -f, --features=FEATURES   Designate a file to read features from [Required] (FEATURES)\n");
+    fprintf(fp, "                        FEATURES may be compiled by the compile command\n");
     fprintf(fp, "    -m, --model=MODEL   Store the obtained model in a file (MODEL)\n");
     fprintf(fp, "    -t, --test=TEST     Report the performance of the model on a data (TEST)\n");
     fprintf(fp, "    -p, --param=NAME=VALUE  Set the parameter NAME to VALUE\n");
+    fprintf(fp, "    -T, --threads=NUM   Read the data with NUM threads (default: all processors)\n");
     fprintf(fp, "    -h, --help          Show the usage of this command and exit\n");
 }
 
@@ -136,6 +158,38 @@ typedef struct {
     crf_dictionary_t* labels;
 } callback_data_t;
 
+static int append_training(learn_option_t* opt, const char *filename)
+{
+    char **trainings = (char**)realloc(opt->trainings, sizeof(char*) * (opt->num_trainings + 1));
+    if (trainings == NULL) {
+        return 1;
+    }
+    opt->trainings = trainings;
+    opt->trainings[opt->num_trainings] = mystrdup(filename);
+    ++opt->num_trainings;
+    return 0;
+}
+
+/* Append the files matching a pattern, or the pattern itself if none matches. */
+static int append_trainings(learn_option_t* opt, const char *pattern)
+{
+    int ret = 0;
+#ifdef    HAVE_GLOB_H
+    size_t i;
+    glob_t g;
+
+    if (strcmp(pattern, "-") != 0 && glob(pattern, 0, NULL, &g) == 0) {
+        for (i = 0;i < g.gl_pathc;++i) {
+            ret |= append_training(opt, g.gl_pathv[i]);
+        }
+        globfree(&g);
+        return ret;
+    }
+#endif/*HAVE_GLOB_H*/
+    ret = append_training(opt, pattern);
+    return ret;
+}
+
 static int message_callback(void *instance, const char *format, va_list args)
 {
     callback_data_t* cd = (callback_data_t*)instance;
@@ -196,6 +250,7 @@ int main_learn(int argc, char *argv[], const char *argv0)
     FILE *fp = NULL, *fpi = stdin, *fpo = stdout, *fpe = stderr;
     callback_data_t cd;
     crf_data_t data_train, data_test;
+    binary_data_t bin_train, bin_test;
     crf_evaluation_t eval;
     crf_trainer_t *trainer = NULL;
     crf_dictionary_t *attrs = NULL, *labels = NULL;
@@ -205,6 +260,8 @@ int main_learn(int argc, char *argv[], const char *argv0)
     learn_option_init(&opt);
     crf_data_init(&data_train);
     crf_data_init(&data_test);
+    binary_data_init(&bin_train);
+    binary_data_init(&bin_test);
     crf_evaluation_init(&eval, 0);
 
     /* Parse the command-line option. */
@@ -227,11 +284,13 @@ int main_learn(int argc, char *argv[], const char *argv0)
         goto force_exit;
     }
 
-    /* Set a training file. */
+    /* Set training files. */
     if (arg_used < argc) {
-        opt.training = mystrdup(argv[arg_used]);
+        for (i = arg_used;i < argc;++i) {
+            append_trainings(&opt, argv[i]);
+        }
     } else {
-        opt.training = mystrdup("-");    /* STDIN. */
+        append_training(&opt, "-");    /* STDIN. */
     }
 
     /* Create dictionaries for attributes and labels. */
@@ -272,14 +331,6 @@ int main_learn(int argc, char *argv[], const char *argv0)
         params->release(params);
     }
 
-    /* Open the training data. */
-    fp = (strcmp(opt.training, "-") == 0) ? fpi : fopen(opt.training, "r");
-    if (fp == NULL) {
-        fprintf(fpe, "ERROR: Failed to open the training data.\n");
-        ret = 1;
-        goto force_exit;        
-    }
-
     /* Log the start time. */
     time(&ts);
     strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", gmtime(&ts));
@@ -289,9 +340,19 @@ int main_learn(int argc, char *argv[], const char *argv0)
     /* Read the training data. */
     fprintf(fpo, "Reading the training data\n");
     clk_begin = clock();
-    read_data(fp, fpo, &data_train, attrs, labels);
+    if (opt.num_trainings == 1 && is_binary_data(opt.trainings[0])) {
+        /* Map the compiled data set. */
+        if (read_binary_data(&bin_train, opt.trainings[0], &data_train, attrs, labels, 1)) {
+            fprintf(fpe, "ERROR: Failed to read the compiled training data.\n");
+            ret = 1;
+            goto force_exit;
+        }
+    } else if (read_data(opt.trainings, opt.num_trainings, opt.num_threads, fpo, &data_train, attrs, labels)) {
+        fprintf(fpe, "ERROR: Failed to read the training data.\n");
+        ret = 1;
+        goto force_exit;
+    }
     clk_current = clock();
-    if (fp != fpi) fclose(fp);
 
     /* Report the statistics of the training data. */
     fprintf(fpo, "Number of instances: %d\n", data_train.num_instances);
@@ -304,19 +365,22 @@ int main_learn(int argc, char *argv[], const char *argv0)
 
     /* Read a test data if necessary */
     if (opt.evaluation != NULL) {
-        fp = fopen(opt.evaluation, "r");
-        if (fp == NULL) {
-            fprintf(fpe, "ERROR: Failed to open the evaluation data.\n");
-            ret = 1;
-            goto force_exit;        
-        }
-
         /* Read the test data. */
         fprintf(fpo, "Reading the evaluation data\n");
         clk_begin = clock();
-        read_data(fp, fpo, &data_test, attrs, labels);
+        if (is_binary_data(opt.evaluation)) {
+            /* Map the compiled data set. */
+            if (read_binary_data(&bin_test, opt.evaluation, &data_test, attrs, labels, 1)) {
+                fprintf(fpe, "ERROR: Failed to read the compiled evaluation data.\n");
+                ret = 1;
+                goto force_exit;
+            }
+        } else if (read_data(&opt.evaluation, 1, opt.num_threads, fpo, &data_test, attrs, labels)) {
+            fprintf(fpe, "ERROR: Failed to open the evaluation data.\n");
+            ret = 1;
+            goto force_exit;
+        }
         clk_current = clock();
-        fclose(fp);
 
         /* Report the statistics of the test data. */
         fprintf(fpo, "Number of instances: %d\n", data_test.num_instances);
@@ -327,20 +391,29 @@ int main_learn(int argc, char *argv[], const char *argv0)
         crf_data_set_num_labels(&data_test, labels->num(labels));
     }
 
-    /* Open the feature data. */
-    fp = (strcmp(opt.features, "-") == 0) ? fpi : fopen(opt.features, "r");
-    if (fp == NULL) {
-        fprintf(fpe, "ERROR: Failed to open the feature data.\n");
-        ret = 1;
-        goto force_exit;        
-    }
-
     /* Read the features */
     fprintf(fpo, "Reading the features\n");
     clk_begin = clock();
-    num_features = read_features(fp, fpo, labels, attrs, trainer);
+    if (is_binary_features(opt.features)) {
+        /* Map the compiled features. */
+        num_features = read_binary_features(opt.features, labels, attrs, trainer);
+        if (num_features < 0) {
+            fprintf(fpe, "ERROR: Failed to read the compiled features, which must be compiled with the same data sets.\n");
+            ret = 1;
+            goto force_exit;
+        }
+    } else {
+        /* Open the feature data. */
+        fp = (strcmp(opt.features, "-") == 0) ? fpi : fopen(opt.features, "r");
+        if (fp == NULL) {
+            fprintf(fpe, "ERROR: Failed to open the feature data.\n");
+            ret = 1;
+            goto force_exit;        
+        }
+        num_features = read_features(fp, fpo, labels, attrs, trainer);
+        if (fp != fpi) fclose(fp);
+    }
     clk_current = clock();
-    if (fp != fpi) fclose(fp);
     fprintf(fpo, "Number of features: %d\n", num_features);
     fprintf(fpo, "Seconds required: %.3f\n",  (clk_current - clk_begin) / (double)CLOCKS_PER_SEC);
     fprintf(fpo, "\n");
@@ -394,6 +467,8 @@ force_exit:
     SAFE_RELEASE(labels);
     SAFE_RELEASE(attrs);
 
+    binary_data_finish(&bin_test, &data_test);
+    binary_data_finish(&bin_train, &data_train);
     crf_data_finish(&data_test);
     crf_data_finish(&data_train);
     crf_evaluation_finish(&eval);
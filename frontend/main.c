@@ -46,6 +46,8 @@
 int main_learn(int argc, char *argv[], const char *argv0);
 int main_tag(int argc, char *argv[], const char *argv0);
 int main_dump(int argc, char *argv[], const char *argv0);
+int main_compile(int argc, char *argv[], const char *argv0);
+int main_reduce(int argc, char *argv[], const char *argv0);
 
 
 
@@ -83,6 +85,8 @@ static void show_usage(FILE *fp, const char *argv0)
     fprintf(fp, "    learn       Obtain a model from a training set of instances\n");
     fprintf(fp, "    tag         Assign suitable labels to given instances by using a model\n");
     fprintf(fp, "    dump        Output a model in a plain-text format\n");
+    fprintf(fp, "    compile     Convert a data set into the compiled (binary) format\n");
+    fprintf(fp, "    reduce      Write a lower-order copy of a model\n");
     fprintf(fp, "\n");
     fprintf(fp, "For the usage of each command, specify -h option in the command argument.\n");
 }
@@ -127,6 +131,10 @@ int main(int argc, char *argv[])
         return main_tag(argc-arg_used, argv+arg_used, argv0);
     } else if (strcmp(command, "dump") == 0) {
         return main_dump(argc-arg_used, argv+arg_used, argv0);
+    } else if (strcmp(command, "compile") == 0) {
+        return main_compile(argc-arg_used, argv+arg_used, argv0);
+    } else if (strcmp(command, "reduce") == 0) {
+        return main_reduce(argc-arg_used, argv+arg_used, argv0);
     } else {
         fprintf(fpe, "ERROR: Unrecognized command (%s) specified.\n", command);    
         return 1;
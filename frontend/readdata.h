@@ -35,7 +35,35 @@
 
 #include <crfsuite.h>
 
-void read_data(FILE *fpi, FILE *fpo, crf_data_t* data, crf_dictionary_t* attrs, crf_dictionary_t* labels);
+int read_data(char * const *filenames, int num_files, int num_threads, FILE *fpo, crf_data_t* data, crf_dictionary_t* attrs, crf_dictionary_t* labels);
 int read_features(FILE* fpi, FILE* fpo, crf_dictionary_t* labels, crf_dictionary_t* attrs, crf_trainer_t* trainer);
 
+/**
+ * Receiver of the features parsed from a feature file, called per batch.
+ *    The label sequences of the features are concatenated.
+ */
+typedef int (*feature_sink_t)(void *instance, int n, const int *attrs, const int *orders, const unsigned char *label_sequences);
+
+int parse_features(FILE* fpi, FILE* fpo, crf_dictionary_t* labels, crf_dictionary_t* attrs, feature_sink_t sink, void *instance);
+
+/**
+ * A compiled data set mapped into memory.
+ */
+typedef struct {
+    void*           block;      /**< File image (mapped or read). */
+    size_t          size;       /**< Size of the file image. */
+    crf_item_t*     items;      /**< Items of all instances. */
+    size_t          num_items;  /**< Number of items. */
+} binary_data_t;
+
+int compile_data(FILE *fpi, FILE *fpo, FILE *fpb, crf_dictionary_t* attrs, crf_dictionary_t* labels);
+int is_binary_data(const char *filename);
+void binary_data_init(binary_data_t* bin);
+int read_binary_data(binary_data_t* bin, const char *filename, crf_data_t* data, crf_dictionary_t* attrs, crf_dictionary_t* labels, int intern);
+void binary_data_finish(binary_data_t* bin, crf_data_t* data);
+
+int compile_features(FILE *fpi, FILE *fpo, FILE *fpb, crf_dictionary_t* attrs, crf_dictionary_t* labels);
+int is_binary_features(const char *filename);
+int read_binary_features(const char *filename, crf_dictionary_t* labels, crf_dictionary_t* attrs, crf_trainer_t* trainer);
+
 #endif/*__READDATA_H__*/
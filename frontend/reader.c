@@ -30,14 +30,27 @@
 
 /* $Id: reader.c 176 2010-07-14 09:31:04Z naoaki $ */
 
+#ifdef    HAVE_CONFIG_H
+#include <config.h>
+#endif/*HAVE_CONFIG_H*/
+
 #include <os.h>
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef    HAVE_UNISTD_H
+#include <unistd.h>
+#endif/*HAVE_UNISTD_H*/
+
+#ifdef    HAVE_LIBPTHREAD
+#include <pthread.h>
+#endif/*HAVE_LIBPTHREAD*/
+
 #include <crfsuite.h>
 #include "iwa.h"
+#include "readdata.h"
 
 static int progress(FILE *fpo, int prev, int current)
 {
@@ -56,48 +69,144 @@ static int progress(FILE *fpo, int prev, int current)
     return prev;
 }
 
-void read_data(FILE *fpi, FILE *fpo, crf_data_t* data, crf_dictionary_t* attrs, crf_dictionary_t* labels)
+#define    CHUNK_MIN_SIZE    (1 << 20)
+
+/**
+ * A chunk of a data file that starts and ends at instance boundaries.
+ */
+typedef struct {
+    const char *filename;       /**< File name ("-" for STDIN). */
+    long begin;                 /**< Offset of the chunk. */
+    long end;                   /**< End offset of the chunk (-1 for EOF). */
+    crf_data_t data;            /**< Instances read from the chunk. */
+    crf_dictionary_t* attrs;    /**< Attribute dictionary of the chunk. */
+    crf_dictionary_t* labels;   /**< Label dictionary of the chunk. */
+    int ret;
+} chunk_t;
+
+typedef struct {
+    chunk_t* chunks;
+    int num_chunks;
+    int next;                   /**< Next chunk to read. */
+
+    FILE *fpo;
+    long total;                 /**< Total size of the chunks. */
+    long done;                  /**< Size of the data read so far. */
+    int prev;                   /**< Last progress reported. */
+
+#ifdef    HAVE_LIBPTHREAD
+    pthread_mutex_t mutex;
+#endif/*HAVE_LIBPTHREAD*/
+} reader_t;
+
+static void reader_lock(reader_t* reader)
+{
+#ifdef    HAVE_LIBPTHREAD
+    pthread_mutex_lock(&reader->mutex);
+#endif/*HAVE_LIBPTHREAD*/
+}
+
+static void reader_unlock(reader_t* reader)
+{
+#ifdef    HAVE_LIBPTHREAD
+    pthread_mutex_unlock(&reader->mutex);
+#endif/*HAVE_LIBPTHREAD*/
+}
+
+static void reader_progress(reader_t* reader, long size)
+{
+    reader_lock(reader);
+    reader->done += size;
+    if (0 < reader->total) {
+        int current = (int)(reader->done * 100.0 / (double)reader->total);
+        reader->prev = progress(reader->fpo, reader->prev, current);
+    }
+    reader_unlock(reader);
+}
+
+/* Append an item to the instance without copying its contents. */
+static int sequence_append_item(crf_sequence_t* inst, crf_item_t* item, int label)
+{
+    if (inst->max_items <= inst->num_items) {
+        crf_item_t* items = NULL;
+        int max_items = (inst->max_items + 1) * 2;
+        items = (crf_item_t*)realloc(inst->items, sizeof(crf_item_t) * max_items);
+        if (items == NULL) {
+            return 1;
+        }
+        inst->items = items;
+        inst->max_items = max_items;
+    }
+    inst->items[inst->num_items] = *item;
+    inst->items[inst->num_items].label = label;
+    ++inst->num_items;
+    crf_item_init(item);
+    return 0;
+}
+
+/* Append an instance to the data without copying its items. */
+static int data_append_sequence(crf_data_t* data, crf_sequence_t* inst)
 {
-    int lid = -1;
+    if (0 < inst->num_items) {
+        if (data->max_instances <= data->num_instances) {
+            crf_sequence_t* instances = NULL;
+            int max_instances = (data->max_instances + 1) * 2;
+            instances = (crf_sequence_t*)realloc(
+                data->instances, sizeof(crf_sequence_t) * max_instances);
+            if (instances == NULL) {
+                return 1;
+            }
+            data->instances = instances;
+            data->max_instances = max_instances;
+        }
+        data->instances[data->num_instances++] = *inst;
+        crf_sequence_init(inst);
+    }
+    return 0;
+}
+
+static int read_chunk(reader_t* reader, chunk_t* chunk)
+{
+    int ret = 0, lid = -1;
     crf_sequence_t inst;
     crf_item_t item;
     crf_content_t cont;
     iwa_t* iwa = NULL;
     const iwa_token_t* token = NULL;
-    long filesize = 0, begin = 0, offset = 0;
-    int prev = 0, current = 0;
+    crf_dictionary_t *attrs = chunk->attrs, *labels = chunk->labels;
+    long offset = chunk->begin, reported = chunk->begin;
+    FILE *fp = NULL;
 
     /* Initialize the instance.*/
     crf_sequence_init(&inst);
+    crf_item_init(&item);
 
-    /* Obtain the file size. */
-    begin = ftell(fpi);
-    fseek(fpi, 0, SEEK_END);
-    filesize = ftell(fpi) - begin;
-    fseek(fpi, begin, SEEK_SET);
-
-    /* */
-    fprintf(fpo, "0");
-    fflush(fpo);
-    prev = 0;
+    /* Open the file, and seek to the chunk. */
+    if (strcmp(chunk->filename, "-") == 0) {
+        fp = stdin;
+    } else {
+        fp = fopen(chunk->filename, "r");
+        if (fp == NULL || fseek(fp, chunk->begin, SEEK_SET) != 0) {
+            ret = 1;
+            goto error_exit;
+        }
+    }
 
-    iwa = iwa_reader(fpi);
+    iwa = iwa_reader(fp);
+    if (iwa == NULL) {
+        ret = 1;
+        goto error_exit;
+    }
     while (token = iwa_read(iwa), token != NULL) {
-        /* Progress report. */
-        offset = ftell(fpi);
-        current = (int)((offset - begin) * 100.0 / (double)filesize);
-        prev = progress(fpo, prev, current);
-
         switch (token->type) {
         case IWA_BOI:
             /* Initialize an item. */
             lid = -1;
-            crf_item_init(&item);
+            crf_item_finish(&item);
             break;
         case IWA_EOI:
             /* Append the item to the instance. */
-            crf_sequence_append(&inst, &item, lid);
-            crf_item_finish(&item);
+            ret |= sequence_append_item(&inst, &item, lid);
             break;
         case IWA_ITEM:
             if (lid == -1) {
@@ -114,44 +223,398 @@ void read_data(FILE *fpi, FILE *fpo, crf_data_t* data, crf_dictionary_t* attrs,
                 } else {
                     cont.scale = 1.0;
                 }
-                crf_item_append_content(&item, &cont);
+                ret |= crf_item_append_content(&item, &cont);
             }
             break;
         case IWA_NONE:
         case IWA_EOF:
             /* Put the training instance. */
-            crf_data_append(data, &inst);
-            crf_sequence_finish(&inst);
+            ret |= data_append_sequence(&chunk->data, &inst);
+
+            /* Progress report. */
+            offset = iwa_offset(iwa);
+            if (CHUNK_MIN_SIZE <= offset - reported) {
+                reader_progress(reader, offset - reported);
+                reported = offset;
+            }
+
+            /* Stop at the end of the chunk. */
+            if (0 <= chunk->end && chunk->end <= offset) {
+                goto error_exit;
+            }
             break;
         case IWA_COMMENT:
             break;
         }
+
+        if (ret) {
+            goto error_exit;
+        }
     }
-    progress(fpo, prev, 100);
+
+error_exit:
+    if (iwa != NULL) {
+        offset = iwa_offset(iwa);
+        if (reported < offset) {
+            reader_progress(reader, offset - reported);
+        }
+        iwa_delete(iwa);
+    }
+    if (fp != NULL && fp != stdin) {
+        fclose(fp);
+    }
+    crf_item_finish(&item);
+    crf_sequence_finish(&inst);
+    chunk->ret = ret;
+    return ret;
+}
+
+static void* read_chunks(void *instance)
+{
+    reader_t* reader = (reader_t*)instance;
+
+    for (;;) {
+        int i;
+
+        /* Take the next chunk. */
+        reader_lock(reader);
+        i = reader->next++;
+        reader_unlock(reader);
+        if (reader->num_chunks <= i) {
+            break;
+        }
+
+        read_chunk(reader, &reader->chunks[i]);
+    }
+    return NULL;
+}
+
+/*
+    Find the beginning of an instance at or after the offset, i.e., the
+    position just after an empty line. Returns -1 if none.
+ */
+static long find_boundary(FILE *fp, long offset)
+{
+    int c, prev = 0;
+
+    if (fseek(fp, offset - 1, SEEK_SET) != 0) {
+        return -1;
+    }
+    for (--offset;(c = getc(fp)) != EOF;++offset) {
+        if (c == '\n' && prev == '\n') {
+            return offset + 1;
+        }
+        prev = c;
+    }
+    return -1;
+}
+
+/* Split a file into chunks for num_threads threads. */
+static int split_file(reader_t* reader, const char *filename, int num_threads)
+{
+    int i, n = 1;
+    long size = -1, begin = 0, offset = 0;
+    FILE *fp = NULL;
+
+    if (strcmp(filename, "-") != 0) {
+        fp = fopen(filename, "r");
+        if (fp == NULL) {
+            return 1;
+        }
+        fseek(fp, 0, SEEK_END);
+        size = ftell(fp);
+        if (0 < size) {
+            reader->total += size;
+            n = (int)(size / CHUNK_MIN_SIZE);
+            n = (n < 1) ? 1 : (num_threads < n ? num_threads : n);
+        }
+    }
+
+    for (i = 0;i < n;++i) {
+        chunk_t* chunk = NULL;
+        chunk_t* chunks = (chunk_t*)realloc(reader->chunks, sizeof(chunk_t) * (reader->num_chunks + 1));
+        if (chunks == NULL) {
+            if (fp != NULL) fclose(fp);
+            return 1;
+        }
+        reader->chunks = chunks;
+
+        /* The chunk ends at the first instance boundary after its share. */
+        offset = (i == n-1) ? -1 : find_boundary(fp, size / n * (i+1));
+        if (0 <= offset && offset <= begin) {
+            continue;
+        }
+
+        chunk = &reader->chunks[reader->num_chunks++];
+        memset(chunk, 0, sizeof(*chunk));
+        chunk->filename = filename;
+        chunk->begin = begin;
+        chunk->end = offset;
+        if (offset < 0) {
+            break;
+        }
+        begin = offset;
+    }
+
+    if (fp != NULL) {
+        fclose(fp);
+    }
+    return 0;
+}
+
+/* Map the IDs in a chunk to the IDs in the dictionaries in the order of their appearance. */
+static int remap_chunk(chunk_t* chunk, crf_dictionary_t* attrs, crf_dictionary_t* labels)
+{
+    int i, j, t, ret = 0;
+    int *amap = NULL, *lmap = NULL;
+    const char **strs = NULL;
+    const int A = chunk->attrs->num(chunk->attrs);
+    const int L = chunk->labels->num(chunk->labels);
+
+    amap = (int*)malloc(sizeof(int) * (A + 1));
+    lmap = (int*)malloc(sizeof(int) * (L + 1));
+    strs = (const char**)malloc(sizeof(char*) * ((A < L ? L : A) + 1));
+    if (amap == NULL || lmap == NULL || strs == NULL) {
+        ret = 1;
+        goto error_exit;
+    }
+
+    /* The strings of a chunk dictionary are views valid until its release. */
+    for (i = 0;i < L;++i) {
+        chunk->labels->to_string(chunk->labels, i, &strs[i]);
+    }
+    if (labels->get_many(labels, strs, L, lmap)) {
+        ret = 1;
+        goto error_exit;
+    }
+    for (i = 0;i < A;++i) {
+        chunk->attrs->to_string(chunk->attrs, i, &strs[i]);
+    }
+    if (attrs->get_many(attrs, strs, A, amap)) {
+        ret = 1;
+        goto error_exit;
+    }
+
+    /* Rewrite the IDs. */
+    for (i = 0;i < chunk->data.num_instances;++i) {
+        crf_sequence_t* inst = &chunk->data.instances[i];
+        for (t = 0;t < inst->num_items;++t) {
+            crf_item_t* item = &inst->items[t];
+            if (0 <= item->label) {
+                item->label = lmap[item->label];
+            }
+            for (j = 0;j < item->num_contents;++j) {
+                item->contents[j].aid = amap[item->contents[j].aid];
+            }
+        }
+    }
+
+error_exit:
+    free(strs);
+    free(lmap);
+    free(amap);
+    return ret;
+}
+
+/* Merge the instances and dictionaries of a chunk into the data. */
+static int merge_chunk(chunk_t* chunk, crf_data_t* data, crf_dictionary_t* attrs, crf_dictionary_t* labels)
+{
+    int n = data->num_instances + chunk->data.num_instances;
+
+    /* A chunk read into the dictionaries directly needs no mapping. */
+    if (chunk->attrs != attrs || chunk->labels != labels) {
+        if (remap_chunk(chunk, attrs, labels)) {
+            return 1;
+        }
+    }
+
+    /* Move the instances. */
+    if (data->max_instances < n) {
+        crf_sequence_t* instances = (crf_sequence_t*)realloc(
+            data->instances, sizeof(crf_sequence_t) * n);
+        if (instances == NULL) {
+            return 1;
+        }
+        data->instances = instances;
+        data->max_instances = n;
+    }
+    if (0 < chunk->data.num_instances) {
+        memcpy(&data->instances[data->num_instances], chunk->data.instances,
+            sizeof(crf_sequence_t) * chunk->data.num_instances);
+    }
+    data->num_instances = n;
+    free(chunk->data.instances);
+    crf_data_init(&chunk->data);
+    return 0;
+}
+
+static int num_processors(void)
+{
+#if defined(HAVE_UNISTD_H) && defined(_SC_NPROCESSORS_ONLN)
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return (0 < n) ? (int)n : 1;
+#else
+    return 1;
+#endif
+}
+
+int read_data(
+    char * const *filenames,
+    int num_files,
+    int num_threads,
+    FILE *fpo,
+    crf_data_t* data,
+    crf_dictionary_t* attrs,
+    crf_dictionary_t* labels
+    )
+{
+    int i, ret = 0;
+    reader_t reader;
+
+    memset(&reader, 0, sizeof(reader));
+    reader.fpo = fpo;
+    if (num_threads <= 0) {
+        num_threads = num_processors();
+    }
+#ifndef    HAVE_LIBPTHREAD
+    num_threads = 1;
+#endif/*HAVE_LIBPTHREAD*/
+
+    /*
+        Split the files into chunks at instance boundaries. A single thread
+        reads the chunks in order into the dictionaries directly; otherwise,
+        each chunk is read into its own dictionaries, and merged in order,
+        which assigns the same IDs as reading the files sequentially.
+     */
+    for (i = 0;i < num_files;++i) {
+        if (ret = split_file(&reader, filenames[i], num_threads)) {
+            goto error_exit;
+        }
+    }
+    if (reader.num_chunks < num_threads) {
+        num_threads = reader.num_chunks;
+    }
+    for (i = 0;i < reader.num_chunks;++i) {
+        chunk_t* chunk = &reader.chunks[i];
+        if (num_threads <= 1) {
+            chunk->attrs = attrs;
+            chunk->labels = labels;
+            attrs->addref(attrs);
+            labels->addref(labels);
+        } else if (!crf_create_instance("dictionary", (void**)&chunk->attrs) ||
+                   !crf_create_instance("dictionary", (void**)&chunk->labels)) {
+            ret = 1;
+            goto error_exit;
+        }
+    }
+
+    fprintf(fpo, "0");
+    fflush(fpo);
+
+    if (num_threads <= 1) {
+        read_chunks(&reader);
+    } else {
+#ifdef    HAVE_LIBPTHREAD
+        pthread_t* threads = (pthread_t*)calloc(num_threads, sizeof(pthread_t));
+        if (threads == NULL) {
+            ret = 1;
+            goto error_exit;
+        }
+        pthread_mutex_init(&reader.mutex, NULL);
+        for (i = 0;i < num_threads;++i) {
+            if (pthread_create(&threads[i], NULL, read_chunks, &reader) != 0) {
+                break;
+            }
+        }
+        if (i == 0) {
+            /* Read the chunks in this thread if no thread was created. */
+            read_chunks(&reader);
+        }
+        while (0 < i) {
+            pthread_join(threads[--i], NULL);
+        }
+        pthread_mutex_destroy(&reader.mutex);
+        free(threads);
+#endif/*HAVE_LIBPTHREAD*/
+    }
+
+    progress(fpo, reader.prev, 100);
     fprintf(fpo, "\n");
-    iwa_delete(iwa);
+
+    /* Merge the chunks in order. */
+    for (i = 0;i < reader.num_chunks;++i) {
+        chunk_t* chunk = &reader.chunks[i];
+        if (chunk->ret) {
+            ret = chunk->ret;
+            goto error_exit;
+        }
+        if (ret = merge_chunk(chunk, data, attrs, labels)) {
+            goto error_exit;
+        }
+    }
+
+error_exit:
+    for (i = 0;i < reader.num_chunks;++i) {
+        chunk_t* chunk = &reader.chunks[i];
+        crf_data_finish(&chunk->data);
+        if (chunk->labels != NULL) chunk->labels->release(chunk->labels);
+        if (chunk->attrs != NULL) chunk->attrs->release(chunk->attrs);
+    }
+    free(reader.chunks);
+    return ret;
 }
 
-int read_features(
+#define    FEATURE_BATCH_SIZE    65536
+
+typedef struct {
+    int num;                    /* Number of features in the batch. */
+    int *attrs;                 /* Attribute of each feature. */
+    int *orders;                /* Number of labels of each feature. */
+    unsigned char *labels;      /* Concatenated label sequences. */
+    size_t num_labels;
+    size_t max_labels;
+} feature_batch_t;
+
+/* Send the buffered features to the sink. */
+static int flush_features(feature_sink_t sink, void *instance, feature_batch_t* batch)
+{
+    int ret = 0;
+    if (0 < batch->num) {
+        ret = sink(instance, batch->num, batch->attrs, batch->orders, batch->labels);
+        batch->num = 0;
+        batch->num_labels = 0;
+    }
+    return ret;
+}
+
+int parse_features(
     FILE* fpi,
     FILE* fpo,
     crf_dictionary_t* labels,
     crf_dictionary_t* attrs,
-    crf_trainer_t* trainer
+    feature_sink_t sink,
+    void *instance
     )
 {
     const iwa_token_t* token = NULL;
     iwa_t* iwa = NULL;
-    long filesize = 0, begin = 0, offset = 0;
+    long filesize = 0, begin = 0;
     int prev = 0, current = 0;
     int L = labels->num(labels);
     int attr = -1;
-    int order = 0;
-    unsigned char* label_sequence;
-    int max_order = 256;
+    int num_features = 0;
     int ret = 0;
+    feature_batch_t batch;
 
-    label_sequence = calloc(max_order, sizeof(unsigned char));
+    memset(&batch, 0, sizeof(batch));
+    batch.max_labels = FEATURE_BATCH_SIZE;
+    batch.attrs = (int*)malloc(sizeof(int) * FEATURE_BATCH_SIZE);
+    batch.orders = (int*)malloc(sizeof(int) * FEATURE_BATCH_SIZE);
+    batch.labels = (unsigned char*)malloc(batch.max_labels);
+    if (batch.attrs == NULL || batch.orders == NULL || batch.labels == NULL) {
+        ret = CRFERR_OUTOFMEMORY;
+        goto error_exit;
+    }
 
     /* Obtain the file size. */
     begin = ftell(fpi);
@@ -163,25 +626,34 @@ int read_features(
     fflush(fpo);
     prev = 0;
 
-    /* Loop over the sequences in the training data. */
-
+    /* Loop over the features in the feature file. */
     iwa = iwa_reader(fpi);
     while (token = iwa_read(iwa), token != NULL) {
         /* Progress report. */
-        int offset = ftell(fpi);
+        long offset = iwa_offset(iwa);
         current = (int)((offset - begin) * 100.0 / (double)filesize);
         prev = progress(fpo, prev, current);
 
         switch (token->type) {
         case IWA_BOI:
             /* Initialize a feature. */
-            memset(label_sequence, 0, max_order * sizeof(unsigned char));
             attr = -1;
-            order = 0;
+            batch.orders[batch.num] = 0;
             break;
         case IWA_EOI:
-            /* Append the feature to the feature set. */
-            if (attr != -1 && order != -1) ret = trainer->add_feature(trainer, attr, order, label_sequence);
+            /* Append the feature to the batch. */
+            if (attr != -1) {
+                batch.attrs[batch.num++] = attr;
+                ++num_features;
+                if (batch.num == FEATURE_BATCH_SIZE) {
+                    if (ret = flush_features(sink, instance, &batch)) {
+                        goto error_exit;
+                    }
+                }
+            } else {
+                /* Discard the labels of an incomplete feature. */
+                batch.num_labels -= batch.orders[batch.num];
+            }
             break;
         case IWA_ITEM:
             if (attr == -1) {
@@ -189,16 +661,17 @@ int read_features(
             } else {
                 int label = labels->to_id(labels, token->attr);
                 if (label < 0) label = L;
-                if (order >= max_order) {
-                    unsigned char* t = realloc(label_sequence, max_order * 2);
-                    if (t == 0) {
-                        free(label_sequence);
-                        return CRFERR_OUTOFMEMORY;
+                if (batch.max_labels <= batch.num_labels) {
+                    unsigned char* t = (unsigned char*)realloc(batch.labels, batch.max_labels * 2);
+                    if (t == NULL) {
+                        ret = CRFERR_OUTOFMEMORY;
+                        goto error_exit;
                     }
-                    label_sequence = t;
+                    batch.labels = t;
+                    batch.max_labels *= 2;
                 }
-                label_sequence[order] = label;
-                order++;
+                batch.labels[batch.num_labels++] = (unsigned char)label;
+                ++batch.orders[batch.num];
             }
             break;
         case IWA_NONE:
@@ -208,10 +681,34 @@ int read_features(
             break;
         }
     }
+    if (ret = flush_features(sink, instance, &batch)) {
+        goto error_exit;
+    }
     progress(fpo, prev, 100);
     fprintf(fpo, "\n");
-    iwa_delete(iwa);
+    ret = num_features;
 
-    free(label_sequence);
+error_exit:
+    if (iwa != NULL) iwa_delete(iwa);
+    free(batch.labels);
+    free(batch.orders);
+    free(batch.attrs);
     return ret;
 }
+
+static int trainer_sink(void *instance, int n, const int *attrs, const int *orders, const unsigned char *label_sequences)
+{
+    crf_trainer_t* trainer = (crf_trainer_t*)instance;
+    return trainer->add_features(trainer, n, attrs, orders, label_sequences);
+}
+
+int read_features(
+    FILE* fpi,
+    FILE* fpo,
+    crf_dictionary_t* labels,
+    crf_dictionary_t* attrs,
+    crf_trainer_t* trainer
+    )
+{
+    return parse_features(fpi, fpo, labels, attrs, trainer_sink, trainer);
+}
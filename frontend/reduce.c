@@ -0,0 +1,346 @@
+/*
+ *        Reduce command for CRFsuite frontend.
+ *
+ * Copyright (c) 2007-2010, Naoaki Okazaki
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the names of the authors nor the names of its contributors
+ *       may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* $Id$ */
+
+#include <os.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <crfsuite.h>
+#include "option.h"
+#include "readdata.h"
+
+#define    SAFE_RELEASE(obj)    if ((obj) != NULL) { (obj)->release(obj); (obj) = NULL; }
+
+typedef struct {
+    char* output;
+    char* dev;
+    int max_order;
+    double threshold;
+    int merge;
+
+    int help;
+} reduce_option_t;
+
+/* Performance of a model on the development set. */
+typedef struct {
+    floatval_t item_accuracy;
+    floatval_t inst_accuracy;
+    floatval_t paths_per_item;
+    double seconds;
+} reduce_result_t;
+
+static char* mystrdup(const char *src)
+{
+    char* dst = (char*)malloc(strlen(src)+1);
+    if (dst != NULL) {
+        strcpy(dst, src);
+    }
+    return dst;
+}
+
+static void reduce_option_init(reduce_option_t* opt)
+{
+    memset(opt, 0, sizeof(*opt));
+    opt->max_order = 3;
+}
+
+static void reduce_option_finish(reduce_option_t* opt)
+{
+    free(opt->output);
+    free(opt->dev);
+}
+
+BEGIN_OPTION_MAP(parse_reduce_options, reduce_option_t)
+
+    ON_OPTION_WITH_ARG(SHORTOPT('o') || LONGOPT("output"))
+        free(opt->output);
+        opt->output = mystrdup(arg);
+
+    ON_OPTION_WITH_ARG(SHORTOPT('n') || LONGOPT("order"))
+        opt->max_order = atoi(arg);
+
+    ON_OPTION_WITH_ARG(SHORTOPT('w') || LONGOPT("threshold"))
+        opt->threshold = atof(arg);
+
+    ON_OPTION(SHORTOPT('M') || LONGOPT("merge"))
+        opt->merge = 1;
+
+    ON_OPTION_WITH_ARG(SHORTOPT('d') || LONGOPT("dev"))
+        free(opt->dev);
+        opt->dev = mystrdup(arg);
+
+    ON_OPTION(SHORTOPT('h') || LONGOPT("help"))
+        opt->help = 1;
+
+END_OPTION_MAP()
+
+static void show_usage(FILE *fp, const char *argv0, const char *command)
+{
+    fprintf(fp, "USAGE: %s %s [OPTIONS] <MODEL>\n", argv0, command);
+    fprintf(fp, "Write a copy of the model (MODEL) without the features of orders above\n");
+    fprintf(fp, "ORDER, which reduces the number of paths the tagger considers per item.\n");
+    fprintf(fp, "Features of higher orders whose absolute weights reach THRESHOLD are kept.\n");
+    fprintf(fp, "With a development set (DEV), report the accuracy and the average number\n");
+    fprintf(fp, "of paths per item of the models before and after the reduction.\n");
+    fprintf(fp, "\n");
+    fprintf(fp, "OPTIONS:\n");
+    fprintf(fp, "    -o, --output=OUTPUT Store the reduced model in a file (OUTPUT) [Required]\n");
+    fprintf(fp, "    -n, --order=ORDER   Remove features of orders above ORDER (DEFAULT=3)\n");
+    fprintf(fp, "    -w, --threshold=THRESHOLD Keep features whose absolute weights are not\n");
+    fprintf(fp, "                        below THRESHOLD (DEFAULT=0, removing all of them)\n");
+    fprintf(fp, "    -M, --merge         Add the weight of a removed feature to the feature of\n");
+    fprintf(fp, "                        order ORDER with the same attribute and latest labels\n");
+    fprintf(fp, "    -d, --dev=DEV       Evaluate the models on a labeled data set (DEV)\n");
+    fprintf(fp, "    -h, --help          Show the usage of this command and exit\n");
+}
+
+/*
+    Tag the development set read with its own dictionaries (attrs and
+    labels); its attribute and label IDs are converted to those of the
+    model, removing the attributes unknown to the model.
+ */
+static int evaluate(
+    crf_model_t* model,
+    const crf_data_t* data,
+    crf_dictionary_t* attrs,
+    crf_dictionary_t* labels,
+    reduce_result_t* result
+    )
+{
+    int i, j, t, L, label, ret = 0;
+    int *amap = NULL, *lmap = NULL;
+    double num_paths = 0, num_items = 0;
+    clock_t clk_begin;
+    crf_sequence_t inst;
+    crf_item_t item;
+    crf_content_t cont;
+    crf_output_t output;
+    crf_evaluation_t eval;
+    crf_tagger_t *tagger = NULL;
+    crf_dictionary_t *mattrs = NULL, *mlabels = NULL;
+    const int A = attrs->num(attrs);
+    const int Y = labels->num(labels);
+
+    memset(&eval, 0, sizeof(eval));
+    if ((ret = model->get_attrs(model, &mattrs)) ||
+        (ret = model->get_labels(model, &mlabels)) ||
+        (ret = model->get_tagger(model, &tagger))) {
+        goto force_exit;
+    }
+    L = mlabels->num(mlabels);
+    crf_evaluation_init(&eval, L);
+
+    /* Convert the IDs once per distinct string. */
+    amap = (int*)malloc(sizeof(int) * (A + 1));
+    lmap = (int*)malloc(sizeof(int) * (Y + 1));
+    if (amap == NULL || lmap == NULL) {
+        ret = 1;
+        goto force_exit;
+    }
+    for (i = 0;i < A;++i) {
+        const char *str = NULL;
+        attrs->to_string(attrs, i, &str);
+        amap[i] = (str != NULL) ? mattrs->to_id(mattrs, str) : -1;
+        attrs->free_(attrs, str);
+    }
+    for (i = 0;i < Y;++i) {
+        const char *str = NULL;
+        labels->to_string(labels, i, &str);
+        lmap[i] = (str != NULL) ? mlabels->to_id(mlabels, str) : -1;
+        if (lmap[i] < 0) lmap[i] = L;    /* #L stands for a unknown label. */
+        labels->free_(labels, str);
+    }
+
+    clk_begin = clock();
+    for (i = 0;i < data->num_instances;++i) {
+        const crf_sequence_t* src = &data->instances[i];
+
+        crf_sequence_init(&inst);
+        for (t = 0;t < src->num_items;++t) {
+            crf_item_init(&item);
+            for (j = 0;j < src->items[t].num_contents;++j) {
+                const int aid = amap[src->items[t].contents[j].aid];
+                if (0 <= aid) {
+                    crf_content_set(&cont, aid, src->items[t].contents[j].scale);
+                    crf_item_append_content(&item, &cont);
+                }
+            }
+            /* The last (EOS) item has a negative label until the number of labels is set. */
+            label = src->items[t].label;
+            crf_sequence_append(&inst, &item, (0 <= label) ? lmap[label] : L);
+            crf_item_finish(&item);
+        }
+
+        crf_output_init(&output);
+        if (ret = tagger->tag(tagger, &inst, &output)) {
+            crf_output_finish(&output);
+            crf_sequence_finish(&inst);
+            goto force_exit;
+        }
+        crf_evaluation_accmulate(&eval, &inst, &output);
+        num_paths += inst.num_paths;
+        num_items += inst.num_items;
+        crf_output_finish(&output);
+        crf_sequence_finish(&inst);
+    }
+    result->seconds = (clock() - clk_begin) / (double)CLOCKS_PER_SEC;
+
+    crf_evaluation_compute(&eval);
+    result->item_accuracy = eval.item_accuracy;
+    result->inst_accuracy = eval.inst_accuracy;
+    result->paths_per_item = (0 < num_items) ? num_paths / num_items : 0.;
+
+force_exit:
+    crf_evaluation_finish(&eval);
+    free(lmap);
+    free(amap);
+    SAFE_RELEASE(tagger);
+    SAFE_RELEASE(mlabels);
+    SAFE_RELEASE(mattrs);
+    return ret;
+}
+
+int main_reduce(int argc, char *argv[], const char *argv0)
+{
+    int ret = 0, arg_used = 0;
+    reduce_option_t opt;
+    const char *command = argv[0];
+    FILE *fpo = stdout, *fpe = stderr;
+    crf_model_t *model = NULL, *reduced = NULL;
+    crf_dictionary_t *attrs = NULL, *labels = NULL;
+    crf_data_t data;
+    binary_data_t bin;
+    reduce_result_t before, after;
+
+    crf_data_init(&data);
+    binary_data_init(&bin);
+
+    /* Parse the command-line option. */
+    reduce_option_init(&opt);
+    arg_used = option_parse(++argv, --argc, parse_reduce_options, &opt);
+    if (arg_used < 0) {
+        ret = 1;
+        goto force_exit;
+    }
+
+    /* Show the help message for this command if specified. */
+    if (opt.help) {
+        show_usage(fpo, argv0, command);
+        goto force_exit;
+    }
+
+    /* Check for the existence of the model file. */
+    if (argc <= arg_used) {
+        fprintf(fpe, "ERROR: No model specified.\n");
+        ret = 1;
+        goto force_exit;
+    }
+
+    /* Make sure that -o or --output option is provided. */
+    if (opt.output == NULL) {
+        fprintf(fpe, "ERROR: You have to designate a file to store the reduced model.\n");
+        ret = 1;
+        goto force_exit;
+    }
+
+    /* Create a model instance corresponding to the model file. */
+    if (ret = crf_create_instance_from_file(argv[arg_used], (void**)&model)) {
+        fprintf(fpe, "ERROR: Failed to read the model: %s\n", argv[arg_used]);
+        goto force_exit;
+    }
+
+    /* Write the reduced model. */
+    fprintf(fpo, "Reducing the model to order %d\n", opt.max_order);
+    if (ret = model->reduce(model, opt.output, opt.max_order, opt.threshold, opt.merge, fpo)) {
+        fprintf(fpe, "ERROR: Failed to write the reduced model.\n");
+        goto force_exit;
+    }
+    fprintf(fpo, "\n");
+
+    if (opt.dev == NULL) {
+        goto force_exit;
+    }
+
+    /* Read the development set with dictionaries of its own. */
+    if (!crf_create_instance("dictionary", (void**)&attrs) ||
+        !crf_create_instance("dictionary", (void**)&labels)) {
+        fprintf(fpe, "ERROR: Failed to create a dictionary instance.\n");
+        ret = 1;
+        goto force_exit;
+    }
+    fprintf(fpo, "Reading the development data\n");
+    if (is_binary_data(opt.dev)) {
+        ret = read_binary_data(&bin, opt.dev, &data, attrs, labels, 1);
+    } else {
+        ret = read_data(&opt.dev, 1, 0, fpo, &data, attrs, labels);
+    }
+    if (ret) {
+        fprintf(fpe, "ERROR: Failed to read the development data: %s\n", opt.dev);
+        goto force_exit;
+    }
+    fprintf(fpo, "Number of instances: %d\n", data.num_instances);
+    fprintf(fpo, "\n");
+
+    /* Evaluate the models. */
+    if (ret = crf_create_instance_from_file(opt.output, (void**)&reduced)) {
+        fprintf(fpe, "ERROR: Failed to read the reduced model: %s\n", opt.output);
+        goto force_exit;
+    }
+    if ((ret = evaluate(model, &data, attrs, labels, &before)) ||
+        (ret = evaluate(reduced, &data, attrs, labels, &after))) {
+        fprintf(fpe, "ERROR: Failed to tag the development data.\n");
+        goto force_exit;
+    }
+
+    fprintf(fpo, "%-20s %12s %12s %12s\n", "", "original", "reduced", "change");
+    fprintf(fpo, "%-20s %12.4f %12.4f %+12.4f\n", "Item accuracy",
+        before.item_accuracy, after.item_accuracy, after.item_accuracy - before.item_accuracy);
+    fprintf(fpo, "%-20s %12.4f %12.4f %+12.4f\n", "Instance accuracy",
+        before.inst_accuracy, after.inst_accuracy, after.inst_accuracy - before.inst_accuracy);
+    fprintf(fpo, "%-20s %12.3f %12.3f %+12.3f\n", "Paths per item",
+        before.paths_per_item, after.paths_per_item, after.paths_per_item - before.paths_per_item);
+    fprintf(fpo, "%-20s %12.3f %12.3f %+12.3f\n", "Seconds",
+        before.seconds, after.seconds, after.seconds - before.seconds);
+
+force_exit:
+    binary_data_finish(&bin, &data);
+    crf_data_finish(&data);
+    SAFE_RELEASE(reduced);
+    SAFE_RELEASE(model);
+    SAFE_RELEASE(labels);
+    SAFE_RELEASE(attrs);
+    reduce_option_finish(&opt);
+    return ret;
+}
@@ -40,12 +40,14 @@
 #include <crfsuite.h>
 #include "option.h"
 #include "iwa.h"
+#include "readdata.h"
 
 #define    SAFE_RELEASE(obj)    if ((obj) != NULL) { (obj)->release(obj); (obj) = NULL; }
 
 typedef struct {
     char *input;
     char *model;
+    char *prewarm;
     int evaluate;
     int quiet;
     int reference;
@@ -83,6 +85,7 @@ static void tagger_option_finish(tagger_option_t* opt)
 
     free(opt->input);
     free(opt->model);
+    free(opt->prewarm);
     for (i = 0;i < opt->num_params;++i) {
         free(opt->params[i]);
     }
@@ -95,6 +98,10 @@ BEGIN_OPTION_MAP(parse_tagger_options, tagger_option_t)
         free(opt->model);
         opt->model = mystrdup(arg);
 
+    ON_OPTION_WITH_ARG(SHORTOPT('w') || LONGOPT("prewarm"))
+        free(opt->prewarm);
+        opt->prewarm = mystrdup(arg);
+
     ON_OPTION(SHORTOPT('t') || LONGOPT("test"))
         opt->evaluate = 1;
 
@@ -120,9 +127,13 @@ static void show_usage(FILE *fp, const char *argv0, const char *command)
     fprintf(fp, "Assign suitable labels to the instances in the data set given by a file (DATA).\n");
     fprintf(fp, "If the argument DATA is omitted or '-', this utility reads a data from STDIN.\n");
     fprintf(fp, "Evaluate the performance of the model on labeled instances (with -t option).\n");
+    fprintf(fp, "DATA may be a data set compiled by the compile command.\n");
     fprintf(fp, "\n");
     fprintf(fp, "OPTIONS:\n");
     fprintf(fp, "    -m, --model=MODEL   Read a model from a file (MODEL)\n");
+    fprintf(fp, "    -w, --prewarm=FILE  Read the features of the attributes listed in a file\n");
+    fprintf(fp, "                        (FILE, one attribute per line) before tagging;\n");
+    fprintf(fp, "                        otherwise they are read on their first use\n");
     fprintf(fp, "    -t, --test          Report the performance of the model on the data\n");
     fprintf(fp, "    -r, --reference     Output the reference labels in the input data\n");
     fprintf(fp, "    -q, --quiet         Suppress tagging results (useful for test mode)\n");
@@ -131,8 +142,124 @@ static void show_usage(FILE *fp, const char *argv0, const char *command)
 
 
 
+#define    WRITER_SIZE    (1 << 20)
+
+/* Output buffer, written to the stream when it is full. */
+typedef struct {
+    FILE *fp;
+    char *buffer;
+    size_t size;
+    size_t max;
+} writer_t;
+
+static void writer_init(writer_t* writer, FILE *fp)
+{
+    writer->fp = fp;
+    writer->size = 0;
+    writer->buffer = (char*)malloc(WRITER_SIZE);
+    /* Without the buffer, everything is written to the stream directly. */
+    writer->max = (writer->buffer != NULL) ? WRITER_SIZE : 0;
+}
+
+static void writer_flush(writer_t* writer)
+{
+    if (0 < writer->size) {
+        fwrite(writer->buffer, 1, writer->size, writer->fp);
+        writer->size = 0;
+    }
+}
+
+static void writer_finish(writer_t* writer)
+{
+    writer_flush(writer);
+    free(writer->buffer);
+    writer->buffer = NULL;
+    writer->max = 0;
+}
+
+static void writer_write(writer_t* writer, const char *str, size_t n)
+{
+    if (writer->max - writer->size < n) {
+        writer_flush(writer);
+        if (writer->max < n) {
+            fwrite(str, 1, n, writer->fp);
+            return;
+        }
+    }
+    memcpy(writer->buffer + writer->size, str, n);
+    writer->size += n;
+}
+
+static void writer_putc(writer_t* writer, int c)
+{
+    char ch = (char)c;
+    writer_write(writer, &ch, 1);
+}
+
+
+
+/* Label strings, obtained from the dictionary once. */
 typedef struct {
-    char **array;
+    const char **strings;
+    size_t *lengths;
+    int num;
+    crf_dictionary_t *labels;
+} label_table_t;
+
+static int label_table_init(label_table_t* table, crf_dictionary_t *labels)
+{
+    int i;
+
+    memset(table, 0, sizeof(*table));
+    table->num = labels->num(labels);
+    table->strings = (const char **)calloc(table->num + 1, sizeof(char*));
+    table->lengths = (size_t*)calloc(table->num + 1, sizeof(size_t));
+    if (table->strings == NULL || table->lengths == NULL) {
+        return 1;
+    }
+    table->labels = labels;
+    for (i = 0;i < table->num;++i) {
+        labels->to_string(labels, i, &table->strings[i]);
+        if (table->strings[i] == NULL) {
+            table->strings[i] = "";
+        }
+        table->lengths[i] = strlen(table->strings[i]);
+    }
+    /* An unknown label (#L) and a label out of range are written as empty strings. */
+    table->strings[table->num] = "";
+    return 0;
+}
+
+static void label_table_finish(label_table_t* table)
+{
+    int i;
+
+    if (table->labels != NULL) {
+        for (i = 0;i < table->num;++i) {
+            table->labels->free_(table->labels, table->strings[i]);
+        }
+    }
+    free(table->strings);
+    free(table->lengths);
+    memset(table, 0, sizeof(*table));
+}
+
+static void label_table_write(const label_table_t* table, int lid, writer_t* writer)
+{
+    if (lid < 0 || table->num < lid) {
+        lid = table->num;
+    }
+    writer_write(writer, table->strings[lid], table->lengths[lid]);
+}
+
+
+
+/* Comments of the items in a sequence, copied into one buffer. */
+typedef struct {
+    char *text;
+    size_t size;
+    size_t max_size;
+    int *offsets;       /* Offsets of the comments in text, -1 for none. */
     int num;
     int max;
 } comments_t;
@@ -144,43 +271,93 @@ static void comments_init(comments_t* comments)
 
 static void comments_finish(comments_t* comments)
 {
-    int i;
-
-    for (i = 0;i < comments->num;++i) {
-        free(comments->array[i]);
-    }
-    free(comments->array);
+    free(comments->text);
+    free(comments->offsets);
     comments_init(comments);
 }
 
-static int comments_append(comments_t* comments, const char *value)
+static void comments_clear(comments_t* comments)
 {
-    int i;
+    comments->size = 0;
+    comments->num = 0;
+}
 
+static int comments_append(comments_t* comments, const char *value)
+{
     if (comments->max <= comments->num) {
-        comments->max = (comments->max + 1) * 2;
-        comments->array = realloc(comments->array, sizeof(char*) * comments->max);
-        if (comments->array == NULL) {
+        int max = (comments->max + 1) * 2;
+        int *offsets = (int*)realloc(comments->offsets, sizeof(int) * max);
+        if (offsets == NULL) {
             return 1;
         }
+        comments->offsets = offsets;
+        comments->max = max;
+    }
 
-        for (i = comments->num;i < comments->max;++i) {
-            comments->array[i] = NULL;
+    if (value != NULL) {
+        size_t n = strlen(value) + 1;
+        if (comments->max_size < comments->size + n) {
+            size_t max_size = (comments->size + n) * 2;
+            char *text = (char*)realloc(comments->text, max_size);
+            if (text == NULL) {
+                return 1;
+            }
+            comments->text = text;
+            comments->max_size = max_size;
         }
+        memcpy(comments->text + comments->size, value, n);
+        comments->offsets[comments->num++] = (int)comments->size;
+        comments->size += n;
+    } else {
+        comments->offsets[comments->num++] = -1;
     }
-
-    comments->array[comments->num++] = (value != NULL ? mystrdup(value) : NULL);
     return 0;
 }
 
 
 
+/*
+    Get a new item at the end of the sequence. The items are reused over
+    sequences, keeping their buffers for the contents and the data that
+    the tagger attaches to them.
+ */
+static crf_item_t* sequence_next_item(crf_sequence_t* inst)
+{
+    crf_item_t* item = NULL;
+
+    if (inst->max_items <= inst->num_items) {
+        int i, max = (inst->max_items + 1) * 2;
+        crf_item_t* items = (crf_item_t*)realloc(inst->items, sizeof(crf_item_t) * max);
+        if (items == NULL) {
+            return NULL;
+        }
+        for (i = inst->max_items;i < max;++i) {
+            crf_item_init(&items[i]);
+        }
+        inst->items = items;
+        inst->max_items = max;
+    }
+
+    item = &inst->items[inst->num_items];
+    item->num_contents = 0;
+    return item;
+}
+
+/* Release all the items of the sequence, including unused ones. */
+static void sequence_finish(crf_sequence_t* inst)
+{
+    inst->num_items = inst->max_items;
+    crf_sequence_finish(inst);
+}
+
+
+
 static void
 output_result(
-    FILE *fpo,
+    writer_t* writer,
     const crf_sequence_t *inst,
     crf_output_t *output,
-    crf_dictionary_t *labels,
+    const label_table_t *labels,
     comments_t* comments,
     const tagger_option_t* opt
     )
@@ -188,32 +365,25 @@ output_result(
     int i;
 
     for (i = 0;i < output->num_labels;++i) {
-        const char *label = NULL;
-
         if (opt->reference) {
-            labels->to_string(labels, inst->items[i].label, &label);
-            fprintf(fpo, "%s\t", label);
-            labels->free_(labels, label);
+            label_table_write(labels, inst->items[i].label, writer);
+            writer_putc(writer, '\t');
         }
 
-        if (output->labels[i] < labels->num(labels)) {
-            labels->to_string(labels, output->labels[i], &label);
-        }
-        else {
-            label = "";
-        }
-        fprintf(fpo, "%s", label);
-        labels->free_(labels, label);
+        label_table_write(labels, output->labels[i], writer);
 
-        if (i < comments->num && comments->array[i] != NULL) {
-            fprintf(fpo, "\t%s\n", comments->array[i]);
-        } else {
-            fprintf(fpo, "\n");
+        if (i < comments->num && 0 <= comments->offsets[i]) {
+            const char *comment = comments->text + comments->offsets[i];
+            writer_putc(writer, '\t');
+            writer_write(writer, comment, strlen(comment));
         }
+        writer_putc(writer, '\n');
     }
-    fprintf(fpo, "\n");
+    writer_putc(writer, '\n');
 }
 
+
+
 static void
 output_instance(
     FILE *fpo,
@@ -244,23 +414,82 @@ output_instance(
     
 
 
+/* Resolve the attributes listed in the file before tagging. */
+static int prewarm(tagger_option_t* opt, crf_tagger_t* tagger, crf_dictionary_t* attrs)
+{
+    int n = 0, max = 0, ret = 0;
+    int *aids = NULL;
+    char line[4096];
+    FILE *fp = NULL, *fpe = opt->fpe;
+
+    fp = fopen(opt->prewarm, "r");
+    if (fp == NULL) {
+        fprintf(fpe, "ERROR: failed to open the list of attributes,\n");
+        fprintf(fpe, "  %s\n", opt->prewarm);
+        ret = 1;
+        goto force_exit;
+    }
+
+    /* Convert the attributes into IDs, skipping those unknown to the model. */
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        int aid;
+        line[strcspn(line, "\r\n")] = 0;
+        aid = attrs->to_id(attrs, line);
+        if (aid < 0) {
+            continue;
+        }
+        if (max <= n) {
+            int *p = NULL;
+            max = (max == 0) ? 1024 : max * 2;
+            p = (int*)realloc(aids, sizeof(int) * max);
+            if (p == NULL) {
+                fprintf(fpe, "ERROR: out of memory.\n");
+                ret = 1;
+                goto force_exit;
+            }
+            aids = p;
+        }
+        aids[n++] = aid;
+    }
+
+    if (ret = tagger->prewarm(tagger, aids, n)) {
+        fprintf(fpe, "ERROR: failed to read the features of the attributes.\n");
+        goto force_exit;
+    }
+
+force_exit:
+    if (fp != NULL) {
+        fclose(fp);
+    }
+    free(aids);
+    return ret;
+}
+
 static int tag(tagger_option_t* opt, crf_model_t* model)
 {
     int N = 0, L = 0, ret = 0, lid = -1;
     clock_t clk0, clk1;
     crf_sequence_t inst;
-    crf_item_t item;
+    crf_item_t *item = NULL;
     crf_content_t cont;
     crf_output_t output;
     crf_evaluation_t eval;
-    char *comment = NULL;
+    const char *comment = NULL;
     comments_t comments;
+    label_table_t table;
+    writer_t writer;
     iwa_t* iwa = NULL;
     const iwa_token_t* token = NULL;
     crf_tagger_t *tagger = NULL;
     crf_dictionary_t *attrs = NULL, *labels = NULL;
     FILE *fp = NULL, *fpi = opt->fpi, *fpo = opt->fpo, *fpe = opt->fpe;
 
+    crf_sequence_init(&inst);
+    comments_init(&comments);
+    memset(&table, 0, sizeof(table));
+    writer_init(&writer, fpo);
+    crf_evaluation_init(&eval, 0);
+
     /* Obtain the dictionary interface representing the labels in the model. */
     if (ret = model->get_labels(model, &labels)) {
         goto force_exit;
@@ -275,11 +504,19 @@ static int tag(tagger_option_t* opt, crf_model_t* model)
     if (ret = model->get_tagger(model, &tagger)) {
         goto force_exit;
     }
+    if (opt->prewarm != NULL && (ret = prewarm(opt, tagger, attrs))) {
+        goto force_exit;
+    }
 
-    /* Initialize the objects for instance and evaluation. */
+    /* Initialize the objects for evaluation and output. */
     L = labels->num(labels);
-    crf_sequence_init(&inst);
+    crf_evaluation_finish(&eval);
     crf_evaluation_init(&eval, L);
+    if (label_table_init(&table, labels)) {
+        fprintf(fpe, "ERROR: out of memory.\n");
+        ret = 1;
+        goto force_exit;
+    }
 
     /* Open the stream for the input data. */
     fp = (strcmp(opt->input, "-") == 0) ? fpi : fopen(opt->input, "r");
@@ -298,23 +535,30 @@ static int tag(tagger_option_t* opt, crf_model_t* model)
         goto force_exit;
     }
 
-    /* Read the input data and assign labels. */
-    comments_init(&comments);
+    /*
+        Read the input data and assign labels. The items of the instance
+        are filled in place and reused for the next instance, so that no
+        memory is allocated once the buffers have grown large enough.
+     */
     clk0 = clock();
     while (token = iwa_read(iwa), token != NULL) {
         switch (token->type) {
         case IWA_BOI:
             /* Initialize an item. */
             lid = -1;
-            crf_item_init(&item);
-            free(comment);
             comment = NULL;
+            item = sequence_next_item(&inst);
+            if (item == NULL) {
+                fprintf(fpe, "ERROR: out of memory.\n");
+                ret = 1;
+                goto force_exit;
+            }
             break;
         case IWA_EOI:
             /* Append the item to the instance. */
-            crf_sequence_append(&inst, &item, lid);
+            item->label = lid;
+            ++inst.num_items;
             comments_append(&comments, comment);
-            crf_item_finish(&item);
             break;
         case IWA_ITEM:
             if (lid == -1) {
@@ -332,7 +576,7 @@ static int tag(tagger_option_t* opt, crf_model_t* model)
                     } else {
                         crf_content_set(&cont, aid, 1.0);
                     }
-                    crf_item_append_content(&item, &cont);
+                    crf_item_append_content(item, &cont);
                 }
             }
             break;
@@ -354,22 +598,22 @@ static int tag(tagger_option_t* opt, crf_model_t* model)
                 }
 
                 if (!opt->quiet) {
-                    output_result(fpo, &inst, &output, labels, &comments, opt);
+                    output_result(&writer, &inst, &output, &table, &comments, opt);
                 }
 
                 crf_output_finish(&output);
-                crf_sequence_finish(&inst);
-
-                comments_finish(&comments);
-                comments_init(&comments);
+                inst.num_items = 0;
+                comments_clear(&comments);
             }
             break;
         case IWA_COMMENT:
-            comment = mystrdup(token->comment);
+            /* The comment stays in the line buffer until the EOI token. */
+            comment = token->comment;
             break;
         }
     }
     clk1 = clock();
+    writer_flush(&writer);
 
     /* Compute the performance if specified. */
     if (opt->evaluate) {
@@ -380,6 +624,8 @@ static int tag(tagger_option_t* opt, crf_model_t* model)
     }
 
 force_exit:
+    writer_finish(&writer);
+
     /* Close the IWA parser. */
     iwa_delete(iwa);
     iwa = NULL;
@@ -390,8 +636,147 @@ force_exit:
         fp = NULL;
     }
 
-    free(comment);
-    crf_sequence_finish(&inst);
+    sequence_finish(&inst);
+    comments_finish(&comments);
+    label_table_finish(&table);
+    crf_evaluation_finish(&eval);
+
+    SAFE_RELEASE(tagger);
+    SAFE_RELEASE(attrs);
+    SAFE_RELEASE(labels);
+
+    return ret;
+}
+
+static int tag_binary(tagger_option_t* opt, crf_model_t* model)
+{
+    int i, t, N = 0, L = 0, ret = 0;
+    clock_t clk0, clk1;
+    crf_sequence_t inst;
+    crf_output_t output;
+    crf_evaluation_t eval;
+    comments_t comments;
+    label_table_t table;
+    writer_t writer;
+    crf_data_t data;
+    binary_data_t bin;
+    crf_tagger_t *tagger = NULL;
+    crf_dictionary_t *attrs = NULL, *labels = NULL;
+    FILE *fpo = opt->fpo, *fpe = opt->fpe;
+
+    crf_data_init(&data);
+    binary_data_init(&bin);
+    crf_sequence_init(&inst);
+    comments_init(&comments);
+    memset(&table, 0, sizeof(table));
+    writer_init(&writer, fpo);
+    crf_evaluation_init(&eval, 0);
+
+    /* Obtain the dictionary interface representing the labels in the model. */
+    if (ret = model->get_labels(model, &labels)) {
+        goto force_exit;
+    }
+
+    /* Obtain the dictionary interface representing the attributes in the model. */
+    if (ret = model->get_attrs(model, &attrs)) {
+        goto force_exit;
+    }
+
+    /* Obtain the tagger interface. */
+    if (ret = model->get_tagger(model, &tagger)) {
+        goto force_exit;
+    }
+    if (opt->prewarm != NULL && (ret = prewarm(opt, tagger, attrs))) {
+        goto force_exit;
+    }
+
+    /* Initialize the objects for evaluation and output. */
+    L = labels->num(labels);
+    crf_evaluation_finish(&eval);
+    crf_evaluation_init(&eval, L);
+    if (label_table_init(&table, labels)) {
+        fprintf(fpe, "ERROR: out of memory.\n");
+        ret = 1;
+        goto force_exit;
+    }
+
+    /*
+        Map the compiled data set. The attribute and label IDs in the data
+        are converted to those in the model once per distinct string;
+        attributes unknown to the model are removed.
+     */
+    if (read_binary_data(&bin, opt->input, &data, attrs, labels, 0)) {
+        fprintf(fpe, "ERROR: Failed to read the compiled data,\n");
+        fprintf(fpe, "  %s\n", opt->input);
+        ret = 1;
+        goto force_exit;
+    }
+
+    /*
+        Assign labels to the instances. Each instance is tagged through
+        the items of one sequence, which borrow the contents mapped from
+        the data and keep the data that the tagger attaches to them.
+     */
+    clk0 = clock();
+    for (i = 0;i < data.num_instances;++i) {
+        const crf_sequence_t* src = &data.instances[i];
+
+        inst.num_items = 0;
+        for (t = 0;t < src->num_items;++t) {
+            crf_item_t* item = sequence_next_item(&inst);
+            if (item == NULL) {
+                fprintf(fpe, "ERROR: out of memory.\n");
+                ret = 1;
+                goto force_exit;
+            }
+            item->contents = src->items[t].contents;
+            item->num_contents = src->items[t].num_contents;
+            item->label = src->items[t].label;
+            ++inst.num_items;
+        }
+
+        /* Initialize the object to receive the tagging result. */
+        crf_output_init(&output);
+
+        /* Tag the instance. */
+        if (ret = tagger->tag(tagger, &inst, &output)) {
+            goto force_exit;
+        }
+        ++N;
+
+        /* Accumulate the tagging performance. */
+        if (opt->evaluate) {
+            crf_evaluation_accmulate(&eval, &inst, &output);
+        }
+
+        if (!opt->quiet) {
+            output_result(&writer, &inst, &output, &table, &comments, opt);
+        }
+
+        crf_output_finish(&output);
+    }
+    clk1 = clock();
+    writer_flush(&writer);
+
+    /* Compute the performance if specified. */
+    if (opt->evaluate) {
+        double sec = (clk1 - clk0) / (double)CLOCKS_PER_SEC;
+        crf_evaluation_compute(&eval);
+        crf_evaluation_output(&eval, labels, fpo);
+        fprintf(fpo, "Elapsed time: %f [sec] (%.1f [instance/sec])\n", sec, N / sec);
+    }
+
+force_exit:
+    writer_finish(&writer);
+
+    /* Return the borrowed contents before releasing the items. */
+    for (t = 0;t < inst.max_items;++t) {
+        inst.items[t].contents = NULL;
+    }
+    sequence_finish(&inst);
+    comments_finish(&comments);
+    label_table_finish(&table);
+    binary_data_finish(&bin, &data);
     crf_evaluation_finish(&eval);
 
     SAFE_RELEASE(tagger);
@@ -438,7 +823,12 @@ int main_tag(int argc, char *argv[], const char *argv0)
         }
 
         /* Tag the input data. */
-        if (ret = tag(&opt, model)) {
+        if (is_binary_data(opt.input)) {
+            ret = tag_binary(&opt, model);
+        } else {
+            ret = tag(&opt, model);
+        }
+        if (ret) {
             goto force_exit;
         }
     }
@@ -51,6 +51,8 @@ typedef double floatval_t;
 #define    strdup        _strdup
 #define    open        _open
 #define isfinite    _finite
+#define    ftello        _ftelli64
+#define    fseeko        _fseeki64
 
 #ifndef    __cplusplus
 /* Microsoft Visual C specific */
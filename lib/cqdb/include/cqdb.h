@@ -116,6 +116,20 @@ typedef struct tag_cqdb_writer cqdb_writer_t;    /**< Typedef of a CQDB writer.
  */
 cqdb_writer_t* cqdb_writer(FILE *fp, int flag);
 
+/**
+ * Reserve the memory for string/identifier associations.
+ *
+ *    This function allocates the hash elements and the reverse lookup array
+ *    for the given number of associations at once, so that putting them does
+ *    not grow the arrays one step at a time. Putting more associations than
+ *    reserved is still allowed.
+ *
+ *    @param    dbw            The pointer to the ::cqdb_writer_t instance.
+ *    @param    num            The expected number of associations.
+ *    @retval    int            Zero if successful, or a status code otherwise.
+ */
+int cqdb_writer_reserve(cqdb_writer_t* dbw, int num);
+
 /**
  * Put a string/identifier association to the database.
  *
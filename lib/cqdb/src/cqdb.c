@@ -91,22 +91,36 @@ struct tag_cqdb_writer {
     uint32_t    cur;            /**< Offset address to a new key/data pair. */
     table_t     ht[NUM_TABLES]; /**< Hash tables (string -> id). */
 
+    bucket_t*   entries;        /**< Hash elements of all tables in the order of insertion. */
+    uint32_t    num_entries;    /**< Number of hash elements. */
+    uint32_t    max_entries;    /**< Number of elements allocated for the hash elements. */
+
     uint32_t*   bwd;            /**< Backlink array. */
     uint32_t    bwd_num;        /**< */
     uint32_t    bwd_size;       /**< Number of elements in the backlink array. */
 };
 
+/**
+ * Hash table read in place from the memory block.
+ */
+typedef struct {
+    uint32_t    num;        /**< Number of elements. */
+    uint8_t*    bucket;     /**< Bucket (pairs of hash and offset values). */
+} table_view_t;
+
 /**
  * Constant quark database (CQDB).
+ *    The hash tables and the backlink array are not copied from the
+ *    memory block, so that opening a database touches only its header.
  */
 struct tag_cqdb {
     uint8_t*    buffer;         /**< Pointer to the memory block. */
     size_t      size;           /**< Size of the memory block. */
 
     header_t    header;         /**< Chunk header. */
-    table_t     ht[NUM_TABLES]; /**< Hash tables (string -> id). */
+    table_view_t ht[NUM_TABLES];/**< Hash tables (string -> id). */
 
-    uint32_t*   bwd;            /**< Array for backward look-up (id -> string). */
+    uint8_t*    bwd;            /**< Array for backward look-up (id -> string). */
 
     int         num;            /**< Number of key/data pairs. */
 };
@@ -132,6 +146,15 @@ static size_t write_data(cqdb_writer_t* wt, const void *data, size_t size)
     return fwrite(data, size, 1, wt->fp);
 }
 
+static uint8_t* encode_uint32(uint8_t* p, uint32_t value)
+{
+    p[0] = (uint8_t)(value & 0xFF);
+    p[1] = (uint8_t)(value >> 8);
+    p[2] = (uint8_t)(value >> 16);
+    p[3] = (uint8_t)(value >> 24);
+    return p + 4;
+}
+
 cqdb_writer_t* cqdb_writer(FILE *fp, int flag)
 {
     int i;
@@ -150,6 +173,10 @@ cqdb_writer_t* cqdb_writer(FILE *fp, int flag)
             dbw->ht[i].bucket = NULL;
         }
 
+        dbw->entries = NULL;
+        dbw->num_entries = 0;
+        dbw->max_entries = 0;
+
         dbw->bwd = NULL;
         dbw->bwd_num = 0;
         dbw->bwd_size = 0;
@@ -175,16 +202,52 @@ static int cqdb_writer_delete(cqdb_writer_t* dbw)
     for (i = 0;i < NUM_TABLES;++i) {
         free(dbw->ht[i].bucket);
     }
+    free(dbw->entries);
     free(dbw->bwd);
     free(dbw);
     return 0;
 }
 
+static int reserve_backlinks(cqdb_writer_t* dbw, uint32_t size)
+{
+    uint32_t* bwd = (uint32_t*)realloc(dbw->bwd, sizeof(uint32_t) * size);
+    if (bwd == NULL) {
+        return CQDB_ERROR_OUTOFMEMORY;
+    }
+    dbw->bwd = bwd;
+    while (dbw->bwd_size < size) {
+        dbw->bwd[dbw->bwd_size++] = 0;
+    }
+    return 0;
+}
+
+int cqdb_writer_reserve(cqdb_writer_t* dbw, int num)
+{
+    bucket_t* entries = NULL;
+
+    if (num <= 0 || (uint32_t)num <= dbw->max_entries) {
+        return 0;
+    }
+
+    entries = (bucket_t*)realloc(dbw->entries, sizeof(bucket_t) * num);
+    if (entries == NULL) {
+        return CQDB_ERROR_OUTOFMEMORY;
+    }
+    dbw->entries = entries;
+    dbw->max_entries = (uint32_t)num;
+
+    if (!(dbw->flag & CQDB_ONEWAY) && dbw->bwd_size < (uint32_t)num) {
+        return reserve_backlinks(dbw, (uint32_t)num);
+    }
+    return 0;
+}
+
 int cqdb_writer_put(cqdb_writer_t* dbw, const char *str, int id)
 {
     int ret = 0;
     const void *key = str;
     uint32_t ksize = (uint32_t)(strlen(str) + 1);
+    uint8_t record[256];
 
     /* Compute the hash value and choose a hash table. */
     uint32_t hv = hashlittle(key, ksize, 0);
@@ -196,28 +259,32 @@ int cqdb_writer_put(cqdb_writer_t* dbw, const char *str, int id)
         goto error_exit;
     }
 
-    /* Write out the current data. */
-    write_uint32(dbw, (uint32_t)id);
-    write_uint32(dbw, (uint32_t)ksize);
-    write_data(dbw, key, ksize);
+    /* Write out the current data, in one piece if the key is short. */
+    encode_uint32(record, (uint32_t)id);
+    encode_uint32(record + 4, (uint32_t)ksize);
+    if (ksize <= sizeof(record) - 8) {
+        memcpy(record + 8, key, ksize);
+        write_data(dbw, record, 8 + ksize);
+    } else {
+        write_data(dbw, record, 8);
+        write_data(dbw, key, ksize);
+    }
     if (ferror(dbw->fp)) {
         ret = CQDB_ERROR_FILEWRITE;
         goto error_exit;
     }
 
-    /* Expand the bucket if necessary. */
-    if (ht->size <= ht->num) {
-        ht->size = (ht->size+1) * 2;
-        ht->bucket = (bucket_t*)realloc(ht->bucket, sizeof(bucket_t) * ht->size);
-        if (ht->bucket == NULL) {
-            ret = CQDB_ERROR_OUTOFMEMORY;
+    /* Expand the hash elements if necessary. */
+    if (dbw->max_entries <= dbw->num_entries) {
+        if (ret = cqdb_writer_reserve(dbw, (dbw->max_entries + 1) * 2)) {
             goto error_exit;
         }
     }
 
     /* Set the hash value and current offset position. */
-    ht->bucket[ht->num].hash = hv;
-    ht->bucket[ht->num].offset = dbw->cur;
+    dbw->entries[dbw->num_entries].hash = hv;
+    dbw->entries[dbw->num_entries].offset = dbw->cur;
+    ++dbw->num_entries;
     ++ht->num;
 
     /* Store the backlink if specified. */
@@ -227,14 +294,9 @@ int cqdb_writer_put(cqdb_writer_t* dbw, const char *str, int id)
             uint32_t size = dbw->bwd_size;
 
             while (size <= (uint32_t)id) size = (size + 1) * 2;
-            dbw->bwd = (uint32_t*)realloc(dbw->bwd, sizeof(uint32_t) * size);
-            if (dbw->bwd == NULL) {
-                ret = CQDB_ERROR_OUTOFMEMORY;
+            if (ret = reserve_backlinks(dbw, size)) {
                 goto error_exit;
             }
-            while (dbw->bwd_size < size) {
-                dbw->bwd[dbw->bwd_size++] = 0;
-            }
         }
 
         if (dbw->bwd_num <= (uint32_t)id) {
@@ -255,10 +317,13 @@ error_exit:
 
 int cqdb_writer_close(cqdb_writer_t* dbw)
 {
-    uint32_t i, j;
+    uint32_t i, j, n, max_num = 0;
     int k, ret = 0;
     long offset = 0;
     header_t header;
+    uint32_t begins[NUM_TABLES+1];
+    bucket_t *sorted = NULL, *dst = NULL;
+    uint8_t *buffer = NULL;
 
     /* If an error have occurred, just free the memory blocks. */
     if (dbw->flag & CQDB_ERROR_OCCURRED) {
@@ -268,38 +333,54 @@ int cqdb_writer_close(cqdb_writer_t* dbw)
 
     /* Initialize the file header. */
     strncpy((char*)header.chunkid, CHUNKID, 4);
+    header.flag = dbw->flag;
     header.byteorder = BYTEORDER_CHECK;
     header.bwd_offset = 0;
     header.bwd_size = dbw->bwd_num;
 
+    /*
+        Group the hash elements by hash tables, keeping the order of
+        insertion in each table.
+     */
+    begins[0] = 0;
+    for (i = 0;i < NUM_TABLES;++i) {
+        begins[i+1] = begins[i] + dbw->ht[i].num;
+        if (max_num < dbw->ht[i].num) max_num = dbw->ht[i].num;
+    }
+    sorted = (bucket_t*)malloc(sizeof(bucket_t) * (dbw->num_entries + 1));
+    dst = (bucket_t*)malloc(sizeof(bucket_t) * (max_num * 2 + 1));
+    buffer = (uint8_t*)malloc(sizeof(bucket_t) * (max_num * 2 + 1));
+    if (sorted == NULL || dst == NULL || buffer == NULL) {
+        ret = CQDB_ERROR_OUTOFMEMORY;
+        goto error_exit;
+    }
+    for (j = 0;j < dbw->num_entries;++j) {
+        sorted[begins[dbw->entries[j].hash % NUM_TABLES]++] = dbw->entries[j];
+    }
+
     /*
         Store the hash tables. At this moment, the file pointer refers to
         the offset succeeding the last key/data pair.
      */
     for (i = 0;i < NUM_TABLES;++i) {
-        table_t* ht = &dbw->ht[i];
+        const table_t* ht = &dbw->ht[i];
+        const bucket_t* src = sorted + begins[i] - ht->num;
+        uint8_t *p = buffer;
 
         /* Do not write empty hash tables. */
-        if (ht->bucket != NULL) {
+        if (0 < ht->num) {
             /*
                 Actual bucket will have the double size; half elements
                 in the bucket are kept empty.
              */
-            int n = ht->num * 2;
-
-            /* Allocate the bucket. */
-            bucket_t* dst = (bucket_t*)calloc(n, sizeof(bucket_t));
-            if (dst == NULL) {
-                ret = CQDB_ERROR_OUTOFMEMORY;
-                goto error_exit;
-            }
+            n = ht->num * 2;
+            memset(dst, 0, sizeof(bucket_t) * n);
 
             /*
                 Put hash elements to the bucket with the open-address method.
              */
             for (j = 0;j < ht->num;++j) {
-                const bucket_t* src = &ht->bucket[j];
-                int k = (src->hash >> 8) % n;
+                k = (src[j].hash >> 8) % n;
 
                 /* Find a vacant element. */
                 while (dst[k].offset != 0) {
@@ -307,18 +388,15 @@ int cqdb_writer_close(cqdb_writer_t* dbw)
                 }
 
                 /* Store the hash element. */
-                dst[k].hash = src->hash;
-                dst[k].offset = src->offset;
+                dst[k] = src[j];
             }
 
             /* Write the bucket. */
-            for (k = 0;k < n;++k) {
-                write_uint32(dbw, dst[k].hash);
-                write_uint32(dbw, dst[k].offset);
+            for (j = 0;j < n;++j) {
+                p = encode_uint32(p, dst[j].hash);
+                p = encode_uint32(p, dst[j].offset);
             }
-
-            /* Free the bucket. */
-            free(dst);
+            write_data(dbw, buffer, p - buffer);
         }
     }
 
@@ -328,7 +406,10 @@ int cqdb_writer_close(cqdb_writer_t* dbw)
         header.bwd_offset = ftell(dbw->fp) - dbw->begin;
         /* Store the contents of the backlink array. */
         for (i = 0;i < dbw->bwd_num;++i) {
-            write_uint32(dbw, dbw->bwd[i]);
+            encode_uint32((uint8_t*)&dbw->bwd[i], dbw->bwd[i]);
+        }
+        if (0 < dbw->bwd_num) {
+            write_data(dbw, dbw->bwd, sizeof(uint32_t) * dbw->bwd_num);
         }
     }
 
@@ -385,12 +466,18 @@ int cqdb_writer_close(cqdb_writer_t* dbw)
         goto error_exit;
     }
 
+    free(buffer);
+    free(dst);
+    free(sorted);
     cqdb_writer_delete(dbw);
     return ret;
 
 error_exit:
     /* Seek to the first position. */
     fseek(dbw->fp, dbw->begin, SEEK_SET);
+    free(buffer);
+    free(dst);
+    free(sorted);
     cqdb_writer_delete(dbw);
     return ret;
 }
@@ -416,30 +503,6 @@ static uint8_t *read_tableref(tableref_t* ref, uint8_t *p)
     return p;
 }
 
-static bucket_t* read_bucket(uint8_t* p, uint32_t num)
-{
-    uint32_t i;
-    bucket_t *bucket = (bucket_t*)calloc(num, sizeof(bucket_t));
-    for (i = 0;i < num;++i) {
-        bucket[i].hash = read_uint32(p);
-        p += sizeof(uint32_t);
-        bucket[i].offset = read_uint32(p);
-        p += sizeof(uint32_t);
-    }
-    return bucket;
-}
-
-static uint32_t* read_backward_links(uint8_t* p, uint32_t num)
-{
-    uint32_t i;
-    uint32_t *bwd = (uint32_t*)calloc(num, sizeof(uint32_t));
-    for (i = 0;i < num;++i) {
-        bwd[i] = read_uint32(p);
-        p += sizeof(uint32_t);
-    }
-    return bwd;
-}
-
 cqdb_t* cqdb_reader(void *buffer, size_t size)
 {
     int i;
@@ -496,9 +559,9 @@ cqdb_t* cqdb_reader(void *buffer, size_t size)
         for (i = 0;i < NUM_TABLES;++i) {
             tableref_t ref;
             p = read_tableref(&ref, p);
-            if (ref.offset) {
+            if (ref.offset && ref.offset < size && ref.num <= (size - ref.offset) / sizeof(bucket_t)) {
                 /* Set buckets. */
-                db->ht[i].bucket = read_bucket(db->buffer + ref.offset, ref.num);
+                db->ht[i].bucket = db->buffer + ref.offset;
                 db->ht[i].num = ref.num;
             } else {
                 /* An empty hash table. */
@@ -511,8 +574,9 @@ cqdb_t* cqdb_reader(void *buffer, size_t size)
         }
 
         /* Set the pointer to the backlink array if any. */
-        if (db->header.bwd_offset) {
-            db->bwd = read_backward_links(db->buffer + db->header.bwd_offset, db->num);
+        if (db->header.bwd_offset && db->header.bwd_offset < size &&
+            db->header.bwd_size <= (size - db->header.bwd_offset) / sizeof(uint32_t)) {
+            db->bwd = db->buffer + db->header.bwd_offset;
         } else {
             db->bwd = NULL;
         }
@@ -523,13 +587,7 @@ cqdb_t* cqdb_reader(void *buffer, size_t size)
 
 void cqdb_delete(cqdb_t* db)
 {
-    int i;
-
     if (db != NULL) {
-        for (i = 0;i < NUM_TABLES;++i) {
-            free(db->ht[i].bucket);
-        }
-        free(db->bwd);
         free(db);
     }
 }
@@ -538,18 +596,18 @@ int cqdb_to_id(cqdb_t* db, const char *str)
 {
     uint32_t hv = hashlittle(str, strlen(str)+1, 0);
     int t = hv % 256;
-    table_t* ht = &db->ht[t];
+    table_view_t* ht = &db->ht[t];
 
     if (ht->num && ht->bucket != NULL) {
         int n = ht->num;
         int k = (hv >> 8) % n;
-        bucket_t* p = NULL;
+        uint32_t offset;
 
-        while (p = &ht->bucket[k], p->offset) {
-            if (p->hash == hv) {
+        while (offset = read_uint32(ht->bucket + sizeof(bucket_t) * k + sizeof(uint32_t)), offset) {
+            if (read_uint32(ht->bucket + sizeof(bucket_t) * k) == hv) {
                 int value;
                 uint32_t ksize;
-                uint8_t *q = db->buffer + p->offset;
+                uint8_t *q = db->buffer + offset;
                 value = (int)read_uint32(q);
                 q += sizeof(uint32_t);
                 ksize = read_uint32(q);
@@ -569,7 +627,7 @@ const char* cqdb_to_string(cqdb_t* db, int id)
 {
     /* Check if the current database supports the backward look-up. */
     if (db->bwd != NULL && (uint32_t)id < db->header.bwd_size) {
-        uint32_t offset = db->bwd[id];
+        uint32_t offset = read_uint32(db->bwd + sizeof(uint32_t) * id);
         if (offset) {
             uint8_t *p = db->buffer + offset;
             p += sizeof(uint32_t);  /* Skip key data. */
@@ -56,6 +56,9 @@ typedef struct tag_crf_dictionary crf_dictionary_t;
 struct tag_crf_params;
 typedef struct tag_crf_params crf_params_t;
 
+struct tag_crf_model_handle;
+typedef struct tag_crf_model_handle crf_model_handle_t;
+
 enum {
     CRF_SUCCESS = 0,
     CRFERR_UNKNOWN = 0x80000000,
@@ -96,6 +99,7 @@ typedef struct {
     int            max_items;    /**< Maximum number of items (internal use). */
     crf_item_t*    items;        /**< Array of the items. */
     int            max_paths;    /* preprocessed data */
+    int            num_paths;    /* preprocessed data: total number of paths over the items */
 } crf_sequence_t;
 
 /**
@@ -176,10 +180,32 @@ struct tag_crf_model {
      */
     int (*release)(crf_model_t* model);
 
+    /**
+     * Create a tagger for the model.
+     *    Every call creates a new tagger, which keeps a reference to the
+     *    model until it is released. A tagger must not be used by two
+     *    threads at a time; taggers of the same model may.
+     */
     int (*get_tagger)(crf_model_t* model, crf_tagger_t** ptr_tagger);
     int (*get_labels)(crf_model_t* model, crf_dictionary_t** ptr_labels);
     int (*get_attrs)(crf_model_t* model, crf_dictionary_t** ptr_attrs);
     int (*dump)(crf_model_t* model, FILE *fpo);
+
+    /**
+     * Write a lower-order copy of the model to a file.
+     *    Features of orders above max_order are removed unless their
+     *    absolute weights reach threshold (a non-positive threshold
+     *    removes all of them). With merge, the weight of a removed
+     *    feature is added to the feature of order max_order that has the
+     *    same attribute and the same latest labels, if any.
+     *    @param  model       The pointer to this model instance.
+     *    @param  filename    The file name of the reduced model.
+     *    @param  max_order   The maximum order of the reduced model.
+     *    @param  threshold   The absolute weight exempting a feature.
+     *    @param  merge       Nonzero to merge the removed features.
+     *    @param  fpo         The stream for the summary, or NULL.
+     */
+    int (*reduce)(crf_model_t* model, const char *filename, int max_order, floatval_t threshold, int merge, FILE *fpo);
 };
 
 
@@ -210,9 +236,22 @@ struct tag_crf_trainer {
     void (*set_message_callback)(crf_trainer_t* trainer, void* instance, crf_logging_callback cbm);
     void (*set_evaluate_callback)(crf_trainer_t* trainer, void* instance, crf_evaluate_callback cbe);
 
+    /**
+     * Add a feature.
+     *    Duplicates are merged when the features are generated for
+     *    training.
+     *    @return int         0 on success, or an error code.
+     */
     int (*add_feature)(crf_trainer_t* trainer, int attr, int order, unsigned char label_sequence[]);
     int (*train)(crf_trainer_t* trainer, void* instances, int num_instances, int num_labels, int num_attributes);
     int (*save)(crf_trainer_t* trainer, const char *filename, crf_dictionary_t* attrs, crf_dictionary_t* labels);
+
+    /**
+     * Add n features at a time.
+     *    The label sequences of the features are concatenated in
+     *    label_sequences, orders[i] labels for the i-th feature.
+     */
+    int (*add_features)(crf_trainer_t* trainer, int n, const int *attrs, const int *orders, const unsigned char *label_sequences);
 };
 
 struct tag_crf_tagger {
@@ -241,6 +280,106 @@ struct tag_crf_tagger {
      */
     int (*tag)(crf_tagger_t* tagger, crf_sequence_t *inst, crf_output_t* output);
 
+    /**
+     * Resolve attributes in advance.
+     *    The tagger reads the features of an attribute from the model
+     *    on its first use; this function does so for attributes that
+     *    are expected to be used, keeping the first tag calls fast.
+     *    @param  tagger      The pointer to this tagger instance.
+     *    @param  aids        The array of attribute IDs.
+     *    @param  n           The number of attribute IDs.
+     */
+    int (*prewarm)(crf_tagger_t* tagger, const int *aids, int n);
+
+    /**
+     * Tag a batch of sequences given by flat arrays.
+     *    The items of the sequence #s are the items in the range
+     *    [seq_offsets[s], seq_offsets[s+1]), and the attributes of the
+     *    item #i are the ones in the range [item_offsets[i],
+     *    item_offsets[i+1]) of the arrays aids and scales. Attribute IDs
+     *    out of the range of the model (e.g., -1 for unknown attributes)
+     *    are ignored. The sequences are tagged by the given number of
+     *    threads. The attributes of the batch are resolved once by the
+     *    calling thread and shared by all threads; each thread only has
+     *    a context, a preprocessor and the buffers of the longest sequence
+     *    it tagged, all of which are kept in the tagger for later calls.
+     *    @param  tagger      The pointer to this tagger instance.
+     *    @param  num_sequences   The number of sequences.
+     *    @param  seq_offsets The array of num_sequences+1 item offsets.
+     *    @param  item_offsets    The array of attribute offsets, one more
+     *                        than the number of items.
+     *    @param  aids        The array of attribute IDs.
+     *    @param  scales      The array of attribute scales, or \c NULL
+     *                        for scales of 1.
+     *    @param  num_threads The number of threads.
+     *    @param  labels      The array receiving the label IDs, one for
+     *                        each item.
+     *    @param  scores      The array receiving the scores, one for each
+     *                        sequence, or \c NULL.
+     */
+    int (*tag_batch)(crf_tagger_t* tagger, int num_sequences, const int *seq_offsets, const int *item_offsets, const int *aids, const floatval_t *scales, int num_threads, int *labels, floatval_t *scores);
+
+};
+
+/**
+ * Handle of a model that is replaced while it is in use.
+ *    A thread obtains the current model with get_model() and uses it
+ *    (its dictionaries and taggers) until it releases the model. Another
+ *    thread may read a new model with reload() in the meantime; the
+ *    calls that start after the swap get the new model, and the old one
+ *    is destroyed when the last reference to it is released. A worker
+ *    keeping a tagger across calls should compare the model returned by
+ *    get_model() with the one of its tagger, and replace the tagger when
+ *    they differ. This instance is created by crf_create_instance()
+ *    with the interface ID "model_handle", which fails when the library
+ *    is built without thread support (neither POSIX threads nor MSVC).
+ */
+struct tag_crf_model_handle {
+    /**
+     * Pointer to the instance data (internal use only).
+     */
+    void *internal;
+
+    /**
+     * Reference counter (internal use only).
+     */
+    int nref;
+
+    /**
+     * Increment the reference counter.
+     */
+    int (*addref)(crf_model_handle_t* handle);
+
+    /**
+     * Decrement the reference counter.
+     */
+    int (*release)(crf_model_handle_t* handle);
+
+    /**
+     * Obtain the current model.
+     *    The caller must release the model after use.
+     *    @param  handle      The pointer to this handle instance.
+     *    @param  ptr_model   The pointer that receives the model.
+     *    @return int         CRFERR_INTERNAL_LOGIC if no model is set.
+     */
+    int (*get_model)(crf_model_handle_t* handle, crf_model_t** ptr_model);
+
+    /**
+     * Replace the current model with a model (which may be NULL).
+     *    The handle keeps a reference to the model.
+     *    @param  handle      The pointer to this handle instance.
+     *    @param  model       The model.
+     */
+    int (*set_model)(crf_model_handle_t* handle, crf_model_t* model);
+
+    /**
+     * Read a model from a file and replace the current model with it.
+     *    The model is read in the calling thread; the current model is
+     *    kept when the file cannot be read.
+     *    @param  handle      The pointer to this handle instance.
+     *    @param  filename    The file name of the model.
+     */
+    int (*reload)(crf_model_handle_t* handle, const char *filename);
 };
 
 struct tag_crf_dictionary {
@@ -269,6 +408,13 @@ struct tag_crf_dictionary {
     int (*to_string)(crf_dictionary_t* dic, int id, char const **pstr);
     int (*num)(crf_dictionary_t* dic);
     void (*free_)(crf_dictionary_t* dic, const char *str);
+
+    /**
+     * Obtain the IDs of n strings at a time, registering unknown ones.
+     *    The IDs are assigned in the order of the strings, as calling
+     *    get() for each string would do.
+     */
+    int (*get_many)(crf_dictionary_t* dic, const char **strs, int n, int *ids);
 };
 
 struct tag_crf_params {
@@ -37,17 +37,23 @@
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef  _MSC_VER
+#include <windows.h>
+#endif/*_MSC_VER*/
+
 #include <crfsuite.h>
 
 int crfvol_create_instance(const char *iid, void **ptr);
 int crf_dictionary_create_instance(const char *interface, void **ptr);
+int crf_model_handle_create_instance(const char *interface, void **ptr);
 int crfvo_create_instance_from_file(const char *filename, void **ptr);
 
 int crf_create_instance(const char *iid, void **ptr)
 {
     int ret = 
         crfvol_create_instance(iid, ptr) == 0 ||
-        crf_dictionary_create_instance(iid, ptr) == 0;
+        crf_dictionary_create_instance(iid, ptr) == 0 ||
+        crf_model_handle_create_instance(iid, ptr) == 0;
 
     return ret;
 }
@@ -104,7 +110,11 @@ void crf_item_init_n(crf_item_t* item, int num_contents)
 void crf_item_finish(crf_item_t* item)
 {
     free(item->contents);
-    free(item->preprocessed_data);
+    if (item->preprocessed_data_delete_func != NULL) {
+        item->preprocessed_data_delete_func(item->preprocessed_data);
+    } else {
+        free(item->preprocessed_data);
+    }
     crf_item_init(item);
 }
 
@@ -499,12 +509,28 @@ void crf_evaluation_output(crf_evaluation_t* eval, crf_dictionary_t* labels, FIL
         );
 }
 
+/*
+    The reference counters are shared by threads that tag with a model
+    while another thread swaps it (see handle.c).
+ */
 int crf_interlocked_increment(int *count)
 {
+#if     defined(_MSC_VER)
+    return (int)InterlockedIncrement((volatile LONG*)count);
+#elif   defined(__GNUC__)
+    return __sync_add_and_fetch(count, 1);
+#else
     return ++(*count);
+#endif
 }
 
 int crf_interlocked_decrement(int *count)
 {
+#if     defined(_MSC_VER)
+    return (int)InterlockedDecrement((volatile LONG*)count);
+#elif   defined(__GNUC__)
+    return __sync_sub_and_fetch(count, 1);
+#else
     return --(*count);
+#endif
 }
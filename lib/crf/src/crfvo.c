@@ -42,6 +42,7 @@
 
 #include <crfsuite.h>
 #include "params.h"
+#include "parallel.h"
 
 #include "logging.h"
 #include "crfvo.h"
@@ -59,9 +60,29 @@ typedef struct {
 
     crf_dictionary_t*    attrs;
     crf_dictionary_t*    labels;
-    crf_tagger_t*        tagger;
 } model_internal_t;
 
+typedef struct {
+    crfvot_t*    crfvot;
+    crf_model_t* model;     /* The model, referenced while the tagger lives. */
+    crfvot_t**   workers;   /* Taggers for the other threads of tag_batch(). */
+    int*         rets;      /* Return values of the threads. */
+    int          num_workers;
+} tagger_internal_t;
+
+typedef struct {
+    tagger_internal_t* ti;
+    int num_sequences;
+    const int *seq_offsets;
+    const int *item_offsets;
+    const int *aids;
+    const floatval_t *scales;
+    int *labels;
+    floatval_t *scores;
+    int *rets;
+    int next;               /* The number of sequences taken by the threads. */
+} batch_t;
+
 /*
  *    Implementation of crf_dictionary_t object representing attributes.
  *    This object is instantiated only by a crf_model_t object.
@@ -83,6 +104,11 @@ static int model_attrs_get(crf_dictionary_t* dic, const char *str)
     return CRFERR_NOTSUPPORTED;    /* This object is ready only. */
 }
 
+static int model_attrs_get_many(crf_dictionary_t* dic, const char **strs, int n, int *ids)
+{
+    return CRFERR_NOTSUPPORTED;    /* This object is ready only. */
+}
+
 static int model_attrs_to_id(crf_dictionary_t* dic, const char *str)
 {
     crfvom_t *crfvom = (crfvom_t*)dic->internal;
@@ -132,6 +158,11 @@ static int model_labels_get(crf_dictionary_t* dic, const char *str)
     return CRFERR_NOTSUPPORTED;    /* This object is ready only. */
 }
 
+static int model_labels_get_many(crf_dictionary_t* dic, const char **strs, int n, int *ids)
+{
+    return CRFERR_NOTSUPPORTED;    /* This object is ready only. */
+}
+
 static int model_labels_to_id(crf_dictionary_t* dic, const char *str)
 {
     crfvom_t *crfvom = (crfvom_t*)dic->internal;
@@ -158,6 +189,10 @@ static void model_labels_free(crf_dictionary_t* dic, const char *str)
 }
 
 
+/*
+ *    Implementation of crf_tagger_t object.
+ *    This object is instantiated by crf_model_t::get_tagger() function.
+ */
 
 static int tagger_addref(crf_tagger_t* tagger)
 {
@@ -166,14 +201,148 @@ static int tagger_addref(crf_tagger_t* tagger)
 
 static int tagger_release(crf_tagger_t* tagger)
 {
-    /* This object is released only by the crf_model_t object. */
-    return crf_interlocked_decrement(&tagger->nref);
+    int count = crf_interlocked_decrement(&tagger->nref);
+    if (count == 0) {
+        /* This instance is being destroyed. */
+        int i;
+        tagger_internal_t* internal = (tagger_internal_t*)tagger->internal;
+        for (i = 0;i < internal->num_workers;++i) {
+            crfvot_delete(internal->workers[i]);
+        }
+        free(internal->workers);
+        free(internal->rets);
+        crfvot_delete(internal->crfvot);
+        internal->model->release(internal->model);
+        free(internal);
+        free(tagger);
+    }
+    return count;
 }
 
 static int tagger_tag(crf_tagger_t* tagger, crf_sequence_t *inst, crf_output_t* output)
 {
-    crfvot_t* crfvot = (crfvot_t*)tagger->internal;
-    crfvot_tag(crfvot, inst, output);
+    tagger_internal_t* internal = (tagger_internal_t*)tagger->internal;
+    return crfvot_tag(internal->crfvot, inst, output);
+}
+
+static int tagger_prewarm(crf_tagger_t* tagger, const int *aids, int n)
+{
+    tagger_internal_t* internal = (tagger_internal_t*)tagger->internal;
+    return crfvot_prewarm(internal->crfvot, aids, n);
+}
+
+/*
+    Each thread tags the sequences it takes one at a time, so that threads
+    finishing short sequences take over the remaining ones.
+ */
+static void tag_batch_task(void *instance, int i)
+{
+    int s, begin, ret = 0;
+    floatval_t score;
+    batch_t* batch = (batch_t*)instance;
+    crfvot_t* crfvot = (i == 0) ? batch->ti->crfvot : batch->ti->workers[i-1];
+
+    for (;;) {
+        s = crf_interlocked_increment(&batch->next) - 1;
+        if (batch->num_sequences <= s) {
+            break;
+        }
+        begin = batch->seq_offsets[s];
+        if (ret = crfvot_tag_items(
+            crfvot,
+            batch->seq_offsets[s+1] - begin,
+            &batch->item_offsets[begin],
+            batch->aids,
+            batch->scales,
+            &batch->labels[begin],
+            &score
+            )) {
+            break;
+        }
+        if (batch->scores != NULL) {
+            batch->scores[s] = score;
+        }
+    }
+    batch->rets[i] = ret;
+}
+
+static int tagger_tag_batch(
+    crf_tagger_t* tagger,
+    int num_sequences,
+    const int *seq_offsets,
+    const int *item_offsets,
+    const int *aids,
+    const floatval_t *scales,
+    int num_threads,
+    int *labels,
+    floatval_t *scores
+    )
+{
+    int i, ret = 0;
+    batch_t batch;
+    tagger_internal_t* internal = (tagger_internal_t*)tagger->internal;
+
+    if (num_sequences < num_threads) num_threads = num_sequences;
+    if (num_threads < 1) num_threads = 1;
+
+    /*
+        Create the taggers for additional threads; they are kept for later
+        calls, and share the attributes resolved by the tagger.
+     */
+    if (internal->num_workers < num_threads - 1) {
+        crfvot_t** workers = (crfvot_t**)realloc(
+            internal->workers, sizeof(crfvot_t*) * (num_threads - 1));
+        int* rets = NULL;
+        if (workers == NULL) {
+            return CRFERR_OUTOFMEMORY;
+        }
+        internal->workers = workers;
+        rets = (int*)realloc(internal->rets, sizeof(int) * num_threads);
+        if (rets == NULL) {
+            return CRFERR_OUTOFMEMORY;
+        }
+        internal->rets = rets;
+        while (internal->num_workers < num_threads - 1) {
+            crfvot_t* crfvot = crfvot_new_worker(internal->crfvot);
+            if (crfvot == NULL) {
+                return CRFERR_OUTOFMEMORY;
+            }
+            workers[internal->num_workers++] = crfvot;
+        }
+    }
+
+    batch.ti = internal;
+    batch.num_sequences = num_sequences;
+    batch.seq_offsets = seq_offsets;
+    batch.item_offsets = item_offsets;
+    batch.aids = aids;
+    batch.scales = scales;
+    batch.labels = labels;
+    batch.scores = scores;
+    batch.next = 0;
+
+    if (num_threads == 1) {
+        batch.rets = &ret;
+        tag_batch_task(&batch, 0);
+        return ret;
+    }
+
+    /* Resolve the attributes of the batch once, before the workers read them. */
+    if (ret = crfvot_prewarm(
+        internal->crfvot,
+        &aids[item_offsets[seq_offsets[0]]],
+        item_offsets[seq_offsets[num_sequences]] - item_offsets[seq_offsets[0]]
+        )) {
+        return ret;
+    }
+
+    batch.rets = internal->rets;
+    parallel_run(num_threads, tag_batch_task, &batch);
+    for (i = 0;i < num_threads;++i) {
+        if (internal->rets[i] != 0) {
+            return internal->rets[i];
+        }
+    }
     return 0;
 }
 
@@ -193,8 +362,6 @@ static int model_release(crf_model_t* model)
     if (count == 0) {
         /* This instance is being destroyed. */
         model_internal_t* internal = (model_internal_t*)model->internal;
-        crfvot_delete((crfvot_t*)internal->tagger->internal);
-        free(internal->tagger);
         free(internal->labels);
         free(internal->attrs);
         crfvom_close(internal->crfvom);
@@ -204,14 +371,43 @@ static int model_release(crf_model_t* model)
     return count;
 }
 
+/*
+    Each call creates a tagger with a context of its own, which keeps a
+    reference to the model until the tagger is released.
+ */
 static int model_get_tagger(crf_model_t* model, crf_tagger_t** ptr_tagger)
 {
     model_internal_t* internal = (model_internal_t*)model->internal;
-    crf_tagger_t* tagger = internal->tagger;
+    tagger_internal_t* ti = NULL;
+    crf_tagger_t* tagger = NULL;
+
+    *ptr_tagger = NULL;
+    tagger = (crf_tagger_t*)calloc(1, sizeof(crf_tagger_t));
+    ti = (tagger_internal_t*)calloc(1, sizeof(tagger_internal_t));
+    if (tagger == NULL || ti == NULL) {
+        goto error_exit;
+    }
+    ti->crfvot = crfvot_new(internal->crfvom);
+    if (ti->crfvot == NULL) {
+        goto error_exit;
+    }
+    ti->model = model;
+    model->addref(model);
 
-    tagger->addref(tagger);
+    tagger->internal = ti;
+    tagger->nref = 1;
+    tagger->addref = tagger_addref;
+    tagger->release = tagger_release;
+    tagger->tag = tagger_tag;
+    tagger->prewarm = tagger_prewarm;
+    tagger->tag_batch = tagger_tag_batch;
     *ptr_tagger = tagger;
     return 0;
+
+error_exit:
+    free(ti);
+    free(tagger);
+    return CRFERR_OUTOFMEMORY;
 }
 
 static int model_get_labels(crf_model_t* model, crf_dictionary_t** ptr_labels)
@@ -241,14 +437,18 @@ static int model_dump(crf_model_t* model, FILE *fpo)
     return 0;
 }
 
+static int model_reduce(crf_model_t* model, const char *filename, int max_order, floatval_t threshold, int merge, FILE *fpo)
+{
+    model_internal_t* internal = (model_internal_t*)model->internal;
+    return crfvom_reduce(internal->crfvom, filename, max_order, threshold, merge, fpo);
+}
+
 int crfvo_model_create(const char *filename, crf_model_t** ptr_model)
 {
     int ret = 0;
     crfvom_t *crfvom = NULL;
-    crfvot_t *crfvot = NULL;
     crf_model_t *model = NULL;
     model_internal_t *internal = NULL;
-    crf_tagger_t *tagger = NULL;
     crf_dictionary_t *attrs = NULL, *labels = NULL;
 
     *ptr_model = NULL;
@@ -260,13 +460,6 @@ int crfvo_model_create(const char *filename, crf_model_t** ptr_model)
         goto error_exit;
     }
 
-    /* Construct a tagger based on the model. */
-    crfvot = crfvot_new(crfvom);
-    if (crfvot == NULL) {
-        ret = CRFERR_OUTOFMEMORY;
-        goto error_exit;
-    }
-
     /* Create an instance of internal data attached to the model. */
     internal = (model_internal_t*)calloc(1, sizeof(model_internal_t));
     if (internal == NULL) {
@@ -288,6 +481,7 @@ int crfvo_model_create(const char *filename, crf_model_t** ptr_model)
     attrs->to_string = model_attrs_to_string;
     attrs->num = model_attrs_num;
     attrs->free_ = model_attrs_free;
+    attrs->get_many = model_attrs_get_many;
 
     /* Create an instance of dictionary object for labels. */
     labels = (crf_dictionary_t*)calloc(1, sizeof(crf_dictionary_t));
@@ -303,24 +497,12 @@ int crfvo_model_create(const char *filename, crf_model_t** ptr_model)
     labels->to_string = model_labels_to_string;
     labels->num = model_labels_num;
     labels->free_ = model_labels_free;
-
-    /* */
-    /* Create an instance of tagger object. */
-    tagger = (crf_tagger_t*)calloc(1, sizeof(crf_tagger_t));
-    if (tagger == NULL) {
-        ret = CRFERR_OUTOFMEMORY;
-        goto error_exit;
-    }
-    tagger->internal = crfvot;
-    tagger->addref = tagger_addref;
-    tagger->release = tagger_release;
-    tagger->tag = tagger_tag;
+    labels->get_many = model_labels_get_many;
 
     /* Set the internal data. */
     internal->crfvom = crfvom;
     internal->attrs = attrs;
     internal->labels = labels;
-    internal->tagger = tagger;
 
     /* Create an instance of model object. */
     model = (crf_model_t*)calloc(1, sizeof(crf_model_t));
@@ -336,16 +518,17 @@ int crfvo_model_create(const char *filename, crf_model_t** ptr_model)
     model->get_labels = model_get_labels;
     model->get_tagger = model_get_tagger;
     model->dump = model_dump;
+    model->reduce = model_reduce;
 
     *ptr_model = model;
     return 0;
 
 error_exit:
-    free(tagger);
     free(labels);
     free(attrs);
-    crfvot_delete(crfvot);
-    crfvom_close(crfvom);
+    if (crfvom != NULL) {
+        crfvom_close(crfvom);
+    }
     free(internal);
     free(model);
     return ret;
@@ -39,6 +39,20 @@
 
 #define MAX_ORDER 8
 
+/*
+    Feature index. Configuring with --enable-large-models (which defines
+    CRFVO_LARGE) makes it 64-bit so that a trainer and a tagger can handle
+    2^31 features or more, at the cost of four more bytes for every
+    feature reference held in memory.
+ */
+#ifdef  CRFVO_LARGE
+typedef int64_t fid_t;
+#define FID_MAX INT64_MAX
+#else
+typedef int32_t fid_t;
+#define FID_MAX INT32_MAX
+#endif/*CRFVO_LARGE*/
+
 typedef struct {
     int    prev_path_index;
     int    longest_suffix_index;
@@ -61,9 +75,28 @@ typedef struct {
     int*               num_paths_by_label;
     int                training_path_index;
     int                num_fids;
-    int*               fids;
+    fid_t*             fids;
+    int                max_paths;   /**< Number of allocated paths. */
+    int                max_fids;    /**< Number of allocated feature ids. */
 } crfvopd_t;
 
+/**
+ * Vector kernels used by crfvoc_decode().
+ *    The maxima are never less than zero and skip NaNs.
+ */
+typedef struct {
+    /** dst[i] = x[i] * y[i] for i in [0, n); returns the maximum of dst. */
+    floatval_t (*mul_max)(floatval_t* dst, const floatval_t* x, const floatval_t* y, int n);
+    /** x[i] *= s for i in [0, n). */
+    void (*scale)(floatval_t* x, floatval_t s, int n);
+    /** Returns the maximum of x[0, n). */
+    floatval_t (*max)(const floatval_t* x, int n);
+    const char *name;
+} crfvo_viterbi_kernels_t;
+
+/* crfvo_viterbi.c */
+const crfvo_viterbi_kernels_t* crfvo_viterbi_kernels();
+
 /**
  * CRF context. 
  */
@@ -96,10 +129,24 @@ typedef struct {
     crfvo_path_score_t** path_scores; /* alpha -> alpha * beta -> sigma */
     int*  num_paths;
     int*  training_path_indexes;
+    int*  best_path_indexes; /* paths of the last Viterbi decoding */
     int** num_paths_by_label;
-    int** fids_refs;
+    fid_t** fids_refs;
     floatval_t* cur_temp_scores;  /* beta * W (backward) */
     floatval_t* prev_temp_scores; /* gamma (forward) / delta (backward) */
+    floatval_t* backup_temp_scores; /* work space for crfvoc_decode() */
+    int*  real_path_indexes;      /* work space for crfvoc_decode() */
+    int*  identity_indexes;       /* 0, 1, 2, ... */
+    int*  suffix_indexes;         /* longest suffixes of the previous paths */
+    floatval_t* path_weights;     /* exp_weight of the current paths */
+    const crfvo_viterbi_kernels_t* kernels;
+
+    /**
+     * Nonzero to have crfvoc_decode() store the log of the best score
+     *    of each path in path_scores[t][i].score.
+     */
+    int viterbi_scores;
+
     /**
      * The normalize factor for the input sequence.
      *    This is equivalent to the total scores of all paths from BOS to
@@ -120,9 +167,12 @@ int crfvoc_set_num_items(crfvo_context_t* ctx, int T, int max_paths);
 void crfvoc_set_context(crfvo_context_t* ctx, const crf_sequence_t* seq);
 void crfvoc_delete(crfvo_context_t* ctx);
 void crfvoc_set_weight(crfvo_context_t* ctx, const floatval_t* exp_weight);
+void crfvoc_calc_norm(crfvo_context_t* ctx);
 void crfvoc_calc_feature_expectations(crfvo_context_t* ctx);
+floatval_t crfvoc_calc_local_expectations(crfvo_context_t* ctx, const floatval_t* exp_weight);
 floatval_t crfvoc_logprob(crfvo_context_t* ctx);
 floatval_t crfvoc_decode(crfvo_context_t* ctx);
+void crfvoc_augment_loss(crfvo_context_t* ctx, floatval_t loss);
 void crfvoc_debug_context(crfvo_context_t* ctx, FILE *fp);
 void crfvoc_test_context(FILE *fp);
 
@@ -156,7 +206,7 @@ typedef struct {
  * Feature set.
  */
 typedef struct {
-    int                    num_features;    /**< Number of features. */
+    fid_t                num_features;    /**< Number of features. */
     crfvol_feature_t*    features;        /**< Array of features. */
 } crfvol_features_t;
 
@@ -168,7 +218,7 @@ void crfvol_features_delete(crfvol_features_t* features);
  */
 typedef struct {
     int        num_features;    /**< Number of features referred */
-    int*    fids;            /**< Array of feature ids */
+    fid_t*    fids;            /**< Array of feature ids */
 } feature_refs_t;
 
 /* Featureset. Used in the process of creating features. */
@@ -176,7 +226,8 @@ struct tag_featureset;
 typedef struct tag_featureset featureset_t;
 
 featureset_t* featureset_new();
-void featureset_generate(crfvol_features_t* features, featureset_t* set);
+int featureset_add(featureset_t* set, int n, const int *attrs, const int *orders, const unsigned char *label_sequences);
+void featureset_generate(crfvol_features_t* features, featureset_t* set, int num_threads);
 void featureset_delete(featureset_t* set);
 
 int crfvol_add_feature(
@@ -202,7 +253,13 @@ typedef struct {
 } crfvom_feature_t;
 
 crfvomw_t* crfvomw(const char *filename);
+int crfvomw_set_weight_bits(crfvomw_t* writer, int bits);
+int crfvomw_set_native(crfvomw_t* writer, int native);
+int crfvomw_set_wide(crfvomw_t* writer, int wide);
+void crfvomw_estimate_sizes(crfvomw_t* writer, int num_labels, size_t* base_size, size_t* feature_size, size_t* attr_size);
+void crfvomw_get_quantization_error(crfvomw_t* writer, floatval_t* max_error, floatval_t* rms_error);
 int crfvomw_close(crfvomw_t* writer);
+void crfvomw_discard(crfvomw_t* writer);
 int crfvomw_open_labels(crfvomw_t* writer, int num_labels);
 int crfvomw_close_labels(crfvomw_t* writer);
 int crfvomw_put_label(crfvomw_t* writer, int lid, const char *value);
@@ -211,26 +268,35 @@ int crfvomw_close_attrs(crfvomw_t* writer);
 int crfvomw_put_attr(crfvomw_t* writer, int aid, const char *value);
 int crfvomw_open_attrrefs(crfvomw_t* writer, int num_attrs);
 int crfvomw_close_attrrefs(crfvomw_t* writer);
-int crfvomw_put_attrref(crfvomw_t* writer, int aid, const feature_refs_t* ref, int *map);
+int crfvomw_put_attrref(crfvomw_t* writer, int aid, const feature_refs_t* ref, fid_t *map);
 int crfvomw_open_features(crfvomw_t* writer);
 int crfvomw_close_features(crfvomw_t* writer);
-int crfvomw_put_feature(crfvomw_t* writer, int fid, const crfvom_feature_t* f);
+int crfvomw_put_feature(crfvomw_t* writer, fid_t fid, const crfvom_feature_t* f);
 
 
 crfvom_t* crfvom_new(const char *filename);
 void crfvom_close(crfvom_t* model);
 int crfvom_get_num_attrs(crfvom_t* model);
 int crfvom_get_num_labels(crfvom_t* model);
-int crfvom_get_num_features(crfvom_t* model);
+fid_t crfvom_get_num_features(crfvom_t* model);
 const char *crfvom_to_label(crfvom_t* model, int lid);
 int crfvom_to_lid(crfvom_t* model, const char *value);
 int crfvom_to_aid(crfvom_t* model, const char *value);
 const char *crfvom_to_attr(crfvom_t* model, int aid);
 int crfvom_get_attrref(crfvom_t* model, int aid, feature_refs_t* ref);
-int crfvom_get_featureid(feature_refs_t* ref, int i);
-int crfvom_get_feature(crfvom_t* model, int fid, crfvom_feature_t* f);
+int crfvom_read_attrref(crfvom_t* model, int aid, feature_refs_t* ref, fid_t* fids, int max);
+fid_t crfvom_get_featureid(feature_refs_t* ref, int i);
+int crfvom_get_feature(crfvom_t* model, fid_t fid, crfvom_feature_t* f);
+int crfvom_get_features(crfvom_t* model, fid_t fid, fid_t n, crfvom_feature_t* fs);
+int crfvom_get_weight_bits(crfvom_t* model);
+int crfvom_get_wide(crfvom_t* model);
+const floatval_t* crfvom_get_exp_weights(crfvom_t* model);
+int crfvom_get_feature_labels(crfvom_t* model, const uint8_t** orders, const uint8_t** label_sequences);
 void crfvom_dump(crfvom_t* model, FILE *fp);
 
+/* crfvo_reduce.c */
+int crfvom_reduce(crfvom_t* model, const char *filename, int max_order, floatval_t threshold, int merge, FILE *fpo);
+
 
 typedef struct {
     char*        regularization;
@@ -242,34 +308,81 @@ typedef struct {
     int            max_iterations;
     char*       linesearch;
     int         linesearch_max_iterations;
+    int         linesearch_num_threads;
 } crfvol_lbfgs_option_t;
 
+typedef struct {
+    floatval_t  eta;
+    floatval_t  gamma;
+    int         period;
+    int         max_iterations;
+    floatval_t  epsilon;
+    int         stop;
+    floatval_t  delta;
+} crfvol_svrg_option_t;
+
+typedef struct {
+    floatval_t  eta;
+    floatval_t  loss;
+    int         max_iterations;
+    int         stop;
+    floatval_t  delta;
+} crfvol_ssvm_option_t;
+
+typedef struct {
+    int         max_iterations;
+    int         cg_max_iterations;
+    floatval_t  epsilon;
+    int         stop;
+    floatval_t  delta;
+    int         linesearch_max_iterations;
+    int         num_threads;
+} crfvol_newton_option_t;
+
 typedef struct {
     char*       algorithm;
+    char*       objective;
+    int         feature_num_threads;
+    int         model_weight_bits;
+    int         model_native;
+    floatval_t  model_prune_threshold;
+    int         model_max_features;
+    floatval_t  model_max_size;
+    int         model_wide;
 
     crfvol_lbfgs_option_t   lbfgs;
+    crfvol_svrg_option_t    svrg;
+    crfvol_ssvm_option_t    ssvm;
+    crfvol_newton_option_t  newton;
 } crfvol_option_t;
 
 
 /* crfvo_preprocess.c */
 crfvopd_t* crfvopd_new(int L, int num_paths, int num_fids);
+int crfvopd_reserve(crfvopd_t* pd, int num_paths, int num_fids);
 void crfvopd_delete(crfvopd_t* pp);
 
 struct tag_buffer_manager;
 typedef struct tag_buffer_manager buffer_manager_t;
+struct tag_trie;
+typedef struct tag_trie trie_t;
 
 typedef struct tag_crfvopp {
     buffer_manager_t* path_manager;
     buffer_manager_t* node_manager;
     buffer_manager_t* fid_list_manager;
+    trie_t* tries;              /**< Tries for the items (and BOS). */
+    uint8_t* label_sequence;
+    int max_items;
 } crfvopp_t;
 
 crfvopp_t* crfvopp_new();
 void crfvopp_delete(crfvopp_t* pp);
-void crfvopp_preprocess_sequence(
+int crfvopp_preprocess_sequence(
     crfvopp_t* pp,
     const feature_refs_t* attrs,
-    const crfvol_feature_t* features,
+    const uint8_t* orders,
+    const uint8_t* label_sequences,
     const int L,
     crf_sequence_t* seq);
 
@@ -297,7 +410,7 @@ struct tag_crfvol {
 
     feature_refs_t* attributes;
 
-    int num_features;            /**< Number of distinct features (K). */
+    fid_t num_features;          /**< Number of distinct features (K). */
 
     /**
      * Feature array.
@@ -306,9 +419,18 @@ struct tag_crfvol {
     crfvol_feature_t* features;
     featureset_t* featureset; /* Used in the process of creating features. */
 
+    /**
+     * Orders and label sequences (MAX_ORDER bytes each) of the features,
+     * which the preprocessor reads.
+     */
+    uint8_t* feature_orders;
+    uint8_t* feature_label_sequences;
+
     floatval_t *w;            /**< Array of w (feature weights) */
     floatval_t *exp_weight;
     floatval_t *prob;
+    floatval_t *g;            /**< Gradient vector being accumulated. */
+    int pseudo_likelihood;    /**< Non-zero to normalize each position locally. */
 
     crf_params_t* params;
     crfvol_option_t opt;
@@ -324,7 +446,7 @@ typedef struct tag_crfvol crfvol_t;
 
 typedef void (*update_feature_t)(
     crfvol_feature_t* f,
-    const int fid,
+    const fid_t fid,
     floatval_t prob,
     floatval_t scale,
     crfvol_t* trainer,
@@ -332,20 +454,37 @@ typedef void (*update_feature_t)(
     int t
     );
 
-void crfvol_preprocess(crfvol_t* trainer);
+int crfvol_preprocess(crfvol_t* trainer);
 void crfvol_enum_features(crfvol_t* trainer, const crf_sequence_t* seq, update_feature_t func, double* logp);
 void crfvol_shuffle(int *perm, int N, int init);
+floatval_t crfvol_sequence_expectations(crfvol_t* trainer, const crf_sequence_t* seq, const floatval_t* exp_weight, floatval_t* g);
+floatval_t crfvol_loglikelihood(crfvol_t* trainer, const floatval_t* w, floatval_t* g);
 
 /* crfvo_learn_lbfgs.c */
 int crfvol_lbfgs(crfvol_t* crfvot, crfvol_option_t *opt);
 int crfvol_lbfgs_options(crf_params_t* params, crfvol_option_t* opt, int mode);
 
+/* crfvo_learn_svrg.c */
+int crfvol_svrg(crfvol_t* crfvot, crfvol_option_t *opt);
+int crfvol_svrg_options(crf_params_t* params, crfvol_option_t* opt, int mode);
+
+/* crfvo_learn_ssvm.c */
+int crfvol_ssvm(crfvol_t* crfvot, crfvol_option_t *opt);
+int crfvol_ssvm_options(crf_params_t* params, crfvol_option_t* opt, int mode);
+
+/* crfvo_learn_newton.c */
+int crfvol_newton(crfvol_t* crfvot, crfvol_option_t *opt);
+int crfvol_newton_options(crf_params_t* params, crfvol_option_t* opt, int mode);
+
 /* crfvo_tag.c */
 struct tag_crfvot;
 typedef struct tag_crfvot crfvot_t;
 
 crfvot_t *crfvot_new(crfvom_t* crfvom);
+crfvot_t *crfvot_new_worker(crfvot_t* owner);
 void crfvot_delete(crfvot_t* crfvot);
 int crfvot_tag(crfvot_t* crfvot, crf_sequence_t *inst, crf_output_t* output);
+int crfvot_prewarm(crfvot_t* crfvot, const int *aids, int n);
+int crfvot_tag_items(crfvot_t* crfvot, int num_items, const int *item_offsets, const int *aids, const floatval_t *scales, int *labels, floatval_t *score);
 
 #endif/*__CRFVO_H__*/
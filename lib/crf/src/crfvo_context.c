@@ -57,6 +57,7 @@ crfvo_context_t* crfvoc_new(int L, int T, int max_paths)
         ctx->norm_significand = 0.0;
         ctx->norm_exponent = 0;
         ctx->max_paths = -1;
+        ctx->kernels = crfvo_viterbi_kernels();
 
         if (ret = crfvoc_set_num_items(ctx, T, max_paths)) {
             goto error_exit;
@@ -73,7 +74,6 @@ error_exit:
 int crfvoc_set_num_items(crfvo_context_t* ctx, int T, int max_paths)
 {
     int i;
-    const int L = ctx->num_labels;
 
     ctx->num_items = T;
     if (ctx->max_paths < max_paths) {
@@ -84,8 +84,23 @@ int crfvoc_set_num_items(crfvo_context_t* ctx, int T, int max_paths)
         }
         free(ctx->cur_temp_scores);
         free(ctx->prev_temp_scores);
+        free(ctx->backup_temp_scores);
+        free(ctx->real_path_indexes);
+        free(ctx->identity_indexes);
+        free(ctx->suffix_indexes);
+        free(ctx->path_weights);
         ctx->cur_temp_scores = (floatval_t*)calloc(max_paths, sizeof(floatval_t));
         ctx->prev_temp_scores = (floatval_t*)calloc(max_paths, sizeof(floatval_t));
+        ctx->backup_temp_scores = (floatval_t*)calloc(max_paths, sizeof(floatval_t));
+        ctx->real_path_indexes = (int*)calloc(max_paths, sizeof(int));
+        ctx->identity_indexes = (int*)calloc(max_paths, sizeof(int));
+        ctx->suffix_indexes = (int*)calloc(max_paths, sizeof(int));
+        ctx->path_weights = (floatval_t*)calloc(max_paths, sizeof(floatval_t));
+        if (ctx->cur_temp_scores == NULL || ctx->prev_temp_scores == NULL ||
+            ctx->backup_temp_scores == NULL || ctx->real_path_indexes == NULL ||
+            ctx->identity_indexes == NULL || ctx->suffix_indexes == NULL ||
+            ctx->path_weights == NULL) return CRFERR_OUTOFMEMORY;
+        for (i = 0; i < max_paths; ++i) ctx->identity_indexes[i] = i;
         ctx->max_paths = max_paths;
     }
 
@@ -97,9 +112,9 @@ int crfvoc_set_num_items(crfvo_context_t* ctx, int T, int max_paths)
         memcpy(path_scores_new, ctx->path_scores, sizeof(crfvo_path_score_t*) * (ctx->max_items));
         memcpy(num_paths_by_label_new, ctx->num_paths_by_label, sizeof(int*) * (ctx->max_items));
         for (i = ctx->max_items; i < T; ++i) {
-            path_scores_new[i] = (crfvo_path_score_t*)calloc(max_paths, sizeof(crfvo_path_score_t));
-            num_paths_by_label_new[i] = (int*)calloc(L, sizeof(int));
-            if (path_scores_new[i] == NULL || num_paths_by_label_new[i] == NULL) return CRFERR_OUTOFMEMORY;
+            path_scores_new[i] = (crfvo_path_score_t*)calloc(ctx->max_paths, sizeof(crfvo_path_score_t));
+            num_paths_by_label_new[i] = NULL;   /* Set by crfvoc_set_context(). */
+            if (path_scores_new[i] == NULL) return CRFERR_OUTOFMEMORY;
         }
         
         free(ctx->exponents);
@@ -109,16 +124,20 @@ int crfvoc_set_num_items(crfvo_context_t* ctx, int T, int max_paths)
         free(ctx->num_paths);
         free(ctx->num_paths_by_label);
         free(ctx->training_path_indexes);
+        free(ctx->best_path_indexes);
         ctx->path_scores = path_scores_new;
         ctx->num_paths_by_label = num_paths_by_label_new;
 
         ctx->labels = (int*)calloc(T, sizeof(int));
         ctx->exponents = (int*)calloc(T, sizeof(int));
-        ctx->fids_refs = (int**)calloc(T, sizeof(int*));
+        ctx->fids_refs = (fid_t**)calloc(T, sizeof(fid_t*));
         ctx->num_paths = (int*)calloc(T, sizeof(int));
         ctx->training_path_indexes = (int*)calloc(T, sizeof(int));
+        ctx->best_path_indexes = (int*)calloc(T, sizeof(int));
         if (ctx->labels == NULL || ctx->exponents == NULL ||
-            ctx->fids_refs == NULL || ctx->num_paths == NULL) return CRFERR_OUTOFMEMORY;
+            ctx->fids_refs == NULL || ctx->num_paths == NULL ||
+            ctx->training_path_indexes == NULL ||
+            ctx->best_path_indexes == NULL) return CRFERR_OUTOFMEMORY;
 
         ctx->max_items = T;
     }
@@ -154,16 +173,24 @@ void crfvoc_delete(crfvo_context_t* ctx)
 {
     if (ctx != NULL) {
         int i;
-        for (i = 0; i < ctx->max_paths; ++i) {
+        for (i = 0; i < ctx->max_items; ++i) {
             free(ctx->path_scores[i]);
         }
         free(ctx->path_scores);
+        free(ctx->num_paths_by_label);
         free(ctx->exponents);
         free(ctx->labels);
         free(ctx->fids_refs);
         free(ctx->num_paths);
+        free(ctx->training_path_indexes);
+        free(ctx->best_path_indexes);
         free(ctx->cur_temp_scores);
         free(ctx->prev_temp_scores);
+        free(ctx->backup_temp_scores);
+        free(ctx->real_path_indexes);
+        free(ctx->identity_indexes);
+        free(ctx->suffix_indexes);
+        free(ctx->path_weights);
     }
     free(ctx);
 }
@@ -182,7 +209,17 @@ floatval_t crfvoc_logprob(crfvo_context_t* ctx)
     return ret;
 }
 
-/* decoding. (forward) */
+/*
+    Decoding (forward).
+    The paths at a position are grouped by their last labels. For each
+    group, the best scores of the previous paths are carried down their
+    suffix links, from the longest paths to the path preceding each path
+    of the group; this part depends on the order of the paths and is done
+    path by path. The products with the weights of the paths and their
+    maximum are then computed over the contiguous block of the group, and
+    the scores at the position are rescaled as a whole, with the vector
+    kernels chosen for the processor.
+ */
 floatval_t crfvoc_decode(crfvo_context_t* ctx)
 {
     int T = ctx->num_items;
@@ -190,8 +227,12 @@ floatval_t crfvoc_decode(crfvo_context_t* ctx)
 
     floatval_t* prev_temp_scores = ctx->prev_temp_scores;
     floatval_t* cur_temp_scores = ctx->cur_temp_scores;
-    floatval_t* prev_temp_scores_backup = (floatval_t*)malloc(sizeof(floatval_t) * ctx->max_paths);
-    int* real_path_indexes = (int*)malloc(sizeof(int) * ctx->max_paths);
+    floatval_t* prev_temp_scores_backup = ctx->backup_temp_scores;
+    floatval_t* path_weights = ctx->path_weights;
+    int* real_path_indexes = ctx->real_path_indexes;
+    int* suffix_indexes = ctx->suffix_indexes;
+    const crfvo_viterbi_kernels_t* kernels = ctx->kernels;
+    const floatval_t ln2 = log(2.0);
 
     int exponent_diff = 0;
     int exponent_all = 0;
@@ -206,60 +247,70 @@ floatval_t crfvoc_decode(crfvo_context_t* ctx)
     prev_temp_scores[1] = 1.0;
 
     for (t = 0; t < T; ++t) {
-        int label, next_label, prev_index_start;
-        floatval_t max_score;
+        int label, begin, end, prev_index_start;
+        floatval_t max_score, block_max;
 
         crfvo_path_score_t* path_scores = ctx->path_scores[t];
         prev_n = n;
         n = ctx->num_paths[t];
         memset(cur_temp_scores, 0, sizeof(floatval_t) * n);
         memcpy(prev_temp_scores_backup, prev_temp_scores, sizeof(floatval_t) * prev_n);
-        for (i = 0; i < prev_n; ++i) real_path_indexes[i] = i;
 
-        label = L;
-        next_label = ctx->num_paths[t] - ctx->num_paths_by_label[t][L];
-        prev_index_start = prev_n;
-        max_score = 0.0;
+        /* Gather the suffix links of the previous paths and the weights. */
+        for (j = 0; j < prev_n; ++j) {
+            suffix_indexes[j] = (t > 0) ? ctx->path_scores[t-1][j].path.longest_suffix_index : 0;
+        }
+        for (i = 1; i < n; ++i) {
+            path_weights[i] = path_scores[i].exp_weight;
+        }
 
-        for (i = n-1; i > 0; --i) {
-            int prev_path_index;
-
-            while (i < next_label && label >= 0) {
-                label--;
-                next_label -= ctx->num_paths_by_label[t][label];
-                memcpy(prev_temp_scores, prev_temp_scores_backup, sizeof(floatval_t) * prev_n);
-                for (j = 0; j < prev_n; ++j) real_path_indexes[j] = j;
-                prev_index_start = prev_n;
-            }
-            if (label < 0) break;
-            prev_path_index = path_scores[i].path.prev_path_index;
-            for (j = prev_index_start-1; j > prev_path_index; --j) {
-                int longest_suffix_index = (t > 0) ? ctx->path_scores[t-1][j].path.longest_suffix_index : 0;
-                if (prev_temp_scores[j] > prev_temp_scores[longest_suffix_index]) {
-                    prev_temp_scores[longest_suffix_index] = prev_temp_scores[j];
-                    real_path_indexes[longest_suffix_index] = real_path_indexes[j];
+        max_score = 0.0;
+        end = n;
+        for (label = L; label >= 0 && 1 < end; --label) {
+            begin = end - ctx->num_paths_by_label[t][label];
+            if (begin < 1) begin = 1;
+            if (begin == end) continue;
+
+            memcpy(prev_temp_scores, prev_temp_scores_backup, sizeof(floatval_t) * prev_n);
+            memcpy(real_path_indexes, ctx->identity_indexes, sizeof(int) * prev_n);
+            prev_index_start = prev_n;
+
+            for (i = end-1; i >= begin; --i) {
+                int prev_path_index = path_scores[i].path.prev_path_index;
+                for (j = prev_index_start-1; j > prev_path_index; --j) {
+                    int longest_suffix_index = suffix_indexes[j];
+                    if (prev_temp_scores[j] > prev_temp_scores[longest_suffix_index]) {
+                        prev_temp_scores[longest_suffix_index] = prev_temp_scores[j];
+                        real_path_indexes[longest_suffix_index] = real_path_indexes[j];
+                    }
                 }
+                prev_index_start = prev_path_index;
+                cur_temp_scores[i] = prev_temp_scores[prev_path_index];
+                path_scores[i].best_path = real_path_indexes[prev_path_index];
             }
-            prev_index_start = prev_path_index; 
-            cur_temp_scores[i] = prev_temp_scores[prev_path_index] * path_scores[i].exp_weight;
-            if (cur_temp_scores[i] > max_score) max_score = cur_temp_scores[i];
-            ctx->path_scores[t][i].best_path = real_path_indexes[prev_path_index];
+
+            block_max = kernels->mul_max(
+                cur_temp_scores + begin, cur_temp_scores + begin, path_weights + begin, end - begin);
+            if (block_max > max_score) max_score = block_max;
+            end = begin;
         }
         frexp(max_score, &exponent_diff);
         exponent_all += exponent_diff;
         real_scale_diff = ldexp(1.0, -exponent_diff);
-        for (i = 1; i < n; ++i) {
-            cur_temp_scores[i] *= real_scale_diff;
-            path_scores[i].score = log(cur_temp_scores[i] * pow(2.0, exponent_all));
+        kernels->scale(cur_temp_scores + 1, real_scale_diff, n - 1);
+        if (ctx->viterbi_scores) {
+            for (i = 1; i < n; ++i) {
+                path_scores[i].score = log(cur_temp_scores[i]) + exponent_all * ln2;
+            }
         }
         memcpy(prev_temp_scores, cur_temp_scores, sizeof(floatval_t) * n);
     }
 
-    for (i = 1; i < n; ++i) {
-        if (prev_temp_scores[i] > last_best_score) {
-            last_best_score = prev_temp_scores[i];
-            last_best_path = i;
-        }
+    /* The first path with the best score. */
+    last_best_score = kernels->max(prev_temp_scores + 1, n - 1);
+    if (last_best_score > 0.0) {
+        for (i = 1; prev_temp_scores[i] != last_best_score; ++i) ;
+        last_best_path = i;
     }
 
     for (t = T-1; t >= 0; --t) {
@@ -270,11 +321,38 @@ floatval_t crfvoc_decode(crfvo_context_t* ctx)
             path_num += ctx->num_paths_by_label[t][label];
         }
         ctx->labels[t] = label;
+        ctx->best_path_indexes[t] = last_best_path;
         last_best_path = ctx->path_scores[t][last_best_path].best_path;
     }
-    free(prev_temp_scores_backup);
-    free(real_path_indexes);
-    return exponent_all * log(2.0) + log(last_best_score);
+    return exponent_all * ln2 + log(last_best_score);
+}
+
+/*
+    Multiply the weights of the paths whose current label differs from the
+    reference label by exp(loss), so that crfvoc_decode() finds the path
+    maximizing the score plus the Hamming loss.
+ */
+void crfvoc_augment_loss(crfvo_context_t* ctx, floatval_t loss)
+{
+    int i, l, t;
+    const int T = ctx->num_items;
+    const int L = ctx->num_labels;
+    const floatval_t exp_loss = exp(loss);
+
+    for (t = 0; t < T; ++t) {
+        crfvo_path_score_t* path_scores = ctx->path_scores[t];
+        int begin = 1;
+
+        for (l = 0; l <= L; ++l) {
+            const int end = begin + ctx->num_paths_by_label[t][l];
+            if (l != ctx->labels[t]) {
+                for (i = begin; i < end; ++i) {
+                    path_scores[i].exp_weight *= exp_loss;
+                }
+            }
+            begin = end;
+        }
+    }
 }
 
 void crfvoc_debug_context(crfvo_context_t* ctx, FILE *fp)
@@ -314,7 +392,7 @@ void crfvoc_set_weight(
 
     for (t = 0; t < T; ++t) {
         crfvo_path_score_t* path_scores = ctx->path_scores[t];
-        int* fids_ref = ctx->fids_refs[t];
+        const fid_t* fids_ref = ctx->fids_refs[t];
         int n = ctx->num_paths[t];
         int fid_index = 0;
 
@@ -333,12 +411,12 @@ void crfvoc_set_weight(
     }
 }
 
-/* calculate feature expectations by sum-difference algorithm. */
-void crfvoc_calc_feature_expectations(
+/* forward scores; returns the exponent of the last scaling. */
+static int crfvoc_forward_score(
     crfvo_context_t* ctx
     )
 {
-    int i, last_n, t;
+    int i, t;
     int T = ctx->num_items;
     floatval_t* prev_temp_scores = ctx->prev_temp_scores;
     floatval_t* cur_temp_scores = ctx->cur_temp_scores;
@@ -383,6 +461,31 @@ void crfvoc_calc_feature_expectations(
     ctx->norm_significand = prev_temp_scores[0] * real_scale_diff;
     ctx->norm_exponent = ctx->exponents[T-1] + exponent_diff;    
 
+    return exponent_diff;
+}
+
+/*
+    calculate the normalization factor only, which is sufficient for
+    crfvoc_logprob().
+ */
+void crfvoc_calc_norm(
+    crfvo_context_t* ctx
+    )
+{
+    crfvoc_forward_score(ctx);
+}
+
+/* calculate feature expectations by sum-difference algorithm. */
+void crfvoc_calc_feature_expectations(
+    crfvo_context_t* ctx
+    )
+{
+    int i, last_n, t;
+    int T = ctx->num_items;
+    floatval_t* prev_temp_scores = ctx->prev_temp_scores;
+    floatval_t* cur_temp_scores = ctx->cur_temp_scores;
+    floatval_t real_scale_diff = ldexp(1.0, -crfvoc_forward_score(ctx));
+
     /* backward / sum up the scores */
     last_n = ctx->num_paths[T-1];
     memset(cur_temp_scores, 0, sizeof(floatval_t) * last_n);
@@ -428,3 +531,110 @@ void crfvoc_calc_feature_expectations(
         memcpy(cur_temp_scores, prev_temp_scores, sizeof(floatval_t) * prev_n);
     }
 }
+
+/*
+    calculate feature expectations of the pseudo-likelihood, where the label
+    at each position is normalized locally given the reference labels at the
+    preceding positions. Only the paths chosen for the reference history
+    are weighted, so crfvoc_set_weight() need not be called beforehand.
+    Returns the log pseudo-likelihood of the sequence.
+ */
+floatval_t crfvoc_calc_local_expectations(
+    crfvo_context_t* ctx,
+    const floatval_t* exp_weight
+    )
+{
+    int i, j, k, l, n, prev_n, t;
+    int T = ctx->num_items;
+    int L = ctx->num_labels;
+    floatval_t* depths = ctx->prev_temp_scores;
+    floatval_t logp = 0.0;
+
+    for (t = 0; t < T; ++t) {
+        crfvo_path_score_t* path_scores = ctx->path_scores[t];
+        const fid_t* fids_ref = ctx->fids_refs[t];
+        int fid_index = 0;
+        int begin = 1;
+        floatval_t norm = 0.0;
+        n = ctx->num_paths[t];
+
+        /*
+            Rank the paths at the previous position that are consistent with
+            the reference labels; a longer history has a larger rank.
+         */
+        if (t > 0) {
+            crfvo_path_score_t* prev_path_scores = ctx->path_scores[t-1];
+            prev_n = ctx->num_paths[t-1];
+            memset(depths, 0, sizeof(floatval_t) * prev_n);
+            for (i = ctx->training_path_indexes[t-1], k = 0; i > 0; i = prev_path_scores[i].path.longest_suffix_index) {
+                depths[i] = prev_n - k++;
+            }
+            depths[0] = prev_n - k;
+        } else {
+            depths[0] = 1.0; /* the empty path */
+            depths[1] = 2.0; /* BOS */
+        }
+
+        /*
+            For each label, choose the longest path whose history is
+            consistent with the reference labels (marked with best_path),
+            and flag the paths on its suffix chain.
+         */
+        for (i = 0; i < n; ++i) {
+            path_scores[i].score = 0.0;
+            path_scores[i].best_path = 0;
+        }
+        for (l = 0; l <= L; ++l) {
+            int end = begin + ctx->num_paths_by_label[t][l];
+            int best = -1;
+            floatval_t best_depth = 0.0;
+            for (i = begin; i < end; ++i) {
+                int prev_path_index = path_scores[i].path.prev_path_index;
+                if (prev_path_index >= 0 && depths[prev_path_index] > best_depth) {
+                    best_depth = depths[prev_path_index];
+                    best = i;
+                }
+            }
+            if (best > 0) {
+                path_scores[best].best_path = 1;
+                for (i = best; i > 0; i = path_scores[i].path.longest_suffix_index) {
+                    path_scores[i].score = 1.0;
+                }
+            }
+            begin = end;
+        }
+
+        /* accumulate weight for the flagged paths */
+        path_scores[0].exp_weight = 1.0;
+        for (i = 1; i < n; ++i) {
+            int feature_count = path_scores[i].path.feature_count;
+            if (path_scores[i].score != 0.0) {
+                int longest_suffix_index = path_scores[i].path.longest_suffix_index;
+                path_scores[i].exp_weight = path_scores[longest_suffix_index].exp_weight;
+                for (j = 0; j < feature_count; ++j) {
+                    path_scores[i].exp_weight *= exp_weight[fids_ref[fid_index+j]];
+                }
+                path_scores[i].score = 0.0;
+                if (path_scores[i].best_path) {
+                    norm += path_scores[i].exp_weight;
+                }
+            }
+            fid_index += feature_count;
+        }
+
+        logp += log(path_scores[ctx->training_path_indexes[t]].exp_weight / norm);
+
+        for (i = n-1; i > 0; --i) {
+            int longest_suffix_index = path_scores[i].path.longest_suffix_index;
+            /* normalize */
+            if (path_scores[i].best_path) {
+                path_scores[i].score += path_scores[i].exp_weight / norm;
+            }
+            /* sigma */
+            path_scores[longest_suffix_index].score += path_scores[i].score;
+        }
+        path_scores[0].score = 0.0;
+    }
+
+    return logp;
+}
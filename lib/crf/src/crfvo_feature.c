@@ -44,22 +44,24 @@
 
 #include "logging.h"
 #include "crfvo.h"
-#include "rumavl.h"    /* AVL tree library necessary for feature generation. */
+#include "parallel.h"
 
 /**
  * Feature set.
+ *    Features are appended to a flat array as they come, and sorted and
+ *    deduplicated at once by featureset_generate().
  */
 struct tag_featureset {
-    RUMAVL* avl;    /**< Root node of the AVL tree. */
-    int num;        /**< Number of features in the AVL tree. */
+    crfvol_feature_t* features; /**< Array of the features added. */
+    fid_t num;                  /**< Number of features in the array. */
+    fid_t max;                  /**< Capacity of the array. */
 };
 
 #define    COMP(a, b)    ((a)>(b))-((a)<(b))
 
-static int featureset_comp(const void *x, const void *y, size_t n, void *udata)
+static int featureset_comp(const void *x, const void *y)
 {
     int ret = 0;
-    int i;
     const crfvol_feature_t* f1 = (const crfvol_feature_t*)x;
     const crfvol_feature_t* f2 = (const crfvol_feature_t*)y;
 
@@ -67,10 +69,8 @@ static int featureset_comp(const void *x, const void *y, size_t n, void *udata)
     if (ret == 0) {
         ret = COMP(f1->order, f2->order);
         if (ret == 0) {
-            for (i = 0; i < f1->order; ++i) {
-                ret = COMP(f1->label_sequence[i], f2->label_sequence[i]);
-                if (ret) break;
-            }
+            /* Label sequences are zero-padded beyond their order. */
+            ret = memcmp(f1->label_sequence, f2->label_sequence, MAX_ORDER);
         }
     }
     return ret;
@@ -80,64 +80,145 @@ featureset_t* featureset_new()
 {
     featureset_t* set = NULL;
     set = (featureset_t*)calloc(1, sizeof(featureset_t));
-    if (set != NULL) {
-        set->num = 0;
-        set->avl = rumavl_new(
-            sizeof(crfvol_feature_t), featureset_comp, NULL, NULL);
-        if (set->avl == NULL) {
-            free(set);
-            set = NULL;
-        }
-    }
     return set;
 }
 
 void featureset_delete(featureset_t* set)
 {
     if (set != NULL) {
-        rumavl_destroy(set->avl);
+        free(set->features);
         free(set);
     }
 }
 
-static int featureset_add(featureset_t* set, const crfvol_feature_t* f)
+static int featureset_reserve(featureset_t* set, fid_t n)
 {
-    /* Check whether if the feature already exists. */
-    crfvol_feature_t *p = (crfvol_feature_t*)rumavl_find(set->avl, f);
-    if (p == NULL) {
-        /* Insert the feature to the feature set. */
-        rumavl_insert(set->avl, f);
-        ++set->num;
-    } else {
-        /* An existing feature: add the observation expectation. */
-        p->freq += f->freq;
+    if (set->max < n) {
+        fid_t max = set->max;
+        crfvol_feature_t* features = NULL;
+        while (max < n) {
+            max = (max < FID_MAX / 2 - 1) ? (max + 1) * 2 : FID_MAX;
+        }
+        features = (crfvol_feature_t*)realloc(set->features, sizeof(crfvol_feature_t) * max);
+        if (features == NULL) {
+            return CRFERR_OUTOFMEMORY;
+        }
+        set->features = features;
+        set->max = max;
     }
     return 0;
 }
 
-void featureset_generate(crfvol_features_t* features, featureset_t* set)
+int featureset_add(
+    featureset_t* set,
+    int n,
+    const int *attrs,
+    const int *orders,
+    const unsigned char *label_sequences
+    )
 {
-    int n = 0, k = 0;
-    RUMAVL_NODE *node = NULL;
-    crfvol_feature_t *f = NULL;
+    int i, ret;
+
+    /* The feature ids must fit in fid_t. */
+    if (FID_MAX - set->num < n) {
+        return CRFERR_OVERFLOW;
+    }
+    if (ret = featureset_reserve(set, set->num + n)) {
+        return ret;
+    }
+
+    for (i = 0;i < n;++i) {
+        const int order = orders[i];
+        /* A feature longer than the supported order cannot be represented. */
+        if (0 <= order && order <= MAX_ORDER) {
+            crfvol_feature_t* f = &set->features[set->num++];
+            memset(f, 0, sizeof(*f));
+            f->attr = attrs[i];
+            f->order = order;
+            memcpy(f->label_sequence, label_sequences, order);
+        }
+        label_sequences += (0 <= orders[i]) ? orders[i] : 0;
+    }
+    return 0;
+}
+
+typedef struct {
+    crfvol_feature_t* features;
+    fid_t num;
+    int num_parts;
+} sort_task_t;
+
+static void featureset_sort_part(void *instance, int i)
+{
+    sort_task_t* task = (sort_task_t*)instance;
+    const fid_t begin = (fid_t)((long long)task->num * i / task->num_parts);
+    const fid_t end = (fid_t)((long long)task->num * (i+1) / task->num_parts);
+    qsort(task->features + begin, end - begin, sizeof(crfvol_feature_t), featureset_comp);
+}
+
+void featureset_generate(crfvol_features_t* features, featureset_t* set, int num_threads)
+{
+    int i;
+    fid_t k = 0;
+    fid_t *heads = NULL, *tails = NULL;
+    crfvol_feature_t *dst = NULL, *last = NULL;
+    sort_task_t task;
 
     features->features = 0;
+    features->num_features = 0;
 
-    /* The first pass: count the number of valid features. */
-    while ((node = rumavl_node_next(set->avl, node, 1, (void**)&f)) != NULL) {
-        ++n;
+    /* Sort the partitions of the array concurrently. */
+    task.features = set->features;
+    task.num = set->num;
+    task.num_parts = (num_threads < 1) ? 1 : num_threads;
+    if (task.num < task.num_parts * 1024) {
+        task.num_parts = 1;
     }
+    parallel_run(task.num_parts, featureset_sort_part, &task);
 
-    /* The second path: copy the valid features to the feature array. */
-    features->features = (crfvol_feature_t*)calloc(n, sizeof(crfvol_feature_t));
-    if (features->features != NULL) {
-        node = NULL;
-        while ((node = rumavl_node_next(set->avl, node, 1, (void**)&f)) != NULL) {
-            memcpy(&features->features[k], f, sizeof(crfvol_feature_t));
-            ++k;
+    /* Merge the partitions, accumulating the frequencies of duplicates. */
+    dst = (crfvol_feature_t*)calloc(set->num > 0 ? set->num : 1, sizeof(crfvol_feature_t));
+    heads = (fid_t*)malloc(sizeof(fid_t) * task.num_parts);
+    tails = (fid_t*)malloc(sizeof(fid_t) * task.num_parts);
+    if (dst == NULL || heads == NULL || tails == NULL) {
+        free(dst);
+        goto error_exit;
+    }
+    for (i = 0;i < task.num_parts;++i) {
+        heads[i] = (fid_t)((long long)task.num * i / task.num_parts);
+        tails[i] = (fid_t)((long long)task.num * (i+1) / task.num_parts);
+    }
+    for (;;) {
+        const crfvol_feature_t* f = NULL;
+        int best = -1;
+        for (i = 0;i < task.num_parts;++i) {
+            if (heads[i] < tails[i]) {
+                if (best < 0 || featureset_comp(&set->features[heads[i]], f) < 0) {
+                    best = i;
+                    f = &set->features[heads[i]];
+                }
+            }
+        }
+        if (best < 0) {
+            break;
+        }
+        ++heads[best];
+
+        if (last != NULL && featureset_comp(last, f) == 0) {
+            /* An existing feature: add the observation expectation. */
+            last->freq += f->freq;
+        } else {
+            last = &dst[k++];
+            memcpy(last, f, sizeof(crfvol_feature_t));
         }
-        features->num_features = n;
     }
+
+    features->features = dst;
+    features->num_features = k;
+
+error_exit:
+    free(tails);
+    free(heads);
 }
 
 void crfvol_features_delete(crfvol_features_t* features)
@@ -173,16 +254,5 @@ int crfvol_add_feature(
     unsigned char label_sequence[]
     )
 {
-    int i, ret;
-    crfvol_feature_t f;
-
-    memset(&f, 0, sizeof(f));
-    f.attr = attr;
-    f.order = order;
-    for (i = 0; i < order; ++i) {
-        f.label_sequence[i] = label_sequence[i];
-    }
-    ret = featureset_add(featureset, &f);
-    if (ret < 0) return ret;
-    return featureset->num;
+    return featureset_add(featureset, 1, &attr, &order, label_sequence);
 }
@@ -65,14 +65,19 @@ void crfvol_enum_features(crfvol_t* trainer, const crf_sequence_t* seq, update_f
 
     for (t = 0; t < T; ++t) {
         crfvo_path_score_t* path_scores = ctx->path_scores[t];
-        int* fids = ctx->fids_refs[t];
+        const fid_t* fids = ctx->fids_refs[t];
         int n = ctx->num_paths[t];
         int fid_counter = 0;
         for (i = 0; i < n; ++i) {
             int fid_num = path_scores[i].path.feature_count;
+            if (path_scores[i].score == 0.) {
+                /* The path contributes nothing to the expectations. */
+                fid_counter += fid_num;
+                continue;
+            }
             for (j = 0; j < fid_num; ++j) {
                 floatval_t prob = path_scores[i].score;
-                int fid = fids[fid_counter];
+                fid_t fid = fids[fid_counter];
                 crfvol_feature_t* f = FEATURE(trainer, fid);
                 fid_counter++;
                 func(f, fid, prob, 1.0, trainer, seq, t);                
@@ -81,11 +86,108 @@ void crfvol_enum_features(crfvol_t* trainer, const crf_sequence_t* seq, update_f
     }
 }
 
+static void accumulate_expectations(
+    crfvol_feature_t* f,
+    const fid_t fid,
+    floatval_t prob,
+    floatval_t scale,
+    crfvol_t* trainer,
+    const crf_sequence_t* seq,
+    int t
+    )
+{
+    trainer->g[fid] += prob * scale;
+}
+
+/*
+    Compute the log-probability of the reference labels of a sequence, and
+    add the model expectations of features to g. When g is NULL, only the
+    forward pass runs to obtain the log-probability.
+ */
+floatval_t crfvol_sequence_expectations(
+    crfvol_t* trainer,
+    const crf_sequence_t* seq,
+    const floatval_t* exp_weight,
+    floatval_t* g
+    )
+{
+    floatval_t logp = 0;
+    crfvo_context_t* ctx = trainer->ctx;
+
+    /* Set label sequences and state scores. */
+    crfvoc_set_context(ctx, seq);
+
+    if (trainer->pseudo_likelihood) {
+        /* Compute the pseudo-likelihood and its expectations. */
+        logp = crfvoc_calc_local_expectations(ctx, exp_weight);
+    } else {
+        crfvoc_set_weight(ctx, exp_weight);
+        if (g != NULL) {
+            crfvoc_calc_feature_expectations(ctx);
+        } else {
+            crfvoc_calc_norm(ctx);
+        }
+
+        /* Compute the probability of the input sequence on the model. */
+        logp = crfvoc_logprob(ctx);
+    }
+
+    /* Accumulate the model expectations of features. */
+    if (g != NULL) {
+        trainer->g = g;
+        crfvol_enum_features(trainer, seq, accumulate_expectations, &logp);
+    }
+    return logp;
+}
+
+/*
+    Compute the log-likelihood of the training data with weights w. This sets
+    trainer->exp_weight and stores the gradients of the negative
+    log-likelihood (model expectations minus observations) to g, unless g is
+    NULL.
+ */
+floatval_t crfvol_loglikelihood(
+    crfvol_t* trainer,
+    const floatval_t* w,
+    floatval_t* g
+    )
+{
+    int i;
+    fid_t k;
+    floatval_t logl = 0;
+    const fid_t K = trainer->num_features;
+    const int N = trainer->num_sequences;
+
+    if (!trainer->exp_weight) {
+        trainer->exp_weight = (floatval_t*)calloc(K, sizeof(floatval_t));
+    }
+
+    for (k = 0;k < K;++k) {
+        trainer->exp_weight[k] = exp(w[k]);
+    }
+
+    /* Initialize the gradients with the observation expectations. */
+    if (g != NULL) {
+        for (k = 0;k < K;++k) {
+            g[k] = -trainer->features[k].freq;
+        }
+    }
+
+    /* Add the model expectations of features. */
+    for (i = 0;i < N;++i) {
+        logl += crfvol_sequence_expectations(
+            trainer, &trainer->seqs[i], trainer->exp_weight, g);
+    }
+
+    return logl;
+}
+
 static int init_feature_references(crfvol_t* trainer, const int A, const int L)
 {
-    int i, k;
+    int i;
+    fid_t k;
     feature_refs_t *fl = NULL;
-    const int K = trainer->num_features;
+    const fid_t K = trainer->num_features;
     const crfvol_feature_t* features = trainer->features;
 
     /*
@@ -116,7 +218,7 @@ static int init_feature_references(crfvol_t* trainer, const int A, const int L)
      */
     for (i = 0;i < trainer->num_attributes;++i) {
         fl = &trainer->attributes[i];
-        fl->fids = (int*)calloc(fl->num_features, sizeof(int));
+        fl->fids = (fid_t*)calloc(fl->num_features, sizeof(fid_t));
         if (fl->fids == NULL) goto error_exit;
         fl->num_features = 0;
     }
@@ -151,6 +253,7 @@ int crfvol_prepare(
     )
 {
     int ret = 0;
+    fid_t k;
     const int L = num_labels;
     const int A = num_attributes;
     const int T = max_item_length;
@@ -176,6 +279,19 @@ int crfvol_prepare(
         goto error_exit;
     }
 
+    /* Lay out the labels of the features for the preprocessor. */
+    trainer->feature_orders = (uint8_t*)malloc(trainer->num_features + 1);
+    trainer->feature_label_sequences = (uint8_t*)malloc(MAX_ORDER * trainer->num_features + 1);
+    if (trainer->feature_orders == NULL || trainer->feature_label_sequences == NULL) {
+        ret = CRFERR_OUTOFMEMORY;
+        goto error_exit;
+    }
+    for (k = 0;k < trainer->num_features;++k) {
+        const crfvol_feature_t* f = &trainer->features[k];
+        trainer->feature_orders[k] = (uint8_t)f->order;
+        memcpy(&trainer->feature_label_sequences[MAX_ORDER * k], f->label_sequence, MAX_ORDER);
+    }
+
     /* Allocate the work space for probability calculation. */
     trainer->prob = (floatval_t*)calloc(L, sizeof(floatval_t));
     if (trainer->prob == NULL) {
@@ -191,25 +307,30 @@ int crfvol_prepare(
 error_exit:
     free(trainer->attributes);
     free(trainer->prob);
+    free(trainer->feature_label_sequences);
+    free(trainer->feature_orders);
     free(trainer->ctx);
     return 0;
 }
 
-void crfvol_preprocess(
+int crfvol_preprocess(
     crfvol_t* trainer
     )
 {
-    int i;
+    int i, ret = 0;
     logging(trainer->lg, "Preprocessing...\n");
     logging_progress_start(trainer->lg);
 
     for (i = 0; i < trainer->num_sequences; ++i) {
-        crfvopp_preprocess_sequence(
+        if (ret = crfvopp_preprocess_sequence(
             (crfvopp_t*)trainer->preprocessor,
             trainer->attributes,
-            trainer->features,
+            trainer->feature_orders,
+            trainer->feature_label_sequences,
             trainer->num_labels,
-            &trainer->seqs[i]);
+            &trainer->seqs[i])) {
+            return ret;
+        }
 
         if (trainer->max_paths < trainer->seqs[i].max_paths) {
             trainer->max_paths = trainer->seqs[i].max_paths;
@@ -218,6 +339,7 @@ void crfvol_preprocess(
     }
 
     logging_progress_end(trainer->lg);
+    return 0;
 }
 
 int crfvol_set_feature_freqs(
@@ -226,6 +348,7 @@ int crfvol_set_feature_freqs(
     )
 {
     int i, t, n, ret;
+    fid_t k;
     int* feature_freqs = (int*)calloc(trainer->num_features, sizeof(int));
     int* feature_last_indexes = (int*)malloc(trainer->max_paths * sizeof(int));
 
@@ -250,9 +373,9 @@ int crfvol_set_feature_freqs(
         }
     }
     ret = 1;
-    for (i = 0; i < trainer->num_features; ++i) {
-        if (trainer->features[i].freq != feature_freqs[i]) {
-            trainer->features[i].freq = feature_freqs[i];
+    for (k = 0; k < trainer->num_features; ++k) {
+        if (trainer->features[k].freq != feature_freqs[k]) {
+            trainer->features[k].freq = feature_freqs[k];
         }
     }
     free(feature_freqs);
@@ -265,11 +388,60 @@ static int crfvol_exchange_options(crf_params_t* params, crfvol_option_t* opt, i
     BEGIN_PARAM_MAP(params, mode)
         DDX_PARAM_STRING(
             "algorithm", opt->algorithm, "lbfgs",
-            "The training algorithm."
+            "The training algorithm:\n"
+            "{'lbfgs': L-BFGS, 'svrg': stochastic variance-reduced gradient,\n"
+            " 'ssvm': structured SVM with loss-augmented Viterbi,\n"
+            " 'newton': Hessian-free Newton-CG}"
+            )
+        DDX_PARAM_STRING(
+            "objective", opt->objective, "likelihood",
+            "The objective function maximized by 'lbfgs', 'svrg' and 'newton':\n"
+            "{'likelihood': log-likelihood, 'pseudo': pseudo-likelihood where each\n"
+            " position is normalized locally given the reference labels before it}"
+            )
+        DDX_PARAM_INT(
+            "feature.num_threads", opt->feature_num_threads, 4,
+            "The number of threads sorting the features given by the feature file."
+            )
+        DDX_PARAM_INT(
+            "model.weight_bits", opt->model_weight_bits, 0,
+            "The number of bits of a feature weight in the model file:\n"
+            "{0: double precision, 8 or 16: quantized with a scale per block of\n"
+            " features, storing the features and references compactly}"
+            )
+        DDX_PARAM_INT(
+            "model.native", opt->model_native, 0,
+            "Append the exp-weights and labels of the features in the native\n"
+            "byte order, which a tagger on the same kind of machine uses in place;\n"
+            "a quantized model stores the labels only."
+            )
+        DDX_PARAM_FLOAT(
+            "model.prune_threshold", opt->model_prune_threshold, 0.,
+            "Drop the features whose absolute weights are below this value when\n"
+            "storing the model (features of zero weights are always dropped)."
+            )
+        DDX_PARAM_INT(
+            "model.max_features", opt->model_max_features, 0,
+            "Keep at most this number of features with the largest absolute\n"
+            "weights when storing the model (0: no limit)."
+            )
+        DDX_PARAM_FLOAT(
+            "model.max_size", opt->model_max_size, 0.,
+            "Keep the features with the largest absolute weights that fit the\n"
+            "model file into this size in megabytes (0: no limit)."
+            )
+        DDX_PARAM_INT(
+            "model.wide", opt->model_wide, 0,
+            "Write the model in the 64-bit format, which has no limit of 4 GB\n"
+            "on the file size:\n"
+            "{0: only if the model is estimated to exceed the limit, 1: always}"
             )
     END_PARAM_MAP()
 
     crfvol_lbfgs_options(params, opt, mode);
+    crfvol_svrg_options(params, opt, mode);
+    crfvol_ssvm_options(params, opt, mode);
+    crfvol_newton_options(params, opt, mode);
 
     return 0;
 }
@@ -323,26 +495,30 @@ void crfvol_delete(crfvol_t* trainer)
 
 int crf_train_tag(crf_tagger_t* tagger, crf_sequence_t *inst, crf_output_t* output)
 {
-    int i;
+    int i, ret = 0;
     floatval_t logscore = 0;
     crfvol_t *crfvot = (crfvol_t*)tagger->internal;
     const floatval_t* exp_weight = crfvot->exp_weight;
-    const int K = crfvot->num_features;
     crfvo_context_t* ctx = crfvot->ctx;
     int max_path = 0;
 
     for (i = 0; i < inst->num_items; ++i) {
         if (inst->items[i].preprocessed_data == 0) {
-            crfvopp_preprocess_sequence(
+            if (ret = crfvopp_preprocess_sequence(
                 (crfvopp_t*)crfvot->preprocessor,
                 crfvot->attributes,
-                crfvot->features,
+                crfvot->feature_orders,
+                crfvot->feature_label_sequences,
                 crfvot->num_labels,
-                inst);
+                inst)) {
+                return ret;
+            }
             break;
         }
     }
-    crfvoc_set_num_items(ctx, inst->num_items, inst->max_paths);
+    if (ret = crfvoc_set_num_items(ctx, inst->num_items, inst->max_paths)) {
+        return ret;
+    }
 
     crfvoc_set_context(ctx, inst);
     crfvoc_set_weight(ctx, exp_weight);
@@ -388,6 +564,18 @@ static int crf_train_add_feature(
         );
 }
 
+static int crf_train_add_features(
+    crf_trainer_t* trainer,
+    int n,
+    const int *attrs,
+    const int *orders,
+    const unsigned char *label_sequences
+    )
+{
+    crfvol_t *crfvot = (crfvol_t*)trainer->internal;
+    return featureset_add(crfvot->featureset, n, attrs, orders, label_sequences);
+}
+
 static int crf_train_train(
     crf_trainer_t* trainer,
     void* instances,
@@ -405,9 +593,16 @@ static int crf_train_train(
     crf_params_t *params = crfvot->params;
     crfvol_option_t *opt = &crfvot->opt;
 
-    featureset_generate(features, crfvot->featureset);
+    /* Access parameters. */
+    crfvol_exchange_options(crfvot->params, opt, -1);
+
+    featureset_generate(features, crfvot->featureset, opt->feature_num_threads);
     featureset_delete(crfvot->featureset);
     crfvot->featureset = 0;
+    if (features->features == NULL) {
+        free(features);
+        return CRFERR_OUTOFMEMORY;
+    }
 
     /* Obtain the maximum number of items. */
     max_item_length = 0;
@@ -417,11 +612,9 @@ static int crf_train_train(
         }
     }
 
-    /* Access parameters. */
-    crfvol_exchange_options(crfvot->params, opt, -1);
-
     /* Report the parameters. */
     logging(crfvot->lg, "Training first-order linear-chain CRFs (trainer.crfvo)\n");
+    logging(crfvot->lg, "Number of distinct features: %lld\n", (long long)features->num_features);
     logging(crfvot->lg, "\n");
 
     /* Preparation for training. */
@@ -432,9 +625,16 @@ static int crf_train_train(
     crfvot->seqs = seqs;
 
     crfvot->preprocessor = crfvopp_new();
+    if (crfvot->preprocessor == NULL) {
+        free(features);
+        return CRFERR_OUTOFMEMORY;
+    }
 
     /* preprocess */
-    crfvol_preprocess(crfvot);
+    if (ret = crfvol_preprocess(crfvot)) {
+        free(features);
+        return ret;
+    }
     crfvol_set_feature_freqs(crfvot, features);
 
     crfvoc_set_num_items(crfvot->ctx, max_item_length, crfvot->max_paths);
@@ -442,8 +642,20 @@ static int crf_train_train(
     crfvot->tagger.internal = crfvot;
     crfvot->tagger.tag = crf_train_tag;
 
+    crfvot->pseudo_likelihood = (strcmp(opt->objective, "pseudo") == 0);
+    if (crfvot->pseudo_likelihood) {
+        logging(crfvot->lg, "Objective: pseudo-likelihood\n");
+        logging(crfvot->lg, "\n");
+    }
+
     if (strcmp(opt->algorithm, "lbfgs") == 0) {
         ret = crfvol_lbfgs(crfvot, opt);
+    } else if (strcmp(opt->algorithm, "svrg") == 0) {
+        ret = crfvol_svrg(crfvot, opt);
+    } else if (strcmp(opt->algorithm, "ssvm") == 0) {
+        ret = crfvol_ssvm(crfvot, opt);
+    } else if (strcmp(opt->algorithm, "newton") == 0) {
+        ret = crfvol_newton(crfvot, opt);
     } else {
         return CRFERR_INTERNAL_LOGIC;
     }
@@ -454,26 +666,134 @@ static int crf_train_train(
 
 /*#define    CRF_TRAIN_SAVE_NO_PRUNING    1*/
 
+typedef struct {
+    floatval_t  value;      /* Absolute weight. */
+    fid_t       k;          /* Feature id. */
+} ranked_feature_t;
+
+static int compare_ranked_features(const void *x, const void *y)
+{
+    const ranked_feature_t* a = (const ranked_feature_t*)x;
+    const ranked_feature_t* b = (const ranked_feature_t*)y;
+    if (a->value != b->value) {
+        return (a->value < b->value) ? 1 : -1;
+    }
+    return (a->k < b->k) ? -1 : (a->k > b->k);
+}
+
+/*
+    Mark the features to be stored in the model. A feature survives if its
+    weight is non-zero and not below model.prune_threshold in magnitude;
+    model.max_features and model.max_size then keep the survivors with
+    the largest absolute weights, counting the size of an attribute when
+    the first of its features is kept. A feature that exceeds the size
+    budget is skipped; a later one whose attribute is already counted may
+    still fit.
+ */
+static fid_t select_features(crfvol_t* crfvot, crfvomw_t* writer, crf_dictionary_t* attrs, uint8_t* active)
+{
+    fid_t i, k, m, n = 0, num_active = 0;
+    const floatval_t *w = crfvot->w;
+    const crfvol_option_t* opt = &crfvot->opt;
+    const fid_t K = crfvot->num_features;
+    ranked_feature_t* ranked = NULL;
+    uint8_t* counted = NULL;
+    size_t size, base_size, feature_size, attr_size, budget;
+
+    for (k = 0;k < K;++k) {
+        active[k] = (w[k] != 0 && opt->model_prune_threshold <= fabs(w[k]));
+        num_active += active[k];
+    }
+    if (opt->model_max_features <= 0 && opt->model_max_size <= 0) {
+        return num_active;
+    }
+
+    /* Rank the surviving features by their absolute weights. */
+    ranked = (ranked_feature_t*)malloc(sizeof(ranked_feature_t) * (num_active + 1));
+    counted = (uint8_t*)calloc(crfvot->num_attributes + 1, sizeof(uint8_t));
+    if (ranked == NULL || counted == NULL) {
+        free(counted);
+        free(ranked);
+        return -1;
+    }
+    for (k = 0;k < K;++k) {
+        if (active[k]) {
+            ranked[n].value = fabs(w[k]);
+            ranked[n].k = k;
+            ++n;
+        }
+    }
+    qsort(ranked, n, sizeof(ranked_feature_t), compare_ranked_features);
+
+    if (0 < opt->model_max_features && opt->model_max_features < n) {
+        n = opt->model_max_features;
+    }
+
+    /* Deactivate the features ranked below the limit. */
+    for (i = n;i < num_active;++i) {
+        active[ranked[i].k] = 0;
+    }
+
+    if (0 < opt->model_max_size) {
+        crfvomw_estimate_sizes(writer, crfvot->num_labels, &base_size, &feature_size, &attr_size);
+        budget = (size_t)(opt->model_max_size * 1024 * 1024);
+        size = base_size;
+        for (i = 0, m = 0;i < n;++i) {
+            size_t cost = feature_size;
+            const int a = crfvot->features[ranked[i].k].attr;
+            if (budget < size + cost) {
+                active[ranked[i].k] = 0;
+                continue;
+            }
+            if (!counted[a]) {
+                const char *str = NULL;
+                cost += attr_size;
+                attrs->to_string(attrs, a, &str);
+                if (str != NULL) {
+                    cost += strlen(str) + 1;
+                    attrs->free_(attrs, str);
+                }
+            }
+            if (budget < size + cost) {
+                active[ranked[i].k] = 0;
+                continue;
+            }
+            size += cost;
+            counted[a] = 1;
+            ++m;
+        }
+        n = m;
+        logging(crfvot->lg, "Estimated model size: %.3f MB\n", size / (1024. * 1024.));
+    }
+
+    free(counted);
+    free(ranked);
+    return n;
+}
+
 static int crf_train_save(crf_trainer_t* trainer, const char *filename, crf_dictionary_t* attrs, crf_dictionary_t* labels)
 {
     crfvol_t *crfvot = (crfvol_t*)trainer->internal;
-    int a, k, l, ret;
-    int *fmap = NULL, *amap = NULL;
+    int a, l, ret, wide;
+    fid_t k, num_selected;
+    fid_t *fmap = NULL;
+    int *amap = NULL;
+    uint8_t *active = NULL;
     crfvomw_t* writer = NULL;
     const feature_refs_t *edge = NULL, *attr = NULL;
     const floatval_t *w = crfvot->w;
-    const floatval_t threshold = 0.01;
     const int L = crfvot->num_labels;
     const int A = crfvot->num_attributes;
-    const int K = crfvot->num_features;
-    int J = 0, B = 0;
+    const fid_t K = crfvot->num_features;
+    fid_t J = 0;
+    int B = 0;
 
     /* Start storing the model. */
     logging(crfvot->lg, "Storing the model\n");
     crfvot->clk_begin = clock();
 
     /* Allocate and initialize the feature mapping. */
-    fmap = (int*)calloc(K, sizeof(int));
+    fmap = (fid_t*)calloc(K, sizeof(fid_t));
     if (fmap == NULL) {
         goto error_exit;
     }
@@ -503,6 +823,39 @@ static int crf_train_save(crf_trainer_t* trainer, const char *filename, crf_dict
     if (writer == NULL) {
         goto error_exit;
     }
+    if (ret = crfvomw_set_weight_bits(writer, crfvot->opt.model_weight_bits)) {
+        goto error_exit;
+    }
+    if (ret = crfvomw_set_native(writer, crfvot->opt.model_native)) {
+        goto error_exit;
+    }
+
+    /* Choose the features to store. */
+    active = (uint8_t*)malloc(K + 1);
+    if (active == NULL) {
+        ret = CRFERR_OUTOFMEMORY;
+        goto error_exit;
+    }
+    num_selected = select_features(crfvot, writer, attrs, active);
+    if (num_selected < 0) {
+        ret = CRFERR_OUTOFMEMORY;
+        goto error_exit;
+    }
+
+    /* Choose the 64-bit format for a model beyond the limit of 4 GB,
+       guessing 16 bytes for the string of an attribute. */
+    wide = crfvot->opt.model_wide;
+    if (!wide) {
+        size_t base_size, feature_size, attr_size;
+        crfvomw_estimate_sizes(writer, L, &base_size, &feature_size, &attr_size);
+        wide = (UINT32_MAX <= base_size + (double)num_selected * feature_size + (double)A * (attr_size + 16));
+    }
+    if (wide) {
+        logging(crfvot->lg, "Writing the model in the 64-bit format\n");
+    }
+    if (ret = crfvomw_set_wide(writer, wide)) {
+        goto error_exit;
+    }
 
     /* Open a feature chunk in the model file. */
     if (ret = crfvomw_open_features(writer)) {
@@ -512,7 +865,7 @@ static int crf_train_save(crf_trainer_t* trainer, const char *filename, crf_dict
     /* Determine a set of active features and attributes. */
     for (k = 0;k < crfvot->num_features;++k) {
         crfvol_feature_t* f = &crfvot->features[k];
-        if (w[k] != 0) {
+        if (active[k]) {
             int attr;
             crfvom_feature_t feat;
 
@@ -543,9 +896,15 @@ static int crf_train_save(crf_trainer_t* trainer, const char *filename, crf_dict
         goto error_exit;
     }
 
-    logging(crfvot->lg, "Number of active features: %d (%d)\n", J, K);
+    logging(crfvot->lg, "Number of active features: %lld (%lld)\n", (long long)J, (long long)K);
     logging(crfvot->lg, "Number of active attributes: %d (%d)\n", B, A);
     logging(crfvot->lg, "Number of active labels: %d (%d)\n", L, L);
+    if (crfvot->opt.model_weight_bits != 0) {
+        floatval_t max_error, rms_error;
+        crfvomw_get_quantization_error(writer, &max_error, &rms_error);
+        logging(crfvot->lg, "Weights quantized to %d bits\n", crfvot->opt.model_weight_bits);
+        logging(crfvot->lg, "Quantization error: max %g, RMS %g\n", max_error, rms_error);
+    }
 
     /* Write labels. */
     logging(crfvot->lg, "Writing labels\n", L);
@@ -605,15 +964,24 @@ static int crf_train_save(crf_trainer_t* trainer, const char *filename, crf_dict
     }
 
     /* Close the writer. */
-    crfvomw_close(writer);
+    ret = crfvomw_close(writer);
+    writer = NULL;
+    if (ret != 0) {
+        if (ret == CRFERR_OVERFLOW) {
+            logging(crfvot->lg, "The model exceeds 4 GB; set model.wide to 1\n");
+        }
+        goto error_exit;
+    }
     logging(crfvot->lg, "Seconds required: %.3f\n", (clock() - crfvot->clk_begin) / (double)CLOCKS_PER_SEC);
     logging(crfvot->lg, "\n");
 
+    free(active);
     free(amap);
     free(fmap);
     return 0;
 
 error_exit:
+    free(active);
     if (writer != NULL) {
         crfvomw_close(writer);
     }
@@ -638,6 +1006,8 @@ static int crf_train_release(crf_trainer_t* trainer)
         crfvol_t* crfvot = (crfvol_t*)trainer->internal;
         if (crfvot->preprocessor) crfvopp_delete(crfvot->preprocessor);
         if (crfvot->features) free(crfvot->features);
+        free(crfvot->feature_orders);
+        free(crfvot->feature_label_sequences);
     }
     return count;
 }
@@ -668,6 +1038,7 @@ int crfvol_create_instance(const char *interface, void **ptr)
         trainer->add_feature = crf_train_add_feature;
         trainer->train = crf_train_train;
         trainer->save = crf_train_save;
+        trainer->add_features = crf_train_add_features;
         trainer->internal = crfvol_new();
 
         *ptr = trainer;
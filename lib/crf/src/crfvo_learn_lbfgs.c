@@ -47,6 +47,7 @@
 
 #include "logging.h"
 #include "params.h"
+#include "parallel.h"
 #include <lbfgs.h>
 
 #include <math.h>
@@ -54,26 +55,11 @@
 typedef struct {
     int l2_regularization;
     floatval_t sigma2inv;
-    floatval_t* g;
     floatval_t* best_w;
 } lbfgs_internal_t;
 
 #define LBFGS_INTERNAL(crfvol)    ((lbfgs_internal_t*)((crfvol)->solver_data))
 
-inline static void update_model_expectations(
-    crfvol_feature_t* f,
-    const int fid,
-    floatval_t prob,
-    floatval_t scale,
-    crfvol_t* crfvol,
-    const crf_sequence_t* seq,
-    int t
-    )
-{
-    lbfgs_internal_t *lbfgsi = LBFGS_INTERNAL(crfvol);
-    lbfgsi->g[fid] += prob * scale;
-}
-
 static lbfgsfloatval_t lbfgs_evaluate(
     void *instance,
     const lbfgsfloatval_t *x,
@@ -83,54 +69,16 @@ static lbfgsfloatval_t lbfgs_evaluate(
     )
 {
     int i;
-    floatval_t logp = 0, logl = 0, norm = 0;
+    floatval_t logl = 0, norm = 0;
     crfvol_t* crfvot = (crfvol_t*)instance;
-    crf_sequence_t* seqs = crfvot->seqs;
-    const int N = crfvot->num_sequences;
-
     lbfgs_internal_t *lbfgsi = LBFGS_INTERNAL(crfvot);
 
-    if (!crfvot->exp_weight) {
-        crfvot->exp_weight = (floatval_t*)calloc(crfvot->num_features, sizeof(floatval_t));
-    }
-
-    for (i = 0; i < crfvot->num_features; ++i) {
-        crfvot->exp_weight[i] = exp(x[i]);
-    }
-
-    /* Set the gradient vector. */
-    lbfgsi->g = g;
-
-    /*
-        Set feature weights from the L-BFGS solver. Initialize model
-        expectations as zero.
-     */
-    for (i = 0;i < crfvot->num_features;++i) {
-        crfvol_feature_t* f = &crfvot->features[i];
-        g[i] = -f->freq;
-    }
-
     /*
-        Compute model expectations.
+        Compute the log-likelihood and the gradients of its negative
+        (model expectations minus observation expectations). Only the
+        objective is computed when g is NULL.
      */
-    for (i = 0;i < N;++i) {
-        /* Set label sequences and state scores. */
-        crfvoc_set_context(crfvot->ctx, &seqs[i]);
-
-        /*crfvoc_debug_context(crfvot->ctx, stdout);*/
-        /*printf("lognorm = %f\n", crfvot->ctx->log_norm);*/
-
-        crfvoc_set_weight(crfvot->ctx, crfvot->exp_weight);
-        crfvoc_calc_feature_expectations(crfvot->ctx);
-
-        /* Compute the probability of the input sequence on the model. */
-        logp = crfvoc_logprob(crfvot->ctx);
-        /* Update the log-likelihood. */
-        logl += logp;
-
-        /* Update the model expectations of features. */
-        crfvol_enum_features(crfvot, &seqs[i], update_model_expectations, &logp);
-    }
+    logl = crfvol_loglikelihood(crfvot, x, g);
 
     /*
         L2 regularization.
@@ -138,8 +86,7 @@ static lbfgsfloatval_t lbfgs_evaluate(
      */
     if (lbfgsi->l2_regularization) {
         for (i = 0;i < crfvot->num_features;++i) {
-            const crfvol_feature_t* f = &crfvot->features[i];
-            g[i] += (lbfgsi->sigma2inv * x[i]);
+            if (g != NULL) g[i] += (lbfgsi->sigma2inv * x[i]);
             norm += x[i] * x[i];
         }
         logl -= (lbfgsi->sigma2inv * norm * 0.5);
@@ -196,6 +143,282 @@ static int lbfgs_progress(
     return 0;
 }
 
+/*
+    L-BFGS with line searches that liblbfgs does not provide.
+
+    'Parallel': liblbfgs evaluates the trial steps of a line search one
+    after another. This driver instead evaluates a batch of step lengths
+    (1, 1/2, 1/4, ... times the initial step) at once, each on its own
+    thread with its own CRF context and buffers, and takes the longest step
+    satisfying the Wolfe conditions (or, failing that, the Armijo condition).
+
+    'Armijo': backtracking with the Armijo condition alone. A trial step
+    needs only the objective, which is computed by the forward pass; the
+    gradient is computed once for the accepted step.
+
+    The search direction is computed by the usual two-loop recursion.
+ */
+
+typedef struct {
+    crfvol_t trainer;       /**< Shallow copy of the trainer with its own context. */
+    floatval_t* x;          /**< Weights at the trial step. */
+    floatval_t* g;          /**< Gradients at the trial step. */
+    floatval_t fx;          /**< Objective at the trial step. */
+    floatval_t step;        /**< Trial step length. */
+} lbfgs_trial_t;
+
+typedef struct {
+    lbfgs_trial_t* trials;
+    const floatval_t* x;
+    const floatval_t* d;
+    int n;
+    int objective_only;
+} lbfgs_batch_t;
+
+static void lbfgs_evaluate_trial(void *instance, int i)
+{
+    int j;
+    lbfgs_batch_t* batch = (lbfgs_batch_t*)instance;
+    lbfgs_trial_t* trial = &batch->trials[i];
+
+    for (j = 0;j < batch->n;++j) {
+        trial->x[j] = batch->x[j] + trial->step * batch->d[j];
+    }
+    trial->fx = lbfgs_evaluate(
+        &trial->trainer, trial->x, batch->objective_only ? NULL : trial->g,
+        batch->n, trial->step);
+}
+
+static floatval_t vecdot(const floatval_t* x, const floatval_t* y, const int n)
+{
+    int i;
+    floatval_t s = 0.;
+    for (i = 0;i < n;++i) {
+        s += x[i] * y[i];
+    }
+    return s;
+}
+
+static int lbfgs_twoloop(
+    crfvol_t* crfvot,
+    floatval_t* x,
+    const crfvol_lbfgs_option_t* opt
+    )
+{
+    int i, j, k, l, ls, end = 0, num_pairs = 0, bound, ret = 0;
+    const int n = crfvot->num_features;
+    const int m = opt->memory;
+    const int armijo = (strcmp(opt->linesearch, "Armijo") == 0);
+    const int B = (armijo || opt->linesearch_num_threads < 1) ? 1 : opt->linesearch_num_threads;
+    const floatval_t ftol = 1e-4, wolfe = 0.9;
+    floatval_t *g = NULL, *d = NULL, *pf = NULL, *alpha = NULL, *ys_ = NULL;
+    floatval_t **s = NULL, **y = NULL;
+    floatval_t fx, xnorm, gnorm, dg, ys, yy, gamma = 1., beta, step0, step;
+    lbfgs_trial_t* trials = NULL;
+    lbfgs_trial_t* best = NULL;
+    lbfgs_batch_t batch;
+
+    /* Allocate the work space. */
+    g = (floatval_t*)calloc(n, sizeof(floatval_t));
+    d = (floatval_t*)calloc(n, sizeof(floatval_t));
+    pf = (floatval_t*)calloc(opt->stop + 1, sizeof(floatval_t));
+    alpha = (floatval_t*)calloc(m, sizeof(floatval_t));
+    ys_ = (floatval_t*)calloc(m, sizeof(floatval_t));
+    s = (floatval_t**)calloc(m, sizeof(floatval_t*));
+    y = (floatval_t**)calloc(m, sizeof(floatval_t*));
+    trials = (lbfgs_trial_t*)calloc(B, sizeof(lbfgs_trial_t));
+    if (g == NULL || d == NULL || pf == NULL || alpha == NULL ||
+        ys_ == NULL || s == NULL || y == NULL || trials == NULL) {
+        ret = LBFGSERR_OUTOFMEMORY;
+        goto error_exit;
+    }
+    for (i = 0;i < m;++i) {
+        s[i] = (floatval_t*)calloc(n, sizeof(floatval_t));
+        y[i] = (floatval_t*)calloc(n, sizeof(floatval_t));
+        if (s[i] == NULL || y[i] == NULL) {
+            ret = LBFGSERR_OUTOFMEMORY;
+            goto error_exit;
+        }
+    }
+
+    /* Each trial evaluates the objective with its own context and buffers. */
+    for (i = 0;i < B;++i) {
+        lbfgs_trial_t* trial = &trials[i];
+        memcpy(&trial->trainer, crfvot, sizeof(crfvol_t));
+        trial->trainer.ctx = crfvoc_new(crfvot->num_labels, crfvot->ctx->max_items, crfvot->ctx->max_paths);
+        trial->trainer.exp_weight = (floatval_t*)calloc(n, sizeof(floatval_t));
+        trial->x = (floatval_t*)calloc(n, sizeof(floatval_t));
+        trial->g = (floatval_t*)calloc(n, sizeof(floatval_t));
+        if (trial->trainer.ctx == NULL || trial->trainer.exp_weight == NULL ||
+            trial->x == NULL || trial->g == NULL) {
+            ret = LBFGSERR_OUTOFMEMORY;
+            goto error_exit;
+        }
+    }
+
+    batch.trials = trials;
+    batch.x = x;
+    batch.d = d;
+    batch.n = n;
+    batch.objective_only = armijo;
+
+    /* Evaluate the objective at the initial point. */
+    fx = lbfgs_evaluate(crfvot, x, g, n, 0);
+    pf[0] = fx;
+
+    xnorm = sqrt(vecdot(x, x, n));
+    gnorm = sqrt(vecdot(g, g, n));
+    if (gnorm / (xnorm < 1.0 ? 1.0 : xnorm) <= opt->epsilon) {
+        ret = LBFGS_ALREADY_MINIMIZED;
+        goto error_exit;
+    }
+
+    /* The initial direction is the steepest descent. */
+    for (i = 0;i < n;++i) d[i] = -g[i];
+    step0 = 1.0 / gnorm;
+
+    for (k = 1;;++k) {
+        /* Line search: evaluate batches of trial steps. */
+        dg = vecdot(g, d, n);
+        best = NULL;
+        step = step0;
+        for (ls = 0;best == NULL;) {
+            lbfgs_trial_t* sufficient = NULL;
+
+            for (i = 0;i < B;++i, step *= 0.5) {
+                trials[i].step = step;
+            }
+            parallel_run(B, lbfgs_evaluate_trial, &batch);
+            ls += B;
+
+            /* Trials are ordered from the longest step. */
+            for (i = 0;i < B;++i) {
+                lbfgs_trial_t* trial = &trials[i];
+                if (trial->fx <= fx + ftol * trial->step * dg) {
+                    if (sufficient == NULL) sufficient = trial;
+                    if (armijo || wolfe * dg <= vecdot(trial->g, d, n)) {
+                        best = trial;
+                        break;
+                    }
+                }
+            }
+            if (best == NULL) {
+                best = sufficient;
+            }
+            if (best == NULL && opt->linesearch_max_iterations <= ls) {
+                ret = LBFGSERR_MAXIMUMLINESEARCH;
+                break;
+            }
+        }
+        if (best == NULL) {
+            /* The trainer still holds the weights of the last point. */
+            break;
+        }
+
+        if (armijo) {
+            /* Compute the gradient at the accepted step. */
+            best->fx = lbfgs_evaluate(&best->trainer, best->x, best->g, n, best->step);
+        }
+
+        /* Move to the accepted point, and store the correction pair. */
+        for (i = 0;i < n;++i) {
+            s[end][i] = best->x[i] - x[i];
+            y[end][i] = best->g[i] - g[i];
+            x[i] = best->x[i];
+            g[i] = best->g[i];
+            crfvot->exp_weight[i] = best->trainer.exp_weight[i];
+        }
+        fx = best->fx;
+        step = best->step;
+
+        xnorm = sqrt(vecdot(x, x, n));
+        gnorm = sqrt(vecdot(g, g, n));
+        lbfgs_progress(crfvot, x, g, fx, xnorm, gnorm, step, n, k, ls);
+
+        /* Convergence test. */
+        if (gnorm / (xnorm < 1.0 ? 1.0 : xnorm) <= opt->epsilon) {
+            ret = LBFGS_CONVERGENCE;
+            break;
+        }
+
+        /* Stopping criterion on the improvement of the objective. */
+        if (0 < opt->stop) {
+            if (opt->stop <= k) {
+                const floatval_t rate = (pf[k % opt->stop] - fx) / fx;
+                if (rate < opt->delta) {
+                    ret = LBFGS_STOP;
+                    break;
+                }
+            }
+            pf[k % opt->stop] = fx;
+        }
+
+        if (opt->max_iterations != 0 && opt->max_iterations <= k) {
+            ret = LBFGSERR_MAXIMUMITERATION;
+            break;
+        }
+
+        /*
+            Keep the correction pair only if it preserves the positive
+            definiteness, which the Armijo condition does not guarantee.
+         */
+        ys = vecdot(y[end], s[end], n);
+        if (0. < ys) {
+            yy = vecdot(y[end], y[end], n);
+            ys_[end] = ys;
+            gamma = ys / yy;
+            end = (end + 1) % m;
+            if (num_pairs < m) ++num_pairs;
+        }
+
+        /* Compute the search direction by the two-loop recursion. */
+        for (l = 0;l < n;++l) d[l] = -g[l];
+        if (num_pairs == 0) {
+            step0 = 1.0 / gnorm;
+            continue;
+        }
+        bound = num_pairs;
+        j = end;
+        for (i = 0;i < bound;++i) {
+            j = (j + m - 1) % m;
+            alpha[j] = vecdot(s[j], d, n) / ys_[j];
+            for (l = 0;l < n;++l) d[l] -= alpha[j] * y[j][l];
+        }
+        for (l = 0;l < n;++l) d[l] *= gamma;
+        for (i = 0;i < bound;++i) {
+            beta = vecdot(y[j], d, n) / ys_[j];
+            for (l = 0;l < n;++l) d[l] += (alpha[j] - beta) * s[j][l];
+            j = (j + 1) % m;
+        }
+        step0 = 1.0;
+    }
+
+error_exit:
+    if (trials != NULL) {
+        for (i = 0;i < B;++i) {
+            crfvoc_delete(trials[i].trainer.ctx);
+            free(trials[i].trainer.exp_weight);
+            free(trials[i].x);
+            free(trials[i].g);
+        }
+    }
+    if (s != NULL && y != NULL) {
+        for (i = 0;i < m;++i) {
+            free(s[i]);
+            free(y[i]);
+        }
+    }
+    free(trials);
+    free(y);
+    free(s);
+    free(ys_);
+    free(alpha);
+    free(pf);
+    free(d);
+    free(g);
+    return ret;
+}
+
 int crfvol_lbfgs_options(crf_params_t* params, crfvol_option_t* opt, int mode)
 {
     crfvol_lbfgs_option_t* lbfgs = &opt->lbfgs;
@@ -234,12 +457,20 @@ int crfvol_lbfgs_options(crf_params_t* params, crfvol_option_t* opt, int mode)
         DDX_PARAM_STRING(
             "lbfgs.linesearch", lbfgs->linesearch, "MoreThuente",
             "The line search algorithm used in L-BFGS updates:\n"
-            "{'MoreThuente': More and Thuente's method, 'Backtracking': backtracking}"
+            "{'MoreThuente': More and Thuente's method, 'Backtracking': backtracking,\n"
+            " 'Parallel': trial steps evaluated concurrently (L2 or no regularization),\n"
+            " 'Armijo': backtracking evaluating only the objective at trial steps\n"
+            " (L2 or no regularization)}"
             )
         DDX_PARAM_INT(
             "lbfgs.linesearch.max_iterations", lbfgs->linesearch_max_iterations, 20,
             "The maximum number of trials for the line search algorithm."
             )
+        DDX_PARAM_INT(
+            "lbfgs.linesearch.num_threads", lbfgs->linesearch_num_threads, 4,
+            "The number of trial steps evaluated concurrently by the Parallel\n"
+            "line search."
+            )
     END_PARAM_MAP()
 
     return 0;
@@ -252,11 +483,18 @@ int crfvol_lbfgs(
     )
 {
     int i, ret;
-    const int K = crfvot->num_features;
+    int K;
     lbfgs_internal_t lbfgsi;
     lbfgs_parameter_t lbfgsparam;
     crfvol_lbfgs_option_t* lbfgsopt = &opt->lbfgs;
 
+    /* libLBFGS indexes the weight vector with int. */
+    if (INT_MAX < crfvot->num_features) {
+        logging(crfvot->lg, "L-BFGS cannot optimize %lld features; use another algorithm\n", (long long)crfvot->num_features);
+        return CRFERR_OVERFLOW;
+    }
+    K = (int)crfvot->num_features;
+
     /* Set the solver-specific information. */
     crfvot->solver_data = &lbfgsi;
 
@@ -282,6 +520,9 @@ int crfvol_lbfgs(
     logging(crfvot->lg, "lbfgs.delta: %f\n", lbfgsopt->delta);
     logging(crfvot->lg, "lbfgs.linesearch: %s\n", lbfgsopt->linesearch);
     logging(crfvot->lg, "lbfgs.linesearch.max_iterations: %d\n", lbfgsopt->linesearch_max_iterations);
+    if (strcmp(lbfgsopt->linesearch, "Parallel") == 0) {
+        logging(crfvot->lg, "lbfgs.linesearch.num_threads: %d\n", lbfgsopt->linesearch_num_threads);
+    }
     logging(crfvot->lg, "\n");
 
     /* Set parameters for L-BFGS. */
@@ -316,15 +557,21 @@ int crfvol_lbfgs(
     /* Call the L-BFGS solver. */
     crfvot->clk_begin = clock();
     crfvot->clk_prev = crfvot->clk_begin;
-    ret = lbfgs(
-        crfvot->num_features,
-        crfvot->w,
-        NULL,
-        lbfgs_evaluate,
-        lbfgs_progress,
-        crfvot,
-        &lbfgsparam
-        );
+    if ((strcmp(lbfgsopt->linesearch, "Parallel") == 0 ||
+         strcmp(lbfgsopt->linesearch, "Armijo") == 0) &&
+        lbfgsparam.orthantwise_c == 0.) {
+        ret = lbfgs_twoloop(crfvot, crfvot->w, lbfgsopt);
+    } else {
+        ret = lbfgs(
+            K,
+            crfvot->w,
+            NULL,
+            lbfgs_evaluate,
+            lbfgs_progress,
+            crfvot,
+            &lbfgsparam
+            );
+    }
     if (ret == LBFGS_CONVERGENCE) {
         logging(crfvot->lg, "L-BFGS resulted in convergence\n");
     } else if (ret == LBFGS_STOP) {
@@ -0,0 +1,459 @@
+/*
+ *      Training variable-order CRF with truncated Newton method.
+ *
+ * Copyright (c) 2007-2010, Naoaki Okazaki
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the names of the authors nor the names of its contributors
+ *       may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* $Id$ */
+
+#ifdef    HAVE_CONFIG_H
+#include <config.h>
+#endif/*HAVE_CONFIG_H*/
+
+#include <os.h>
+
+#include <float.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+
+#include <crfsuite.h>
+#include "crfvo.h"
+
+#include "logging.h"
+#include "params.h"
+#include "parallel.h"
+
+#include <math.h>
+
+/*
+    Hessian-free (truncated) Newton method. Every outer iteration solves
+    the Newton system H d = -g approximately by the conjugate gradient
+    method, and takes a step along d with a backtracking line search. The
+    Hessian is never formed: a Hessian-vector product is computed from the
+    gradient at a slightly perturbed point,
+        H v ~ (g(w + e * v) - g(w)) / e,
+    which costs one more forward-backward sweep over the training data.
+
+    Both the gradient and the Hessian-vector product are computed by
+    splitting the training data into parts, each processed on its own
+    thread with its own CRF context and gradient buffer; the parts are
+    summed up in a fixed order, so the results do not depend on timing.
+ */
+
+typedef struct {
+    crfvol_t trainer;       /**< Shallow copy of the trainer with its own context. */
+    floatval_t* g;          /**< Model expectations over the part. */
+    floatval_t logl;        /**< Log-likelihood of the part. */
+} newton_worker_t;
+
+typedef struct {
+    int l2_regularization;
+    floatval_t sigma2inv;
+    int num_workers;
+    newton_worker_t* workers;
+    const floatval_t* exp_weight;
+} newton_internal_t;
+
+#define NEWTON_INTERNAL(crfvol)    ((newton_internal_t*)((crfvol)->solver_data))
+
+static floatval_t dot(const floatval_t* x, const floatval_t* y, const fid_t n)
+{
+    fid_t i;
+    floatval_t s = 0.;
+    for (i = 0;i < n;++i) {
+        s += x[i] * y[i];
+    }
+    return s;
+}
+
+static void evaluate_part(void *instance, int t)
+{
+    int i;
+    fid_t k;
+    newton_internal_t *newtoni = (newton_internal_t*)instance;
+    newton_worker_t* worker = &newtoni->workers[t];
+    crfvol_t* trainer = &worker->trainer;
+    const int N = trainer->num_sequences;
+    const int end = (int)((int64_t)N * (t + 1) / newtoni->num_workers);
+
+    for (k = 0;k < trainer->num_features;++k) {
+        worker->g[k] = 0.;
+    }
+    worker->logl = 0.;
+    for (i = (int)((int64_t)N * t / newtoni->num_workers);i < end;++i) {
+        worker->logl += crfvol_sequence_expectations(
+            trainer, &trainer->seqs[i], newtoni->exp_weight, worker->g);
+    }
+}
+
+/*
+    Compute the log-likelihood of the training data and its gradients at w
+    as crfvol_loglikelihood() does, with the parts of the data evaluated
+    concurrently.
+ */
+static floatval_t loglikelihood(crfvol_t* crfvot, const floatval_t* w, floatval_t* g)
+{
+    int t;
+    fid_t k;
+    floatval_t logl = 0;
+    newton_internal_t *newtoni = NEWTON_INTERNAL(crfvot);
+    const fid_t K = crfvot->num_features;
+
+    if (newtoni->num_workers <= 1) {
+        return crfvol_loglikelihood(crfvot, w, g);
+    }
+
+    for (k = 0;k < K;++k) {
+        crfvot->exp_weight[k] = exp(w[k]);
+    }
+    newtoni->exp_weight = crfvot->exp_weight;
+    parallel_run(newtoni->num_workers, evaluate_part, newtoni);
+
+    for (k = 0;k < K;++k) {
+        g[k] = -crfvot->features[k].freq;
+    }
+    for (t = 0;t < newtoni->num_workers;++t) {
+        const floatval_t* wg = newtoni->workers[t].g;
+        for (k = 0;k < K;++k) {
+            g[k] += wg[k];
+        }
+        logl += newtoni->workers[t].logl;
+    }
+    return logl;
+}
+
+/*
+    Compute the objective (negative log-likelihood plus the L2 term) and its
+    gradients at w.
+ */
+static floatval_t evaluate(crfvol_t* crfvot, const floatval_t* w, floatval_t* g)
+{
+    fid_t i;
+    floatval_t logl = 0, norm = 0;
+    newton_internal_t *newtoni = NEWTON_INTERNAL(crfvot);
+
+    logl = loglikelihood(crfvot, w, g);
+
+    if (newtoni->l2_regularization) {
+        for (i = 0;i < crfvot->num_features;++i) {
+            g[i] += (newtoni->sigma2inv * w[i]);
+            norm += w[i] * w[i];
+        }
+        logl -= (newtoni->sigma2inv * norm * 0.5);
+    }
+
+    return -logl;
+}
+
+int crfvol_newton_options(crf_params_t* params, crfvol_option_t* opt, int mode)
+{
+    crfvol_newton_option_t* newton = &opt->newton;
+
+    BEGIN_PARAM_MAP(params, mode)
+        DDX_PARAM_INT(
+            "newton.max_iterations", newton->max_iterations, 100,
+            "The maximum number of Newton iterations."
+            )
+        DDX_PARAM_INT(
+            "newton.cg.max_iterations", newton->cg_max_iterations, 20,
+            "The maximum number of conjugate gradient iterations for solving\n"
+            "a Newton system; each costs one pass over the training data."
+            )
+        DDX_PARAM_FLOAT(
+            "newton.epsilon", newton->epsilon, 1e-5,
+            "Epsilon for testing the convergence of the objective."
+            )
+        DDX_PARAM_INT(
+            "newton.stop", newton->stop, 5,
+            "The duration of iterations to test the stopping criterion."
+            )
+        DDX_PARAM_FLOAT(
+            "newton.delta", newton->delta, 1e-5,
+            "The threshold for the stopping criterion; the optimization stops when the\n"
+            "improvement of the log likelihood over the last ${newton.stop} iterations\n"
+            "is no greater than this threshold."
+            )
+        DDX_PARAM_INT(
+            "newton.linesearch.max_iterations", newton->linesearch_max_iterations, 20,
+            "The maximum number of trials for the backtracking line search."
+            )
+        DDX_PARAM_INT(
+            "newton.num_threads", newton->num_threads, 4,
+            "The number of threads computing the gradients and the Hessian-vector\n"
+            "products, each over a part of the training data."
+            )
+    END_PARAM_MAP()
+
+    return 0;
+}
+
+int crfvol_newton(
+    crfvol_t* crfvot,
+    crfvol_option_t *opt
+    )
+{
+    int j, k, ls, t, ret = 0;
+    fid_t i, num_active_features;
+    const fid_t K = crfvot->num_features;
+    floatval_t* w = crfvot->w;
+    floatval_t *g = NULL, *d = NULL, *r = NULL, *p = NULL, *hp = NULL;
+    floatval_t *w1 = NULL, *g1 = NULL, *pf = NULL;
+    floatval_t fx, fx1, gnorm, xnorm, rr, rr1, pnorm, alpha, beta, eps, php, gd, step = 0.;
+    clock_t duration, clk;
+    newton_internal_t newtoni;
+    crfvol_newton_option_t* newtonopt = &opt->newton;
+    crfvol_lbfgs_option_t* lbfgsopt = &opt->lbfgs;
+
+    memset(&newtoni, 0, sizeof(newtoni));
+    crfvot->solver_data = &newtoni;
+
+    /* Allocate the work space. */
+    g = (floatval_t*)calloc(K, sizeof(floatval_t));
+    d = (floatval_t*)calloc(K, sizeof(floatval_t));
+    r = (floatval_t*)calloc(K, sizeof(floatval_t));
+    p = (floatval_t*)calloc(K, sizeof(floatval_t));
+    hp = (floatval_t*)calloc(K, sizeof(floatval_t));
+    w1 = (floatval_t*)calloc(K, sizeof(floatval_t));
+    g1 = (floatval_t*)calloc(K, sizeof(floatval_t));
+    pf = (floatval_t*)calloc(newtonopt->stop + 1, sizeof(floatval_t));
+    if (g == NULL || d == NULL || r == NULL || p == NULL || hp == NULL ||
+        w1 == NULL || g1 == NULL || pf == NULL) {
+        ret = CRFERR_OUTOFMEMORY;
+        goto error_exit;
+    }
+
+    /* Each worker evaluates a part of the data with its own context. */
+    newtoni.num_workers = newtonopt->num_threads;
+    if (crfvot->num_sequences < newtoni.num_workers) {
+        newtoni.num_workers = crfvot->num_sequences;
+    }
+    if (1 < newtoni.num_workers) {
+        if (crfvot->exp_weight == NULL) {
+            crfvot->exp_weight = (floatval_t*)calloc(K, sizeof(floatval_t));
+        }
+        newtoni.workers = (newton_worker_t*)calloc(newtoni.num_workers, sizeof(newton_worker_t));
+        if (crfvot->exp_weight == NULL || newtoni.workers == NULL) {
+            ret = CRFERR_OUTOFMEMORY;
+            goto error_exit;
+        }
+        for (t = 0;t < newtoni.num_workers;++t) {
+            newton_worker_t* worker = &newtoni.workers[t];
+            memcpy(&worker->trainer, crfvot, sizeof(crfvol_t));
+            worker->trainer.ctx = crfvoc_new(crfvot->num_labels, crfvot->ctx->max_items, crfvot->ctx->max_paths);
+            worker->g = (floatval_t*)calloc(K, sizeof(floatval_t));
+            if (worker->trainer.ctx == NULL || worker->g == NULL) {
+                ret = CRFERR_OUTOFMEMORY;
+                goto error_exit;
+            }
+        }
+    }
+
+    /* Only L2 regularization is supported by this solver. */
+    if (strcmp(lbfgsopt->regularization, "L2") == 0) {
+        newtoni.l2_regularization = 1;
+        newtoni.sigma2inv = 1.0 / (lbfgsopt->regularization_sigma * lbfgsopt->regularization_sigma);
+    } else {
+        newtoni.l2_regularization = 0;
+        newtoni.sigma2inv = 0.;
+    }
+
+    logging(crfvot->lg, "Hessian-free Newton-CG optimization\n");
+    logging(crfvot->lg, "regularization: %s\n", newtoni.l2_regularization ? "L2" : "none");
+    logging(crfvot->lg, "regularization.sigma: %f\n", lbfgsopt->regularization_sigma);
+    logging(crfvot->lg, "newton.max_iterations: %d\n", newtonopt->max_iterations);
+    logging(crfvot->lg, "newton.cg.max_iterations: %d\n", newtonopt->cg_max_iterations);
+    logging(crfvot->lg, "newton.epsilon: %f\n", newtonopt->epsilon);
+    logging(crfvot->lg, "newton.stop: %d\n", newtonopt->stop);
+    logging(crfvot->lg, "newton.delta: %f\n", newtonopt->delta);
+    logging(crfvot->lg, "newton.linesearch.max_iterations: %d\n", newtonopt->linesearch_max_iterations);
+    logging(crfvot->lg, "newton.num_threads: %d\n", newtonopt->num_threads);
+    logging(crfvot->lg, "\n");
+
+    crfvot->clk_begin = clock();
+    crfvot->clk_prev = crfvot->clk_begin;
+
+    fx = evaluate(crfvot, w, g);
+    pf[0] = fx;
+
+    for (k = 1;k <= newtonopt->max_iterations;++k) {
+        /* Convergence test. */
+        gnorm = sqrt(dot(g, g, K));
+        xnorm = sqrt(dot(w, w, K));
+        if (gnorm / (xnorm < 1.0 ? 1.0 : xnorm) <= newtonopt->epsilon) {
+            logging(crfvot->lg, "Newton-CG resulted in convergence\n");
+            break;
+        }
+
+        /*
+            Solve H d = -g by the conjugate gradient method, terminated
+            when the residual falls below min(0.5, sqrt(|g|)) * |g|.
+         */
+        for (i = 0;i < K;++i) {
+            d[i] = 0.;
+            r[i] = p[i] = -g[i];
+        }
+        rr = gnorm * gnorm;
+        for (j = 0;j < newtonopt->cg_max_iterations;++j) {
+            /* Hessian-vector product by the finite difference of gradients. */
+            pnorm = sqrt(dot(p, p, K));
+            eps = sqrt(DBL_EPSILON) * (1.0 + xnorm) / pnorm;
+            for (i = 0;i < K;++i) {
+                w1[i] = w[i] + eps * p[i];
+            }
+            evaluate(crfvot, w1, hp);
+            for (i = 0;i < K;++i) {
+                hp[i] = (hp[i] - g[i]) / eps;
+            }
+
+            php = dot(p, hp, K);
+            if (php <= 0.) {
+                /* Negative curvature: fall back to the steepest descent. */
+                if (j == 0) {
+                    for (i = 0;i < K;++i) d[i] = -g[i];
+                }
+                ++j;
+                break;
+            }
+
+            alpha = rr / php;
+            for (i = 0;i < K;++i) {
+                d[i] += alpha * p[i];
+                r[i] -= alpha * hp[i];
+            }
+            rr1 = dot(r, r, K);
+            if (sqrt(rr1) <= (gnorm < 0.25 ? sqrt(gnorm) : 0.5) * gnorm) {
+                ++j;
+                break;
+            }
+            beta = rr1 / rr;
+            rr = rr1;
+            for (i = 0;i < K;++i) {
+                p[i] = r[i] + beta * p[i];
+            }
+        }
+
+        /* Backtracking line search with the Armijo condition. */
+        gd = dot(g, d, K);
+        if (0. <= gd) {
+            /* Not a descent direction. */
+            for (i = 0;i < K;++i) d[i] = -g[i];
+            gd = -gnorm * gnorm;
+        }
+        step = 1.0;
+        for (ls = 1;;++ls) {
+            for (i = 0;i < K;++i) {
+                w1[i] = w[i] + step * d[i];
+            }
+            fx1 = evaluate(crfvot, w1, g1);
+            if (fx1 <= fx + 1e-4 * step * gd) {
+                break;
+            }
+            if (newtonopt->linesearch_max_iterations <= ls) {
+                break;
+            }
+            step *= 0.5;
+        }
+        if (!(fx1 <= fx)) {
+            /* Restore the weights. */
+            evaluate(crfvot, w, g);
+            logging(crfvot->lg, "Newton-CG terminated: the line search failed\n");
+            break;
+        }
+
+        /* Move to the new point. */
+        fx = fx1;
+        num_active_features = 0;
+        for (i = 0;i < K;++i) {
+            w[i] = w1[i];
+            g[i] = g1[i];
+            if (w[i] != 0.) ++num_active_features;
+        }
+
+        clk = clock();
+        duration = clk - crfvot->clk_prev;
+        crfvot->clk_prev = clk;
+
+        /* Report the progress. */
+        logging(crfvot->lg, "***** Iteration #%d *****\n", k);
+        logging(crfvot->lg, "Log-likelihood: %f\n", -fx);
+        logging(crfvot->lg, "Feature norm: %f\n", sqrt(dot(w, w, K)));
+        logging(crfvot->lg, "Error norm: %f\n", sqrt(dot(g, g, K)));
+        logging(crfvot->lg, "Active features: %lld\n", (long long)num_active_features);
+        logging(crfvot->lg, "CG iterations: %d\n", j);
+        logging(crfvot->lg, "Line search trials: %d\n", ls);
+        logging(crfvot->lg, "Line search step: %f\n", step);
+        logging(crfvot->lg, "Seconds required for this iteration: %.3f\n", duration / (double)CLOCKS_PER_SEC);
+
+        /* Send the tagger with the current parameters. */
+        if (crfvot->cbe_proc != NULL) {
+            /* Callback notification with the tagger object. */
+            crfvot->cbe_proc(crfvot->cbe_instance, &crfvot->tagger);
+        }
+        logging(crfvot->lg, "\n");
+
+        /* Stopping criterion on the improvement of the objective. */
+        if (0 < newtonopt->stop) {
+            if (newtonopt->stop <= k) {
+                const floatval_t rate = (pf[k % newtonopt->stop] - fx) / fx;
+                if (rate < newtonopt->delta) {
+                    logging(crfvot->lg, "Newton-CG terminated with the stopping criteria\n");
+                    break;
+                }
+            }
+            pf[k % newtonopt->stop] = fx;
+        }
+    }
+
+    if (newtonopt->max_iterations < k) {
+        logging(crfvot->lg, "Newton-CG terminated with the maximum number of iterations\n");
+    }
+
+    logging(crfvot->lg, "Total seconds required for Newton-CG: %.3f\n", (clock() - crfvot->clk_begin) / (double)CLOCKS_PER_SEC);
+    logging(crfvot->lg, "\n");
+
+error_exit:
+    if (newtoni.workers != NULL) {
+        for (t = 0;t < newtoni.num_workers;++t) {
+            crfvoc_delete(newtoni.workers[t].trainer.ctx);
+            free(newtoni.workers[t].g);
+        }
+        free(newtoni.workers);
+    }
+    free(pf);
+    free(g1);
+    free(w1);
+    free(hp);
+    free(p);
+    free(r);
+    free(d);
+    free(g);
+    crfvot->solver_data = NULL;
+    return ret;
+}
@@ -0,0 +1,354 @@
+/*
+ *      Training variable-order CRF with structured SVM (Pegasos).
+ *
+ * Copyright (c) 2007-2010, Naoaki Okazaki
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the names of the authors nor the names of its contributors
+ *       may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* $Id$ */
+
+#ifdef    HAVE_CONFIG_H
+#include <config.h>
+#endif/*HAVE_CONFIG_H*/
+
+#include <os.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+
+#include <crfsuite.h>
+#include "crfvo.h"
+
+#include "logging.h"
+#include "params.h"
+
+#include <math.h>
+
+/*
+    This solver minimizes the structured hinge loss with the Hamming loss,
+        (1/N) \sum_i max_y { Delta(y, y_i) + w.phi(x_i, y) - w.phi(x_i, y_i) }
+            + (lambda/2) |w|^2,
+    where lambda = sigma2inv / N, by Pegasos-style stochastic subgradient
+    steps. The inner maximization is a Viterbi decoding on the lattice whose
+    path weights are augmented with the loss, so that no forward-backward
+    computation is necessary.
+
+    The weight vector is represented as w = scale * v so that the decay
+    caused by the regularization term costs O(1) per step.
+ */
+
+typedef struct {
+    floatval_t gain;        /**< Coefficient for updating v. */
+} ssvm_internal_t;
+
+#define SSVM_INTERNAL(crfvol)    ((ssvm_internal_t*)((crfvol)->solver_data))
+
+inline static void update_weights(
+    crfvol_feature_t* f,
+    const fid_t fid,
+    floatval_t prob,
+    floatval_t scale,
+    crfvol_t* crfvol,
+    const crf_sequence_t* seq,
+    int t
+    )
+{
+    ssvm_internal_t *ssvmi = SSVM_INTERNAL(crfvol);
+    crfvol->w[fid] += ssvmi->gain * prob * scale;
+}
+
+/*
+    Mark the paths of the reference labels with +1 and the paths of the
+    decoded labels with -1 so that crfvol_enum_features() yields
+    phi(x, y_i) - phi(x, y^). Returns zero if the both are identical.
+ */
+static int set_path_differences(crfvo_context_t* ctx)
+{
+    int i, t, n, differ = 0;
+    const int T = ctx->num_items;
+
+    for (t = 0;t < T;++t) {
+        crfvo_path_score_t* path_scores = ctx->path_scores[t];
+        for (i = 0;i < ctx->num_paths[t];++i) {
+            path_scores[i].score = 0.;
+        }
+        if (ctx->training_path_indexes[t] == ctx->best_path_indexes[t]) {
+            continue;
+        }
+        differ = 1;
+        for (n = ctx->training_path_indexes[t];n > 0;n = path_scores[n].path.longest_suffix_index) {
+            path_scores[n].score += 1.;
+        }
+        for (n = ctx->best_path_indexes[t];n > 0;n = path_scores[n].path.longest_suffix_index) {
+            path_scores[n].score -= 1.;
+        }
+    }
+    return differ;
+}
+
+static floatval_t reference_score(crfvo_context_t* ctx)
+{
+    int t;
+    floatval_t ret = 0.;
+
+    for (t = 0;t < ctx->num_items;++t) {
+        ret += log(ctx->path_scores[t][ctx->training_path_indexes[t]].exp_weight);
+    }
+    return ret;
+}
+
+/*
+    Compute the objective at the current weights by decoding every sequence
+    with the augmented loss. This sets crfvot->exp_weight.
+ */
+static floatval_t objective(crfvol_t* crfvot, floatval_t loss, floatval_t sigma2inv)
+{
+    int i;
+    fid_t k;
+    floatval_t ret = 0., norm = 0.;
+    crfvo_context_t* ctx = crfvot->ctx;
+    const floatval_t* w = crfvot->w;
+
+    for (k = 0;k < crfvot->num_features;++k) {
+        crfvot->exp_weight[k] = exp(w[k]);
+        norm += w[k] * w[k];
+    }
+    for (i = 0;i < crfvot->num_sequences;++i) {
+        crfvoc_set_context(ctx, &crfvot->seqs[i]);
+        crfvoc_set_weight(ctx, crfvot->exp_weight);
+        crfvoc_augment_loss(ctx, loss);
+        ret += crfvoc_decode(ctx) - reference_score(ctx);
+    }
+    return ret + sigma2inv * norm * 0.5;
+}
+
+int crfvol_ssvm_options(crf_params_t* params, crfvol_option_t* opt, int mode)
+{
+    crfvol_ssvm_option_t* ssvm = &opt->ssvm;
+
+    BEGIN_PARAM_MAP(params, mode)
+        DDX_PARAM_FLOAT(
+            "ssvm.eta", ssvm->eta, 0.1,
+            "The initial learning rate."
+            )
+        DDX_PARAM_FLOAT(
+            "ssvm.loss", ssvm->loss, 1.0,
+            "The loss for each item labeled incorrectly (Hamming loss)."
+            )
+        DDX_PARAM_INT(
+            "ssvm.max_iterations", ssvm->max_iterations, 100,
+            "The maximum number of epochs."
+            )
+        DDX_PARAM_INT(
+            "ssvm.stop", ssvm->stop, 10,
+            "The duration of epochs to test the stopping criterion."
+            )
+        DDX_PARAM_FLOAT(
+            "ssvm.delta", ssvm->delta, 1e-5,
+            "The threshold for the stopping criterion; the optimization stops when the\n"
+            "improvement of the objective over the last ${ssvm.stop} epochs is no\n"
+            "greater than this threshold."
+            )
+    END_PARAM_MAP()
+
+    return 0;
+}
+
+int crfvol_ssvm(
+    crfvol_t* crfvot,
+    crfvol_option_t *opt
+    )
+{
+    int i, t, epoch, ret = 0;
+    int num_errors;
+    fid_t j, num_active_features;
+    long step = 0;
+    const fid_t K = crfvot->num_features;
+    const int N = crfvot->num_sequences;
+    crf_sequence_t* seqs = crfvot->seqs;
+    crfvo_context_t* ctx = crfvot->ctx;
+    floatval_t* w = crfvot->w;
+    floatval_t *pf = NULL;
+    int *perm = NULL;
+    floatval_t sigma2inv = 0., lambda, eta, scale = 1., loss, norm;
+    clock_t duration, clk;
+    ssvm_internal_t ssvmi;
+    crfvol_ssvm_option_t* ssvmopt = &opt->ssvm;
+    crfvol_lbfgs_option_t* lbfgsopt = &opt->lbfgs;
+
+    crfvot->solver_data = &ssvmi;
+
+    /* Allocate the work space. */
+    if (!crfvot->exp_weight) {
+        crfvot->exp_weight = (floatval_t*)calloc(K, sizeof(floatval_t));
+    }
+    pf = (floatval_t*)calloc(ssvmopt->stop + 1, sizeof(floatval_t));
+    perm = (int*)calloc(N, sizeof(int));
+    if (crfvot->exp_weight == NULL || pf == NULL || perm == NULL) {
+        ret = CRFERR_OUTOFMEMORY;
+        goto error_exit;
+    }
+
+    /* Only L2 regularization is supported by this solver. */
+    if (strcmp(lbfgsopt->regularization, "L2") == 0) {
+        sigma2inv = 1.0 / (lbfgsopt->regularization_sigma * lbfgsopt->regularization_sigma);
+    }
+    lambda = sigma2inv / N;
+    eta = ssvmopt->eta;
+
+    logging(crfvot->lg, "Structured SVM (Pegasos)\n");
+    logging(crfvot->lg, "regularization: %s\n", sigma2inv != 0. ? "L2" : "none");
+    logging(crfvot->lg, "regularization.sigma: %f\n", lbfgsopt->regularization_sigma);
+    logging(crfvot->lg, "ssvm.eta: %f\n", ssvmopt->eta);
+    logging(crfvot->lg, "ssvm.loss: %f\n", ssvmopt->loss);
+    logging(crfvot->lg, "ssvm.max_iterations: %d\n", ssvmopt->max_iterations);
+    logging(crfvot->lg, "ssvm.stop: %d\n", ssvmopt->stop);
+    logging(crfvot->lg, "ssvm.delta: %f\n", ssvmopt->delta);
+    logging(crfvot->lg, "\n");
+
+    crfvot->clk_begin = clock();
+    crfvot->clk_prev = crfvot->clk_begin;
+
+    crfvol_shuffle(perm, N, 1);
+
+    /* The objective at the initial weights for the stopping criterion. */
+    if (0 < ssvmopt->stop) {
+        pf[0] = objective(crfvot, ssvmopt->loss, sigma2inv);
+    }
+
+    for (epoch = 1;epoch <= ssvmopt->max_iterations;++epoch) {
+        loss = 0.;
+        num_errors = 0;
+        crfvol_shuffle(perm, N, 0);
+
+        for (i = 0;i < N;++i, ++step) {
+            const crf_sequence_t* seq = &seqs[perm[i]];
+
+            /* Compute the weights of the features in the sequence. */
+            for (t = 0;t < seq->num_items;++t) {
+                const crfvopd_t* pd = (const crfvopd_t*)seq->items[t].preprocessed_data;
+                for (j = 0;j < pd->num_fids;++j) {
+                    const fid_t k = pd->fids[j];
+                    crfvot->exp_weight[k] = exp(scale * w[k]);
+                }
+            }
+
+            /* Find the most violating label sequence. */
+            crfvoc_set_context(ctx, seq);
+            crfvoc_set_weight(ctx, crfvot->exp_weight);
+            crfvoc_augment_loss(ctx, ssvmopt->loss);
+            loss += crfvoc_decode(ctx) - reference_score(ctx);
+
+            /* Decay the weights by the regularization term. */
+            eta = ssvmopt->eta / (1. + lambda * ssvmopt->eta * step);
+            scale *= (1. - eta * lambda);
+
+            /* Move the weights towards the reference labels. */
+            if (set_path_differences(ctx)) {
+                ++num_errors;
+                ssvmi.gain = eta / scale;
+                crfvol_enum_features(crfvot, seq, update_weights, NULL);
+            }
+
+            /* Fold the scaling factor into the weights to avoid underflow. */
+            if (scale < 1e-20) {
+                for (j = 0;j < K;++j) w[j] *= scale;
+                scale = 1.;
+            }
+        }
+
+        /* Fold the scaling factor into the weights. */
+        norm = 0.;
+        num_active_features = 0;
+        for (j = 0;j < K;++j) {
+            w[j] *= scale;
+            crfvot->exp_weight[j] = exp(w[j]);
+            norm += w[j] * w[j];
+            if (w[j] != 0.) ++num_active_features;
+        }
+        scale = 1.;
+        loss += sigma2inv * norm * 0.5;
+
+        clk = clock();
+        duration = clk - crfvot->clk_prev;
+        crfvot->clk_prev = clk;
+
+        /* Report the progress. */
+        logging(crfvot->lg, "***** Epoch #%d *****\n", epoch);
+        logging(crfvot->lg, "Loss: %f\n", loss);
+        logging(crfvot->lg, "Feature norm: %f\n", sqrt(norm));
+        logging(crfvot->lg, "Margin violations: %d (%d)\n", num_errors, N);
+        logging(crfvot->lg, "Active features: %lld\n", (long long)num_active_features);
+        logging(crfvot->lg, "Learning rate (eta): %f\n", eta);
+        logging(crfvot->lg, "Seconds required for this iteration: %.3f\n", duration / (double)CLOCKS_PER_SEC);
+
+        /* Send the tagger with the current parameters. */
+        if (crfvot->cbe_proc != NULL) {
+            /* Callback notification with the tagger object. */
+            crfvot->cbe_proc(crfvot->cbe_instance, &crfvot->tagger);
+        }
+        logging(crfvot->lg, "\n");
+
+        /*
+            Without regularization (regularization other than L2), an
+            epoch with no margin violations leaves the weights unchanged,
+            and so would every later epoch. With L2, the weights still
+            decay, so the stopping criterion below decides instead.
+         */
+        if (num_errors == 0 && sigma2inv == 0.) {
+            logging(crfvot->lg, "Structured SVM resulted in convergence\n");
+            break;
+        }
+
+        /* Stopping criterion on the improvement of the objective. */
+        if (0 < ssvmopt->stop) {
+            if (ssvmopt->stop <= epoch) {
+                const floatval_t rate = (pf[epoch % ssvmopt->stop] - loss) / loss;
+                if (rate < ssvmopt->delta) {
+                    logging(crfvot->lg, "Structured SVM terminated with the stopping criteria\n");
+                    break;
+                }
+            }
+            pf[epoch % ssvmopt->stop] = loss;
+        }
+    }
+
+    if (ssvmopt->max_iterations < epoch) {
+        logging(crfvot->lg, "Structured SVM terminated with the maximum number of iterations\n");
+    }
+
+    logging(crfvot->lg, "Total seconds required for structured SVM: %.3f\n", (clock() - crfvot->clk_begin) / (double)CLOCKS_PER_SEC);
+    logging(crfvot->lg, "\n");
+
+error_exit:
+    free(perm);
+    free(pf);
+    crfvot->solver_data = NULL;
+    return ret;
+}
@@ -0,0 +1,424 @@
+/*
+ *      Training variable-order CRF with Stochastic Variance Reduced Gradient.
+ *
+ * Copyright (c) 2007-2010, Naoaki Okazaki
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the names of the authors nor the names of its contributors
+ *       may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* $Id$ */
+
+#ifdef    HAVE_CONFIG_H
+#include <config.h>
+#endif/*HAVE_CONFIG_H*/
+
+#include <os.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+
+#include <crfsuite.h>
+#include "crfvo.h"
+
+#include "logging.h"
+#include "params.h"
+
+#include <math.h>
+
+/*
+    The objective is the regularized negative log-likelihood, written as the
+    average of per-sequence losses,
+        F(w) = (1/N) \sum_i { -log p(y_i|x_i) + (lambda/2) |w|^2 },
+    where lambda = sigma2inv / N. Every outer iteration takes a snapshot w~
+    of the weights and computes the full gradient mu of the data term at w~.
+    An inner step on a sequence i then moves the weights along
+        d = (E_w[phi_i] - E_w~[phi_i]) + mu + lambda * w,
+    where the observation terms of the two sequence gradients cancel out.
+
+    The first term is sparse: it touches only the features that appear in
+    the lattice of the sequence. The other two terms are dense, but they
+    form an affine map w <- a * w - eta * mu (a = 1 - eta * lambda) that
+    does not depend on the sequence. We delay the dense part for each
+    feature until the feature is needed again, and apply the accumulated k
+    steps at once,
+        w <- a^k * w - eta * mu * (1 + a + ... + a^{k-1}).
+
+    The learning rate follows an estimate of the Lipschitz constant L of the
+    per-sequence gradients. Every inner step gives a secant estimate for
+    free, |E_w[phi_i] - E_w~[phi_i]| / |w - w~| + lambda, over the features
+    of the sequence. When eta exceeds gamma / L for the largest estimate so
+    far, the pending dense updates are flushed and eta is lowered to
+    gamma / L, so the first epoch finds the step size on its own. After an
+    outer iteration that decreases the objective, eta is doubled up to
+    gamma / L for the largest estimate of that iteration.
+ */
+
+typedef struct {
+    floatval_t eta;         /**< Learning rate. */
+    floatval_t lambda;      /**< Per-sequence coefficient of L2 term. */
+    floatval_t lipschitz;   /**< Largest Lipschitz estimate in this iteration. */
+    floatval_t* mu;         /**< Average gradient of the data term at snapshot. */
+    int* last;              /**< Last step at which each weight was updated. */
+} svrg_internal_t;
+
+static void catch_up(
+    svrg_internal_t* svrgi,
+    floatval_t* w,
+    fid_t fid,
+    int k
+    )
+{
+    const floatval_t eta = svrgi->eta;
+    const floatval_t mu = svrgi->mu[fid];
+
+    if (k <= 0) {
+        return;
+    } else if (svrgi->lambda == 0.) {
+        w[fid] -= k * eta * mu;
+    } else {
+        const floatval_t ak = pow(1. - eta * svrgi->lambda, k);
+        w[fid] = ak * w[fid] - mu * (1. - ak) / svrgi->lambda;
+    }
+}
+
+static floatval_t evaluate(
+    crfvol_t* crfvot,
+    const floatval_t* w,
+    floatval_t* g,
+    floatval_t sigma2inv,
+    floatval_t* gnorm,
+    floatval_t* xnorm
+    )
+{
+    fid_t i;
+    floatval_t logl, gg = 0., ww = 0.;
+    const fid_t K = crfvot->num_features;
+
+    logl = crfvol_loglikelihood(crfvot, w, g);
+    for (i = 0;i < K;++i) {
+        const floatval_t gi = g[i] + sigma2inv * w[i];
+        gg += gi * gi;
+        ww += w[i] * w[i];
+    }
+    *gnorm = sqrt(gg);
+    *xnorm = sqrt(ww);
+    return -logl + sigma2inv * ww * 0.5;
+}
+
+int crfvol_svrg_options(crf_params_t* params, crfvol_option_t* opt, int mode)
+{
+    crfvol_svrg_option_t* svrg = &opt->svrg;
+
+    BEGIN_PARAM_MAP(params, mode)
+        DDX_PARAM_FLOAT(
+            "svrg.eta", svrg->eta, 1.0,
+            "The initial learning rate; lowered to ${svrg.gamma} / L for the Lipschitz\n"
+            "constant L estimated during the inner steps, halved whenever an outer\n"
+            "iteration fails to decrease the objective, and doubled (up to the same\n"
+            "bound) whenever it succeeds."
+            )
+        DDX_PARAM_FLOAT(
+            "svrg.gamma", svrg->gamma, 0.5,
+            "The largest product of the learning rate and the Lipschitz estimate."
+            )
+        DDX_PARAM_INT(
+            "svrg.period", svrg->period, 2,
+            "The number of passes over the training data between snapshots."
+            )
+        DDX_PARAM_INT(
+            "svrg.max_iterations", svrg->max_iterations, 100,
+            "The maximum number of outer iterations (snapshots)."
+            )
+        DDX_PARAM_FLOAT(
+            "svrg.epsilon", svrg->epsilon, 1e-5,
+            "Epsilon for testing the convergence of the objective."
+            )
+        DDX_PARAM_INT(
+            "svrg.stop", svrg->stop, 10,
+            "The duration of iterations to test the stopping criterion."
+            )
+        DDX_PARAM_FLOAT(
+            "svrg.delta", svrg->delta, 1e-5,
+            "The threshold for the stopping criterion; the optimization stops when the\n"
+            "improvement of the log likelihood over the last ${svrg.stop} iterations is\n"
+            "no greater than this threshold."
+            )
+    END_PARAM_MAP()
+
+    return 0;
+}
+
+int crfvol_svrg(
+    crfvol_t* crfvot,
+    crfvol_option_t *opt
+    )
+{
+    int j, t, s, iter, ret = 0;
+    int num_accepted;
+    fid_t i, k, num_active_features;
+    const fid_t K = crfvot->num_features;
+    const int N = crfvot->num_sequences;
+    crf_sequence_t* seqs = crfvot->seqs;
+    floatval_t* w = crfvot->w;
+    floatval_t *snap_w = NULL, *snap_exp_weight = NULL, *new_mu = NULL;
+    floatval_t *ew = NULL, *es = NULL, *pf = NULL, *tmp = NULL;
+    int *perm = NULL;
+    floatval_t sigma2inv = 0., fx, new_fx, gnorm, xnorm, dd, ww, L;
+    clock_t duration, clk;
+    svrg_internal_t svrgi;
+    crfvol_svrg_option_t* svrgopt = &opt->svrg;
+    crfvol_lbfgs_option_t* lbfgsopt = &opt->lbfgs;
+    const int M = N * svrgopt->period;
+
+    memset(&svrgi, 0, sizeof(svrgi));
+    crfvot->solver_data = &svrgi;
+
+    /* Allocate the work space. */
+    svrgi.mu = (floatval_t*)calloc(K, sizeof(floatval_t));
+    svrgi.last = (int*)calloc(K, sizeof(int));
+    new_mu = (floatval_t*)calloc(K, sizeof(floatval_t));
+    snap_w = (floatval_t*)calloc(K, sizeof(floatval_t));
+    snap_exp_weight = (floatval_t*)calloc(K, sizeof(floatval_t));
+    ew = (floatval_t*)calloc(K, sizeof(floatval_t));
+    es = (floatval_t*)calloc(K, sizeof(floatval_t));
+    pf = (floatval_t*)calloc(svrgopt->stop + 1, sizeof(floatval_t));
+    perm = (int*)calloc(N, sizeof(int));
+    if (svrgi.mu == NULL || svrgi.last == NULL || new_mu == NULL ||
+        snap_w == NULL || snap_exp_weight == NULL || ew == NULL ||
+        es == NULL || pf == NULL || perm == NULL) {
+        ret = CRFERR_OUTOFMEMORY;
+        goto error_exit;
+    }
+
+    /* Only L2 regularization is supported by this solver. */
+    if (strcmp(lbfgsopt->regularization, "L2") == 0) {
+        sigma2inv = 1.0 / (lbfgsopt->regularization_sigma * lbfgsopt->regularization_sigma);
+    }
+    svrgi.lambda = sigma2inv / N;
+    svrgi.eta = svrgopt->eta;
+
+    logging(crfvot->lg, "Stochastic Variance Reduced Gradient (SVRG)\n");
+    logging(crfvot->lg, "regularization: %s\n", sigma2inv != 0. ? "L2" : "none");
+    logging(crfvot->lg, "regularization.sigma: %f\n", lbfgsopt->regularization_sigma);
+    logging(crfvot->lg, "svrg.eta: %f\n", svrgopt->eta);
+    logging(crfvot->lg, "svrg.gamma: %f\n", svrgopt->gamma);
+    logging(crfvot->lg, "svrg.period: %d\n", svrgopt->period);
+    logging(crfvot->lg, "svrg.max_iterations: %d\n", svrgopt->max_iterations);
+    logging(crfvot->lg, "svrg.epsilon: %f\n", svrgopt->epsilon);
+    logging(crfvot->lg, "svrg.stop: %d\n", svrgopt->stop);
+    logging(crfvot->lg, "svrg.delta: %f\n", svrgopt->delta);
+    logging(crfvot->lg, "\n");
+
+    crfvot->clk_begin = clock();
+    crfvot->clk_prev = crfvot->clk_begin;
+
+    /* Compute the objective and the full gradient at the initial weights. */
+    fx = evaluate(crfvot, w, svrgi.mu, sigma2inv, &gnorm, &xnorm);
+    crfvol_shuffle(perm, N, 1);
+    num_accepted = 0;
+    pf[0] = fx;
+
+    for (iter = 1;iter <= svrgopt->max_iterations;++iter) {
+        /* Take a snapshot of the weights. */
+        for (i = 0;i < K;++i) {
+            snap_w[i] = w[i];
+            snap_exp_weight[i] = crfvot->exp_weight[i];
+            svrgi.mu[i] /= N;
+            svrgi.last[i] = 0;
+        }
+        svrgi.lipschitz = 0.;
+
+        for (s = 0;s < M;++s) {
+            const crf_sequence_t* seq = NULL;
+
+            if (s % N == 0) {
+                crfvol_shuffle(perm, N, 0);
+            }
+            seq = &seqs[perm[s % N]];
+
+            /* Bring the weights of the features in the sequence up to date. */
+            for (t = 0;t < seq->num_items;++t) {
+                const crfvopd_t* pd = (const crfvopd_t*)seq->items[t].preprocessed_data;
+                for (j = 0;j < pd->num_fids;++j) {
+                    k = pd->fids[j];
+                    if (svrgi.last[k] < s) {
+                        catch_up(&svrgi, w, k, s - svrgi.last[k]);
+                        svrgi.last[k] = s;
+                        crfvot->exp_weight[k] = exp(w[k]);
+                    }
+                }
+            }
+
+            /* Model expectations at the current weights and the snapshot. */
+            crfvol_sequence_expectations(crfvot, seq, crfvot->exp_weight, ew);
+            crfvol_sequence_expectations(crfvot, seq, snap_exp_weight, es);
+
+            /*
+                Take a step for the features in the sequence, measuring the
+                secant of the sequence gradient on the way.
+             */
+            dd = ww = 0.;
+            for (t = 0;t < seq->num_items;++t) {
+                const crfvopd_t* pd = (const crfvopd_t*)seq->items[t].preprocessed_data;
+                for (j = 0;j < pd->num_fids;++j) {
+                    k = pd->fids[j];
+                    if (svrgi.last[k] == s) {
+                        dd += (ew[k] - es[k]) * (ew[k] - es[k]);
+                        ww += (w[k] - snap_w[k]) * (w[k] - snap_w[k]);
+                        w[k] = (1. - svrgi.eta * svrgi.lambda) * w[k]
+                            - svrgi.eta * (ew[k] - es[k] + svrgi.mu[k]);
+                        crfvot->exp_weight[k] = exp(w[k]);
+                        ew[k] = es[k] = 0.;
+                        svrgi.last[k] = s + 1;
+                    }
+                }
+            }
+
+            /* Lower the learning rate for the next steps if it is too large. */
+            if (1e-12 < ww) {
+                L = sqrt(dd / ww) + svrgi.lambda;
+                if (svrgi.lipschitz < L) {
+                    svrgi.lipschitz = L;
+                }
+                if (svrgopt->gamma < svrgi.eta * L) {
+                    /* The pending updates were scheduled with the old rate. */
+                    for (i = 0;i < K;++i) {
+                        if (svrgi.last[i] <= s) {
+                            catch_up(&svrgi, w, i, s + 1 - svrgi.last[i]);
+                            svrgi.last[i] = s + 1;
+                            crfvot->exp_weight[i] = exp(w[i]);
+                        }
+                    }
+                    svrgi.eta = svrgopt->gamma / L;
+                }
+            }
+        }
+
+        /* Apply the pending updates to all weights. */
+        for (i = 0;i < K;++i) {
+            catch_up(&svrgi, w, i, M - svrgi.last[i]);
+        }
+
+        /* Evaluate the objective at the new weights. */
+        new_fx = evaluate(crfvot, w, new_mu, sigma2inv, &gnorm, &xnorm);
+
+        clk = clock();
+        duration = clk - crfvot->clk_prev;
+        crfvot->clk_prev = clk;
+
+        if (!(new_fx <= fx)) {
+            /*
+                The objective did not decrease: go back to the snapshot and
+                retry with a smaller learning rate.
+             */
+            for (i = 0;i < K;++i) {
+                w[i] = snap_w[i];
+                crfvot->exp_weight[i] = snap_exp_weight[i];
+                svrgi.mu[i] *= N;
+            }
+            svrgi.eta *= 0.5;
+            logging(crfvot->lg, "***** Iteration #%d *****\n", iter);
+            logging(crfvot->lg, "Objective increased (%f -> %f); learning rate decreased to %f\n",
+                -fx, -new_fx, svrgi.eta);
+            logging(crfvot->lg, "Seconds required for this iteration: %.3f\n", duration / (double)CLOCKS_PER_SEC);
+            logging(crfvot->lg, "\n");
+            continue;
+        }
+
+        tmp = svrgi.mu;
+        svrgi.mu = new_mu;
+        new_mu = tmp;
+        fx = new_fx;
+        ++num_accepted;
+
+        num_active_features = 0;
+        for (i = 0;i < K;++i) {
+            if (w[i] != 0.) ++num_active_features;
+        }
+
+        /* Report the progress. */
+        logging(crfvot->lg, "***** Iteration #%d *****\n", iter);
+        logging(crfvot->lg, "Log-likelihood: %f\n", -fx);
+        logging(crfvot->lg, "Feature norm: %f\n", xnorm);
+        logging(crfvot->lg, "Error norm: %f\n", gnorm);
+        logging(crfvot->lg, "Active features: %lld\n", (long long)num_active_features);
+        logging(crfvot->lg, "Learning rate (eta): %f\n", svrgi.eta);
+        logging(crfvot->lg, "Seconds required for this iteration: %.3f\n", duration / (double)CLOCKS_PER_SEC);
+
+        /* Send the tagger with the current parameters. */
+        if (crfvot->cbe_proc != NULL) {
+            /* Callback notification with the tagger object. */
+            crfvot->cbe_proc(crfvot->cbe_instance, &crfvot->tagger);
+        }
+        logging(crfvot->lg, "\n");
+
+        /* Let the learning rate grow back after a successful iteration. */
+        svrgi.eta *= 2.;
+        if (0. < svrgi.lipschitz && svrgopt->gamma < svrgi.eta * svrgi.lipschitz) {
+            svrgi.eta = svrgopt->gamma / svrgi.lipschitz;
+        }
+
+        /* Convergence test. */
+        if (gnorm / (xnorm < 1.0 ? 1.0 : xnorm) <= svrgopt->epsilon) {
+            logging(crfvot->lg, "SVRG resulted in convergence\n");
+            break;
+        }
+
+        /* Stopping criterion on the improvement of the objective. */
+        if (0 < svrgopt->stop) {
+            if (svrgopt->stop <= num_accepted) {
+                const floatval_t rate = (pf[num_accepted % svrgopt->stop] - fx) / fx;
+                if (rate < svrgopt->delta) {
+                    logging(crfvot->lg, "SVRG terminated with the stopping criteria\n");
+                    break;
+                }
+            }
+            pf[num_accepted % svrgopt->stop] = fx;
+        }
+    }
+
+    if (svrgopt->max_iterations < iter) {
+        logging(crfvot->lg, "SVRG terminated with the maximum number of iterations\n");
+    }
+
+    logging(crfvot->lg, "Total seconds required for SVRG: %.3f\n", (clock() - crfvot->clk_begin) / (double)CLOCKS_PER_SEC);
+    logging(crfvot->lg, "\n");
+
+error_exit:
+    free(perm);
+    free(pf);
+    free(es);
+    free(ew);
+    free(snap_exp_weight);
+    free(snap_w);
+    free(new_mu);
+    free(svrgi.last);
+    free(svrgi.mu);
+    crfvot->solver_data = NULL;
+    return ret;
+}
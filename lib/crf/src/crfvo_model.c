@@ -30,26 +30,131 @@
 
 /* $Id: crfvo_model.c 176 2010-07-14 09:31:04Z naoaki $ */
 
+#ifdef    HAVE_CONFIG_H
+#include <config.h>
+#endif/*HAVE_CONFIG_H*/
+
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+#define    USE_MMAP    1
+#endif/*HAVE_MMAP*/
+
+#ifndef    _POSIX_C_SOURCE
+#define    _POSIX_C_SOURCE    200112L    /* fseeko(), ftello(), fileno() */
+#endif/*_POSIX_C_SOURCE*/
+#ifndef    _FILE_OFFSET_BITS
+#define    _FILE_OFFSET_BITS    64    /* 64-bit off_t on 32-bit platforms */
+#endif/*_FILE_OFFSET_BITS*/
+
 #include "os.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <limits.h>
+#include <math.h>
 #include <cqdb.h>
 
+#ifdef    USE_MMAP
+#include <sys/types.h>
+#include <sys/mman.h>
+#endif/*USE_MMAP*/
+
 #include <crfsuite.h>
 #include "crfvo.h"
+#include "mph.h"
 
 #define FILEMAGIC       "lCRF"
 #define MODELTYPE       "FOMC"
-#define VERSION_NUMBER  (100)
+#define VERSION_NUMBER  (101)
+#define VERSION_COMPACT (200)
+#define VERSION_WIDE    (0x10000)
 #define CHUNK_LABELREF  "LFRF"
 #define CHUNK_ATTRREF   "AFRF"
 #define CHUNK_FEATURE   "FEAT"
-#define HEADER_SIZE     44
+#define CHUNK_ATTRREFV  "AFRV"
+#define CHUNK_FEATUREQ  "FEAQ"
+#define CHUNK_EXPWEIGHT "EXPW"
+#define CHUNK_FEATURESOA "FSOA"
+#define BYTE_ORDER_MARK 0x01020304
+#define CHUNK_CHUNKS    "CHNK"
+#define CHUNK_LABELMPH  "LMPH"
+#define CHUNK_ATTRMPH   "AMPH"
+#define HEADER_SIZE     48
+#define HEADER_SIZE_WIDE    80
 #define CHUNK_SIZE      12
+#define CHUNK_SIZE_WIDE 20
 #define FEATURE_SIZE    24
+#define MAX_CHUNKS      16
+#define QBLOCK_SIZE     64
+#define WRITE_BUFFER_SIZE   (1 << 22)
+
+/*
+    Version 101 appends the offset to a chunk table to the file header.
+    The table lists optional chunks by their ids, which a reader skips
+    when it does not know them; a reader of version 100 ignores the
+    table altogether since all the other offsets stay in place.
+
+    An MPH chunk (LMPH for labels, AMPH for attributes) is a minimal
+    perfect hash of the strings in the corresponding CQDB chunk:
+
+    chunk id, size, num (number of strings)
+    uint32_t    num_buckets
+    uint32_t    disps[num_buckets]      (displacements of buckets)
+    uint32_t    table[num][2]           (fingerprint and ID of each slot)
+
+    Version 200 is the compact format written when the weights are
+    quantized; it replaces the feature chunk with FEAQ and the attribute
+    references with AFRV, leaving the other chunks as they are:
+
+    FEAQ: chunk id, size, num (number of features)
+    uint32_t    bits                    (8 or 16)
+    uint32_t    block_size              (number of features per block)
+    float64     scales[num_blocks]      (weight = scale * quantized value)
+    uint32_t    offsets[num_blocks]     (offset to the first record of each
+                                         block from the chunk head)
+    intN_t      weights[num]            (padded to a DWORD boundary)
+    records:    varint  zigzag(attr - attr of the previous record), where
+                        the previous attr is zero at the head of a block
+                uint8   order
+                uint8   label_sequence[order]
+
+    AFRV: chunk id, size, num (number of attributes)
+    uint32_t    num_fids                (total number of references)
+    uint32_t    offsets[num]            (offset to the list of each attribute)
+    lists:      varint  n, followed by n varints zigzag(fid - previous fid)
+
+    The native chunks (EXPW and FSOA), listed in the chunk table, repeat
+    the features in the byte order and layout of the writing machine so
+    that a tagger on a machine of the same kind uses them in place. A model
+    with quantized weights has no EXPW chunk, which would take more room
+    than the weights themselves:
+
+    EXPW: chunk id, size, num (number of features)
+    uint32_t    byte_order              (BYTE_ORDER_MARK in native order)
+    floatval_t  exp_weights[num]        (aligned to a QWORD boundary)
+
+    FSOA: chunk id, size, num (number of features)
+    uint32_t    max_order               (MAX_ORDER)
+    uint8_t     orders[num]             (padded to a DWORD boundary)
+    uint8_t     label_sequences[num][max_order]
+
+    The wide format, flagged by VERSION_WIDE in the version number of
+    either format, lifts the 4 GB limit of a file and the 2^32 limit of
+    features. The first 16 bytes of the file header are the same (with
+    the 32-bit size set to zero); the rest of the header is:
+
+    uint64_t    size
+    uint64_t    num_features
+    uint32_t    num_labels, num_attrs
+    uint64_t    off_features, off_labels, off_attrs, off_attrrefs, off_chunks
+
+    A chunk header has a 64-bit size and a 64-bit number of items, and
+    every offset, feature id and reference count in the chunks above is
+    64 bits wide (varints are 64-bit as well). The number of references
+    of an attribute in AFRF stays 32-bit, as do the CQDB and MPH chunks,
+    which index attributes and labels by 32-bit IDs.
+ */
 
 enum {
     WSTATE_NONE,
@@ -62,38 +167,76 @@ enum {
 
 typedef struct {
     uint8_t     magic[4];       /* File magic. */
-    uint32_t    size;           /* File size. */
+    uint64_t    size;           /* File size. */
     uint8_t     type[4];        /* Model type */
     uint32_t    version;        /* Version number. */
-    uint32_t    num_features;   /* Number of features. */
+    uint64_t    num_features;   /* Number of features. */
     uint32_t    num_labels;     /* Number of labels. */
     uint32_t    num_attrs;      /* Number of attributes. */
-    uint32_t    off_features;   /* Offset to features. */
-    uint32_t    off_labels;     /* Offset to label CQDB. */
-    uint32_t    off_attrs;      /* Offset to attribute CQDB. */
-    uint32_t    off_attrrefs;   /* Offset to attribute feature references. */
+    uint64_t    off_features;   /* Offset to features. */
+    uint64_t    off_labels;     /* Offset to label CQDB. */
+    uint64_t    off_attrs;      /* Offset to attribute CQDB. */
+    uint64_t    off_attrrefs;   /* Offset to attribute feature references. */
+    uint64_t    off_chunks;     /* Offset to the chunk table (version 101). */
 } header_t;
 
+typedef struct {
+    uint32_t        num;        /* Number of strings (slots). */
+    uint32_t        num_buckets;/* Number of buckets. */
+    const uint8_t*  disps;      /* Displacements of buckets. */
+    const uint8_t*  table;      /* Fingerprints and IDs of slots. */
+} mph_t;
+
 typedef struct {
     uint8_t     chunk[4];       /* Chunk id */
-    uint32_t    size;           /* Chunk size. */
-    uint32_t    num;            /* Number of items. */
-    uint32_t    offsets[1];     /* Offsets. */
+    uint64_t    size;           /* Chunk size. */
+    uint64_t    num;            /* Number of items. */
+    uint64_t    offsets[1];     /* Offsets. */
 } featureref_header_t;
 
 typedef struct {
     uint8_t     chunk[4];       /* Chunk id */
-    uint32_t    size;           /* Chunk size. */
-    uint32_t    num;            /* Number of items. */
+    uint64_t    size;           /* Chunk size. */
+    uint64_t    num;            /* Number of items. */
 } feature_header_t;
 
+typedef struct {
+    uint32_t        bits;       /* Bits of a quantized weight (8 or 16). */
+    uint32_t        block_size; /* Number of features per block. */
+    uint64_t        num_blocks; /* Number of blocks. */
+    uint32_t        offset_size;/* Bytes of an offset to a block (4 or 8). */
+    const uint8_t*  base;       /* Head of the FEAQ chunk. */
+    const uint8_t*  scales;     /* Scales of blocks. */
+    const uint8_t*  offsets;    /* Offsets to the records of blocks. */
+    const uint8_t*  weights;    /* Quantized weights. */
+} qfeatures_t;
+
+enum {
+    AREF_INPLACE,               /* AFRF lists of fid_t, used in place when aligned. */
+    AREF_FIXED,                 /* AFRF lists decoded into fid_t. */
+    AREF_VARINT,                /* AFRV lists of delta-coded feature ids. */
+};
+
 struct tag_crfvom {
     uint8_t*    buffer_orig;
     uint8_t*    buffer;
-    uint32_t    size;
+    size_t      size;
+    int         mapped;         /* Nonzero when the buffer maps the file. */
     header_t*   header;
+    int         wide;           /* Nonzero for the wide format. */
+    uint32_t    chunk_size;     /* Size of a chunk header. */
     cqdb_t*     labels;
     cqdb_t*     attrs;
+    mph_t       label_mph;
+    mph_t       attr_mph;
+    qfeatures_t qfeatures;      /* Quantized features (version 200). */
+    int         attrref_coding; /* Coding of the attribute references (AREF_*). */
+    const uint8_t* attrref_offsets; /* Offsets to the lists of attributes. */
+    uint8_t*    fids;           /* Decoded feature references (fid_t each). */
+    fid_t*      fid_begins;     /* Index of the first reference of each attribute. */
+    const floatval_t* exp_weights;  /* Native exp-weights (EXPW). */
+    const uint8_t* orders;      /* Native orders of features (FSOA). */
+    const uint8_t* label_sequences; /* Native label sequences of features (FSOA). */
 };
 
 struct tag_crfvomw {
@@ -103,6 +246,33 @@ struct tag_crfvomw {
     cqdb_writer_t* dbw;
     featureref_header_t* href;
     feature_header_t* hfeat;
+
+    uint32_t num_keys;          /* Number of strings put to the CQDB chunk. */
+    uint32_t max_keys;
+    uint64_t* hashes;           /* Hash values of the strings. */
+    uint32_t* ids;              /* IDs of the strings. */
+
+    int num_chunks;             /* Number of chunks in the chunk table. */
+    uint8_t chunks[MAX_CHUNKS][4];
+    uint64_t chunk_offsets[MAX_CHUNKS];
+
+    int wide;                   /* Nonzero to write the wide format. */
+    int weight_bits;            /* Bits of quantized weights (0: none). */
+    crfvom_feature_t* features; /* Features buffered for the quantization. */
+    size_t max_features;
+    uint64_t num_fids;          /* Number of feature references written. */
+    floatval_t max_error;       /* Maximum quantization error of weights. */
+    floatval_t sum_error2;      /* Sum of squared quantization errors. */
+
+    int native;                 /* Nonzero to write the native chunks. */
+    floatval_t* exp_weights;    /* Exp-weights buffered for EXPW. */
+    uint8_t* orders;            /* Orders buffered for FSOA. */
+    uint8_t* label_sequences;   /* Label sequences buffered for FSOA. */
+    size_t max_native;
+
+    char* iobuf;                /* Stream buffer of the file. */
+    uint8_t* buffer;            /* Buffer to serialize a record or a table. */
+    size_t buffer_size;
 };
 
 
@@ -116,6 +286,55 @@ enum {
     KT_FEATURE,
 };
 
+static uint8_t* encode_uint32(uint8_t* p, uint32_t value)
+{
+    p[0] = (uint8_t)(value & 0xFF);
+    p[1] = (uint8_t)(value >> 8);
+    p[2] = (uint8_t)(value >> 16);
+    p[3] = (uint8_t)(value >> 24);
+    return p + 4;
+}
+
+static uint8_t* encode_uint64(uint8_t* p, uint64_t value)
+{
+    p = encode_uint32(p, (uint32_t)(value & 0xFFFFFFFF));
+    return encode_uint32(p, (uint32_t)(value >> 32));
+}
+
+static uint8_t* encode_float(uint8_t* p, floatval_t value)
+{
+    /*
+        We assume:
+            - sizeof(floatval_t) = sizeof(double) = sizeof(uint64_t)
+            - the byte order of floatval_t and uint64_t is the same
+            - ARM's mixed-endian is not supported
+    */
+    uint64_t iv;
+
+    /* Copy the memory image of floatval_t value to uint64_t. */
+    memcpy(&iv, &value, sizeof(iv));
+
+    p[0] = (uint8_t)(iv & 0xFF);
+    p[1] = (uint8_t)(iv >> 8);
+    p[2] = (uint8_t)(iv >> 16);
+    p[3] = (uint8_t)(iv >> 24);
+    p[4] = (uint8_t)(iv >> 32);
+    p[5] = (uint8_t)(iv >> 40);
+    p[6] = (uint8_t)(iv >> 48);
+    p[7] = (uint8_t)(iv >> 56);
+    return p + 8;
+}
+
+static uint8_t* encode_varint(uint8_t* p, uint64_t value)
+{
+    while (0x80 <= value) {
+        *p++ = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    *p++ = (uint8_t)value;
+    return p;
+}
+
 static int write_uint8(FILE *fp, uint8_t value)
 {
     return fwrite(&value, sizeof(value), 1, fp) == 1 ? 0 : 1;
@@ -130,10 +349,7 @@ static int read_uint8(uint8_t* buffer, uint8_t* value)
 static int write_uint32(FILE *fp, uint32_t value)
 {
     uint8_t buffer[4];
-    buffer[0] = (uint8_t)(value & 0xFF);
-    buffer[1] = (uint8_t)(value >> 8);
-    buffer[2] = (uint8_t)(value >> 16);
-    buffer[3] = (uint8_t)(value >> 24);
+    encode_uint32(buffer, value);
     return fwrite(buffer, sizeof(uint8_t), 4, fp) == 4 ? 0 : 1;
 }
 
@@ -146,14 +362,18 @@ static int read_uint32(uint8_t* buffer, uint32_t* value)
     return sizeof(*value);
 }
 
+static int read_uint64(uint8_t* buffer, uint64_t* value)
+{
+    uint32_t lo, hi;
+    read_uint32(buffer, &lo);
+    read_uint32(buffer + 4, &hi);
+    *value = ((uint64_t)hi << 32) | lo;
+    return sizeof(*value);
+}
+
 static int write_uint8_array(FILE *fp, uint8_t *array, size_t n)
 {
-    size_t i;
-    int ret = 0;
-    for (i = 0;i < n;++i) {
-        ret |= write_uint8(fp, array[i]);
-    }
-    return ret;
+    return fwrite(array, sizeof(uint8_t), n, fp) == n ? 0 : 1;
 }
 
 static int read_uint8_array(uint8_t* buffer, uint8_t *array, size_t n)
@@ -168,31 +388,6 @@ static int read_uint8_array(uint8_t* buffer, uint8_t *array, size_t n)
     return ret;
 }
 
-static void write_float(FILE *fp, floatval_t value)
-{
-    /*
-        We assume:
-            - sizeof(floatval_t) = sizeof(double) = sizeof(uint64_t)
-            - the byte order of floatval_t and uint64_t is the same
-            - ARM's mixed-endian is not supported
-    */
-    uint64_t iv;
-    uint8_t buffer[8];
-
-    /* Copy the memory image of floatval_t value to uint64_t. */
-    memcpy(&iv, &value, sizeof(iv));
-
-    buffer[0] = (uint8_t)(iv & 0xFF);
-    buffer[1] = (uint8_t)(iv >> 8);
-    buffer[2] = (uint8_t)(iv >> 16);
-    buffer[3] = (uint8_t)(iv >> 24);
-    buffer[4] = (uint8_t)(iv >> 32);
-    buffer[5] = (uint8_t)(iv >> 40);
-    buffer[6] = (uint8_t)(iv >> 48);
-    buffer[7] = (uint8_t)(iv >> 56);
-    fwrite(buffer, sizeof(uint8_t), 8, fp);
-}
-
 static int read_float(uint8_t* buffer, floatval_t* value)
 {
     uint64_t iv;
@@ -208,6 +403,213 @@ static int read_float(uint8_t* buffer, floatval_t* value)
     return sizeof(*value);
 }
 
+static int read_varint(const uint8_t* buffer, uint64_t* value)
+{
+    int i = 0;
+    uint64_t v = 0;
+    do {
+        v |= (uint64_t)(buffer[i] & 0x7F) << (7 * i);
+    } while ((buffer[i++] & 0x80) && i < 10);
+    *value = v;
+    return i;
+}
+
+static int varint_size(uint64_t value)
+{
+    int n = 1;
+    while (0x80 <= value) {
+        value >>= 7;
+        ++n;
+    }
+    return n;
+}
+
+static uint64_t zigzag(int64_t value)
+{
+    return ((uint64_t)value << 1) ^ (uint64_t)-(int64_t)((uint64_t)value >> 63);
+}
+
+static int64_t unzigzag(uint64_t value)
+{
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+/* Store a feature id in the little-endian layout of fid_t. */
+static void store_fid(uint8_t* p, fid_t fid)
+{
+#ifdef  CRFVO_LARGE
+    encode_uint64(p, (uint64_t)fid);
+#else
+    encode_uint32(p, (uint32_t)fid);
+#endif/*CRFVO_LARGE*/
+}
+
+static int align_dword(FILE *fp)
+{
+    uint64_t offset = (uint64_t)ftello(fp);
+    while (offset % 4 != 0) {
+        if (write_uint8(fp, 0)) {
+            return 1;
+        }
+        ++offset;
+    }
+    return 0;
+}
+
+static int align_qword(FILE *fp)
+{
+    uint64_t offset = (uint64_t)ftello(fp);
+    while (offset % 8 != 0) {
+        if (write_uint8(fp, 0)) {
+            return 1;
+        }
+        ++offset;
+    }
+    return 0;
+}
+
+/* Make the serialization buffer of the writer hold at least size bytes. */
+static uint8_t* reserve_buffer(crfvomw_t* writer, size_t size)
+{
+    if (writer->buffer_size < size) {
+        uint8_t* buffer = (uint8_t*)realloc(writer->buffer, size);
+        if (buffer == NULL) {
+            return NULL;
+        }
+        writer->buffer = buffer;
+        writer->buffer_size = size;
+    }
+    return writer->buffer;
+}
+
+static uint32_t chunk_header_size(int wide)
+{
+    return wide ? CHUNK_SIZE_WIDE : CHUNK_SIZE;
+}
+
+static uint64_t tell(crfvomw_t* writer)
+{
+    return (uint64_t)ftello(writer->fp);
+}
+
+/* Encode an offset, a size or a feature id in the width of the format. */
+static uint8_t* encode_word(const crfvomw_t* writer, uint8_t* p, uint64_t value)
+{
+    if (writer->wide) {
+        return encode_uint64(p, value);
+    } else {
+        return encode_uint32(p, (uint32_t)value);
+    }
+}
+
+static int write_chunk_header(crfvomw_t* writer, const char *chunk, uint64_t size, uint64_t num)
+{
+    uint8_t buffer[CHUNK_SIZE_WIDE], *p = buffer;
+    memcpy(p, chunk, 4);
+    p = encode_word(writer, p + 4, size);
+    p = encode_word(writer, p, num);
+    return write_uint8_array(writer->fp, buffer, p - buffer);
+}
+
+static int add_chunk(crfvomw_t* writer, const char *chunk, uint64_t offset)
+{
+    if (MAX_CHUNKS <= writer->num_chunks) {
+        return CRFERR_INTERNAL_LOGIC;
+    }
+    memcpy(writer->chunks[writer->num_chunks], chunk, 4);
+    writer->chunk_offsets[writer->num_chunks] = offset;
+    ++writer->num_chunks;
+    return 0;
+}
+
+static int open_keys(crfvomw_t* writer, int num)
+{
+    free(writer->hashes);
+    free(writer->ids);
+    writer->num_keys = 0;
+    writer->max_keys = (uint32_t)num;
+    writer->hashes = (uint64_t*)malloc(sizeof(uint64_t) * (num + 1));
+    writer->ids = (uint32_t*)malloc(sizeof(uint32_t) * (num + 1));
+    return (writer->hashes == NULL || writer->ids == NULL);
+}
+
+static void put_key(crfvomw_t* writer, int id, const char *value)
+{
+    if (writer->num_keys < writer->max_keys) {
+        writer->hashes[writer->num_keys] = mph_hash(value);
+        writer->ids[writer->num_keys] = (uint32_t)id;
+        ++writer->num_keys;
+    }
+}
+
+/* Write an MPH chunk for the strings put to the preceding CQDB chunk. */
+static int write_mph(crfvomw_t* writer, const char *chunk)
+{
+    int ret = 0;
+    uint32_t i;
+    uint64_t offset;
+    uint8_t *p = NULL;
+    FILE *fp = writer->fp;
+    const uint32_t n = writer->num_keys;
+    const uint32_t num_buckets = (0 < n) ? n : 1;
+    uint32_t *disps = NULL, *slots = NULL, *table = NULL;
+
+    disps = (uint32_t*)malloc(sizeof(uint32_t) * num_buckets);
+    slots = (uint32_t*)malloc(sizeof(uint32_t) * (n + 1));
+    table = (uint32_t*)malloc(sizeof(uint32_t) * 2 * (n + 1));
+    if (disps == NULL || slots == NULL || table == NULL) {
+        ret = CRFERR_OUTOFMEMORY;
+        goto error_exit;
+    }
+
+    /* Leave the strings to the CQDB only if the hash cannot be built. */
+    if (mph_build(writer->hashes, n, num_buckets, disps, slots) != 0) {
+        goto error_exit;
+    }
+    for (i = 0;i < n;++i) {
+        table[2*slots[i]+0] = mph_fingerprint(writer->hashes[i]);
+        table[2*slots[i]+1] = writer->ids[i];
+    }
+
+    if (align_dword(fp)) {
+        ret = 1;
+        goto error_exit;
+    }
+    offset = tell(writer);
+    write_chunk_header(writer, chunk, chunk_header_size(writer->wide) + sizeof(uint32_t) * (1 + num_buckets + 2 * (uint64_t)n), n);
+    write_uint32(fp, num_buckets);
+
+    /* Serialize the tables into the buffer to write them at once. */
+    p = reserve_buffer(writer, sizeof(uint32_t) * (num_buckets + 2 * n));
+    if (p == NULL) {
+        ret = CRFERR_OUTOFMEMORY;
+        goto error_exit;
+    }
+    for (i = 0;i < num_buckets;++i) {
+        p = encode_uint32(p, disps[i]);
+    }
+    for (i = 0;i < 2 * n;++i) {
+        p = encode_uint32(p, table[i]);
+    }
+    write_uint8_array(fp, writer->buffer, p - writer->buffer);
+    if (ferror(fp)) {
+        ret = 1;
+        goto error_exit;
+    }
+    ret = add_chunk(writer, chunk, offset);
+
+error_exit:
+    free(table);
+    free(slots);
+    free(disps);
+    free(writer->hashes);
+    free(writer->ids);
+    writer->hashes = NULL;
+    writer->ids = NULL;
+    writer->num_keys = writer->max_keys = 0;
+    return ret;
+}
+
 crfvomw_t* crfvomw(const char *filename)
 {
     header_t *header = NULL;
@@ -225,6 +627,13 @@ crfvomw_t* crfvomw(const char *filename)
         goto error_exit;
     }
 
+    /* Give the stream a large buffer; it is flushed only when the writer
+       moves back to fill a chunk header. */
+    writer->iobuf = (char*)malloc(WRITE_BUFFER_SIZE);
+    if (writer->iobuf != NULL) {
+        setvbuf(writer->fp, writer->iobuf, _IOFBF, WRITE_BUFFER_SIZE);
+    }
+
     /* Fill the members in the header. */
     header = &writer->header;
     strncpy(header->magic, FILEMAGIC, 4);
@@ -232,7 +641,7 @@ crfvomw_t* crfvomw(const char *filename)
     header->version = VERSION_NUMBER;
 
     /* Advance the file position to skip the file header. */
-    if (fseek(writer->fp, HEADER_SIZE, SEEK_CUR) != 0) {
+    if (fseeko(writer->fp, HEADER_SIZE, SEEK_CUR) != 0) {
         goto error_exit;
     }
 
@@ -243,36 +652,143 @@ error_exit:
         if (writer->fp != NULL) {
             fclose(writer->fp);
         }
+        free(writer->iobuf);
         free(writer);
     }
     return NULL;
 }
 
+int crfvomw_set_weight_bits(crfvomw_t* writer, int bits)
+{
+    /* The format must be chosen before writing any chunk. */
+    if (writer->state != WSTATE_NONE || writer->header.off_features != 0) {
+        return CRFERR_INTERNAL_LOGIC;
+    }
+    if (bits != 0 && bits != 8 && bits != 16) {
+        return CRFERR_INTERNAL_LOGIC;
+    }
+    writer->weight_bits = bits;
+    return 0;
+}
+
+int crfvomw_set_wide(crfvomw_t* writer, int wide)
+{
+    /* The format must be chosen before writing any chunk. */
+    if (writer->state != WSTATE_NONE ||
+        tell(writer) != (writer->wide ? HEADER_SIZE_WIDE : HEADER_SIZE)) {
+        return CRFERR_INTERNAL_LOGIC;
+    }
+    writer->wide = wide;
+
+    /* Leave room for the file header of the format. */
+    if (fseeko(writer->fp, wide ? HEADER_SIZE_WIDE : HEADER_SIZE, SEEK_SET) != 0) {
+        return 1;
+    }
+    return 0;
+}
+
+int crfvomw_set_native(crfvomw_t* writer, int native)
+{
+    /* The chunks must be chosen before writing the features. */
+    if (writer->state != WSTATE_NONE || writer->header.off_features != 0) {
+        return CRFERR_INTERNAL_LOGIC;
+    }
+    writer->native = native;
+    return 0;
+}
+
+void crfvomw_estimate_sizes(crfvomw_t* writer, int num_labels, size_t* base_size, size_t* feature_size, size_t* attr_size)
+{
+    /* Two CQDB chunks with their table references, the label strings
+       (guessed at 16 bytes each) and the chunk table. */
+    const int wide = writer->wide;
+    *base_size = (wide ? HEADER_SIZE_WIDE : HEADER_SIZE) + 2 * (24 + 8 * 256) + (size_t)num_labels * (16 + 29 + 12);
+    *base_size += chunk_header_size(wide) + (wide ? 12 : 8) * MAX_CHUNKS;
+
+    /* A feature has a record and a reference, and the native chunks if any. */
+    if (writer->weight_bits != 0) {
+        *feature_size = writer->weight_bits / 8 + 6;
+    } else {
+        *feature_size = FEATURE_SIZE + (wide ? 8 : 4);
+    }
+    if (writer->native) {
+        *feature_size += 1 + MAX_ORDER;
+        if (writer->weight_bits == 0) {
+            *feature_size += sizeof(floatval_t);
+        }
+    }
+
+    /* Besides its string, an attribute has a CQDB record with its hash
+       entries and backward link (29 bytes), an MPH slot (12 bytes), and
+       the offset and count of its references. */
+    *attr_size = 29 + 12 + ((writer->weight_bits != 0) ? 5 : 8) + (wide ? 4 : 0);
+}
+
+void crfvomw_get_quantization_error(crfvomw_t* writer, floatval_t* max_error, floatval_t* rms_error)
+{
+    const uint64_t K = writer->header.num_features;
+    *max_error = writer->max_error;
+    *rms_error = (0 < K) ? sqrt(writer->sum_error2 / K) : 0.;
+}
+
 int crfvomw_close(crfvomw_t* writer)
 {
+    int i, ret = 1;
     FILE *fp = writer->fp;
     header_t *header = &writer->header;
+    uint8_t buffer[HEADER_SIZE_WIDE], *p = buffer;
+
+    /* Write the chunk table. */
+    if (0 < writer->num_chunks) {
+        if (align_dword(fp)) {
+            goto error_exit;
+        }
+        header->off_chunks = tell(writer);
+        write_chunk_header(writer, CHUNK_CHUNKS,
+            chunk_header_size(writer->wide) + (writer->wide ? 12 : 8) * writer->num_chunks, writer->num_chunks);
+        for (i = 0;i < writer->num_chunks;++i) {
+            write_uint8_array(fp, writer->chunks[i], 4);
+            p = encode_word(writer, buffer, writer->chunk_offsets[i]);
+            write_uint8_array(fp, buffer, p - buffer);
+        }
+    }
 
-    /* Store the file size. */
-    header->size = (uint32_t)ftell(fp);
+    /* Store the file size; no offset exceeds it. */
+    header->size = tell(writer);
+    if (!writer->wide && UINT32_MAX < header->size) {
+        ret = CRFERR_OVERFLOW;
+        goto error_exit;
+    }
+    header->version = (writer->weight_bits != 0) ? VERSION_COMPACT : VERSION_NUMBER;
+    if (writer->wide) {
+        header->version |= VERSION_WIDE;
+    }
 
     /* Move the file position to the head. */
-    if (fseek(fp, 0, SEEK_SET) != 0) {
+    if (fseeko(fp, 0, SEEK_SET) != 0) {
         goto error_exit;
     }
 
     /* Write the file header. */
-    write_uint8_array(fp, header->magic, sizeof(header->magic));
-    write_uint32(fp, header->size);
-    write_uint8_array(fp, header->type, sizeof(header->type));
-    write_uint32(fp, header->version);
-    write_uint32(fp, header->num_features);
-    write_uint32(fp, header->num_labels);
-    write_uint32(fp, header->num_attrs);
-    write_uint32(fp, header->off_features);
-    write_uint32(fp, header->off_labels);
-    write_uint32(fp, header->off_attrs);
-    write_uint32(fp, header->off_attrrefs);
+    p = buffer;
+    memcpy(p, header->magic, 4);
+    p = encode_uint32(p + 4, writer->wide ? 0 : (uint32_t)header->size);
+    memcpy(p, header->type, 4);
+    p = encode_uint32(p + 4, header->version);
+    if (writer->wide) {
+        p = encode_uint64(p, header->size);
+        p = encode_uint64(p, header->num_features);
+    } else {
+        p = encode_uint32(p, (uint32_t)header->num_features);
+    }
+    p = encode_uint32(p, header->num_labels);
+    p = encode_uint32(p, header->num_attrs);
+    p = encode_word(writer, p, header->off_features);
+    p = encode_word(writer, p, header->off_labels);
+    p = encode_word(writer, p, header->off_attrs);
+    p = encode_word(writer, p, header->off_attrrefs);
+    p = encode_word(writer, p, header->off_chunks);
+    write_uint8_array(fp, buffer, p - buffer);
 
     /* Check for any error occurrence. */
     if (ferror(fp)) {
@@ -280,18 +796,43 @@ int crfvomw_close(crfvomw_t* writer)
     }
 
     /* Close the writer. */
-    fclose(fp);
+    if (fclose(fp) != 0) {
+        writer->fp = NULL;
+        goto error_exit;
+    }
+    free(writer->buffer);
+    free(writer->iobuf);
     free(writer);
     return 0;
 
 error_exit:
+    crfvomw_discard(writer);
+    return ret;
+}
+
+/*
+    Release the writer without completing the file; the caller removes
+    the file, which is left incomplete.
+ */
+void crfvomw_discard(crfvomw_t* writer)
+{
     if (writer != NULL) {
+        if (writer->dbw != NULL) {
+            cqdb_writer_close(writer->dbw);
+        }
         if (writer->fp != NULL) {
             fclose(writer->fp);
         }
+        free(writer->buffer);
+        free(writer->iobuf);
+        free(writer->hashes);
+        free(writer->ids);
+        free(writer->features);
+        free(writer->exp_weights);
+        free(writer->orders);
+        free(writer->label_sequences);
         free(writer);
     }
-    return 1;
 }
 
 int crfvomw_open_labels(crfvomw_t* writer, int num_labels)
@@ -302,7 +843,7 @@ int crfvomw_open_labels(crfvomw_t* writer, int num_labels)
     }
 
     /* Store the current offset. */
-    writer->header.off_labels = (uint32_t)ftell(writer->fp);
+    writer->header.off_labels = tell(writer);
 
     /* Open a CQDB chunk for writing. */
     writer->dbw = cqdb_writer(writer->fp, 0);
@@ -311,6 +852,10 @@ int crfvomw_open_labels(crfvomw_t* writer, int num_labels)
         return 1;
     }
 
+    if (cqdb_writer_reserve(writer->dbw, num_labels) || open_keys(writer, num_labels)) {
+        return CRFERR_OUTOFMEMORY;
+    }
+
     writer->state = WSTATE_LABELS;
     writer->header.num_labels = num_labels;
     return 0;
@@ -327,10 +872,11 @@ int crfvomw_close_labels(crfvomw_t* writer)
     if (cqdb_writer_close(writer->dbw)) {
         return 1;
     }
-
     writer->dbw = NULL;
     writer->state = WSTATE_NONE;
-    return 0;
+
+    /* Follow the CQDB chunk with the perfect hash. */
+    return write_mph(writer, CHUNK_LABELMPH);
 }
 
 int crfvomw_put_label(crfvomw_t* writer, int lid, const char *value)
@@ -344,6 +890,7 @@ int crfvomw_put_label(crfvomw_t* writer, int lid, const char *value)
     if (cqdb_writer_put(writer->dbw, value, lid)) {
         return 1;
     }
+    put_key(writer, lid, value);
 
     return 0;
 }
@@ -356,7 +903,7 @@ int crfvomw_open_attrs(crfvomw_t* writer, int num_attrs)
     }
 
     /* Store the current offset. */
-    writer->header.off_attrs = (uint32_t)ftell(writer->fp);
+    writer->header.off_attrs = tell(writer);
 
     /* Open a CQDB chunk for writing. */
     writer->dbw = cqdb_writer(writer->fp, 0);
@@ -365,6 +912,10 @@ int crfvomw_open_attrs(crfvomw_t* writer, int num_attrs)
         return 1;
     }
 
+    if (cqdb_writer_reserve(writer->dbw, num_attrs) || open_keys(writer, num_attrs)) {
+        return CRFERR_OUTOFMEMORY;
+    }
+
     writer->state = WSTATE_ATTRS;
     writer->header.num_attrs = num_attrs;
     return 0;
@@ -381,10 +932,11 @@ int crfvomw_close_attrs(crfvomw_t* writer)
     if (cqdb_writer_close(writer->dbw)) {
         return 1;
     }
-
     writer->dbw = NULL;
     writer->state = WSTATE_NONE;
-    return 0;
+
+    /* Follow the CQDB chunk with the perfect hash. */
+    return write_mph(writer, CHUNK_ATTRMPH);
 }
 
 int crfvomw_put_attr(crfvomw_t* writer, int aid, const char *value)
@@ -398,30 +950,37 @@ int crfvomw_put_attr(crfvomw_t* writer, int aid, const char *value)
     if (cqdb_writer_put(writer->dbw, value, aid)) {
         return 1;
     }
+    put_key(writer, aid, value);
 
     return 0;
 }
 
 int crfvomw_open_attrrefs(crfvomw_t* writer, int num_attrs)
 {
-    uint32_t offset;
+    uint64_t offset;
     FILE *fp = writer->fp;
     featureref_header_t* href = NULL;
-    size_t size = CHUNK_SIZE + sizeof(uint32_t) * num_attrs;
+    const size_t word = writer->wide ? 8 : 4;
+    size_t size = chunk_header_size(writer->wide) + word * num_attrs;
 
     /* Check if we aren't writing anything at this moment. */
     if (writer->state != WSTATE_NONE) {
         return CRFERR_INTERNAL_LOGIC;
     }
 
+    /* The compact format has the total number of references. */
+    if (writer->weight_bits != 0) {
+        size += word;
+    }
+
     /* Allocate a feature reference array. */
-    href = (featureref_header_t*)calloc(size, 1);
+    href = (featureref_header_t*)calloc(sizeof(featureref_header_t) + sizeof(uint64_t) * num_attrs, 1);
     if (href == NULL) {
         return CRFERR_OUTOFMEMORY;
     }
 
     /* Align the offset to a DWORD boundary. */
-    offset = (uint32_t)ftell(fp);
+    offset = tell(writer);
     while (offset % 4 != 0) {
         uint8_t c = 0;
         fwrite(&c, sizeof(uint8_t), 1, fp);
@@ -430,12 +989,13 @@ int crfvomw_open_attrrefs(crfvomw_t* writer, int num_attrs)
 
     /* Store the current offset position to the file header. */
     writer->header.off_attrrefs = offset;
-    fseek(fp, size, SEEK_CUR);
+    fseeko(fp, size, SEEK_CUR);
 
     /* Fill members in the feature reference header. */
-    strncpy(href->chunk, CHUNK_ATTRREF, 4);
+    strncpy(href->chunk, writer->weight_bits != 0 ? CHUNK_ATTRREFV : CHUNK_ATTRREF, 4);
     href->size = 0;
     href->num = num_attrs;
+    writer->num_fids = 0;
 
     writer->href = href;
     writer->state = WSTATE_ATTRREFS;
@@ -444,10 +1004,11 @@ int crfvomw_open_attrrefs(crfvomw_t* writer, int num_attrs)
 
 int crfvomw_close_attrrefs(crfvomw_t* writer)
 {
-    uint32_t i;
+    uint64_t i;
+    uint8_t *p = NULL;
     FILE *fp = writer->fp;
     featureref_header_t* href = writer->href;
-    uint32_t begin = writer->header.off_attrrefs, end = 0;
+    uint64_t begin = writer->header.off_attrrefs, end = 0;
 
     /* Make sure that we are writing attribute feature references. */
     if (writer->state != WSTATE_ATTRREFS) {
@@ -455,22 +1016,30 @@ int crfvomw_close_attrrefs(crfvomw_t* writer)
     }
 
     /* Store the current offset position. */
-    end = (uint32_t)ftell(fp);
+    end = tell(writer);
 
     /* Compute the size of this chunk. */
     href->size = (end - begin);
 
-    /* Write the chunk header and offset array. */
-    fseek(fp, begin, SEEK_SET);
-    write_uint8_array(fp, href->chunk, 4);
-    write_uint32(fp, href->size);
-    write_uint32(fp, href->num);
+    /* Serialize the offset array into the buffer. */
+    p = reserve_buffer(writer, 8 * (href->num + 1));
+    if (p == NULL) {
+        return CRFERR_OUTOFMEMORY;
+    }
+    if (writer->weight_bits != 0) {
+        p = encode_word(writer, p, writer->num_fids);
+    }
     for (i = 0;i < href->num;++i) {
-        write_uint32(fp, href->offsets[i]);
+        p = encode_word(writer, p, href->offsets[i]);
     }
 
+    /* Write the chunk header and offset array. */
+    fseeko(fp, begin, SEEK_SET);
+    write_chunk_header(writer, (const char*)href->chunk, href->size, href->num);
+    write_uint8_array(fp, writer->buffer, p - writer->buffer);
+
     /* Move the file pointer to the tail. */
-    fseek(fp, end, SEEK_SET);
+    fseeko(fp, end, SEEK_SET);
 
     /* Uninitialize. */
     free(href);
@@ -479,10 +1048,12 @@ int crfvomw_close_attrrefs(crfvomw_t* writer)
     return 0;
 }
 
-int crfvomw_put_attrref(crfvomw_t* writer, int aid, const feature_refs_t* ref, int *map)
+int crfvomw_put_attrref(crfvomw_t* writer, int aid, const feature_refs_t* ref, fid_t *map)
 {
-    int i, fid;
-    uint32_t n = 0, offset = 0;
+    int i;
+    fid_t fid, prev = 0;
+    uint32_t n = 0;
+    uint8_t *p = NULL;
     FILE *fp = writer->fp;
     featureref_header_t* href = writer->href;
 
@@ -492,21 +1063,39 @@ int crfvomw_put_attrref(crfvomw_t* writer, int aid, const feature_refs_t* ref, i
     }
 
     /* Store the current offset to the offset array. */
-    href->offsets[aid] = ftell(fp);
+    href->offsets[aid] = tell(writer);
 
     /* Count the number of references to active features. */
     for (i = 0;i < ref->num_features;++i) {
         if (0 <= map[ref->fids[i]]) ++n;
     }
 
-    /* Write the feature reference. */
-    write_uint32(fp, (uint32_t)n);
-    for (i = 0;i < ref->num_features;++i) {
-        fid = map[ref->fids[i]];
-        if (0 <= fid) write_uint32(fp, (uint32_t)fid);
+    /* Serialize the feature reference into the buffer. */
+    p = reserve_buffer(writer, 10 * ((size_t)n + 1));
+    if (p == NULL) {
+        return CRFERR_OUTOFMEMORY;
+    }
+    if (writer->weight_bits != 0) {
+        /* Delta-code the feature ids with variable-length integers. */
+        p = encode_varint(p, n);
+        for (i = 0;i < ref->num_features;++i) {
+            fid = map[ref->fids[i]];
+            if (0 <= fid) {
+                p = encode_varint(p, zigzag((int64_t)fid - prev));
+                prev = fid;
+            }
+        }
+        writer->num_fids += n;
+    } else {
+        p = encode_uint32(p, (uint32_t)n);
+        for (i = 0;i < ref->num_features;++i) {
+            fid = map[ref->fids[i]];
+            if (0 <= fid) p = encode_word(writer, p, (uint64_t)fid);
+        }
     }
 
-    return 0;
+    /* Write the feature reference. */
+    return write_uint8_array(fp, writer->buffer, p - writer->buffer);
 }
 
 int crfvomw_open_features(crfvomw_t* writer)
@@ -525,52 +1114,231 @@ int crfvomw_open_features(crfvomw_t* writer)
         return CRFERR_OUTOFMEMORY;
     }
 
-    writer->header.off_features = (uint32_t)ftell(fp);
-    fseek(fp, CHUNK_SIZE, SEEK_CUR);
-
-    strncpy(hfeat->chunk, CHUNK_FEATURE, 4);
+    writer->header.off_features = tell(writer);
+    if (writer->weight_bits != 0) {
+        /* Quantized features are buffered until the chunk is closed. */
+        strncpy(hfeat->chunk, CHUNK_FEATUREQ, 4);
+    } else {
+        fseeko(fp, chunk_header_size(writer->wide), SEEK_CUR);
+        strncpy(hfeat->chunk, CHUNK_FEATURE, 4);
+    }
     writer->hfeat = hfeat;
 
     writer->state = WSTATE_FEATURES;
     return 0;
 }
 
-int crfvomw_close_features(crfvomw_t* writer)
+/* Write the FEAQ chunk for the features buffered in the writer. */
+static int write_qfeatures(crfvomw_t* writer)
 {
+    int ret = 0;
+    uint64_t b, i, k, offset;
     FILE *fp = writer->fp;
-    feature_header_t* hfeat = writer->hfeat;
-    uint32_t begin = writer->header.off_features, end = 0;
+    const uint64_t K = writer->hfeat->num;
+    const uint64_t B = (K + QBLOCK_SIZE - 1) / QBLOCK_SIZE;
+    const int bytes = writer->weight_bits / 8;
+    const int word = writer->wide ? 8 : 4;
+    const int32_t qmax = (writer->weight_bits == 8) ? 127 : 32767;
+    const uint64_t size_weights = (bytes * K + 3) & ~(uint64_t)3;
+    floatval_t *scales = NULL;
+    uint64_t *offsets = NULL;
+    uint8_t *p = NULL;
 
-    /* Make sure that we are writing attribute feature references. */
-    if (writer->state != WSTATE_FEATURES) {
-        return CRFERR_INTERNAL_LOGIC;
+    scales = (floatval_t*)calloc(B + 1, sizeof(floatval_t));
+    offsets = (uint64_t*)calloc(B + 1, sizeof(uint64_t));
+    p = reserve_buffer(writer, 16 * (B + 1) + QBLOCK_SIZE * (10 + 1 + MAX_ORDER));
+    if (scales == NULL || offsets == NULL || p == NULL) {
+        ret = CRFERR_OUTOFMEMORY;
+        goto error_exit;
     }
 
-    /* Store the current offset position. */
-    end = (uint32_t)ftell(fp);
+    /* Scale each block so that its largest weight maps to qmax, and
+       compute the offset to the records of the block. */
+    offset = chunk_header_size(writer->wide) + 8 + (8 + word) * B + size_weights;
+    for (b = 0;b < B;++b) {
+        int32_t prev = 0;
+        floatval_t amax = 0.;
+        offsets[b] = offset;
+        for (k = b * QBLOCK_SIZE;k < K && k < (b+1) * QBLOCK_SIZE;++k) {
+            const crfvom_feature_t* f = &writer->features[k];
+            if (amax < fabs(f->weight)) amax = fabs(f->weight);
+            offset += varint_size(zigzag(f->attr - prev)) + 1 + f->order;
+            prev = f->attr;
+        }
+        scales[b] = amax / qmax;
+    }
 
-    /* Compute the size of this chunk. */
-    hfeat->size = (end - begin);
+    /* Write the chunk header and the block table. */
+    write_chunk_header(writer, CHUNK_FEATUREQ, offset, K);
+    write_uint32(fp, (uint32_t)writer->weight_bits);
+    write_uint32(fp, QBLOCK_SIZE);
+    for (b = 0;b < B;++b) {
+        p = encode_float(p, scales[b]);
+    }
+    for (b = 0;b < B;++b) {
+        p = encode_word(writer, p, offsets[b]);
+    }
+    write_uint8_array(fp, writer->buffer, p - writer->buffer);
+
+    /* Write the quantized weights while measuring the errors, a block at a time. */
+    writer->max_error = writer->sum_error2 = 0.;
+    p = writer->buffer;
+    for (k = 0;k < K;++k) {
+        int32_t q = 0;
+        floatval_t err;
+        const floatval_t scale = scales[k / QBLOCK_SIZE];
+        const floatval_t w = writer->features[k].weight;
+        if (0 < scale) {
+            q = (int32_t)floor(w / scale + 0.5);
+            if (q < -qmax) q = -qmax;
+            if (qmax < q) q = qmax;
+        }
+        err = fabs(w - q * scale);
+        if (writer->max_error < err) writer->max_error = err;
+        writer->sum_error2 += err * err;
+        *p++ = (uint8_t)(q & 0xFF);
+        if (bytes == 2) {
+            *p++ = (uint8_t)((q >> 8) & 0xFF);
+        }
+        if (k + 1 == K || (k + 1) % QBLOCK_SIZE == 0) {
+            write_uint8_array(fp, writer->buffer, p - writer->buffer);
+            p = writer->buffer;
+        }
+    }
+    for (i = bytes * K;i < size_weights;++i) {
+        write_uint8(fp, 0);
+    }
+
+    /* Write the records with variable-length label sequences, a block at a time. */
+    for (k = 0;k < K;++k) {
+        const crfvom_feature_t* f = &writer->features[k];
+        const int32_t prev = (k % QBLOCK_SIZE != 0) ? writer->features[k-1].attr : 0;
+        p = encode_varint(p, zigzag(f->attr - prev));
+        *p++ = (uint8_t)f->order;
+        memcpy(p, f->label_sequence, f->order);
+        p += f->order;
+        if (k + 1 == K || (k + 1) % QBLOCK_SIZE == 0) {
+            write_uint8_array(fp, writer->buffer, p - writer->buffer);
+            p = writer->buffer;
+        }
+    }
+
+    if (ferror(fp)) {
+        ret = 1;
+    }
+
+error_exit:
+    free(offsets);
+    free(scales);
+    return ret;
+}
+
+/* Write the EXPW and FSOA chunks for the features buffered in the writer. */
+static int write_native(crfvomw_t* writer)
+{
+    int ret = 0;
+    uint32_t pad;
+    uint64_t offset;
+    FILE *fp = writer->fp;
+    const uint64_t K = writer->header.num_features;
+    const uint32_t hsize = chunk_header_size(writer->wide);
+    const uint32_t bom = BYTE_ORDER_MARK;
+
+    /* The exp-weights are read in place, hence aligned to a QWORD. */
+    if (writer->exp_weights != NULL) {
+        if (align_qword(fp)) {
+            return 1;
+        }
+        offset = tell(writer);
+        write_chunk_header(writer, CHUNK_EXPWEIGHT, hsize + sizeof(bom) + sizeof(floatval_t) * K, K);
+        fwrite(&bom, sizeof(bom), 1, fp);
+        fwrite(writer->exp_weights, sizeof(floatval_t), K, fp);
+        if (ret = add_chunk(writer, CHUNK_EXPWEIGHT, offset)) {
+            return ret;
+        }
+    }
+
+    offset = tell(writer);
+    pad = (uint32_t)((4 - K % 4) % 4);
+    write_chunk_header(writer, CHUNK_FEATURESOA, hsize + 4 + K + pad + MAX_ORDER * K, K);
+    write_uint32(fp, MAX_ORDER);
+    write_uint8_array(fp, writer->orders, K);
+    while (0 < pad--) {
+        write_uint8(fp, 0);
+    }
+    write_uint8_array(fp, writer->label_sequences, MAX_ORDER * K);
+    if (ret = add_chunk(writer, CHUNK_FEATURESOA, offset)) {
+        return ret;
+    }
+
+    return ferror(fp) ? 1 : 0;
+}
+
+static int close_native(crfvomw_t* writer)
+{
+    int ret = 0;
+    if (writer->native) {
+        ret = write_native(writer);
+    }
+    free(writer->exp_weights);
+    free(writer->orders);
+    free(writer->label_sequences);
+    writer->exp_weights = NULL;
+    writer->orders = writer->label_sequences = NULL;
+    writer->max_native = 0;
+    return ret;
+}
+
+int crfvomw_close_features(crfvomw_t* writer)
+{
+    FILE *fp = writer->fp;
+    feature_header_t* hfeat = writer->hfeat;
+    uint64_t begin = writer->header.off_features, end = 0;
+
+    /* Make sure that we are writing attribute feature references. */
+    if (writer->state != WSTATE_FEATURES) {
+        return CRFERR_INTERNAL_LOGIC;
+    }
+
+    if (writer->weight_bits != 0) {
+        int ret = write_qfeatures(writer);
+        writer->header.num_features = hfeat->num;
+        free(writer->features);
+        writer->features = NULL;
+        writer->max_features = 0;
+        free(hfeat);
+        writer->hfeat = NULL;
+        writer->state = WSTATE_NONE;
+        if (ret == 0) {
+            ret = close_native(writer);
+        }
+        return ret;
+    }
+
+    /* Store the current offset position. */
+    end = tell(writer);
+
+    /* Compute the size of this chunk. */
+    hfeat->size = (end - begin);
 
     /* Write the chunk header and offset array. */
-    fseek(fp, begin, SEEK_SET);
-    write_uint8_array(fp, hfeat->chunk, 4);
-    write_uint32(fp, hfeat->size);
-    write_uint32(fp, hfeat->num);
+    fseeko(fp, begin, SEEK_SET);
+    write_chunk_header(writer, (const char*)hfeat->chunk, hfeat->size, hfeat->num);
 
     /* Move the file pointer to the tail. */
-    fseek(fp, end, SEEK_SET);
+    fseeko(fp, end, SEEK_SET);
     writer->header.num_features = hfeat->num;
 
     /* Uninitialize. */
     free(hfeat);
     writer->hfeat = NULL;
     writer->state = WSTATE_NONE;
-    return 0;
+    return close_native(writer);
 }
 
-int crfvomw_put_feature(crfvomw_t* writer, int fid, const crfvom_feature_t* f)
+int crfvomw_put_feature(crfvomw_t* writer, fid_t fid, const crfvom_feature_t* f)
 {
+    uint8_t record[FEATURE_SIZE], *p = NULL;
     FILE *fp = writer->fp;
     feature_header_t* hfeat = writer->hfeat;
 
@@ -580,22 +1348,401 @@ int crfvomw_put_feature(crfvomw_t* writer, int fid, const crfvom_feature_t* f)
     }
 
     /* We must put features #0, #1, ..., #(K-1) in this order. */
-    if (fid != hfeat->num) {
+    if (fid < 0 || (uint64_t)fid != hfeat->num) {
         return CRFERR_INTERNAL_LOGIC;
     }
 
-    write_uint32(fp, f->order);
-    write_uint32(fp, f->attr);
-    write_uint8_array(fp, (uint8_t*)f->label_sequence, MAX_ORDER);
-    write_float(fp, f->weight);
+    /* Buffer the feature for the native chunks. */
+    if (writer->native) {
+        if (writer->max_native <= hfeat->num) {
+            size_t max = (writer->max_native != 0) ? writer->max_native * 2 : 1024;
+            floatval_t* exp_weights = NULL;
+            uint8_t* orders = NULL;
+            uint8_t* label_sequences = NULL;
+            if (writer->weight_bits == 0) {
+                exp_weights = (floatval_t*)realloc(writer->exp_weights, sizeof(floatval_t) * max);
+                if (exp_weights != NULL) writer->exp_weights = exp_weights;
+            }
+            orders = (uint8_t*)realloc(writer->orders, max);
+            if (orders != NULL) writer->orders = orders;
+            label_sequences = (uint8_t*)realloc(writer->label_sequences, MAX_ORDER * max);
+            if (label_sequences != NULL) writer->label_sequences = label_sequences;
+            if ((writer->weight_bits == 0 && exp_weights == NULL) ||
+                orders == NULL || label_sequences == NULL) {
+                return CRFERR_OUTOFMEMORY;
+            }
+            writer->max_native = max;
+        }
+        if (writer->exp_weights != NULL) {
+            writer->exp_weights[hfeat->num] = exp(f->weight);
+        }
+        writer->orders[hfeat->num] = (uint8_t)f->order;
+        memcpy(&writer->label_sequences[MAX_ORDER * hfeat->num], f->label_sequence, MAX_ORDER);
+    }
+
+    /* Buffer the feature to quantize its weight per block. */
+    if (writer->weight_bits != 0) {
+        if (f->order < 0 || MAX_ORDER < f->order) {
+            return CRFERR_INTERNAL_LOGIC;
+        }
+        if (writer->max_features <= hfeat->num) {
+            size_t max = (writer->max_features != 0) ? writer->max_features * 2 : 1024;
+            crfvom_feature_t* features = (crfvom_feature_t*)realloc(
+                writer->features, sizeof(crfvom_feature_t) * max);
+            if (features == NULL) {
+                return CRFERR_OUTOFMEMORY;
+            }
+            writer->features = features;
+            writer->max_features = max;
+        }
+        writer->features[hfeat->num++] = *f;
+        return 0;
+    }
+
+    p = encode_uint32(record, f->order);
+    p = encode_uint32(p, f->attr);
+    memcpy(p, f->label_sequence, MAX_ORDER);
+    p = encode_float(p + MAX_ORDER, f->weight);
+    if (write_uint8_array(fp, record, p - record)) {
+        return 1;
+    }
     ++hfeat->num;
     return 0;
 }
 
+/* Read an offset, a size or a feature id in the width of the format. */
+static uint64_t read_word(const crfvom_t* model, const uint8_t* p)
+{
+    uint32_t value32;
+    uint64_t value;
+    if (model->wide) {
+        read_uint64((uint8_t*)p, &value);
+        return value;
+    } else {
+        read_uint32((uint8_t*)p, &value32);
+        return value32;
+    }
+}
+
+/* Read the header of the chunk at the offset and return its body. */
+static const uint8_t* read_chunk_header(const crfvom_t* model, uint64_t offset, uint64_t* size, uint64_t* num)
+{
+    const uint8_t *p = model->buffer + offset;
+
+    if (model->size < offset || model->size - offset < model->chunk_size) {
+        return NULL;
+    }
+    *size = read_word(model, p + 4);
+    *num = read_word(model, p + 4 + (model->wide ? 8 : 4));
+    return p + model->chunk_size;
+}
+
+static void read_mph(crfvom_t* model, uint64_t offset, mph_t* mph)
+{
+    uint64_t size = 0, num = 0;
+    const uint8_t *p = read_chunk_header(model, offset, &size, &num);
+
+    if (p == NULL || model->size - offset < model->chunk_size + 4 || UINT32_MAX < num) {
+        return;
+    }
+    mph->num = (uint32_t)num;
+    p += read_uint32((uint8_t*)p, &mph->num_buckets);
+    if (mph->num_buckets == 0 || model->size - offset < size ||
+        size != model->chunk_size + sizeof(uint32_t) * (1 + mph->num_buckets + 2 * (uint64_t)mph->num)) {
+        memset(mph, 0, sizeof(*mph));
+        return;
+    }
+    mph->disps = p;
+    mph->table = p + sizeof(uint32_t) * mph->num_buckets;
+}
+
+static void read_expweights(crfvom_t* model, uint64_t offset)
+{
+    uint32_t bom = 0;
+    uint64_t size = 0, num = 0;
+    const uint8_t *p = read_chunk_header(model, offset, &size, &num);
+
+    if (p == NULL || model->size - offset < model->chunk_size + sizeof(bom)) {
+        return;
+    }
+    memcpy(&bom, p, sizeof(bom));
+    p += sizeof(bom);
+
+    /* Use the array only if it was written by a machine of the same kind. */
+    if (bom != BYTE_ORDER_MARK || num != model->header->num_features ||
+        size != model->chunk_size + sizeof(bom) + sizeof(floatval_t) * num ||
+        model->size - offset < size || ((size_t)p % sizeof(floatval_t)) != 0) {
+        return;
+    }
+    model->exp_weights = (const floatval_t*)p;
+}
+
+static void read_featuresoa(crfvom_t* model, uint64_t offset)
+{
+    uint32_t max_order = 0;
+    uint64_t size = 0, num = 0;
+    const uint8_t *p = read_chunk_header(model, offset, &size, &num);
+
+    if (p == NULL || model->size - offset < model->chunk_size + 4) {
+        return;
+    }
+    read_uint32((uint8_t*)p, &max_order);
+    if (max_order != MAX_ORDER || num != model->header->num_features ||
+        size != model->chunk_size + 4 + ((num + 3) & ~(uint64_t)3) + MAX_ORDER * num ||
+        model->size - offset < size) {
+        return;
+    }
+    model->orders = p + 4;
+    model->label_sequences = model->orders + ((num + 3) & ~(uint64_t)3);
+}
+
+static void read_chunks(crfvom_t* model)
+{
+    uint64_t i, size = 0, num = 0, offset = 0;
+    const header_t* header = model->header;
+    const int entry = model->wide ? 12 : 8;
+    const uint8_t *p = read_chunk_header(model, header->off_chunks, &size, &num);
+
+    if (p == NULL || memcmp(model->buffer + header->off_chunks, CHUNK_CHUNKS, 4) != 0) {
+        return;
+    }
+    for (i = 0;i < num && p + entry <= model->buffer + model->size;++i, p += entry) {
+        offset = read_word(model, p + 4);
+        if (memcmp(p, CHUNK_LABELMPH, 4) == 0) {
+            read_mph(model, offset, &model->label_mph);
+        } else if (memcmp(p, CHUNK_ATTRMPH, 4) == 0) {
+            read_mph(model, offset, &model->attr_mph);
+        } else if (memcmp(p, CHUNK_EXPWEIGHT, 4) == 0) {
+            read_expweights(model, offset);
+        } else if (memcmp(p, CHUNK_FEATURESOA, 4) == 0) {
+            read_featuresoa(model, offset);
+        }
+    }
+}
+
+static int mph_to_id(const mph_t* mph, const char *value)
+{
+    uint32_t disp, slot, fp, id;
+    const uint64_t h = mph_hash(value);
+
+    if (mph->num == 0) {
+        return -1;
+    }
+    read_uint32((uint8_t*)mph->disps + sizeof(uint32_t) * mph_bucket(h, mph->num_buckets), &disp);
+    slot = mph_slot(h, disp, mph->num);
+    read_uint32((uint8_t*)mph->table + 8 * slot, &fp);
+    if (fp != mph_fingerprint(h)) {
+        return -1;
+    }
+    read_uint32((uint8_t*)mph->table + 8 * slot + 4, &id);
+    return (int)id;
+}
+
+static int read_qfeatures(crfvom_t* model)
+{
+    uint64_t size = 0, num = 0;
+    qfeatures_t* qf = &model->qfeatures;
+    const uint64_t offset = model->header->off_features;
+    const uint8_t *p = read_chunk_header(model, offset, &size, &num);
+
+    if (p == NULL || model->size - offset < model->chunk_size + 8) {
+        return 1;
+    }
+    read_uint32((uint8_t*)p, &qf->bits);
+    read_uint32((uint8_t*)p + 4, &qf->block_size);
+    if ((qf->bits != 8 && qf->bits != 16) || qf->block_size == 0 ||
+        num != model->header->num_features || model->size - offset < size) {
+        return 1;
+    }
+    qf->offset_size = model->wide ? 8 : 4;
+    qf->num_blocks = (num + qf->block_size - 1) / qf->block_size;
+    if (size < model->chunk_size + 8 + (8 + qf->offset_size) * qf->num_blocks + (qf->bits / 8) * num) {
+        return 1;
+    }
+    qf->base = model->buffer + offset;
+    qf->scales = p + 8;
+    qf->offsets = qf->scales + 8 * qf->num_blocks;
+    qf->weights = qf->offsets + qf->offset_size * qf->num_blocks;
+    return 0;
+}
+
+static int read_attrrefv(crfvom_t* model)
+{
+    uint64_t i, j, n, v, size = 0, num = 0, num_fids = 0, offset, total = 0;
+    const uint64_t begin = model->header->off_attrrefs;
+    const uint32_t word = model->wide ? 8 : 4;
+    const uint8_t *p = read_chunk_header(model, begin, &size, &num), *q = NULL;
+    const uint8_t *last = model->buffer + model->size;
+
+    if (p == NULL || model->size - begin < model->chunk_size + word) {
+        return 1;
+    }
+    num_fids = read_word(model, p);
+    p += word;
+    if (num != model->header->num_attrs || model->size < num_fids ||
+        (model->size - begin - model->chunk_size - word) / word < num) {
+        return 1;
+    }
+
+    /* Decode the lists into little-endian arrays of fid_t. */
+    model->fid_begins = (fid_t*)malloc(sizeof(fid_t) * (num + 1));
+    model->fids = (uint8_t*)malloc(sizeof(fid_t) * num_fids + 1);
+    if (model->fid_begins == NULL || model->fids == NULL) {
+        return 1;
+    }
+    for (i = 0;i < num;++i) {
+        int64_t fid = 0;
+        offset = read_word(model, p + word * i);
+        if (model->size <= offset) {
+            return 1;
+        }
+        q = model->buffer + offset;
+        q += read_varint(q, &n);
+        if (num_fids - total < n) {
+            return 1;
+        }
+        model->fid_begins[i] = (fid_t)total;
+        for (j = 0;j < n;++j) {
+            if (last <= q) {
+                return 1;
+            }
+            q += read_varint(q, &v);
+            fid += unzigzag(v);
+            if (fid < 0 || FID_MAX < fid) {
+                return 1;
+            }
+            store_fid(model->fids + sizeof(fid_t) * (total + j), (fid_t)fid);
+        }
+        total += n;
+    }
+    model->fid_begins[num] = (fid_t)total;
+    return 0;
+}
+
+/*
+    Decode the AFRF lists into little-endian arrays of fid_t when they
+    cannot be used in place.
+ */
+static int read_attrref(crfvom_t* model)
+{
+    uint32_t n;
+    uint64_t i, j, fid, size = 0, num = 0, offset, total = 0;
+    const uint64_t begin = model->header->off_attrrefs;
+    const uint32_t word = model->wide ? 8 : 4;
+    const uint8_t *p = read_chunk_header(model, begin, &size, &num);
+
+    if (p == NULL || num != model->header->num_attrs ||
+        (model->size - begin - model->chunk_size) / word < num) {
+        return 1;
+    }
+
+    /* Count the references to allocate the arrays. */
+    for (i = 0;i < num;++i) {
+        offset = read_word(model, p + word * i);
+        if (model->size < offset || model->size - offset < 4) {
+            return 1;
+        }
+        read_uint32(model->buffer + offset, &n);
+        if ((model->size - offset - 4) / word < n) {
+            return 1;
+        }
+        total += n;
+    }
+    model->fid_begins = (fid_t*)malloc(sizeof(fid_t) * (num + 1));
+    model->fids = (uint8_t*)malloc(sizeof(fid_t) * total + 1);
+    if (model->fid_begins == NULL || model->fids == NULL) {
+        return 1;
+    }
+
+    for (i = 0, total = 0;i < num;++i) {
+        const uint8_t *q = model->buffer + read_word(model, p + word * i);
+        q += read_uint32((uint8_t*)q, &n);
+        model->fid_begins[i] = (fid_t)total;
+        for (j = 0;j < n;++j, q += word) {
+            fid = read_word(model, q);
+            if ((uint64_t)FID_MAX < fid) {
+                return 1;
+            }
+            store_fid(model->fids + sizeof(fid_t) * (total + j), (fid_t)fid);
+        }
+        total += n;
+    }
+    model->fid_begins[num] = (fid_t)total;
+    return 0;
+}
+
+/* The file stores integers in little endian; see BYTE_ORDER_MARK. */
+static int is_little_endian()
+{
+    uint8_t b[4];
+    const uint32_t bom = BYTE_ORDER_MARK;
+    memcpy(b, &bom, sizeof(b));
+    return (b[0] == 0x04);
+}
+
+/*
+    Locate the table of offsets to the lists of attribute references;
+    the lists themselves are read when an attribute is used.
+ */
+static int read_attrrefs(crfvom_t* model)
+{
+    uint64_t size = 0, num = 0;
+    const uint64_t begin = model->header->off_attrrefs;
+    const uint32_t word = model->wide ? 8 : 4;
+    const uint8_t *p = read_chunk_header(model, begin, &size, &num);
+
+    if (p == NULL || num != model->header->num_attrs) {
+        return 1;
+    }
+    if (memcmp(model->buffer + begin, CHUNK_ATTRREFV, 4) == 0) {
+        if (model->size - begin - model->chunk_size < word) {
+            return 1;
+        }
+        model->attrref_coding = AREF_VARINT;
+        p += word;      /* Skip the total number of references. */
+    } else if (word == sizeof(fid_t) && is_little_endian()) {
+        model->attrref_coding = AREF_INPLACE;
+    } else {
+        model->attrref_coding = AREF_FIXED;
+    }
+    if ((uint64_t)(model->buffer + model->size - p) / word < num) {
+        return 1;
+    }
+    model->attrref_offsets = p;
+    return 0;
+}
+
+/* Decode the references of all the attributes at a time. */
+static int decode_attrrefs(crfvom_t* model)
+{
+    int ret = (model->attrref_coding == AREF_VARINT) ? read_attrrefv(model) : read_attrref(model);
+
+    if (ret != 0) {
+        free(model->fid_begins);
+        free(model->fids);
+        model->fid_begins = NULL;
+        model->fids = NULL;
+    }
+    return ret;
+}
+
+static void release_buffer(crfvom_t* model)
+{
+#ifdef  USE_MMAP
+    if (model->mapped) {
+        munmap(model->buffer, model->size);
+        model->mapped = 0;
+    }
+#endif/*USE_MMAP*/
+    free(model->buffer_orig);
+    model->buffer_orig = model->buffer = NULL;
+}
+
 crfvom_t* crfvom_new(const char *filename)
 {
     FILE *fp = NULL;
     uint8_t* p = NULL;
+    uint32_t value = 0;
     crfvom_t *model = NULL;
     header_t *header = NULL;
 
@@ -609,34 +1756,100 @@ crfvom_t* crfvom_new(const char *filename)
         goto error_exit;
     }
 
-    fseek(fp, 0, SEEK_END);
-    model->size = (uint32_t)ftell(fp);
-    fseek(fp, 0, SEEK_SET);
+    fseeko(fp, 0, SEEK_END);
+    model->size = (size_t)ftello(fp);
+    fseeko(fp, 0, SEEK_SET);
 
-    model->buffer = model->buffer_orig = (uint8_t*)malloc(model->size + 16);
-    while ((uint32_t)model->buffer % 16 != 0) {
-        ++model->buffer;
+#ifdef  USE_MMAP
+    /*
+        Map the file so that only the pages of the sections in use are read
+        (and kept resident); the sections are read in place or on demand.
+     */
+    if (HEADER_SIZE <= model->size) {
+        void *addr = mmap(NULL, model->size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+        if (addr != MAP_FAILED) {
+            model->buffer = (uint8_t*)addr;
+            model->mapped = 1;
+        }
     }
+#endif/*USE_MMAP*/
 
-    fread(model->buffer, 1, model->size, fp);
+    if (!model->mapped) {
+        model->buffer = model->buffer_orig = (uint8_t*)malloc(model->size + 16);
+        if (model->buffer_orig == NULL) {
+            goto error_exit;
+        }
+        while ((size_t)model->buffer % 16 != 0) {
+            ++model->buffer;
+        }
+        fread(model->buffer, 1, model->size, fp);
+    }
     fclose(fp);
+    fp = NULL;
 
     /* Write the file header. */
     header = (header_t*)calloc(1, sizeof(header_t));
+    if (header == NULL || model->size < HEADER_SIZE) {
+        free(header);
+        goto error_exit;
+    }
+    model->header = header;
 
     p = model->buffer;
     p += read_uint8_array(p, header->magic, sizeof(header->magic));
-    p += read_uint32(p, &header->size);
+    p += read_uint32(p, &value);
+    header->size = value;
     p += read_uint8_array(p, header->type, sizeof(header->type));
     p += read_uint32(p, &header->version);
-    p += read_uint32(p, &header->num_features);
+    model->wide = (header->version & VERSION_WIDE) != 0;
+    model->chunk_size = chunk_header_size(model->wide);
+    if (model->wide) {
+        if (model->size < HEADER_SIZE_WIDE) {
+            goto error_exit;
+        }
+        p += read_uint64(p, &header->size);
+        p += read_uint64(p, &header->num_features);
+    } else {
+        p += read_uint32(p, &value);
+        header->num_features = value;
+    }
     p += read_uint32(p, &header->num_labels);
     p += read_uint32(p, &header->num_attrs);
-    p += read_uint32(p, &header->off_features);
-    p += read_uint32(p, &header->off_labels);
-    p += read_uint32(p, &header->off_attrs);
-    p += read_uint32(p, &header->off_attrrefs);
-    model->header = header;
+    header->off_features = read_word(model, p);
+    p += model->wide ? 8 : 4;
+    header->off_labels = read_word(model, p);
+    p += model->wide ? 8 : 4;
+    header->off_attrs = read_word(model, p);
+    p += model->wide ? 8 : 4;
+    header->off_attrrefs = read_word(model, p);
+    p += model->wide ? 8 : 4;
+    if (101 <= (header->version & ~VERSION_WIDE)) {
+        header->off_chunks = read_word(model, p);
+    }
+
+    /* A model with more features than fid_t represents cannot be used. */
+    if ((uint64_t)FID_MAX < header->num_features) {
+        goto error_exit;
+    }
+
+    if (header->off_chunks != 0) {
+        read_chunks(model);
+    }
+
+    /* Read the quantized features and the table of the references. */
+    if (header->off_features + 4 <= model->size &&
+        memcmp(model->buffer + header->off_features, CHUNK_FEATUREQ, 4) == 0) {
+        if (read_qfeatures(model) != 0) {
+            goto error_exit;
+        }
+    }
+    if (header->off_attrrefs + 4 <= model->size &&
+        (memcmp(model->buffer + header->off_attrrefs, CHUNK_ATTRREFV, 4) == 0 ||
+         memcmp(model->buffer + header->off_attrrefs, CHUNK_ATTRREF, 4) == 0)) {
+        if (read_attrrefs(model) != 0) {
+            goto error_exit;
+        }
+    }
 
     model->labels = cqdb_reader(
         model->buffer + header->off_labels,
@@ -652,6 +1865,8 @@ crfvom_t* crfvom_new(const char *filename)
 
 error_exit:
     if (model != NULL) {
+        free(model->header);
+        release_buffer(model);
         free(model);
     }
     if (fp != NULL) {
@@ -672,10 +1887,9 @@ void crfvom_close(crfvom_t* model)
         free(model->header);
         model->header = NULL;
     }
-    if (model->buffer_orig != NULL) {
-        free(model->buffer_orig);
-        model->buffer_orig = model->buffer = NULL;
-    }
+    release_buffer(model);
+    free(model->fid_begins);
+    free(model->fids);
     free(model);
 }
 
@@ -689,9 +1903,9 @@ int crfvom_get_num_labels(crfvom_t* model)
     return model->header->num_labels;
 }
 
-int crfvom_get_num_features(crfvom_t* model)
+fid_t crfvom_get_num_features(crfvom_t* model)
 {
-    return model->header->num_features;
+    return (fid_t)model->header->num_features;
 }
 
 const char *crfvom_to_label(crfvom_t* model, int lid)
@@ -705,7 +1919,9 @@ const char *crfvom_to_label(crfvom_t* model, int lid)
 
 int crfvom_to_lid(crfvom_t* model, const char *value)
 {
-    if (model->labels != NULL) {
+    if (model->label_mph.disps != NULL) {
+        return mph_to_id(&model->label_mph, value);
+    } else if (model->labels != NULL) {
         return cqdb_to_id(model->labels, value);
     } else {
         return -1;
@@ -714,7 +1930,9 @@ int crfvom_to_lid(crfvom_t* model, const char *value)
 
 int crfvom_to_aid(crfvom_t* model, const char *value)
 {
-    if (model->attrs != NULL) {
+    if (model->attr_mph.disps != NULL) {
+        return mph_to_id(&model->attr_mph, value);
+    } else if (model->attrs != NULL) {
         return cqdb_to_id(model->attrs, value);
     } else {
         return -1;
@@ -730,37 +1948,227 @@ const char *crfvom_to_attr(crfvom_t* model, int aid)
     }
 }
 
-int crfvom_get_attrref(crfvom_t* model, int aid, feature_refs_t* ref)
+int crfvom_get_weight_bits(crfvom_t* model)
 {
-    uint8_t *p = model->buffer;
-    uint32_t offset;
+    return (model->qfeatures.base != NULL) ? (int)model->qfeatures.bits : 0;
+}
 
-    p += model->header->off_attrrefs;
-    p += CHUNK_SIZE;
-    p += sizeof(uint32_t) * aid;
-    read_uint32(p, &offset);
+int crfvom_get_wide(crfvom_t* model)
+{
+    return model->wide;
+}
 
-    p = model->buffer + offset;
-    p += read_uint32(p, &ref->num_features);
-    ref->fids = (int*)p;
+const floatval_t* crfvom_get_exp_weights(crfvom_t* model)
+{
+    return model->exp_weights;
+}
+
+int crfvom_get_feature_labels(crfvom_t* model, const uint8_t** orders, const uint8_t** label_sequences)
+{
+    if (model->orders == NULL) {
+        return 1;
+    }
+    *orders = model->orders;
+    *label_sequences = model->label_sequences;
     return 0;
 }
 
-int crfvom_get_featureid(feature_refs_t* ref, int i)
+/*
+    Decode the references of all the attributes on the first call unless
+    they are used in place. Not safe to call from multiple threads at the
+    first time; a tagger uses crfvom_read_attrref() instead.
+ */
+int crfvom_get_attrref(crfvom_t* model, int aid, feature_refs_t* ref)
+{
+    if (model->fid_begins == NULL) {
+        if (model->attrref_coding == AREF_INPLACE) {
+            if (crfvom_read_attrref(model, aid, ref, NULL, 0) < 0) {
+                return CRFERR_INCOMPATIBLE;
+            }
+            if (ref->fids != NULL || ref->num_features == 0) {
+                return 0;
+            }
+            /* A misaligned list: decode all the lists instead. */
+        }
+        if (decode_attrrefs(model) != 0) {
+            ref->num_features = 0;
+            ref->fids = NULL;
+            return CRFERR_INCOMPATIBLE;
+        }
+    }
+
+    ref->num_features = (int)(model->fid_begins[aid+1] - model->fid_begins[aid]);
+    ref->fids = (fid_t*)(model->fids + sizeof(fid_t) * model->fid_begins[aid]);
+    return 0;
+}
+
+/*
+    Read the references of an attribute without touching the others. They
+    are used in place when the file stores them as aligned fid_t on a
+    little-endian host, or decoded into fids when it has room for them
+    (ref->fids is NULL otherwise). Returns
+    the number of the references, or -1 when the list is broken.
+ */
+int crfvom_read_attrref(crfvom_t* model, int aid, feature_refs_t* ref, fid_t* fids, int max)
+{
+    uint32_t n32;
+    uint64_t i, n, v, offset;
+    int64_t fid = 0;
+    const uint32_t word = model->wide ? 8 : 4;
+    const uint8_t *q = NULL, *last = model->buffer + model->size;
+
+    ref->num_features = 0;
+    ref->fids = NULL;
+    if (model->attrref_offsets == NULL) {
+        return 0;
+    }
+    if (aid < 0 || model->header->num_attrs <= (uint32_t)aid) {
+        return -1;
+    }
+
+    offset = read_word(model, model->attrref_offsets + (uint64_t)word * aid);
+    if (model->size < offset || model->size - offset < 4) {
+        return -1;
+    }
+    q = model->buffer + offset;
+    if (model->attrref_coding == AREF_VARINT) {
+        q += read_varint(q, &n);
+    } else {
+        q += read_uint32((uint8_t*)q, &n32);
+        n = n32;
+        if ((uint64_t)(last - q) / word < n) {
+            return -1;
+        }
+    }
+    if ((uint64_t)INT_MAX < n) {
+        return -1;
+    }
+    ref->num_features = (int)n;
+
+    if (model->attrref_coding == AREF_INPLACE && ((size_t)q % sizeof(fid_t)) == 0) {
+        ref->fids = (fid_t*)q;
+        return (int)n;
+    }
+    if ((uint64_t)max < n) {
+        return (int)n;
+    }
+    for (i = 0;i < n;++i) {
+        if (model->attrref_coding == AREF_VARINT) {
+            if (last <= q) {
+                return -1;
+            }
+            q += read_varint(q, &v);
+            fid += unzigzag(v);
+        } else {
+            fid = (int64_t)read_word(model, q);
+            q += word;
+        }
+        if (fid < 0 || FID_MAX < fid) {
+            return -1;
+        }
+        fids[i] = (fid_t)fid;
+    }
+    ref->fids = fids;
+    return (int)n;
+}
+
+fid_t crfvom_get_featureid(feature_refs_t* ref, int i)
 {
-    uint32_t fid;
     uint8_t* p = (uint8_t*)ref->fids;
+#ifdef  CRFVO_LARGE
+    uint64_t fid;
+    p += sizeof(uint64_t) * i;
+    read_uint64(p, &fid);
+#else
+    uint32_t fid;
     p += sizeof(uint32_t) * i;
     read_uint32(p, &fid);
-    return (int)fid;
+#endif/*CRFVO_LARGE*/
+    return (fid_t)fid;
 }
 
-int crfvom_get_feature(crfvom_t* model, int fid, crfvom_feature_t* f)
+/* Decode the features #fid, ..., #(fid+n-1) in the same block. */
+static void get_qfeatures(const qfeatures_t* qf, fid_t fid, int n, crfvom_feature_t* fs)
+{
+    int32_t q;
+    uint64_t i, v, offset;
+    const uint8_t *p = NULL;
+    const uint64_t block = (uint64_t)fid / qf->block_size;
+    floatval_t scale;
+    int attr = 0, order;
+
+    /* Skip the records preceding the feature in the block. */
+    read_float((uint8_t*)qf->scales + 8 * block, &scale);
+    if (qf->offset_size == 8) {
+        read_uint64((uint8_t*)qf->offsets + 8 * block, &offset);
+    } else {
+        uint32_t offset32;
+        read_uint32((uint8_t*)qf->offsets + 4 * block, &offset32);
+        offset = offset32;
+    }
+    p = qf->base + offset;
+    for (i = block * qf->block_size;i < (uint64_t)(fid + n);++i) {
+        p += read_varint(p, &v);
+        attr += (int)unzigzag(v);
+        order = *p++;
+        if (MAX_ORDER < order) {
+            order = MAX_ORDER;
+        }
+        if ((uint64_t)fid <= i) {
+            crfvom_feature_t* f = &fs[i - fid];
+            f->attr = attr;
+            f->order = order;
+            memset(f->label_sequence, 0, sizeof(f->label_sequence));
+            memcpy(f->label_sequence, p, order);
+
+            /* Dequantize the weight. */
+            if (qf->bits == 8) {
+                q = (int8_t)qf->weights[i];
+            } else {
+                q = (int16_t)(qf->weights[2*i] | (qf->weights[2*i+1] << 8));
+            }
+            f->weight = q * scale;
+        }
+        p += order;
+    }
+}
+
+int crfvom_get_features(crfvom_t* model, fid_t fid, fid_t n, crfvom_feature_t* fs)
+{
+    fid_t i;
+    const qfeatures_t* qf = &model->qfeatures;
+
+    if (qf->base == NULL) {
+        for (i = 0;i < n;++i) {
+            crfvom_get_feature(model, fid + i, &fs[i]);
+        }
+        return 0;
+    }
+
+    /* Decode block by block so that no record is skipped twice. */
+    while (0 < n) {
+        int m = (int)(qf->block_size - (uint64_t)fid % qf->block_size);
+        if (n < m) m = (int)n;
+        get_qfeatures(qf, fid, m, fs);
+        fid += m;
+        fs += m;
+        n -= m;
+    }
+    return 0;
+}
+
+int crfvom_get_feature(crfvom_t* model, fid_t fid, crfvom_feature_t* f)
 {
     uint8_t *p = NULL;
     uint32_t val = 0;
-    uint32_t offset = model->header->off_features + CHUNK_SIZE;
-    offset += FEATURE_SIZE * fid;
+    uint64_t offset = model->header->off_features + model->chunk_size;
+
+    if (model->qfeatures.base != NULL) {
+        get_qfeatures(&model->qfeatures, fid, 1, f);
+        return 0;
+    }
+
+    offset += FEATURE_SIZE * (uint64_t)fid;
     p = model->buffer + offset;
     p += read_uint32(p, &val);
     f->order = val;
@@ -782,17 +2190,18 @@ void crfvom_dump(crfvom_t* crfvom, FILE *fp)
     fprintf(fp, "FILEHEADER = {\n");
     fprintf(fp, "  magic: %c%c%c%c\n",
         hfile->magic[0], hfile->magic[1], hfile->magic[2], hfile->magic[3]);
-    fprintf(fp, "  size: %d\n", hfile->size);
+    fprintf(fp, "  size: %llu\n", (unsigned long long)hfile->size);
     fprintf(fp, "  type: %c%c%c%c\n",
         hfile->type[0], hfile->type[1], hfile->type[2], hfile->type[3]);
     fprintf(fp, "  version: %d\n", hfile->version);
-    fprintf(fp, "  num_features: %d\n", hfile->num_features);
+    fprintf(fp, "  num_features: %llu\n", (unsigned long long)hfile->num_features);
     fprintf(fp, "  num_labels: %d\n", hfile->num_labels);
     fprintf(fp, "  num_attrs: %d\n", hfile->num_attrs);
-    fprintf(fp, "  off_features: 0x%X\n", hfile->off_features);
-    fprintf(fp, "  off_labels: 0x%X\n", hfile->off_labels);
-    fprintf(fp, "  off_attrs: 0x%X\n", hfile->off_attrs);
-    fprintf(fp, "  off_attrrefs: 0x%X\n", hfile->off_attrrefs);
+    fprintf(fp, "  off_features: 0x%llX\n", (unsigned long long)hfile->off_features);
+    fprintf(fp, "  off_labels: 0x%llX\n", (unsigned long long)hfile->off_labels);
+    fprintf(fp, "  off_attrs: 0x%llX\n", (unsigned long long)hfile->off_attrs);
+    fprintf(fp, "  off_attrrefs: 0x%llX\n", (unsigned long long)hfile->off_attrrefs);
+    fprintf(fp, "  off_chunks: 0x%llX\n", (unsigned long long)hfile->off_chunks);
     fprintf(fp, "}\n");
     fprintf(fp, "\n");
 
@@ -832,7 +2241,7 @@ void crfvom_dump(crfvom_t* crfvom, FILE *fp)
         crfvom_get_attrref(crfvom, i, &refs);
         for (j = 0;j < refs.num_features;++j) {
             crfvom_feature_t f;
-            int fid = crfvom_get_featureid(&refs, j);
+            fid_t fid = crfvom_get_featureid(&refs, j);
             const char *attr = NULL, *to = NULL;
 
             crfvom_get_feature(crfvom, fid, &f);
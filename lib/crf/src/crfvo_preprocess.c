@@ -41,14 +41,33 @@ crfvopd_t* crfvopd_new(int L, int num_paths, int num_fids)
 {
     crfvopd_t* pd = (crfvopd_t*)calloc(1, sizeof(crfvopd_t));    
 
-    pd->num_paths = num_paths;
-    pd->num_fids = num_fids;
-    pd->fids = (int*)malloc(sizeof(int) * num_fids);
+    pd->num_paths = pd->max_paths = num_paths;
+    pd->num_fids = pd->max_fids = num_fids;
+    pd->fids = (fid_t*)malloc(sizeof(fid_t) * num_fids);
     pd->paths = (crfvo_path_t*)malloc(sizeof(crfvo_path_t) * num_paths);
     pd->num_paths_by_label = (int*)malloc(sizeof(int) * (L+1));
     return pd;
 }
 
+int crfvopd_reserve(crfvopd_t* pd, int num_paths, int num_fids)
+{
+    if (pd->max_paths < num_paths) {
+        crfvo_path_t* paths = (crfvo_path_t*)realloc(pd->paths, sizeof(crfvo_path_t) * num_paths);
+        if (paths == NULL) return CRFERR_OUTOFMEMORY;
+        pd->paths = paths;
+        pd->max_paths = num_paths;
+    }
+    if (pd->max_fids < num_fids) {
+        fid_t* fids = (fid_t*)realloc(pd->fids, sizeof(fid_t) * num_fids);
+        if (fids == NULL) return CRFERR_OUTOFMEMORY;
+        pd->fids = fids;
+        pd->max_fids = num_fids;
+    }
+    pd->num_paths = num_paths;
+    pd->num_fids = num_fids;
+    return 0;
+}
+
 void crfvopd_delete(crfvopd_t* pd)
 {
     if (pd != NULL) {
@@ -115,7 +134,7 @@ void buf_delete(buffer_manager_t* manager)
 
 typedef struct
 {
-    int fid;
+    fid_t fid;
     int next;
 } fid_list_t;
 
@@ -130,7 +149,7 @@ typedef struct {
     int fid_list;
 } path_t;
 
-typedef struct {
+struct tag_trie {
     int label_number;
     int root;
     int start_path;
@@ -139,7 +158,7 @@ typedef struct {
     buffer_manager_t* node_manager;
     buffer_manager_t* path_manager;
     buffer_manager_t* fid_list_manager;
-} trie_t;
+};
 
 #define INVALID (-1)
 #define EMPTY (0)
@@ -176,7 +195,7 @@ void trie_init(
     trie->fid_count = 0;
 }
 
-int trie_set_feature(trie_t* trie, crfvol_feature_t* f, int fid, int* created)
+int trie_set_feature(trie_t* trie, crfvol_feature_t* f, fid_t fid, int* created)
 {
     int i;
     int node = trie->root;
@@ -211,7 +230,7 @@ int trie_get_longest_match_path_index(trie_t* trie, uint8_t* label_sequence, int
 {
     int cur_node = trie->root;
     int ret_node = cur_node;
-    int i, last_valid_path;
+    int i, last_valid_path = INVALID;
 
     for (i = 0; i < label_sequence_len; ++i) {
         int path;
@@ -220,7 +239,8 @@ int trie_get_longest_match_path_index(trie_t* trie, uint8_t* label_sequence, int
         path = GET_PATH(trie, cur_node);
         if (IS_VALID(path)) last_valid_path = path;
     }
-    return PATH(trie, last_valid_path)->index;
+    /* No path matches the labels when they are unknown (tagging). */
+    return IS_VALID(last_valid_path) ? PATH(trie, last_valid_path)->index : INVALID;
 }
 
 int trie_get_path_count(trie_t* trie)
@@ -271,7 +291,7 @@ void trie_get_preprocessed_data_(
     }
 }
 
-void trie_get_preprocessed_data(
+int trie_get_preprocessed_data(
     trie_t* trie,
     trie_t* prev_trie,
     crfvopd_t** preprocessed_data_p,
@@ -286,9 +306,14 @@ void trie_get_preprocessed_data(
     int valid_parent_index = 0;
     int prev_index_by_label;
     recursion_data_t r;
-    crfvopd_t* preprocessed_data;
-    
-    preprocessed_data = crfvopd_new(trie->label_number, trie->path_count, trie->fid_count);
+    crfvopd_t* preprocessed_data = *preprocessed_data_p;
+
+    /* Reuse the data of an item preprocessed before if any. */
+    if (preprocessed_data == NULL) {
+        preprocessed_data = crfvopd_new(trie->label_number, trie->path_count, trie->fid_count);
+    } else if (crfvopd_reserve(preprocessed_data, trie->path_count, trie->fid_count) != 0) {
+        return CRFERR_OUTOFMEMORY;
+    }
 
     /* empty path */
     preprocessed_data->paths[cur_path_index].feature_count = 0;
@@ -315,6 +340,7 @@ void trie_get_preprocessed_data(
     preprocessed_data->training_path_index = trie_get_longest_match_path_index(trie, label_sequence, label_sequence_len);
 
     *preprocessed_data_p = preprocessed_data;
+    return 0;
 }
 
 crfvopp_t* crfvopp_new()
@@ -322,6 +348,9 @@ crfvopp_t* crfvopp_new()
     crfvopp_t* pp = (crfvopp_t*)malloc(sizeof(crfvopp_t));
     if (!pp) return 0;
 
+    pp->tries = NULL;
+    pp->label_sequence = NULL;
+    pp->max_items = 0;
     pp->path_manager = (buffer_manager_t*)malloc(sizeof(buffer_manager_t));
     pp->node_manager = (buffer_manager_t*)malloc(sizeof(buffer_manager_t));
     pp->fid_list_manager = (buffer_manager_t*)malloc(sizeof(buffer_manager_t));
@@ -341,29 +370,46 @@ void crfvopp_delete(crfvopp_t* pp)
     free(pp->path_manager);
     free(pp->node_manager);
     free(pp->fid_list_manager);
+    free(pp->tries);
+    free(pp->label_sequence);
     pp->path_manager = pp->node_manager = pp->fid_list_manager = 0;
     free(pp);
     pp = 0;
 }
 
-void crfvopp_preprocess_sequence(
+int crfvopp_preprocess_sequence(
     crfvopp_t* pp,
     const feature_refs_t* attrs,
-    const crfvol_feature_t* features,
+    const uint8_t* orders,
+    const uint8_t* label_sequences,
     const int num_labels,
     crf_sequence_t* seq)
 {
     const int T = seq->num_items;
     const int L = num_labels;
-    int i, j, l, r, t;
+    int i, j, l, r, t, ret = 0;
     crf_item_t* item;
     trie_t* trie_array;
-    trie_t* trie_array_orig;
-    uint8_t* label_sequence = malloc(sizeof(uint8_t) * (T+1));
-
-    trie_array_orig = malloc(sizeof(trie_t) * (T+1));
-    trie_array = trie_array_orig + 1;
+    uint8_t* label_sequence;
+
+    /* The tries and the label sequence are kept for the next sequence. */
+    if (pp->max_items < T) {
+        trie_t* tries = (trie_t*)realloc(pp->tries, sizeof(trie_t) * (T+1));
+        uint8_t* ls = NULL;
+        if (tries != NULL) {
+            pp->tries = tries;
+            ls = (uint8_t*)realloc(pp->label_sequence, sizeof(uint8_t) * (T+1));
+        }
+        if (ls == NULL) {
+            return CRFERR_OUTOFMEMORY;
+        }
+        pp->label_sequence = ls;
+        pp->max_items = T;
+    }
+    label_sequence = pp->label_sequence;
+    trie_array = pp->tries + 1;
     seq->max_paths = 0;
+    seq->num_paths = 0;
 
     for (t = -1; t < T; ++t) { /* -1: BOS */
         int created;
@@ -396,34 +442,36 @@ void crfvopp_preprocess_sequence(
             /* Loop over features for the attribute. */
             for (r = 0; r < attr->num_features; ++r) {
                 int next_path;
-                int fid;
-                const crfvol_feature_t* f;
+                fid_t fid;
+                int order;
+                const uint8_t* ls;
 
                 fid = attr->fids[r];
-                f = &features[fid];
+                order = orders[fid];
+                ls = &label_sequences[MAX_ORDER * fid];
                 if (
-                    (f->order > t+1 && !(f->order == t+2 && f->label_sequence[f->order-1] == L)) ||
-                    (f->label_sequence[f->order-1] == L && t != f->order-2 && f->order > 1) ||
-                    (t == T-1 && f->label_sequence[0] != L) ||
-                    (t != T-1 && f->label_sequence[0] == L)
+                    (order > t+1 && !(order == t+2 && ls[order-1] == L)) ||
+                    (ls[order-1] == L && t != order-2 && order > 1) ||
+                    (t == T-1 && ls[0] != L) ||
+                    (t != T-1 && ls[0] == L)
                     ) continue;
 
                 next_path = INVALID;
-                for (j = 0; j < f->order; ++j) {
+                for (j = 0; j < order; ++j) {
                     int created;
                     int path;
                     crfvol_feature_t f2;
                     
-                    f2.attr = f->attr;
-                    f2.order = f->order - j;
-                    memcpy(f2.label_sequence, f->label_sequence + j, (MAX_ORDER - j) * sizeof(uint8_t));
+                    f2.attr = 0;
+                    f2.order = order - j;
+                    memcpy(f2.label_sequence, ls + j, (MAX_ORDER - j) * sizeof(uint8_t));
 
                     path = trie_set_feature(&trie_array[t-j], &f2, fid, &created);
 
                     if (IS_VALID(next_path)) {
                         PATH(&trie_array[t-j+1], next_path)->prev_path = path;
                     }
-                    if (j == f->order-1) {
+                    if (j == order-1) {
                         int prev = (t-j == -1) ? INVALID : EMPTY;
                         PATH(&trie_array[t-j], path)->prev_path = prev;
                     }
@@ -442,14 +490,17 @@ void crfvopp_preprocess_sequence(
         item = &seq->items[t];
         label_sequence[T-t-1] = item->label;
 
-        trie_get_preprocessed_data(
+        if (ret = trie_get_preprocessed_data(
             &trie_array[t],
             &trie_array[t-1],
             (crfvopd_t**)&(item->preprocessed_data),
             &(label_sequence[T-t-1]),
             t+2
-            );
+            )) {
+            break;
+        }
         item->preprocessed_data_delete_func = crfvopd_delete;
+        seq->num_paths += ((crfvopd_t*)item->preprocessed_data)->num_paths;
         if (((crfvopd_t*)item->preprocessed_data)->num_paths > seq->max_paths) {
             seq->max_paths = ((crfvopd_t*)item->preprocessed_data)->num_paths;
         }
@@ -458,7 +509,5 @@ void crfvopp_preprocess_sequence(
     buf_clear(pp->node_manager);
     buf_clear(pp->path_manager);
     buf_clear(pp->fid_list_manager);
-
-    free(trie_array_orig);
-    free(label_sequence);
+    return ret;
 }
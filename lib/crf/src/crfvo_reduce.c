@@ -0,0 +1,301 @@
+/*
+ *      Reducing the order of a variable-order CRF model.
+ *      Linear-chain CRF tagger.
+ *
+ * Copyright (c) 2007-2010, Naoaki Okazaki
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the names of the authors nor the names of its contributors
+ *       may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* $Id$ */
+
+#ifdef    HAVE_CONFIG_H
+#include <config.h>
+#endif/*HAVE_CONFIG_H*/
+
+#include <os.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <crfsuite.h>
+#include "crfvo.h"
+
+/* A feature of order max_order to which removed features are merged. */
+typedef struct {
+    const uint8_t*  label_sequence;
+    fid_t           fid;
+} merge_target_t;
+
+static int compare_targets(const void *x, const void *y)
+{
+    const merge_target_t* a = (const merge_target_t*)x;
+    const merge_target_t* b = (const merge_target_t*)y;
+    return memcmp(a->label_sequence, b->label_sequence, MAX_ORDER);
+}
+
+/*
+    Merge the removed features into the kept features of order max_order
+    with the same attributes and the same latest labels. Features of an
+    attribute are found in its reference list; the targets in each list
+    are sorted by their label sequences truncated to max_order.
+ */
+static fid_t merge_features(crfvom_t* model, crfvom_feature_t* fs, const uint8_t* removed, int max_order)
+{
+    int a, i, n, max_targets = 0;
+    fid_t num_merged = 0;
+    feature_refs_t ref;
+    merge_target_t *targets = NULL;
+    uint8_t *keys = NULL;
+    const int A = crfvom_get_num_attrs(model);
+
+    for (a = 0;a < A;++a) {
+        crfvom_get_attrref(model, a, &ref);
+
+        /* Collect the targets in the list. */
+        if (max_targets < ref.num_features) {
+            max_targets = ref.num_features;
+            free(targets);
+            free(keys);
+            targets = (merge_target_t*)malloc(sizeof(merge_target_t) * max_targets);
+            keys = (uint8_t*)malloc(MAX_ORDER * max_targets);
+            if (targets == NULL || keys == NULL) {
+                num_merged = -1;
+                goto exit;
+            }
+        }
+        for (i = 0, n = 0;i < ref.num_features;++i) {
+            const fid_t fid = crfvom_get_featureid(&ref, i);
+            if (!removed[fid] && fs[fid].order == max_order) {
+                memset(&keys[MAX_ORDER * n], 0, MAX_ORDER);
+                memcpy(&keys[MAX_ORDER * n], fs[fid].label_sequence, max_order);
+                targets[n].label_sequence = &keys[MAX_ORDER * n];
+                targets[n].fid = fid;
+                ++n;
+            }
+        }
+        if (n == 0) {
+            continue;
+        }
+        qsort(targets, n, sizeof(merge_target_t), compare_targets);
+
+        /* Add the weights of the removed features to their targets. */
+        for (i = 0;i < ref.num_features;++i) {
+            const fid_t fid = crfvom_get_featureid(&ref, i);
+            if (removed[fid]) {
+                uint8_t key[MAX_ORDER];
+                merge_target_t query, *target = NULL;
+                memset(key, 0, sizeof(key));
+                memcpy(key, fs[fid].label_sequence, max_order);
+                query.label_sequence = key;
+                target = (merge_target_t*)bsearch(
+                    &query, targets, n, sizeof(merge_target_t), compare_targets);
+                if (target != NULL) {
+                    fs[target->fid].weight += fs[fid].weight;
+                    ++num_merged;
+                }
+            }
+        }
+    }
+
+exit:
+    free(keys);
+    free(targets);
+    return num_merged;
+}
+
+int crfvom_reduce(crfvom_t* model, const char *filename, int max_order, floatval_t threshold, int merge, FILE *fpo)
+{
+    int a, l, ret = 0, B = 0;
+    fid_t k, J = 0, num_merged = 0;
+    fid_t before[MAX_ORDER+1], after[MAX_ORDER+1];
+    fid_t *fmap = NULL;
+    int *amap = NULL;
+    uint8_t *removed = NULL;
+    crfvom_feature_t *fs = NULL;
+    crfvomw_t* writer = NULL;
+    feature_refs_t ref;
+    const uint8_t *orders = NULL, *label_sequences = NULL;
+    const fid_t K = crfvom_get_num_features(model);
+    const int A = crfvom_get_num_attrs(model);
+    const int L = crfvom_get_num_labels(model);
+
+    if (max_order < 1 || MAX_ORDER < max_order) {
+        return CRFERR_INTERNAL_LOGIC;
+    }
+
+    fs = (crfvom_feature_t*)malloc(sizeof(crfvom_feature_t) * (K + 1));
+    removed = (uint8_t*)calloc(K + 1, sizeof(uint8_t));
+    fmap = (fid_t*)malloc(sizeof(fid_t) * (K + 1));
+    amap = (int*)malloc(sizeof(int) * (A + 1));
+    if (fs == NULL || removed == NULL || fmap == NULL || amap == NULL) {
+        ret = CRFERR_OUTOFMEMORY;
+        goto error_exit;
+    }
+    crfvom_get_features(model, 0, K, fs);
+
+    /* Remove the features of higher orders unless their weights are large. */
+    memset(before, 0, sizeof(before));
+    memset(after, 0, sizeof(after));
+    for (k = 0;k < K;++k) {
+        ++before[fs[k].order];
+        if (max_order < fs[k].order && (threshold <= 0 || fabs(fs[k].weight) < threshold)) {
+            removed[k] = 1;
+        }
+    }
+
+    if (merge) {
+        num_merged = merge_features(model, fs, removed, max_order);
+        if (num_merged < 0) {
+            ret = CRFERR_OUTOFMEMORY;
+            goto error_exit;
+        }
+    }
+
+    /* Renumber the remaining features and their attributes. */
+    for (a = 0;a < A;++a) amap[a] = -1;
+    for (k = 0;k < K;++k) {
+        if (removed[k]) {
+            fmap[k] = -1;
+        } else {
+            fmap[k] = J++;
+            if (amap[fs[k].attr] < 0) amap[fs[k].attr] = B++;
+            ++after[fs[k].order];
+        }
+    }
+
+    /* Write the reduced model in the format of the source model. */
+    writer = crfvomw(filename);
+    if (writer == NULL) {
+        ret = CRFERR_INTERNAL_LOGIC;
+        goto error_exit;
+    }
+    if (ret = crfvomw_set_weight_bits(writer, crfvom_get_weight_bits(model))) {
+        goto error_exit;
+    }
+    if (ret = crfvomw_set_native(writer, crfvom_get_feature_labels(model, &orders, &label_sequences) == 0)) {
+        goto error_exit;
+    }
+    if (ret = crfvomw_set_wide(writer, crfvom_get_wide(model))) {
+        goto error_exit;
+    }
+
+    if (ret = crfvomw_open_features(writer)) {
+        goto error_exit;
+    }
+    for (k = 0;k < K;++k) {
+        if (0 <= fmap[k]) {
+            crfvom_feature_t f = fs[k];
+            f.attr = amap[fs[k].attr];
+            if (ret = crfvomw_put_feature(writer, fmap[k], &f)) {
+                goto error_exit;
+            }
+        }
+    }
+    if (ret = crfvomw_close_features(writer)) {
+        goto error_exit;
+    }
+
+    if (ret = crfvomw_open_labels(writer, L)) {
+        goto error_exit;
+    }
+    for (l = 0;l < L;++l) {
+        const char *str = crfvom_to_label(model, l);
+        if (str != NULL) {
+            if (ret = crfvomw_put_label(writer, l, str)) {
+                goto error_exit;
+            }
+        }
+    }
+    if (ret = crfvomw_close_labels(writer)) {
+        goto error_exit;
+    }
+
+    if (ret = crfvomw_open_attrs(writer, B)) {
+        goto error_exit;
+    }
+    for (a = 0;a < A;++a) {
+        if (0 <= amap[a]) {
+            const char *str = crfvom_to_attr(model, a);
+            if (str != NULL) {
+                if (ret = crfvomw_put_attr(writer, amap[a], str)) {
+                    goto error_exit;
+                }
+            }
+        }
+    }
+    if (ret = crfvomw_close_attrs(writer)) {
+        goto error_exit;
+    }
+
+    if (ret = crfvomw_open_attrrefs(writer, B)) {
+        goto error_exit;
+    }
+    for (a = 0;a < A;++a) {
+        if (0 <= amap[a]) {
+            crfvom_get_attrref(model, a, &ref);
+            if (ret = crfvomw_put_attrref(writer, amap[a], &ref, fmap)) {
+                goto error_exit;
+            }
+        }
+    }
+    if (ret = crfvomw_close_attrrefs(writer)) {
+        goto error_exit;
+    }
+
+    ret = crfvomw_close(writer);
+    writer = NULL;
+    if (ret != 0) {
+        remove(filename);
+        goto error_exit;
+    }
+
+    /* Summarize the reduction. */
+    if (fpo != NULL) {
+        fprintf(fpo, "Number of features by order:\n");
+        for (l = 1;l <= MAX_ORDER;++l) {
+            if (0 < before[l]) {
+                fprintf(fpo, "  %d: %lld -> %lld\n", l, (long long)before[l], (long long)after[l]);
+            }
+        }
+        fprintf(fpo, "Number of features: %lld -> %lld\n", (long long)K, (long long)J);
+        fprintf(fpo, "Number of merged features: %lld\n", (long long)num_merged);
+        fprintf(fpo, "Number of attributes: %d -> %d\n", A, B);
+    }
+
+error_exit:
+    /* Do not leave a truncated model behind. */
+    if (writer != NULL) {
+        crfvomw_discard(writer);
+        remove(filename);
+    }
+    free(amap);
+    free(fmap);
+    free(removed);
+    free(fs);
+    return ret;
+}
@@ -45,84 +45,300 @@
 
 #include "crfvo.h"
 
+#define    REFS_BLOCK_SIZE    4096
+
+/*
+    The tagger resolves an attribute on its first use: it reads the
+    references of the attribute and, unless the model stores the native
+    chunks, the features they refer to. The arrays for the attributes and
+    the features are allocated with calloc() and filled on demand, so that
+    the pages for unused attributes are never written (and never made
+    resident); crfvot_prewarm() resolves the attributes expected to be hot
+    in advance.
+ */
 struct tag_crfvot {
     int num_labels;            /**< Number of distinct output labels (L). */
     int num_attributes;        /**< Number of distinct attributes (A). */
-    int num_features;          /**< Number of features. */
+    fid_t num_features;        /**< Number of features. */
 
-    feature_refs_t* attributes;
-    crfvol_feature_t* features;
-    floatval_t* exp_weight;
+    feature_refs_t* attributes;     /**< References of attributes (fids is NULL until resolved). */
+    const uint8_t* orders;          /**< Orders of features. */
+    const uint8_t* label_sequences; /**< Label sequences of features. */
+    const floatval_t* exp_weight;
     crfvopp_t* preprocessor;
 
+    uint8_t* labels_buffer;     /**< Decoded orders and label sequences (NULL when in place). */
+    floatval_t* exp_weight_buffer;  /**< Computed exp-weights (NULL when in place). */
+
+    fid_t** ref_blocks;         /**< Blocks holding decoded references. */
+    int num_ref_blocks;
+    fid_t* refs_next;           /**< Free space in the last block. */
+    int refs_avail;
+    fid_t no_refs;              /**< Marks a resolved attribute without references. */
+
+    crf_sequence_t flat_seq;        /**< Sequence reused by crfvot_tag_items(). */
+    crf_content_t* flat_contents;   /**< Contents of the items in flat_seq. */
+    int max_flat_contents;
+
     crfvom_t *model;        /**< CRF model. */
     crfvo_context_t *ctx;    /**< CRF context. */
+    crfvot_t* owner;        /**< Tagger owning the attributes and the buffers (NULL if this). */
 };
 
+static fid_t* alloc_refs(crfvot_t* crfvot, int n)
+{
+    fid_t* fids = NULL;
+
+    if (crfvot->refs_avail < n) {
+        const int size = (n < REFS_BLOCK_SIZE) ? REFS_BLOCK_SIZE : n;
+        fid_t** blocks = (fid_t**)realloc(
+            crfvot->ref_blocks, sizeof(fid_t*) * (crfvot->num_ref_blocks + 1));
+        if (blocks == NULL) {
+            return NULL;
+        }
+        crfvot->ref_blocks = blocks;
+        blocks[crfvot->num_ref_blocks] = (fid_t*)malloc(sizeof(fid_t) * size);
+        if (blocks[crfvot->num_ref_blocks] == NULL) {
+            return NULL;
+        }
+        crfvot->refs_next = blocks[crfvot->num_ref_blocks++];
+        crfvot->refs_avail = size;
+    }
+    fids = crfvot->refs_next;
+    crfvot->refs_next += n;
+    crfvot->refs_avail -= n;
+    return fids;
+}
+
+static int resolve_attribute(crfvot_t* crfvot, int aid)
+{
+    int i, j, m, n;
+    fid_t fid;
+    crfvom_feature_t fs[256];
+    crfvom_t* model = crfvot->model;
+    feature_refs_t* attr = &crfvot->attributes[aid];
+
+    /* A worker only reads the attributes resolved by its owner. */
+    if (crfvot->owner != NULL) {
+        return CRFERR_INTERNAL_LOGIC;
+    }
+
+    /* Read the references in place, or decode them into the blocks. */
+    n = crfvom_read_attrref(model, aid, attr, NULL, 0);
+    if (n < 0) {
+        return CRFERR_INCOMPATIBLE;
+    }
+    if (attr->fids == NULL && 0 < n) {
+        fid_t* fids = alloc_refs(crfvot, n);
+        if (fids == NULL) {
+            return CRFERR_OUTOFMEMORY;
+        }
+        if (crfvom_read_attrref(model, aid, attr, fids, n) != n) {
+            attr->fids = NULL;
+            return CRFERR_INCOMPATIBLE;
+        }
+    }
+
+    /* Read the features unless they are in place, a run of consecutive ids at a time. */
+    if (crfvot->labels_buffer != NULL || crfvot->exp_weight_buffer != NULL) {
+        for (i = 0;i < n;i += m) {
+            fid = attr->fids[i];
+            for (m = 1;i + m < n && m < 256 && attr->fids[i+m] == fid + m;++m) ;
+            if (fid < 0 || crfvot->num_features - fid < m) {
+                attr->fids = NULL;
+                return CRFERR_INCOMPATIBLE;
+            }
+            crfvom_get_features(model, fid, m, fs);
+            for (j = 0;j < m;++j) {
+                if (crfvot->labels_buffer != NULL) {
+                    crfvot->labels_buffer[fid+j] = (uint8_t)fs[j].order;
+                    memcpy(&crfvot->labels_buffer[crfvot->num_features + MAX_ORDER * (fid+j)],
+                        fs[j].label_sequence, MAX_ORDER);
+                }
+                if (crfvot->exp_weight_buffer != NULL) {
+                    crfvot->exp_weight_buffer[fid+j] = exp(fs[j].weight);
+                }
+            }
+        }
+    }
+
+    if (attr->fids == NULL) {
+        attr->fids = &crfvot->no_refs;
+    }
+    return 0;
+}
+
 crfvot_t *crfvot_new(crfvom_t* crfvom)
 {
-    int i;
+    fid_t K;
     crfvot_t* crfvot = NULL;
 
     crfvot = (crfvot_t*)calloc(1, sizeof(crfvot_t));
+    if (crfvot == NULL) {
+        return NULL;
+    }
     crfvot->num_labels = crfvom_get_num_labels(crfvom);
     crfvot->num_attributes = crfvom_get_num_attrs(crfvom);
-    crfvot->num_features = crfvom_get_num_features(crfvom);
+    crfvot->num_features = K = crfvom_get_num_features(crfvom);
     crfvot->model = crfvom;
     crfvot->ctx = crfvoc_new(crfvot->num_labels, 0, 0);
-    crfvot->attributes = (feature_refs_t*)malloc(crfvot->num_attributes * sizeof(feature_refs_t));
-    crfvot->features = (crfvol_feature_t*)malloc(crfvot->num_features * sizeof(crfvol_feature_t));
-    crfvot->exp_weight = (floatval_t*)malloc(crfvot->num_features * sizeof(floatval_t));
-
-    if (!crfvot->attributes || !crfvot->features || !crfvot->exp_weight) {
-        return 0;
+    crfvot->attributes = (feature_refs_t*)calloc(crfvot->num_attributes + 1, sizeof(feature_refs_t));
+    if (crfvot->ctx == NULL || crfvot->attributes == NULL) {
+        goto error_exit;
     }
 
-    for (i = 0; i < crfvot->num_attributes; ++i) {
-        crfvom_get_attrref(crfvom, i, &crfvot->attributes[i]);
+    /* Use the native sections of the model in place if any. */
+    crfvot->exp_weight = crfvom_get_exp_weights(crfvom);
+    if (crfvom_get_feature_labels(crfvom, &crfvot->orders, &crfvot->label_sequences) != 0) {
+        crfvot->labels_buffer = (uint8_t*)calloc((1 + MAX_ORDER) * K + 1, 1);
+        if (!crfvot->labels_buffer) {
+            goto error_exit;
+        }
+        crfvot->orders = crfvot->labels_buffer;
+        crfvot->label_sequences = crfvot->labels_buffer + K;
     }
-
-    for (i = 0; i < crfvot->num_features; ++i) {
-        crfvom_feature_t f;
-        crfvom_get_feature(crfvom, i, &f);
-        crfvot->features[i].attr = f.attr;
-        memcpy(crfvot->features[i].label_sequence, f.label_sequence, MAX_ORDER);
-        crfvot->features[i].order = f.order;
-        crfvot->exp_weight[i] = exp(f.weight);
+    if (crfvot->exp_weight == NULL) {
+        crfvot->exp_weight_buffer = (floatval_t*)calloc(K + 1, sizeof(floatval_t));
+        if (!crfvot->exp_weight_buffer) {
+            goto error_exit;
+        }
+        crfvot->exp_weight = crfvot->exp_weight_buffer;
     }
 
     crfvot->preprocessor = crfvopp_new();
+    if (crfvot->preprocessor == NULL) {
+        goto error_exit;
+    }
+
+    return crfvot;
+
+error_exit:
+    crfvot_delete(crfvot);
+    return NULL;
+}
 
+/*
+    A worker has a context, a preprocessor and a flat sequence of its own,
+    but reads the attributes, the feature labels and the exp-weights of its
+    owner. The owner must resolve every attribute that the worker meets
+    (crfvot_prewarm) before the worker runs, and must outlive it.
+ */
+crfvot_t *crfvot_new_worker(crfvot_t* owner)
+{
+    crfvot_t* crfvot = NULL;
+
+    crfvot = (crfvot_t*)calloc(1, sizeof(crfvot_t));
+    if (crfvot == NULL) {
+        return NULL;
+    }
+    crfvot->num_labels = owner->num_labels;
+    crfvot->num_attributes = owner->num_attributes;
+    crfvot->num_features = owner->num_features;
+    crfvot->model = owner->model;
+    crfvot->owner = owner;
+    crfvot->attributes = owner->attributes;
+    crfvot->orders = owner->orders;
+    crfvot->label_sequences = owner->label_sequences;
+    crfvot->exp_weight = owner->exp_weight;
+    crfvot->ctx = crfvoc_new(crfvot->num_labels, 0, 0);
+    crfvot->preprocessor = crfvopp_new();
+    if (crfvot->ctx == NULL || crfvot->preprocessor == NULL) {
+        crfvot_delete(crfvot);
+        return NULL;
+    }
     return crfvot;
 }
 
 void crfvot_delete(crfvot_t* crfvot)
 {
-    crfvoc_delete(crfvot->ctx);
+    int i;
+
+    if (crfvot == NULL) {
+        return;
+    }
+    if (crfvot->ctx) crfvoc_delete(crfvot->ctx);
     if (crfvot->preprocessor) crfvopp_delete(crfvot->preprocessor);
+    for (i = 0;i < crfvot->num_ref_blocks;++i) {
+        free(crfvot->ref_blocks[i]);
+    }
+    free(crfvot->ref_blocks);
+    for (i = 0;i < crfvot->flat_seq.max_items;++i) {
+        crfvopd_delete((crfvopd_t*)crfvot->flat_seq.items[i].preprocessed_data);
+    }
+    free(crfvot->flat_seq.items);
+    free(crfvot->flat_contents);
+    free(crfvot->exp_weight_buffer);
+    free(crfvot->labels_buffer);
+    if (crfvot->owner == NULL) {
+        free(crfvot->attributes);
+    }
     free(crfvot);
 }
 
-int crfvot_tag(crfvot_t* crfvot, crf_sequence_t *inst, crf_output_t* output)
+int crfvot_prewarm(crfvot_t* crfvot, const int *aids, int n)
 {
-    int i;
-    floatval_t score = 0;
+    int i, ret = 0;
+
+    for (i = 0;i < n;++i) {
+        const int aid = aids[i];
+        if (0 <= aid && aid < crfvot->num_attributes && crfvot->attributes[aid].fids == NULL) {
+            if (ret = resolve_attribute(crfvot, aid)) {
+                return ret;
+            }
+        }
+    }
+    return 0;
+}
+
+static int tag_sequence(crfvot_t* crfvot, crf_sequence_t *inst, floatval_t* score)
+{
+    int ret = 0;
     crfvo_context_t* ctx = crfvot->ctx;
 
-    crfvopp_preprocess_sequence(
+    if (ret = crfvopp_preprocess_sequence(
         crfvot->preprocessor,
         crfvot->attributes,
-        crfvot->features,
+        crfvot->orders,
+        crfvot->label_sequences,
         crfvot->num_labels,
         inst
-        );
+        )) {
+        return ret;
+    }
 
-    crfvoc_set_num_items(ctx, inst->num_items, inst->max_paths);
+    if (ret = crfvoc_set_num_items(ctx, inst->num_items, inst->max_paths)) {
+        return ret;
+    }
 
     crfvoc_set_context(ctx, inst);
     crfvoc_set_weight(ctx, crfvot->exp_weight);
 
-    score = crfvoc_decode(ctx);
+    *score = crfvoc_decode(ctx);
+    return 0;
+}
+
+int crfvot_tag(crfvot_t* crfvot, crf_sequence_t *inst, crf_output_t* output)
+{
+    int i, c, ret = 0;
+    floatval_t score = 0;
+    crfvo_context_t* ctx = crfvot->ctx;
+
+    /* Resolve the attributes used for the first time. */
+    for (i = 0;i < inst->num_items;++i) {
+        const crf_item_t* item = &inst->items[i];
+        for (c = 0;c < item->num_contents;++c) {
+            const int aid = item->contents[c].aid;
+            if (crfvot->attributes[aid].fids == NULL) {
+                if (ret = resolve_attribute(crfvot, aid)) {
+                    return ret;
+                }
+            }
+        }
+    }
+
+    if (ret = tag_sequence(crfvot, inst, &score)) {
+        return ret;
+    }
 
     crf_output_init_n(output, inst->num_items);
     output->probability = score;
@@ -133,3 +349,81 @@ int crfvot_tag(crfvot_t* crfvot, crf_sequence_t *inst, crf_output_t* output)
 
     return 0;
 }
+
+/*
+    The items and the contents of the sequence are kept in the tagger and
+    reused, and so is the preprocessed data attached to the items: once
+    the buffers have grown to the size of the largest sequence, tagging
+    allocates no memory.
+ */
+int crfvot_tag_items(
+    crfvot_t* crfvot,
+    int num_items,
+    const int *item_offsets,
+    const int *aids,
+    const floatval_t *scales,
+    int *labels,
+    floatval_t *score
+    )
+{
+    int i, t, k, ret = 0;
+    crf_sequence_t* seq = &crfvot->flat_seq;
+    const int num_contents = item_offsets[num_items] - item_offsets[0];
+
+    *score = 0;
+    if (num_items <= 0) {
+        return 0;
+    }
+
+    if (seq->max_items < num_items) {
+        crf_item_t* items = (crf_item_t*)realloc(seq->items, sizeof(crf_item_t) * num_items);
+        if (items == NULL) {
+            return CRFERR_OUTOFMEMORY;
+        }
+        for (t = seq->max_items;t < num_items;++t) {
+            crf_item_init(&items[t]);
+        }
+        seq->items = items;
+        seq->max_items = num_items;
+    }
+    if (crfvot->max_flat_contents < num_contents) {
+        crf_content_t* contents = (crf_content_t*)realloc(
+            crfvot->flat_contents, sizeof(crf_content_t) * num_contents);
+        if (contents == NULL) {
+            return CRFERR_OUTOFMEMORY;
+        }
+        crfvot->flat_contents = contents;
+        crfvot->max_flat_contents = num_contents;
+    }
+
+    /* Point the items to their contents, skipping unknown attributes. */
+    for (t = 0, k = 0;t < num_items;++t) {
+        crf_item_t* item = &seq->items[t];
+        item->contents = &crfvot->flat_contents[k];
+        item->num_contents = 0;
+        item->label = 0;
+        for (i = item_offsets[t];i < item_offsets[t+1];++i) {
+            const int aid = aids[i];
+            if (aid < 0 || crfvot->num_attributes <= aid) {
+                continue;
+            }
+            if (crfvot->attributes[aid].fids == NULL) {
+                if (ret = resolve_attribute(crfvot, aid)) {
+                    return ret;
+                }
+            }
+            crf_content_set(&crfvot->flat_contents[k++], aid, scales != NULL ? scales[i] : 1.);
+            ++item->num_contents;
+        }
+        item->max_contents = item->num_contents;
+    }
+    seq->num_items = num_items;
+
+    if (ret = tag_sequence(crfvot, seq, score)) {
+        return ret;
+    }
+    for (t = 0;t < num_items;++t) {
+        labels[t] = crfvot->ctx->labels[t];
+    }
+    return 0;
+}
@@ -0,0 +1,252 @@
+/*
+ *      Vector kernels for the Viterbi decoder.
+ *
+ * Copyright (c) 2007-2010, Naoaki Okazaki
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the names of the authors nor the names of its contributors
+ *       may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* $Id$ */
+
+#ifdef    HAVE_CONFIG_H
+#include <config.h>
+#endif/*HAVE_CONFIG_H*/
+
+#include <os.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <crfsuite.h>
+
+#include "crfvo.h"
+
+/*
+    The AVX2 and AVX-512 kernels are compiled with the target attribute of
+    GCC (and Clang), so that the library runs on any x86 processor; the
+    kernels for the processor are chosen at run time. The other compilers
+    and architectures use the portable kernels.
+ */
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define    USE_X86_KERNELS    1
+#include <immintrin.h>
+#endif
+
+/*
+    The maxima are taken so that NaNs are skipped and the result is never
+    negative, exactly as the loop "if (x > m) m = x;" starting at m = 0.
+ */
+
+static floatval_t mul_max_default(floatval_t* dst, const floatval_t* x, const floatval_t* y, int n)
+{
+    int i;
+    floatval_t m = 0.;
+
+    for (i = 0;i < n;++i) {
+        dst[i] = x[i] * y[i];
+        if (dst[i] > m) m = dst[i];
+    }
+    return m;
+}
+
+static void scale_default(floatval_t* x, floatval_t s, int n)
+{
+    int i;
+
+    for (i = 0;i < n;++i) {
+        x[i] *= s;
+    }
+}
+
+static floatval_t max_default(const floatval_t* x, int n)
+{
+    int i;
+    floatval_t m = 0.;
+
+    for (i = 0;i < n;++i) {
+        if (x[i] > m) m = x[i];
+    }
+    return m;
+}
+
+static const crfvo_viterbi_kernels_t kernels_default = {
+    mul_max_default, scale_default, max_default, "default",
+};
+
+#ifdef  USE_X86_KERNELS
+
+__attribute__((target("avx2")))
+static floatval_t reduce_max_avx2(__m256d v, floatval_t m)
+{
+    int k;
+    floatval_t a[4];
+
+    _mm256_storeu_pd(a, v);
+    for (k = 0;k < 4;++k) {
+        if (a[k] > m) m = a[k];
+    }
+    return m;
+}
+
+__attribute__((target("avx2")))
+static floatval_t mul_max_avx2(floatval_t* dst, const floatval_t* x, const floatval_t* y, int n)
+{
+    int i;
+    __m256d vm = _mm256_setzero_pd();
+    floatval_t m = 0.;
+
+    for (i = 0;i + 4 <= n;i += 4) {
+        __m256d v = _mm256_mul_pd(_mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i));
+        _mm256_storeu_pd(dst + i, v);
+        vm = _mm256_max_pd(v, vm);  /* vm unless v > vm. */
+    }
+    m = reduce_max_avx2(vm, m);
+    for (;i < n;++i) {
+        dst[i] = x[i] * y[i];
+        if (dst[i] > m) m = dst[i];
+    }
+    return m;
+}
+
+__attribute__((target("avx2")))
+static void scale_avx2(floatval_t* x, floatval_t s, int n)
+{
+    int i;
+    const __m256d vs = _mm256_set1_pd(s);
+
+    for (i = 0;i + 4 <= n;i += 4) {
+        _mm256_storeu_pd(x + i, _mm256_mul_pd(_mm256_loadu_pd(x + i), vs));
+    }
+    for (;i < n;++i) {
+        x[i] *= s;
+    }
+}
+
+__attribute__((target("avx2")))
+static floatval_t max_avx2(const floatval_t* x, int n)
+{
+    int i;
+    __m256d vm = _mm256_setzero_pd();
+    floatval_t m = 0.;
+
+    for (i = 0;i + 4 <= n;i += 4) {
+        vm = _mm256_max_pd(_mm256_loadu_pd(x + i), vm);
+    }
+    m = reduce_max_avx2(vm, m);
+    for (;i < n;++i) {
+        if (x[i] > m) m = x[i];
+    }
+    return m;
+}
+
+static const crfvo_viterbi_kernels_t kernels_avx2 = {
+    mul_max_avx2, scale_avx2, max_avx2, "avx2",
+};
+
+__attribute__((target("avx512f")))
+static floatval_t reduce_max_avx512(__m512d v, floatval_t m)
+{
+    int k;
+    floatval_t a[8];
+
+    _mm512_storeu_pd(a, v);
+    for (k = 0;k < 8;++k) {
+        if (a[k] > m) m = a[k];
+    }
+    return m;
+}
+
+__attribute__((target("avx512f")))
+static floatval_t mul_max_avx512(floatval_t* dst, const floatval_t* x, const floatval_t* y, int n)
+{
+    int i;
+    __m512d vm = _mm512_setzero_pd();
+
+    for (i = 0;i + 8 <= n;i += 8) {
+        __m512d v = _mm512_mul_pd(_mm512_loadu_pd(x + i), _mm512_loadu_pd(y + i));
+        _mm512_storeu_pd(dst + i, v);
+        vm = _mm512_max_pd(v, vm);
+    }
+    if (i < n) {
+        /* The remaining elements, with zeros (not stored) for the rest. */
+        const __mmask8 mask = (__mmask8)((1u << (n - i)) - 1);
+        __m512d v = _mm512_mul_pd(_mm512_maskz_loadu_pd(mask, x + i), _mm512_maskz_loadu_pd(mask, y + i));
+        _mm512_mask_storeu_pd(dst + i, mask, v);
+        vm = _mm512_max_pd(v, vm);
+    }
+    return reduce_max_avx512(vm, 0.);
+}
+
+__attribute__((target("avx512f")))
+static void scale_avx512(floatval_t* x, floatval_t s, int n)
+{
+    int i;
+    const __m512d vs = _mm512_set1_pd(s);
+
+    for (i = 0;i + 8 <= n;i += 8) {
+        _mm512_storeu_pd(x + i, _mm512_mul_pd(_mm512_loadu_pd(x + i), vs));
+    }
+    if (i < n) {
+        const __mmask8 mask = (__mmask8)((1u << (n - i)) - 1);
+        _mm512_mask_storeu_pd(x + i, mask, _mm512_mul_pd(_mm512_maskz_loadu_pd(mask, x + i), vs));
+    }
+}
+
+__attribute__((target("avx512f")))
+static floatval_t max_avx512(const floatval_t* x, int n)
+{
+    int i;
+    __m512d vm = _mm512_setzero_pd();
+
+    for (i = 0;i + 8 <= n;i += 8) {
+        vm = _mm512_max_pd(_mm512_loadu_pd(x + i), vm);
+    }
+    if (i < n) {
+        const __mmask8 mask = (__mmask8)((1u << (n - i)) - 1);
+        vm = _mm512_max_pd(_mm512_maskz_loadu_pd(mask, x + i), vm);
+    }
+    return reduce_max_avx512(vm, 0.);
+}
+
+static const crfvo_viterbi_kernels_t kernels_avx512 = {
+    mul_max_avx512, scale_avx512, max_avx512, "avx512",
+};
+
+#endif/*USE_X86_KERNELS*/
+
+const crfvo_viterbi_kernels_t* crfvo_viterbi_kernels()
+{
+#ifdef  USE_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return &kernels_avx512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return &kernels_avx2;
+    }
+#endif/*USE_X86_KERNELS*/
+    return &kernels_default;
+}
@@ -60,6 +60,12 @@ static int dictionary_get(crf_dictionary_t* dic, const char *str)
     return quark_get(qrk, str);
 }
 
+static int dictionary_get_many(crf_dictionary_t* dic, const char **strs, int n, int *ids)
+{
+    quark_t *qrk = (quark_t*)dic->internal;
+    return quark_get_many(qrk, strs, n, ids);
+}
+
 static int dictionary_to_id(crf_dictionary_t* dic, const char *str)
 {
     quark_t *qrk = (quark_t*)dic->internal;
@@ -71,12 +77,9 @@ static int dictionary_to_string(crf_dictionary_t* dic, int id, char const **pstr
     quark_t *qrk = (quark_t*)dic->internal;
     const char *str = quark_to_string(qrk, id);
     if (str != NULL) {
-        char *dst = (char*)malloc(strlen(str)+1);
-        if (dst) {
-            strcpy(dst, str);
-            *pstr = dst;
-            return 0;
-        }
+        /* The string stays alive until the final release. */
+        *pstr = str;
+        return 0;
     }
     return 1;
 }
@@ -89,7 +92,7 @@ static int dictionary_num(crf_dictionary_t* dic)
 
 static void dictionary_free(crf_dictionary_t* dic, const char *str)
 {
-    free((char*)str);
+    /* Unnecessary: all strings are freed on the final release. */
 }
 
 int crf_dictionary_create_instance(const char *interface, void **ptr)
@@ -99,6 +102,10 @@ int crf_dictionary_create_instance(const char *interface, void **ptr)
 
         if (dic != NULL) {
             dic->internal = quark_new();
+            if (dic->internal == NULL) {
+                free(dic);
+                return -1;
+            }
             dic->nref = 1;
             dic->addref = dictionary_addref;
             dic->release = dictionary_release;
@@ -107,6 +114,7 @@ int crf_dictionary_create_instance(const char *interface, void **ptr)
             dic->to_string = dictionary_to_string;
             dic->num = dictionary_num;
             dic->free_ = dictionary_free;
+            dic->get_many = dictionary_get_many;
             *ptr = dic;
             return 0;
         } else {
@@ -0,0 +1,159 @@
+/*
+ *      Handle of a model replaced while in use.
+ *
+ * Copyright (c) 2007-2010, Naoaki Okazaki
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the names of the authors nor the names of its contributors
+ *       may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* $Id$ */
+
+#ifdef    HAVE_CONFIG_H
+#include <config.h>
+#endif/*HAVE_CONFIG_H*/
+
+#include <os.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <crfsuite.h>
+#include "parallel.h"
+
+/*
+    The mutex guards the pointer to the current model only: a model is
+    referenced before the mutex is unlocked, and released (possibly
+    destroyed) after it is unlocked, so that get_model() never waits for
+    a model being read or destroyed.
+ */
+typedef struct {
+    parallel_mutex_t    mutex;
+    crf_model_t*        model;      /* Current model (NULL if not set). */
+} handle_internal_t;
+
+static int handle_addref(crf_model_handle_t* handle)
+{
+    return crf_interlocked_increment(&handle->nref);
+}
+
+static int handle_release(crf_model_handle_t* handle)
+{
+    int count = crf_interlocked_decrement(&handle->nref);
+    if (count == 0) {
+        /* This instance is being destroyed. */
+        handle_internal_t* internal = (handle_internal_t*)handle->internal;
+        if (internal->model != NULL) {
+            internal->model->release(internal->model);
+        }
+        parallel_mutex_destroy(&internal->mutex);
+        free(internal);
+        free(handle);
+    }
+    return count;
+}
+
+static int handle_get_model(crf_model_handle_t* handle, crf_model_t** ptr_model)
+{
+    handle_internal_t* internal = (handle_internal_t*)handle->internal;
+    crf_model_t* model = NULL;
+
+    parallel_mutex_lock(&internal->mutex);
+    model = internal->model;
+    if (model != NULL) {
+        model->addref(model);
+    }
+    parallel_mutex_unlock(&internal->mutex);
+
+    *ptr_model = model;
+    return (model != NULL) ? 0 : CRFERR_INTERNAL_LOGIC;
+}
+
+static int handle_set_model(crf_model_handle_t* handle, crf_model_t* model)
+{
+    handle_internal_t* internal = (handle_internal_t*)handle->internal;
+    crf_model_t* old = NULL;
+
+    if (model != NULL) {
+        model->addref(model);
+    }
+
+    parallel_mutex_lock(&internal->mutex);
+    old = internal->model;
+    internal->model = model;
+    parallel_mutex_unlock(&internal->mutex);
+
+    /* The old model is destroyed here unless calls still use it. */
+    if (old != NULL) {
+        old->release(old);
+    }
+    return 0;
+}
+
+static int handle_reload(crf_model_handle_t* handle, const char *filename)
+{
+    int ret = 0;
+    crf_model_t* model = NULL;
+
+    if (ret = crf_create_instance_from_file(filename, (void**)&model)) {
+        return ret;
+    }
+    ret = handle_set_model(handle, model);
+    model->release(model);
+    return ret;
+}
+
+int crf_model_handle_create_instance(const char *interface, void **ptr)
+{
+    if (strcmp(interface, "model_handle") == 0) {
+        crf_model_handle_t* handle = NULL;
+        handle_internal_t* internal = NULL;
+
+#ifndef PARALLEL_HAVE_MUTEX
+        /* Swapping models between threads is unsafe without a mutex. */
+        return CRFERR_NOTSUPPORTED;
+#endif/*PARALLEL_HAVE_MUTEX*/
+        handle = (crf_model_handle_t*)calloc(1, sizeof(crf_model_handle_t));
+        internal = (handle_internal_t*)calloc(1, sizeof(handle_internal_t));
+
+        if (handle != NULL && internal != NULL) {
+            parallel_mutex_init(&internal->mutex);
+            handle->internal = internal;
+            handle->nref = 1;
+            handle->addref = handle_addref;
+            handle->release = handle_release;
+            handle->get_model = handle_get_model;
+            handle->set_model = handle_set_model;
+            handle->reload = handle_reload;
+            *ptr = handle;
+            return 0;
+        } else {
+            free(internal);
+            free(handle);
+            return -1;
+        }
+    } else {
+        return 1;
+    }
+}
@@ -0,0 +1,167 @@
+/*
+ *      Minimal perfect hashing (hash and displace).
+ *
+ * Copyright (c) 2007-2010, Naoaki Okazaki
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the names of the authors nor the names of its contributors
+ *       may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* $Id$ */
+
+#ifdef    HAVE_CONFIG_H
+#include <config.h>
+#endif/*HAVE_CONFIG_H*/
+
+#include <os.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "mph.h"
+
+/* The largest displacement tried for a bucket before giving up. */
+#define    MAX_DISPLACEMENT    0x00FFFFFFU
+
+uint64_t mph_hash(const char *str)
+{
+    /* FNV-1a followed by a finalizer that spreads the bits. */
+    const uint8_t *p = (const uint8_t*)str;
+    uint64_t h = 14695981039346656037ULL;
+    while (*p) {
+        h ^= *p++;
+        h *= 1099511628211ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+int mph_build(const uint64_t* hashes, uint32_t n, uint32_t num_buckets, uint32_t* disps, uint32_t* slots)
+{
+    int ret = 0;
+    uint32_t i, j, k, b, size, max_size = 0, next_free = 0, num_order = 0;
+    uint32_t *counts = NULL, *begins = NULL, *keys = NULL, *order = NULL;
+    uint8_t *used = NULL;
+
+    counts = (uint32_t*)calloc(num_buckets + 1, sizeof(uint32_t));
+    begins = (uint32_t*)calloc(num_buckets + 1, sizeof(uint32_t));
+    keys = (uint32_t*)malloc(sizeof(uint32_t) * (n + 1));
+    order = (uint32_t*)malloc(sizeof(uint32_t) * (num_buckets + 1));
+    used = (uint8_t*)calloc(n + 1, sizeof(uint8_t));
+    if (counts == NULL || begins == NULL || keys == NULL || order == NULL || used == NULL) {
+        ret = 1;
+        goto error_exit;
+    }
+
+    /* Group the keys by their buckets. */
+    for (i = 0;i < n;++i) {
+        ++counts[mph_bucket(hashes[i], num_buckets)];
+    }
+    for (b = 0;b < num_buckets;++b) {
+        begins[b+1] = begins[b] + counts[b];
+        if (max_size < counts[b]) {
+            max_size = counts[b];
+        }
+    }
+    memset(counts, 0, sizeof(uint32_t) * num_buckets);
+    for (i = 0;i < n;++i) {
+        b = mph_bucket(hashes[i], num_buckets);
+        keys[begins[b] + counts[b]++] = i;
+    }
+
+    /* Sort the buckets in descending order of their sizes (counting sort). */
+    k = 0;
+    for (size = max_size;0 < size;--size) {
+        for (b = 0;b < num_buckets;++b) {
+            if (counts[b] == size) {
+                order[k++] = b;
+            }
+        }
+    }
+    num_order = k;
+
+    /* Place the buckets with two or more keys by searching displacements. */
+    for (k = 0;k < num_order;++k) {
+        uint32_t d;
+        b = order[k];
+        size = counts[b];
+        if (size < 2) {
+            break;
+        }
+
+        for (d = 0;d <= MAX_DISPLACEMENT;++d) {
+            for (i = 0;i < size;++i) {
+                uint32_t s = mph_slot(hashes[keys[begins[b]+i]], d, n);
+                if (used[s]) {
+                    break;
+                }
+                /* Mark the slot temporarily to detect collisions in the bucket. */
+                used[s] = 1;
+                slots[keys[begins[b]+i]] = s;
+            }
+            if (i == size) {
+                break;
+            }
+            for (j = 0;j < i;++j) {
+                used[slots[keys[begins[b]+j]]] = 0;
+            }
+        }
+        if (MAX_DISPLACEMENT < d) {
+            /* Keys with the same hash value cannot be separated. */
+            ret = 1;
+            goto error_exit;
+        }
+        disps[b] = d;
+    }
+
+    /* Give the remaining free slots to the buckets with a single key. */
+    for (;k < num_order;++k) {
+        b = order[k];
+        while (used[next_free]) {
+            ++next_free;
+        }
+        used[next_free] = 1;
+        slots[keys[begins[b]]] = next_free;
+        disps[b] = MPH_DIRECT | next_free;
+    }
+
+    /* Empty buckets. */
+    for (b = 0;b < num_buckets;++b) {
+        if (counts[b] == 0) {
+            disps[b] = 0;
+        }
+    }
+
+error_exit:
+    free(used);
+    free(order);
+    free(keys);
+    free(begins);
+    free(counts);
+    return ret;
+}
@@ -0,0 +1,99 @@
+/*
+ *      Minimal perfect hashing (hash and displace).
+ *
+ * Copyright (c) 2007-2010, Naoaki Okazaki
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the names of the authors nor the names of its contributors
+ *       may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* $Id$ */
+
+#ifndef    __MPH_H__
+#define    __MPH_H__
+
+#include <stdint.h>
+
+/*
+ * A minimal perfect hash maps n distinct keys to the slots [0, n). The
+ * keys are distributed to buckets by their hash values, and each bucket
+ * has a displacement that moves its keys to free slots (CHD). A bucket
+ * with a single key stores its slot directly (MPH_DIRECT).
+ */
+
+#define    MPH_DIRECT    0x80000000U
+
+/**
+ * Compute the 64-bit hash value of a string.
+ */
+uint64_t mph_hash(const char *str);
+
+/**
+ * Build a minimal perfect hash for n keys.
+ *  @param  hashes      The hash values of the keys, computed by mph_hash().
+ *  @param  n           The number of keys.
+ *  @param  num_buckets The number of buckets.
+ *  @param  disps       The array of num_buckets elements that receives
+ *                      the displacements of the buckets.
+ *  @param  slots       The array of n elements that receives the slots of
+ *                      the keys.
+ *  @return int         0 if successful, or non-zero when the hash values
+ *                      collide or memory runs out.
+ */
+int mph_build(const uint64_t* hashes, uint32_t n, uint32_t num_buckets, uint32_t* disps, uint32_t* slots);
+
+/**
+ * Obtain the bucket of a hash value.
+ */
+inline static uint32_t mph_bucket(uint64_t h, uint32_t num_buckets)
+{
+    return (uint32_t)(((h >> 32) * (uint64_t)num_buckets) >> 32);
+}
+
+/**
+ * Obtain the slot of a hash value given the displacement of its bucket.
+ */
+inline static uint32_t mph_slot(uint64_t h, uint32_t disp, uint32_t n)
+{
+    uint64_t x;
+    if (disp & MPH_DIRECT) {
+        return disp & ~MPH_DIRECT;
+    }
+    x = h + (uint64_t)disp * 0x9E3779B97F4A7C15ULL;
+    x ^= x >> 29;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 32;
+    return (uint32_t)(((x & 0xFFFFFFFFU) * (uint64_t)n) >> 32);
+}
+
+/**
+ * Obtain the fingerprint of a hash value, which tells a key stored in a
+ * slot from other strings.
+ */
+inline static uint32_t mph_fingerprint(uint64_t h)
+{
+    return (uint32_t)h;
+}
+
+#endif/*__MPH_H__*/
@@ -0,0 +1,174 @@
+/*
+ *      Running tasks on multiple threads.
+ *
+ * Copyright (c) 2007-2010, Naoaki Okazaki
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the names of the authors nor the names of its contributors
+ *       may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* $Id$ */
+
+#ifdef    HAVE_CONFIG_H
+#include <config.h>
+#endif/*HAVE_CONFIG_H*/
+
+#include <os.h>
+
+#include <stdlib.h>
+
+#ifdef  HAVE_LIBPTHREAD
+#include <pthread.h>
+#endif/*HAVE_LIBPTHREAD*/
+
+#include "parallel.h"
+
+#ifdef  HAVE_LIBPTHREAD
+
+typedef struct {
+    parallel_task_t task;
+    void *instance;
+    int i;
+} parallel_arg_t;
+
+static void *parallel_thread(void *arg)
+{
+    parallel_arg_t* pa = (parallel_arg_t*)arg;
+    pa->task(pa->instance, pa->i);
+    return NULL;
+}
+
+void parallel_run(int n, parallel_task_t task, void *instance)
+{
+    int i;
+    pthread_t* threads = NULL;
+    parallel_arg_t* args = NULL;
+    int* created = NULL;
+
+    threads = (pthread_t*)calloc(n, sizeof(pthread_t));
+    args = (parallel_arg_t*)calloc(n, sizeof(parallel_arg_t));
+    created = (int*)calloc(n, sizeof(int));
+    if (threads == NULL || args == NULL || created == NULL) {
+        for (i = 0;i < n;++i) task(instance, i);
+        goto exit;
+    }
+
+    /* Task #0 runs in the calling thread. */
+    for (i = 1;i < n;++i) {
+        args[i].task = task;
+        args[i].instance = instance;
+        args[i].i = i;
+        created[i] = (pthread_create(&threads[i], NULL, parallel_thread, &args[i]) == 0);
+    }
+    if (0 < n) {
+        task(instance, 0);
+    }
+    for (i = 1;i < n;++i) {
+        if (created[i]) {
+            pthread_join(threads[i], NULL);
+        } else {
+            task(instance, i);
+        }
+    }
+
+exit:
+    free(created);
+    free(args);
+    free(threads);
+}
+
+void parallel_mutex_init(parallel_mutex_t* mutex)
+{
+    pthread_mutex_init(mutex, NULL);
+}
+
+void parallel_mutex_destroy(parallel_mutex_t* mutex)
+{
+    pthread_mutex_destroy(mutex);
+}
+
+void parallel_mutex_lock(parallel_mutex_t* mutex)
+{
+    pthread_mutex_lock(mutex);
+}
+
+void parallel_mutex_unlock(parallel_mutex_t* mutex)
+{
+    pthread_mutex_unlock(mutex);
+}
+
+#else
+
+void parallel_run(int n, parallel_task_t task, void *instance)
+{
+    int i;
+    for (i = 0;i < n;++i) {
+        task(instance, i);
+    }
+}
+
+#if     defined(_MSC_VER)
+
+void parallel_mutex_init(parallel_mutex_t* mutex)
+{
+    InitializeCriticalSection(mutex);
+}
+
+void parallel_mutex_destroy(parallel_mutex_t* mutex)
+{
+    DeleteCriticalSection(mutex);
+}
+
+void parallel_mutex_lock(parallel_mutex_t* mutex)
+{
+    EnterCriticalSection(mutex);
+}
+
+void parallel_mutex_unlock(parallel_mutex_t* mutex)
+{
+    LeaveCriticalSection(mutex);
+}
+
+#else
+
+void parallel_mutex_init(parallel_mutex_t* mutex)
+{
+    *mutex = 0;
+}
+
+void parallel_mutex_destroy(parallel_mutex_t* mutex)
+{
+}
+
+void parallel_mutex_lock(parallel_mutex_t* mutex)
+{
+}
+
+void parallel_mutex_unlock(parallel_mutex_t* mutex)
+{
+}
+
+#endif/*_MSC_VER*/
+
+#endif/*HAVE_LIBPTHREAD*/
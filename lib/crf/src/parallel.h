@@ -0,0 +1,75 @@
+/*
+ *      Running tasks on multiple threads.
+ *
+ * Copyright (c) 2007-2010, Naoaki Okazaki
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the names of the authors nor the names of its contributors
+ *       may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* $Id$ */
+
+#ifndef    __PARALLEL_H__
+#define    __PARALLEL_H__
+
+/**
+ * Type of a task function.
+ *  @param  instance    The user data given to parallel_run().
+ *  @param  i           The task number in [0, n).
+ */
+typedef void (*parallel_task_t)(void *instance, int i);
+
+/**
+ * Run tasks concurrently, one thread per task, and wait for all of them.
+ *  The tasks are run one after another in the calling thread when the
+ *  library is built without thread support or a thread cannot be created.
+ *  @param  n           The number of tasks.
+ *  @param  task        The task function.
+ *  @param  instance    The user data passed to the task function.
+ */
+void parallel_run(int n, parallel_task_t task, void *instance);
+
+/**
+ * Mutex of POSIX threads, or a critical section with MSVC.
+ *  PARALLEL_HAVE_MUTEX is undefined when the build has neither, in which
+ *  case locking it does nothing.
+ */
+#if     defined(HAVE_LIBPTHREAD)
+#include <pthread.h>
+typedef pthread_mutex_t parallel_mutex_t;
+#define PARALLEL_HAVE_MUTEX
+#elif   defined(_MSC_VER)
+#include <windows.h>
+typedef CRITICAL_SECTION parallel_mutex_t;
+#define PARALLEL_HAVE_MUTEX
+#else
+typedef int parallel_mutex_t;
+#endif
+
+void parallel_mutex_init(parallel_mutex_t* mutex);
+void parallel_mutex_destroy(parallel_mutex_t* mutex);
+void parallel_mutex_lock(parallel_mutex_t* mutex);
+void parallel_mutex_unlock(parallel_mutex_t* mutex);
+
+#endif/*__PARALLEL_H__*/
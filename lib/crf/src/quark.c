@@ -33,104 +33,245 @@
 #include "os.h"
 #include <stdlib.h>
 #include <string.h>
-#include "rumavl.h"
 #include "quark.h"
 
+/*
+ * A quark is an open-addressing hash table (linear probing) whose slots
+ * hold the hash value and the ID of a string. The strings themselves are
+ * packed into a chain of arena blocks, and never move once stored; thus,
+ * quark_to_string() returns a pointer that is valid until quark_delete().
+ */
+
+#define    QUARK_INITIAL_SLOTS     1024
+#define    QUARK_BLOCK_SIZE        (1 << 20)
+
 typedef struct {
-    char *str;
-    int qid;
-} record_t;
+    unsigned int hash;
+    int qid;                    /* -1 for an empty slot. */
+} slot_t;
+
+typedef struct tag_block {
+    struct tag_block *next;
+    size_t size;
+    size_t used;
+    char data[1];
+} block_t;
 
 struct tag_quark {
     int num;
     int max;
-    RUMAVL* string_to_id;
     char **id_to_string;
+
+    size_t num_slots;           /* Always a power of two. */
+    slot_t *slots;
+
+    block_t *blocks;
 };
 
-static int keycmp(const void *_x, const void *_y, size_t n, void *udata)
+static unsigned int hash_string(const char *str)
 {
-    const record_t* x = (const record_t*)_x;
-    const record_t* y = (const record_t*)_y;
-    return strcmp(x->str, y->str);
+    /* FNV-1a. */
+    const unsigned char *p = (const unsigned char*)str;
+    unsigned int h = 2166136261U;
+    while (*p) {
+        h ^= *p++;
+        h *= 16777619U;
+    }
+    return h;
 }
 
-static int owcb(RUMAVL *tree, RUMAVL_NODE *n, void *_x, const void *_y, void *udata)
+static slot_t* alloc_slots(size_t n)
 {
-    record_t* x = (record_t*)_x;
-    free(x->str);
-    return 0;
+    size_t i;
+    slot_t *slots = (slot_t*)malloc(sizeof(slot_t) * n);
+    if (slots != NULL) {
+        for (i = 0;i < n;++i) {
+            slots[i].qid = -1;
+        }
+    }
+    return slots;
+}
+
+/* Find the slot for a string: the slot holding it, or the empty slot to insert it into. */
+static slot_t* find_slot(quark_t* qrk, const char *str, unsigned int hash)
+{
+    const size_t mask = qrk->num_slots - 1;
+    size_t i = hash & mask;
+
+    for (;;) {
+        slot_t *slot = &qrk->slots[i];
+        if (slot->qid < 0) {
+            return slot;
+        }
+        if (slot->hash == hash && strcmp(qrk->id_to_string[slot->qid], str) == 0) {
+            return slot;
+        }
+        i = (i + 1) & mask;
+    }
 }
 
-static int delcb(RUMAVL *tree, RUMAVL_NODE *n, void *_record, void *udata)
+/* Grow the table so that it holds n strings with the load factor below 3/4. */
+static int reserve(quark_t* qrk, int n)
 {
-    record_t* record = (record_t*)_record;
-    free(record->str);
+    size_t i, num_slots = qrk->num_slots;
+    slot_t *slots = NULL;
+
+    if (qrk->max < n) {
+        int max = qrk->max;
+        char **id_to_string = NULL;
+        while (max < n) {
+            max = (max + 1) * 2;
+        }
+        id_to_string = (char **)realloc(qrk->id_to_string, sizeof(char *) * max);
+        if (id_to_string == NULL) {
+            return 1;
+        }
+        qrk->id_to_string = id_to_string;
+        qrk->max = max;
+    }
+
+    while (num_slots / 4 * 3 <= (size_t)n) {
+        num_slots *= 2;
+    }
+    if (num_slots == qrk->num_slots) {
+        return 0;
+    }
+
+    slots = alloc_slots(num_slots);
+    if (slots == NULL) {
+        return 1;
+    }
+    for (i = 0;i < qrk->num_slots;++i) {
+        const slot_t *src = &qrk->slots[i];
+        if (0 <= src->qid) {
+            size_t j = src->hash & (num_slots - 1);
+            while (0 <= slots[j].qid) {
+                j = (j + 1) & (num_slots - 1);
+            }
+            slots[j] = *src;
+        }
+    }
+    free(qrk->slots);
+    qrk->slots = slots;
+    qrk->num_slots = num_slots;
     return 0;
 }
 
+/* Copy a string into the arena. */
+static char* store_string(quark_t* qrk, const char *str)
+{
+    size_t size = strlen(str) + 1;
+    block_t *block = qrk->blocks;
+    char *dst = NULL;
+
+    if (block == NULL || block->size < block->used + size) {
+        size_t block_size = (QUARK_BLOCK_SIZE < size) ? size : QUARK_BLOCK_SIZE;
+        block = (block_t*)malloc(sizeof(block_t) + block_size);
+        if (block == NULL) {
+            return NULL;
+        }
+        block->size = block_size;
+        block->used = 0;
+        block->next = qrk->blocks;
+        qrk->blocks = block;
+    }
+
+    dst = block->data + block->used;
+    memcpy(dst, str, size);
+    block->used += size;
+    return dst;
+}
+
+static int intern(quark_t* qrk, const char *str, unsigned int hash)
+{
+    slot_t *slot = find_slot(qrk, str, hash);
+    if (slot->qid < 0) {
+        char *newstr = store_string(qrk, str);
+        if (newstr == NULL) {
+            return -1;
+        }
+        qrk->id_to_string[qrk->num] = newstr;
+        slot->hash = hash;
+        slot->qid = qrk->num++;
+    }
+    return slot->qid;
+}
+
 quark_t* quark_new()
 {
-    quark_t* qrk = (quark_t*)malloc(sizeof(quark_t));
+    quark_t* qrk = (quark_t*)calloc(1, sizeof(quark_t));
     if (qrk != NULL) {
-        qrk->num = 0;
-        qrk->max = 0;
-        qrk->string_to_id = rumavl_new(sizeof(record_t), keycmp, NULL, NULL);
-        if (qrk->string_to_id != NULL) {
-            *rumavl_delcb(qrk->string_to_id) = delcb;
-            *rumavl_owcb(qrk->string_to_id) = owcb;
+        qrk->num_slots = QUARK_INITIAL_SLOTS;
+        qrk->slots = alloc_slots(qrk->num_slots);
+        if (qrk->slots == NULL) {
+            free(qrk);
+            return NULL;
         }
-        qrk->id_to_string = NULL;
     }
     return qrk;
 }
 
 void quark_delete(quark_t* qrk)
 {
-    rumavl_destroy(qrk->string_to_id);
+    if (qrk != NULL) {
+        block_t *block = qrk->blocks;
+        while (block != NULL) {
+            block_t *next = block->next;
+            free(block);
+            block = next;
+        }
+        free(qrk->slots);
+        free(qrk->id_to_string);
+        free(qrk);
+    }
 }
 
 int quark_get(quark_t* qrk, const char *str)
 {
-    record_t key, *record = NULL;
-
-    key.str = (char *)str;
-    record = (record_t*)rumavl_find(qrk->string_to_id, &key);
-    if (record == NULL) {
-        char *newstr = (char*)malloc(strlen(str)+1);
-        if (newstr != NULL) {
-            strcpy(newstr, str);
-        }
+    if (reserve(qrk, qrk->num + 1) != 0) {
+        return -1;
+    }
+    return intern(qrk, str, hash_string(str));
+}
+
+int quark_get_many(quark_t* qrk, const char **strs, int n, int *qids)
+{
+    int i;
+    unsigned int *hashes = NULL;
+
+    /* Grow the table at most once for all the strings. */
+    if (reserve(qrk, qrk->num + n) != 0) {
+        return 1;
+    }
 
-        if (qrk->max <= qrk->num) {
-            qrk->max = (qrk->max + 1) * 2;
-            qrk->id_to_string = (char **)realloc(qrk->id_to_string, sizeof(char *) * qrk->max);
+    hashes = (unsigned int*)malloc(sizeof(unsigned int) * n);
+    if (hashes == NULL) {
+        return 1;
+    }
+    for (i = 0;i < n;++i) {
+        hashes[i] = hash_string(strs[i]);
+    }
+    for (i = 0;i < n;++i) {
+        qids[i] = intern(qrk, strs[i], hashes[i]);
+        if (qids[i] < 0) {
+            free(hashes);
+            return 1;
         }
+    }
 
-        qrk->id_to_string[qrk->num] = newstr;
-        key.str = newstr;
-        key.qid = qrk->num;
-        rumavl_insert(qrk->string_to_id, &key);
-
-        ++qrk->num;
-        return key.qid;
-    } else {
-        return record->qid;
-    }    
+    free(hashes);
+    return 0;
 }
 
 int quark_to_id(quark_t* qrk, const char *str)
 {
-    record_t key, *record = NULL;
-
-    key.str = (char *)str;
-    record = (record_t*)rumavl_find(qrk->string_to_id, &key);
-    return (record != NULL) ? record->qid : -1;
+    slot_t *slot = find_slot(qrk, str, hash_string(str));
+    return slot->qid;
 }
 
 const char *quark_to_string(quark_t* qrk, int qid)
 {
-    return (qid < qrk->num) ? qrk->id_to_string[qid] : NULL;
+    return (0 <= qid && qid < qrk->num) ? qrk->id_to_string[qid] : NULL;
 }
 
 int quark_num(quark_t* qrk)
@@ -138,7 +279,6 @@ int quark_num(quark_t* qrk)
     return qrk->num;
 }
 
-
 #if 0
 int main(int argc, char *argv[])
 {